@@ -0,0 +1,83 @@
+#include "../lightdam/BlueNoise.h"
+#include "../lightdam/ErrorHandling.h"
+#include "../external/stb/stb_image_write.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+static void PrintUsage()
+{
+    LogPrint(LogLevel::Info,
+        "Usage: bluenoise-generator [options] <output.png>\n"
+        "Generates a spatiotemporal blue noise texture with 4 independent channels (RGBA).\n"
+        "Slices are stacked vertically, i.e. the output image is size x (size * slices).\n\n"
+        "Options:\n"
+        "  --size <n>             Width and height of a slice, power of two (default 128)\n"
+        "  --slices <n>           Number of slices, power of two (default 64)\n"
+        "  --sigma <s>            Spatial energy sigma (default 1.9)\n"
+        "  --temporal-sigma <s>   Temporal energy sigma (default 1.9)\n"
+        "  --seed <n>             Random seed (default 0)\n"
+        "  --threads <n>          Number of channels generated in parallel (default: number of cores)");
+}
+
+int main(int argc, char** argv)
+{
+    BlueNoiseSettings settings;
+    uint32_t seed = 0;
+    uint32_t numThreads = std::thread::hardware_concurrency();
+    const uint32_t numChannels = 4;
+    std::string outputFilename;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--size") == 0 && hasValue)
+            settings.width = settings.height = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--slices") == 0 && hasValue)
+            settings.numSlices = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--sigma") == 0 && hasValue)
+            settings.sigmaSpatial = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--temporal-sigma") == 0 && hasValue)
+            settings.sigmaTemporal = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && hasValue)
+            seed = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && hasValue)
+            numThreads = (uint32_t)atoi(argv[++i]);
+        else if (argv[i][0] != '-' && outputFilename.empty())
+            outputFilename = argv[i];
+        else
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    if (outputFilename.empty())
+    {
+        PrintUsage();
+        return 1;
+    }
+    if (!settings.IsValid())
+    {
+        LogPrint(LogLevel::Failure, "Invalid settings, size and number of slices need to be powers of two.");
+        return 1;
+    }
+
+    LogPrint(LogLevel::Info, "Generating %ux%ux%u blue noise with %u channels on %u threads...", settings.width, settings.height, settings.numSlices, numChannels, numThreads);
+    auto startTime = std::chrono::high_resolution_clock::now();
+    BlueNoiseGenerator generator(settings);
+    std::vector<uint8_t> texture = generator.GenerateTexture(numChannels, seed, numThreads);
+    auto duration = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime);
+    LogPrint(LogLevel::Info, "Generation took %.2fs", duration.count());
+
+    if (!stbi_write_png(outputFilename.c_str(), (int)settings.width, (int)(settings.height * settings.numSlices), (int)numChannels, texture.data(), (int)(settings.width * numChannels)))
+    {
+        LogPrint(LogLevel::Failure, "Failed to write \"%s\"", outputFilename.c_str());
+        return 1;
+    }
+    LogPrint(LogLevel::Success, "Wrote \"%s\"", outputFilename.c_str());
+    return 0;
+}
@@ -0,0 +1,339 @@
+#include "Commands.h"
+#include "../lightdam/cpu/Brdf8.h"
+#include "../lightdam/CpuFeatures.h"
+#include "../lightdam/ErrorHandling.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <vector>
+
+// Random shading points in tangent space, in blocks of 8.
+struct ShadingPoints
+{
+    std::vector<Float3Block8> toLight;
+    std::vector<Float3Block8> toView;
+    std::vector<Float3Block8> normal;
+    std::vector<Float3Block8> diffuse;
+    std::vector<float> NdotL;
+    std::vector<float> NdotV;
+    std::vector<float> randomX;
+    std::vector<float> randomY;
+
+    size_t NumBlocks() const { return toLight.size(); }
+};
+
+static Float3 RandomUpperHemisphereDirection(std::mt19937& random)
+{
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    Float3 direction = SampleHemisphereCosine(Float2(uniform(random), uniform(random)));
+    // Keep grazing directions, but not exactly in the tangent plane.
+    direction.z = std::max(direction.z, 0.001f);
+    return Normalize(direction);
+}
+
+static ShadingPoints GenerateShadingPoints(uint32_t numBlocks, uint32_t seed)
+{
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    ShadingPoints points;
+    points.toLight.resize(numBlocks);
+    points.toView.resize(numBlocks);
+    points.normal.resize(numBlocks);
+    points.diffuse.resize(numBlocks);
+    points.NdotL.resize(numBlocks * 8);
+    points.NdotV.resize(numBlocks * 8);
+    points.randomX.resize(numBlocks * 8);
+    points.randomY.resize(numBlocks * 8);
+    for (uint32_t block = 0; block < numBlocks; ++block)
+    {
+        for (int lane = 0; lane < 8; ++lane)
+        {
+            const Float3 toLight = RandomUpperHemisphereDirection(random);
+            const Float3 toView = RandomUpperHemisphereDirection(random);
+            points.toLight[block].Set(lane, toLight);
+            points.toView[block].Set(lane, toView);
+            points.normal[block].Set(lane, Float3(0.0f, 0.0f, 1.0f));
+            points.diffuse[block].Set(lane, Float3(uniform(random), uniform(random), uniform(random)));
+            points.NdotL[block * 8 + lane] = toLight.z;
+            points.NdotV[block * 8 + lane] = toView.z;
+            // Random numbers from the path tracer are in [0, 1).
+            points.randomX[block * 8 + lane] = std::min(uniform(random), 0.99999994f);
+            points.randomY[block * 8 + lane] = std::min(uniform(random), 0.99999994f);
+        }
+    }
+    return points;
+}
+
+// Largest difference of 8 wide results to the scalar ones, relative to the scalar value but at least to 1.
+// Both being non-finite counts as a match.
+struct Deviation
+{
+    float maxError = 0.0f;
+    uint32_t numOutliers = 0;
+    uint32_t numValues = 0;
+
+    void Add(const Float3& value, const Float3& reference, float tolerance)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            ++numValues;
+            if (!std::isfinite(value[axis]) || !std::isfinite(reference[axis]))
+            {
+                if (std::isfinite(value[axis]) != std::isfinite(reference[axis]))
+                    ++numOutliers;
+                continue;
+            }
+            const float error = fabsf(value[axis] - reference[axis]) / std::max(fabsf(reference[axis]), 1.0f);
+            maxError = std::max(maxError, error);
+            if (error > tolerance)
+                ++numOutliers;
+        }
+    }
+};
+
+struct MaterialParameters
+{
+    const char* name;
+    Float3 eta;
+    Float3 k;
+    float roughness;
+};
+
+// Runs the function for all blocks until at least minSeconds passed, returns shading points per second.
+static double MeasureThroughput(const ShadingPoints& points, double minSeconds, const std::function<void(size_t block)>& function)
+{
+    uint64_t numPoints = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    double seconds = 0.0;
+    do
+    {
+        for (size_t block = 0; block < points.NumBlocks(); ++block)
+            function(block);
+        numPoints += points.NumBlocks() * 8;
+        seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    } while (seconds < minSeconds);
+    return numPoints / seconds;
+}
+
+int RunBrdfTest(int argc, char** argv)
+{
+    uint32_t numBlocks = 4096;
+    double minSeconds = 0.5;
+    bool validArguments = true;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--blocks") == 0 && i + 1 < argc)
+            numBlocks = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+            minSeconds = atof(argv[++i]);
+        else
+            validArguments = false;
+    }
+    if (!validArguments || numBlocks == 0)
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless brdf-test [options]\n\n"
+            "Compares the 8 wide BRDF functions with the scalar ones in Brdf.h on random shading points\n"
+            "and measures the throughput of both per material type.\n\n"
+            "Options:\n"
+            "  --blocks <n>      Blocks of 8 shading points, kept in cache for the benchmark (default 4096)\n"
+            "  --seconds <s>     Minimum time per measurement (default 0.5)");
+        return 1;
+    }
+    LogPrint(LogLevel::Info, "8 wide functions use %s", CpuSupportsAvx2() ? "AVX2" : "the scalar fallback (no AVX2)");
+
+    const ShadingPoints points = GenerateShadingPoints(numBlocks, 0);
+    // Roughness 0.05 makes for very peaked distributions, where rounding differences are amplified the most.
+    const MaterialParameters materials[] =
+    {
+        { "gold, rough", Float3(0.143f, 0.374f, 1.442f), Float3(3.983f, 2.385f, 1.603f), 0.5f },
+        { "copper, smooth", Float3(0.200f, 0.924f, 1.102f), Float3(3.912f, 2.452f, 2.142f), 0.05f },
+        { "plastic, medium", Float3(1.5f), Float3(0.04f), 0.2f },
+    };
+
+    // The 8 wide functions only differ in rounding (and sin/cos accurate to about 1e-7), but the GGX distribution of the smooth
+    // material turns a rounding error in NdotH into a relative error of about 1e-4.
+    const float tolerance = 1e-3f;
+    bool passed = true;
+    auto report = [&](const char* function, const char* material, const Deviation& deviation)
+    {
+        passed &= deviation.numOutliers == 0;
+        LogPrint(deviation.numOutliers == 0 ? LogLevel::Success : LogLevel::Failure, "%-36s %-16s max relative error %9.2g, %u of %u values off by more than %g",
+            function, material, deviation.maxError, deviation.numOutliers, deviation.numValues, tolerance);
+    };
+
+    {
+        Deviation deviation;
+        for (size_t block = 0; block < points.NumBlocks(); ++block)
+        {
+            Float3Block8 direction;
+            SampleHemisphereCosine8(&points.randomX[block * 8], &points.randomY[block * 8], direction);
+            for (int lane = 0; lane < 8; ++lane)
+                deviation.Add(direction.Get(lane), SampleHemisphereCosine(Float2(points.randomX[block * 8 + lane], points.randomY[block * 8 + lane])), tolerance);
+        }
+        report("SampleHemisphereCosine", "", deviation);
+    }
+    for (const MaterialParameters& material : materials)
+    {
+        const float roughnessSq = material.roughness * material.roughness;
+        Deviation fresnel, microfacet, visibleNormal, ashikminShirley, substrateDirection, substrateThroughput;
+        for (size_t block = 0; block < points.NumBlocks(); ++block)
+        {
+            const float* NdotL = &points.NdotL[block * 8];
+            const float* NdotV = &points.NdotV[block * 8];
+            const float* randomX = &points.randomX[block * 8];
+            const float* randomY = &points.randomY[block * 8];
+            Float3Block8 fresnel8, microfacet8, visibleNormal8, ashikminShirley8, substrateDirection8, substrateThroughput8;
+            FresnelDieletricConductorApprox8(material.eta, material.k, NdotL, fresnel8);
+            EvaluateMicrofacetBrdf8(NdotL, points.toLight[block], NdotV, points.toView[block], points.normal[block], material.eta, material.k, roughnessSq, microfacet8);
+            SampleGGXVisibleNormal8(points.toView[block], material.roughness, randomX, randomY, visibleNormal8);
+            EvaluateAshikminShirleyBrdf8(NdotL, points.toLight[block], NdotV, points.toView[block], points.normal[block], material.k, roughnessSq, points.diffuse[block], ashikminShirley8);
+            SampleAshikminShirleySubstrateBrdf8(points.toView[block], randomX, randomY, material.k, roughnessSq, points.diffuse[block], substrateDirection8, substrateThroughput8);
+
+            for (int lane = 0; lane < 8; ++lane)
+            {
+                const Float3 toLight = points.toLight[block].Get(lane);
+                const Float3 toView = points.toView[block].Get(lane);
+                const Float3 normal = points.normal[block].Get(lane);
+                const Float3 diffuse = points.diffuse[block].Get(lane);
+                const Float2 randomSample(randomX[lane], randomY[lane]);
+                fresnel.Add(fresnel8.Get(lane), FresnelDieletricConductorApprox(material.eta, material.k, NdotL[lane]), tolerance);
+                microfacet.Add(microfacet8.Get(lane), EvaluateMicrofacetBrdf(NdotL[lane], toLight, NdotV[lane], toView, normal, material.eta, material.k, roughnessSq), tolerance);
+                visibleNormal.Add(visibleNormal8.Get(lane), SampleGGXVisibleNormal(toView, material.roughness, randomSample), tolerance);
+                ashikminShirley.Add(ashikminShirley8.Get(lane), EvaluateAshikminShirleyBrdf(NdotL[lane], toLight, NdotV[lane], toView, normal, material.k, roughnessSq, diffuse), tolerance);
+                Float3 throughput;
+                const Float3 substrateDirectionReference = SampleAshikminShirleySubstrateBrdf(toView, randomSample, material.k, roughnessSq, diffuse, throughput);
+                substrateDirection.Add(substrateDirection8.Get(lane), substrateDirectionReference, tolerance);
+                // Paths end on directions below the surface, their throughput is never used and can be far off.
+                if (substrateDirectionReference.z > 0.0f && substrateDirection8.z[lane] > 0.0f)
+                    substrateThroughput.Add(substrateThroughput8.Get(lane), throughput, tolerance);
+            }
+        }
+        report("FresnelDieletricConductorApprox", material.name, fresnel);
+        report("EvaluateMicrofacetBrdf", material.name, microfacet);
+        report("SampleGGXVisibleNormal", material.name, visibleNormal);
+        report("EvaluateAshikminShirleyBrdf", material.name, ashikminShirley);
+        report("SampleAshikminShirleySubstrateBrdf", material.name, substrateDirection);
+        report("  throughput", material.name, substrateThroughput);
+    }
+
+    // Throughput of what the path tracer does per hit and material: evaluate the BRDF for a light sample and sample the next direction.
+    // Results go to a sink, so that nothing is optimized away.
+    const MaterialParameters& material = materials[0];
+    const float roughnessSq = material.roughness * material.roughness;
+    Float3 scalarSink(0.0f);
+    Float3Block8 sink8 = {};
+    auto accumulate8 = [&](const Float3Block8& block)
+    {
+        for (int lane = 0; lane < 8; ++lane)
+        {
+            sink8.x[lane] += block.x[lane];
+            sink8.y[lane] += block.y[lane];
+            sink8.z[lane] += block.z[lane];
+        }
+    };
+    struct Benchmark
+    {
+        const char* name;
+        std::function<void(size_t block)> scalar;
+        std::function<void(size_t block)> wide;
+    };
+    const Benchmark benchmarks[] =
+    {
+        {
+            "matte",
+            [&](size_t block)
+            {
+                for (int lane = 0; lane < 8; ++lane)
+                {
+                    const size_t i = block * 8 + lane;
+                    const Float3 diffuse = points.diffuse[block].Get(lane);
+                    scalarSink += EvaluateLambertBrdf(diffuse);
+                    scalarSink += SampleHemisphereCosine(Float2(points.randomX[i], points.randomY[i]));
+                }
+            },
+            [&](size_t block)
+            {
+                Float3Block8 brdf, direction;
+                for (int lane = 0; lane < 8; ++lane)
+                    brdf.Set(lane, EvaluateLambertBrdf(points.diffuse[block].Get(lane)));
+                SampleHemisphereCosine8(&points.randomX[block * 8], &points.randomY[block * 8], direction);
+                accumulate8(brdf);
+                accumulate8(direction);
+            },
+        },
+        {
+            "metal",
+            [&](size_t block)
+            {
+                for (int lane = 0; lane < 8; ++lane)
+                {
+                    const size_t i = block * 8 + lane;
+                    const Float3 toView = points.toView[block].Get(lane);
+                    scalarSink += EvaluateMicrofacetBrdf(points.NdotL[i], points.toLight[block].Get(lane), points.NdotV[i], toView, points.normal[block].Get(lane),
+                                                         material.eta, material.k, roughnessSq);
+                    const Float3 microfacetNormal = SampleGGXVisibleNormal(toView, material.roughness, Float2(points.randomX[i], points.randomY[i]));
+                    const Float3 nextRayDir = Reflect(-toView, microfacetNormal);
+                    scalarSink += FresnelDieletricConductorApprox(material.eta, material.k, nextRayDir.z);
+                }
+            },
+            [&](size_t block)
+            {
+                Float3Block8 brdf, microfacetNormal, fresnel;
+                EvaluateMicrofacetBrdf8(&points.NdotL[block * 8], points.toLight[block], &points.NdotV[block * 8], points.toView[block], points.normal[block],
+                                        material.eta, material.k, roughnessSq, brdf);
+                SampleGGXVisibleNormal8(points.toView[block], material.roughness, &points.randomX[block * 8], &points.randomY[block * 8], microfacetNormal);
+                float NdotL[8];
+                for (int lane = 0; lane < 8; ++lane)
+                    NdotL[lane] = Reflect(-points.toView[block].Get(lane), microfacetNormal.Get(lane)).z;
+                FresnelDieletricConductorApprox8(material.eta, material.k, NdotL, fresnel);
+                accumulate8(brdf);
+                accumulate8(fresnel);
+            },
+        },
+        {
+            "substrate",
+            [&](size_t block)
+            {
+                for (int lane = 0; lane < 8; ++lane)
+                {
+                    const size_t i = block * 8 + lane;
+                    const Float3 toView = points.toView[block].Get(lane);
+                    const Float3 diffuse = points.diffuse[block].Get(lane);
+                    scalarSink += EvaluateAshikminShirleyBrdf(points.NdotL[i], points.toLight[block].Get(lane), points.NdotV[i], toView, points.normal[block].Get(lane),
+                                                              material.k, roughnessSq, diffuse);
+                    Float3 throughput;
+                    scalarSink += SampleAshikminShirleySubstrateBrdf(toView, Float2(points.randomX[i], points.randomY[i]), material.k, roughnessSq, diffuse, throughput);
+                    scalarSink += throughput;
+                }
+            },
+            [&](size_t block)
+            {
+                Float3Block8 brdf, direction, throughput;
+                EvaluateAshikminShirleyBrdf8(&points.NdotL[block * 8], points.toLight[block], &points.NdotV[block * 8], points.toView[block], points.normal[block],
+                                             material.k, roughnessSq, points.diffuse[block], brdf);
+                SampleAshikminShirleySubstrateBrdf8(points.toView[block], &points.randomX[block * 8], &points.randomY[block * 8], material.k, roughnessSq,
+                                                    points.diffuse[block], direction, throughput);
+                accumulate8(brdf);
+                accumulate8(direction);
+                accumulate8(throughput);
+            },
+        },
+    };
+    for (const Benchmark& benchmark : benchmarks)
+    {
+        const double scalarRate = MeasureThroughput(points, minSeconds, benchmark.scalar);
+        const double wideRate = MeasureThroughput(points, minSeconds, benchmark.wide);
+        LogPrint(LogLevel::Info, "%-10s scalar %7.1f M evaluations/s  8 wide %7.1f M evaluations/s  (%.2fx)",
+            benchmark.name, scalarRate * 1e-6, wideRate * 1e-6, wideRate / scalarRate);
+    }
+    float sink = scalarSink.x + scalarSink.y + scalarSink.z;
+    for (int lane = 0; lane < 8; ++lane)
+        sink += sink8.x[lane] + sink8.y[lane] + sink8.z[lane];
+    LogPrint(LogLevel::Info, "(checksum %g)", sink);
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,1571 @@
+#include "Commands.h"
+#include "GeneratedScenes.h"
+#include "../lightdam/cpu/Brdf.h"
+#include "../lightdam/cpu/Bvh.h"
+#include "../lightdam/cpu/CpuPathTracer.h"
+#include "../lightdam/cpu/CpuScene.h"
+#include "../lightdam/cpu/InstancedSceneIntersector.h"
+#include "../lightdam/cpu/SceneIntersector.h"
+#include "../lightdam/CpuFeatures.h"
+#include "../lightdam/MappedFile.h"
+#include "../lightdam/ThreadPool.h"
+#include "../lightdam/ErrorHandling.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct BvhBenchmarkOptions
+{
+    std::string sceneFilePath;          // Empty generates a scene.
+    uint32_t numGeneratedTriangles = 1000000;
+    uint32_t maxThreads = 0;            // 0 uses all hardware threads.
+    uint32_t numRepetitions = 3;
+    uint32_t numRays = 1000000;
+    uint32_t numInstances = 100000;
+    uint32_t numFrames = 30;
+};
+
+static bool ParseBvhBenchmarkOptions(int argc, char** argv, BvhBenchmarkOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* option = argv[i];
+        if (option[0] != '-')
+        {
+            options.sceneFilePath = option;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+            return false;
+        const char* value = argv[++i];
+        if (strcmp(option, "--triangles") == 0)
+            options.numGeneratedTriangles = strtoul(value, nullptr, 10);
+        else if (strcmp(option, "--threads") == 0)
+            options.maxThreads = strtoul(value, nullptr, 10);
+        else if (strcmp(option, "--repeat") == 0)
+            options.numRepetitions = strtoul(value, nullptr, 10);
+        else if (strcmp(option, "--rays") == 0)
+            options.numRays = strtoul(value, nullptr, 10);
+        else if (strcmp(option, "--instances") == 0)
+            options.numInstances = strtoul(value, nullptr, 10);
+        else if (strcmp(option, "--frames") == 0)
+            options.numFrames = strtoul(value, nullptr, 10);
+        else
+            return false;
+    }
+    return options.numGeneratedTriangles > 0 && options.numRepetitions > 0;
+}
+
+// Appends a UV sphere with numSegments * (numRings - 1) * 2 triangles, the poles have a single triangle per segment.
+static void AppendSphere(CpuScene::Mesh& mesh, const Float3& center, float radius, uint32_t numRings, uint32_t numSegments)
+{
+    const uint32_t first = static_cast<uint32_t>(mesh.positions.size());
+    for (uint32_t ring = 0; ring <= numRings; ++ring)
+    {
+        const float theta = ring * 3.14159265f / numRings;
+        for (uint32_t segment = 0; segment < numSegments; ++segment)
+        {
+            const float phi = segment * 2.0f * 3.14159265f / numSegments;
+            mesh.positions.push_back(center + Float3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)) * radius);
+        }
+    }
+    for (uint32_t ring = 0; ring < numRings; ++ring)
+    {
+        for (uint32_t segment = 0; segment < numSegments; ++segment)
+        {
+            const uint32_t i00 = first + ring * numSegments + segment;
+            const uint32_t i01 = first + ring * numSegments + (segment + 1) % numSegments;
+            const uint32_t i10 = i00 + numSegments;
+            const uint32_t i11 = i01 + numSegments;
+            if (ring > 0)
+                mesh.indices.insert(mesh.indices.end(), { i00, i01, i10 });
+            if (ring < numRings - 1)
+                mesh.indices.insert(mesh.indices.end(), { i01, i11, i10 });
+        }
+    }
+}
+
+// Randomly placed and sized tessellated spheres above a large ground quad, lit by a quad light and seen by a camera from above.
+// The mix of tiny and huge triangles and the uneven distribution is closer to real scenes than uniform triangle soup.
+static std::unique_ptr<CpuScene> GenerateSphereScene(uint32_t numTriangles)
+{
+    const uint32_t numRings = 64;
+    const uint32_t numSegments = 128;
+    const uint32_t trianglesPerSphere = numSegments * (numRings - 1) * 2;
+    const uint32_t numSpheres = std::max(1u, (numTriangles + trianglesPerSphere / 2) / trianglesPerSphere);
+    const float sceneSize = 4.0f * cbrtf(static_cast<float>(numSpheres));
+
+    std::unique_ptr<CpuScene> scene(new CpuScene());
+    std::mt19937 random(0);
+    std::uniform_real_distribution<float> position(-sceneSize, sceneSize);
+    std::uniform_real_distribution<float> radius(0.1f, 2.0f);
+    for (uint32_t sphere = 0; sphere < numSpheres; ++sphere)
+    {
+        CpuScene::Mesh mesh;
+        mesh.materialIndex = 0;
+        mesh.isEmitter = false;
+        mesh.areaLightRadiance = Float3(0.0f);
+
+        const Float3 center(position(random), std::abs(position(random)), position(random));
+        AppendSphere(mesh, center, radius(random), numRings, numSegments);
+        scene->meshes.push_back(std::move(mesh));
+    }
+
+    CpuScene::Mesh ground;
+    ground.materialIndex = 0;
+    ground.isEmitter = false;
+    ground.areaLightRadiance = Float3(0.0f);
+    const float groundSize = sceneSize * 4.0f;
+    ground.positions = { Float3(-groundSize, 0.0f, -groundSize), Float3(groundSize, 0.0f, -groundSize),
+                         Float3(groundSize, 0.0f, groundSize), Float3(-groundSize, 0.0f, groundSize) };
+    ground.indices = { 0, 1, 2, 0, 2, 3 };
+    scene->meshes.push_back(std::move(ground));
+
+    CpuScene::Mesh light;
+    light.materialIndex = 0;
+    light.isEmitter = true;
+    light.areaLightRadiance = Float3(10.0f);
+    const float lightSize = sceneSize * 0.5f;
+    const float lightHeight = sceneSize * 3.0f;
+    light.positions = { Float3(-lightSize, lightHeight, -lightSize), Float3(-lightSize, lightHeight, lightSize),
+                        Float3(lightSize, lightHeight, lightSize), Float3(lightSize, lightHeight, -lightSize) };
+    light.vertices.assign(4, { Float3(0.0f, -1.0f, 0.0f), Float2(0.0f, 0.0f) });
+    light.indices = { 0, 1, 2, 0, 2, 3 };
+    scene->AddAreaLights(light);
+    scene->meshes.push_back(std::move(light));
+
+    const Float3 cameraPosition(0.0f, sceneSize * 1.5f, -sceneSize * 2.5f);
+    scene->cameras.push_back({ cameraPosition, Normalize(Float3(0.0f, sceneSize * 0.3f, 0.0f) - cameraPosition), Float3(0.0f, 1.0f, 0.0f), 1.0f });
+
+    return scene;
+}
+
+// Room with walls of two huge triangles each, filled with small spheres and crossed by thin rods in random directions,
+// lit by a quad light at the ceiling. A tenth of the triangles are rods. Like the floors, walls, railings and cables of
+// architectural scenes, their bounding boxes overlap large parts of the scene.
+static std::unique_ptr<CpuScene> GenerateRodScene(uint32_t numTriangles)
+{
+    const uint32_t numRodSegments = 8;
+    const uint32_t numRods = std::max(1u, numTriangles / 10 / (numRodSegments * 2));
+    const uint32_t numRings = 16;
+    const uint32_t numSegments = 32;
+    const uint32_t trianglesPerSphere = numSegments * (numRings - 1) * 2;
+    const uint32_t numSpheres = std::max(1u, (numTriangles - numRods * numRodSegments * 2) / trianglesPerSphere);
+    const float roomSize = 10.0f;
+    const float rodRadius = 0.01f;
+
+    std::unique_ptr<CpuScene> scene(new CpuScene());
+    CpuScene::Mesh room;
+    room.materialIndex = 0;
+    room.isEmitter = false;
+    room.areaLightRadiance = Float3(0.0f);
+    for (int corner = 0; corner < 8; ++corner)
+        room.positions.push_back(Float3(corner & 1 ? roomSize : -roomSize, corner & 2 ? roomSize : -roomSize, corner & 4 ? roomSize : -roomSize));
+    room.indices = { 0, 1, 3, 0, 3, 2,  4, 6, 7, 4, 7, 5,  0, 4, 5, 0, 5, 1,  2, 3, 7, 2, 7, 6,  0, 2, 6, 0, 6, 4,  1, 5, 7, 1, 7, 3 };
+    scene->meshes.push_back(std::move(room));
+
+    std::mt19937 random(0);
+    std::uniform_real_distribution<float> position(-roomSize * 0.95f, roomSize * 0.95f);
+    std::uniform_real_distribution<float> radius(0.05f, 0.5f);
+    CpuScene::Mesh spheres;
+    spheres.materialIndex = 0;
+    spheres.isEmitter = false;
+    spheres.areaLightRadiance = Float3(0.0f);
+    for (uint32_t sphere = 0; sphere < numSpheres; ++sphere)
+    {
+        const Float3 center(position(random), position(random), position(random));
+        AppendSphere(spheres, center, radius(random), numRings, numSegments);
+    }
+    scene->meshes.push_back(std::move(spheres));
+
+    CpuScene::Mesh rods;
+    rods.materialIndex = 0;
+    rods.isEmitter = false;
+    rods.areaLightRadiance = Float3(0.0f);
+    for (uint32_t rod = 0; rod < numRods; ++rod)
+    {
+        // At least half a room long.
+        Float3 start, end;
+        do
+        {
+            start = Float3(position(random), position(random), position(random));
+            end = Float3(position(random), position(random), position(random));
+        } while (Length(end - start) < roomSize);
+
+        const Float3x3 frame = CreateONB(Normalize(end - start));
+        const uint32_t first = static_cast<uint32_t>(rods.positions.size());
+        for (uint32_t segment = 0; segment < numRodSegments; ++segment)
+        {
+            const float angle = segment * 2.0f * 3.14159265f / numRodSegments;
+            const Float3 offset = (frame.rows[0] * cosf(angle) + frame.rows[1] * sinf(angle)) * rodRadius;
+            rods.positions.push_back(start + offset);
+            rods.positions.push_back(end + offset);
+        }
+        for (uint32_t segment = 0; segment < numRodSegments; ++segment)
+        {
+            const uint32_t i0 = first + segment * 2;
+            const uint32_t i1 = first + (segment + 1) % numRodSegments * 2;
+            rods.indices.insert(rods.indices.end(), { i0, i1, i0 + 1, i1, i1 + 1, i0 + 1 });
+        }
+    }
+    scene->meshes.push_back(std::move(rods));
+
+    CpuScene::Mesh light;
+    light.materialIndex = 0;
+    light.isEmitter = true;
+    light.areaLightRadiance = Float3(10.0f);
+    const float lightSize = roomSize * 0.25f;
+    const float lightHeight = roomSize * 0.99f;
+    light.positions = { Float3(-lightSize, lightHeight, -lightSize), Float3(-lightSize, lightHeight, lightSize),
+                        Float3(lightSize, lightHeight, lightSize), Float3(lightSize, lightHeight, -lightSize) };
+    light.vertices.assign(4, { Float3(0.0f, -1.0f, 0.0f), Float2(0.0f, 0.0f) });
+    light.indices = { 0, 1, 2, 0, 2, 3 };
+    scene->AddAreaLights(light);
+    scene->meshes.push_back(std::move(light));
+
+    const Float3 cameraPosition(roomSize * 0.9f, roomSize * 0.5f, -roomSize * 0.9f);
+    scene->cameras.push_back({ cameraPosition, Normalize(-cameraPosition), Float3(0.0f, 1.0f, 0.0f), 1.0f });
+
+    return scene;
+}
+
+static void AppendQuad(CpuScene::Mesh& mesh, const Float3& v0, const Float3& v1, const Float3& v2, const Float3& v3)
+{
+    const uint32_t first = static_cast<uint32_t>(mesh.positions.size());
+    mesh.positions.insert(mesh.positions.end(), { v0, v1, v2, v3 });
+    mesh.indices.insert(mesh.indices.end(), { first, first + 1, first + 2, first, first + 2, first + 3 });
+}
+
+// Vertical wall from start to end on the floor, with a door in the middle.
+static void AppendWallWithDoor(CpuScene::Mesh& mesh, const Float3& start, const Float3& end, float height, float doorWidth, float doorHeight)
+{
+    const Float3 up(0.0f, height, 0.0f);
+    const Float3 doorUp(0.0f, doorHeight, 0.0f);
+    const Float3 along = Normalize(end - start);
+    const Float3 doorStart = (start + end) * 0.5f - along * (doorWidth * 0.5f);
+    const Float3 doorEnd = doorStart + along * doorWidth;
+    AppendQuad(mesh, start, doorStart, doorStart + up, start + up);
+    AppendQuad(mesh, doorEnd, end, end + up, doorEnd + up);
+    AppendQuad(mesh, doorStart + doorUp, doorEnd + doorUp, doorEnd + up, doorStart + up);
+}
+
+// Grid of rooms connected by doors, each with its own furniture (spheres) and a light. The camera stands in a room in
+// the middle of the building and looks through the doors. Like in real interiors, most of the scene is hidden behind walls.
+std::unique_ptr<CpuScene> GenerateBuildingScene(uint32_t numTriangles, bool doors)
+{
+    const uint32_t numSpheresPerRoom = 8;
+    const uint32_t numRings = 32;
+    const uint32_t numSegments = 64;
+    const uint32_t trianglesPerRoom = numSpheresPerRoom * numSegments * (numRings - 1) * 2;
+    const uint32_t numRoomsPerSide = std::max(1u, static_cast<uint32_t>(sqrtf(static_cast<float>(numTriangles / trianglesPerRoom)) + 0.5f));
+    const float roomSize = 10.0f;
+    const float roomHeight = 4.0f;
+    // Neighboring rooms have walls of their own, with a small gap between them.
+    const float wallInset = 0.1f;
+
+    std::unique_ptr<CpuScene> scene(new CpuScene());
+    std::mt19937 random(0);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    for (uint32_t roomX = 0; roomX < numRoomsPerSide; ++roomX)
+    {
+        for (uint32_t roomZ = 0; roomZ < numRoomsPerSide; ++roomZ)
+        {
+            const Float3 roomMin(roomX * roomSize + wallInset, 0.0f, roomZ * roomSize + wallInset);
+            const Float3 roomMax((roomX + 1) * roomSize - wallInset, roomHeight, (roomZ + 1) * roomSize - wallInset);
+            CpuScene::Mesh room;
+            room.materialIndex = 0;
+            room.isEmitter = false;
+            room.areaLightRadiance = Float3(0.0f);
+            const Float3 corners[4] = { Float3(roomMin.x, 0.0f, roomMin.z), Float3(roomMax.x, 0.0f, roomMin.z), Float3(roomMax.x, 0.0f, roomMax.z), Float3(roomMin.x, 0.0f, roomMax.z) };
+            const Float3 up(0.0f, roomHeight, 0.0f);
+            AppendQuad(room, corners[0], corners[3], corners[2], corners[1]);
+            AppendQuad(room, corners[0] + up, corners[1] + up, corners[2] + up, corners[3] + up);
+            for (int wall = 0; wall < 4; ++wall)
+            {
+                const Float3& start = corners[wall];
+                const Float3& end = corners[(wall + 1) % 4];
+                if (doors)
+                    AppendWallWithDoor(room, start, end, roomHeight, 1.5f, 2.5f);
+                else
+                    AppendQuad(room, start, end, end + up, start + up);
+            }
+            for (uint32_t sphere = 0; sphere < numSpheresPerRoom; ++sphere)
+            {
+                const float radius = 0.3f + uniform(random) * 0.7f;
+                const Float3 center(roomMin.x + radius + uniform(random) * (roomMax.x - roomMin.x - 2.0f * radius), radius,
+                                    roomMin.z + radius + uniform(random) * (roomMax.z - roomMin.z - 2.0f * radius));
+                AppendSphere(room, center, radius, numRings, numSegments);
+            }
+            scene->meshes.push_back(std::move(room));
+
+            CpuScene::Mesh light;
+            light.materialIndex = 0;
+            light.isEmitter = true;
+            light.areaLightRadiance = Float3(10.0f);
+            const Float3 lightCenter((roomMin.x + roomMax.x) * 0.5f, roomHeight - 0.05f, (roomMin.z + roomMax.z) * 0.5f);
+            AppendQuad(light, lightCenter + Float3(-0.5f, 0.0f, -0.5f), lightCenter + Float3(-0.5f, 0.0f, 0.5f),
+                       lightCenter + Float3(0.5f, 0.0f, 0.5f), lightCenter + Float3(0.5f, 0.0f, -0.5f));
+            light.vertices.assign(4, { Float3(0.0f, -1.0f, 0.0f), Float2(0.0f, 0.0f) });
+            scene->AddAreaLights(light);
+            scene->meshes.push_back(std::move(light));
+        }
+    }
+
+    const Float3 middleRoom((numRoomsPerSide / 2 + 0.5f) * roomSize, 0.0f, (numRoomsPerSide / 2 + 0.5f) * roomSize);
+    scene->cameras.push_back({ middleRoom + Float3(0.0f, 1.6f, -roomSize * 0.4f), Normalize(Float3(0.0f, -0.05f, 1.0f)), Float3(0.0f, 1.0f, 0.0f), 1.0f });
+    return scene;
+}
+
+static std::vector<Aabb> ComputeTriangleBounds(const CpuScene& scene)
+{
+    std::vector<Aabb> triangleBounds;
+    for (const CpuScene::Mesh& mesh : scene.meshes)
+    {
+        for (size_t i = 0; i < mesh.indices.size(); i += 3)
+        {
+            Aabb bounds;
+            for (int corner = 0; corner < 3; ++corner)
+                bounds.Extend(mesh.positions[mesh.indices[i + corner]]);
+            triangleBounds.push_back(bounds);
+        }
+    }
+    return triangleBounds;
+}
+
+// Three vertices per triangle, the input of the spatial split builder.
+static std::vector<Float3> ComputeTriangleVertices(const CpuScene& scene)
+{
+    std::vector<Float3> triangleVertices;
+    for (const CpuScene::Mesh& mesh : scene.meshes)
+    {
+        for (uint32_t index : mesh.indices)
+            triangleVertices.push_back(mesh.positions[index]);
+    }
+    return triangleVertices;
+}
+
+// Rays starting at random points on random triangles in uniformly distributed directions, much like diffuse bounces.
+static std::vector<Ray> GenerateSurfaceRays(const CpuScene& scene, uint32_t numRays)
+{
+    std::vector<std::pair<uint32_t, uint32_t>> triangles; // mesh, primitive
+    for (uint32_t meshIndex = 0; meshIndex < scene.meshes.size(); ++meshIndex)
+    {
+        for (uint32_t primitiveIndex = 0; primitiveIndex < scene.meshes[meshIndex].indices.size() / 3; ++primitiveIndex)
+            triangles.push_back({ meshIndex, primitiveIndex });
+    }
+
+    std::vector<Ray> rays(numRays);
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    for (Ray& ray : rays)
+    {
+        const auto triangle = triangles[random() % triangles.size()];
+        const CpuScene::Mesh& mesh = scene.meshes[triangle.first];
+        const Float3& v0 = mesh.positions[mesh.indices[triangle.second * 3 + 0]];
+        const Float3& v1 = mesh.positions[mesh.indices[triangle.second * 3 + 1]];
+        const Float3& v2 = mesh.positions[mesh.indices[triangle.second * 3 + 2]];
+        float u = uniform(random);
+        float v = uniform(random);
+        if (u + v > 1.0f)
+        {
+            u = 1.0f - u;
+            v = 1.0f - v;
+        }
+        const float cosTheta = uniform(random) * 2.0f - 1.0f;
+        const float sinTheta = sqrtf(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+        const float phi = uniform(random) * 2.0f * 3.14159265f;
+        ray.origin = v0 + (v1 - v0) * u + (v2 - v0) * v;
+        ray.direction = Float3(sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta);
+        ray.tMin = DefaultRayTMin;
+        ray.tMax = DefaultRayTMax;
+    }
+    return rays;
+}
+
+// Camera rays through random points on the image plane of the first camera.
+static std::vector<Ray> GeneratePrimaryRays(const CpuScene& scene, uint32_t numRays)
+{
+    const CpuScene::CameraDefinition camera = scene.cameras.empty() ?
+        CpuScene::CameraDefinition{ Float3(0.0f), Float3(0.0f, 0.0f, 1.0f), Float3(0.0f, 1.0f, 0.0f), 1.0f } : scene.cameras[0];
+    Float3 cameraU, cameraV, cameraW;
+    camera.ComputeCameraParams(scene.screenHeight ? static_cast<float>(scene.screenWidth) / scene.screenHeight : 4.0f / 3.0f, cameraU, cameraV, cameraW);
+
+    std::vector<Ray> rays(numRays);
+    std::mt19937 random(2);
+    std::uniform_real_distribution<float> screenCoord(-1.0f, 1.0f);
+    for (Ray& ray : rays)
+    {
+        ray.origin = camera.position;
+        ray.direction = Normalize(screenCoord(random) * cameraU + screenCoord(random) * cameraV + cameraW);
+        ray.tMin = DefaultRayTMin;
+        ray.tMax = DefaultRayTMax;
+    }
+    return rays;
+}
+
+// Diffuse bounces and shadow rays towards random points on area lights, both starting where the given rays hit.
+// Moves a point on a surface off it along the normal, by a number of ulps that grows with the distance from the scene origin
+// (Waechter and Binder 2019, "A Fast and Robust Method for Avoiding Self-Intersection"). A ray starting right on a triangle
+// hits it again at a tiny t that depends on rounding. That would decide the hit differently in different BVHs, only because
+// boxes of the same triangle are clipped or padded differently.
+static Float3 OffsetRayOrigin(const Float3& position, const Float3& normal)
+{
+    const float originThreshold = 1.0f / 32.0f;
+    const float floatScale = 1.0f / 65536.0f;
+    const float intScale = 256.0f;
+    Float3 offsetPosition;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (fabsf(position[axis]) < originThreshold)
+        {
+            offsetPosition[axis] = position[axis] + floatScale * normal[axis];
+            continue;
+        }
+        const int32_t ulps = static_cast<int32_t>(intScale * normal[axis]);
+        const float coordinate = position[axis];
+        int32_t bits;
+        memcpy(&bits, &coordinate, sizeof(bits));
+        bits += coordinate < 0.0f ? -ulps : ulps;
+        memcpy(&offsetPosition[axis], &bits, sizeof(bits));
+    }
+    return offsetPosition;
+}
+
+static void GenerateSecondaryRays(const CpuScene& scene, const SceneIntersector& intersector, const std::vector<Ray>& rays,
+                                  std::vector<Ray>& diffuseRays, std::vector<Ray>& shadowRays)
+{
+    std::mt19937 random(3);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    for (const Ray& ray : rays)
+    {
+        RayHit hit;
+        if (!intersector.Intersect(ray, hit))
+            continue;
+
+        // Geometric normal facing the incoming ray, not all generated meshes have vertex normals.
+        const CpuScene::Mesh& mesh = scene.meshes[hit.meshIndex];
+        const Float3& v0 = mesh.positions[mesh.indices[hit.primitiveIndex * 3 + 0]];
+        const Float3& v1 = mesh.positions[mesh.indices[hit.primitiveIndex * 3 + 1]];
+        const Float3& v2 = mesh.positions[mesh.indices[hit.primitiveIndex * 3 + 2]];
+        Float3 normal = Normalize(Cross(v1 - v0, v2 - v0));
+        if (Dot(normal, ray.direction) > 0.0f)
+            normal = -normal;
+        const Float3 position = ray.origin + hit.t * ray.direction;
+        const Float3 offsetPosition = OffsetRayOrigin(position, normal);
+
+        const Float2 randomSample(uniform(random), uniform(random));
+        diffuseRays.push_back({ offsetPosition, DefaultRayTMin, CreateONB(normal).TransformToWorld(SampleHemisphereCosine(randomSample)), DefaultRayTMax });
+
+        if (scene.areaLights.empty())
+            continue;
+        const CpuScene::AreaLightTriangle& light = scene.areaLights[random() % scene.areaLights.size()];
+        float u = uniform(random);
+        float v = uniform(random);
+        if (u + v > 1.0f)
+        {
+            u = 1.0f - u;
+            v = 1.0f - v;
+        }
+        const Float3 toLight = light.positions[0] + (light.positions[1] - light.positions[0]) * u + (light.positions[2] - light.positions[0]) * v - position;
+        const float lightDistance = Length(toLight);
+        // Lights behind the surface are reached through it, the origin goes to that side.
+        const Float3 shadowRayOrigin = Dot(toLight, normal) < 0.0f ? OffsetRayOrigin(position, -normal) : offsetPosition;
+        // Ends just before the light, exactly on it rounding decides whether the light occludes itself.
+        shadowRays.push_back({ shadowRayOrigin, DefaultRayTMin, toLight / lightDistance, lightDistance * 0.9999f });
+    }
+}
+
+// Returns the number of hits, which should be the same for all BVHs over the same scene.
+// Closest hits are searched unless occlusionOnly is set, then any hit ends the search like for shadow rays.
+static uint32_t TraceRays(const SceneIntersector& intersector, const std::vector<Ray>& rays, bool occlusionOnly, ThreadPool& threadPool, double& megaRaysPerSecond)
+{
+    std::atomic<uint32_t> numHits(0);
+    auto start = std::chrono::high_resolution_clock::now();
+    threadPool.ParallelFor(0, static_cast<uint32_t>(rays.size()), 4096, [&](uint32_t begin, uint32_t end)
+    {
+        uint32_t numHitsRange = 0;
+        RayHit hit;
+        for (uint32_t i = begin; i < end; ++i)
+            numHitsRange += (occlusionOnly ? intersector.IsOccluded(rays[i]) : intersector.Intersect(rays[i], hit)) ? 1 : 0;
+        numHits += numHitsRange;
+    });
+    auto end = std::chrono::high_resolution_clock::now();
+    megaRaysPerSecond = rays.size() / std::chrono::duration<double>(end - start).count() * 1e-6;
+    return numHits;
+}
+
+struct HitComparison
+{
+    uint32_t numMissed = 0;     // Reference hits, but the intersector misses, hits farther away or finds no occluder.
+    uint32_t numCloser = 0;     // The intersector hits something closer than the reference.
+};
+
+// Compares the closest hit or occlusion of two intersectors that test the same triangles.
+static HitComparison CompareHits(const SceneIntersector& reference, const SceneIntersector& intersector, const std::vector<Ray>& rays, bool occlusionOnly, ThreadPool& threadPool)
+{
+    std::atomic<uint32_t> numMissed(0), numCloser(0);
+    threadPool.ParallelFor(0, static_cast<uint32_t>(rays.size()), 4096, [&](uint32_t begin, uint32_t end)
+    {
+        HitComparison range;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            if (occlusionOnly)
+            {
+                const bool referenceOccluded = reference.IsOccluded(rays[i]);
+                const bool occluded = intersector.IsOccluded(rays[i]);
+                range.numMissed += referenceOccluded && !occluded ? 1 : 0;
+                range.numCloser += !referenceOccluded && occluded ? 1 : 0;
+                continue;
+            }
+            RayHit referenceHit, hit;
+            const bool referenceHasHit = reference.Intersect(rays[i], referenceHit);
+            const bool hasHit = intersector.Intersect(rays[i], hit);
+            range.numMissed += referenceHasHit && (!hasHit || hit.t > referenceHit.t) ? 1 : 0;
+            range.numCloser += hasHit && (!referenceHasHit || hit.t < referenceHit.t) ? 1 : 0;
+        }
+        numMissed += range.numMissed;
+        numCloser += range.numCloser;
+    });
+    HitComparison comparison;
+    comparison.numMissed = numMissed;
+    comparison.numCloser = numCloser;
+    return comparison;
+}
+
+// Best of several builds in milliseconds, the first build also pays for page faults of freshly allocated memory.
+template<typename BuildFunction>
+static double MeasureBuild(uint32_t numRepetitions, BuildFunction build, Bvh& bvh)
+{
+    double bestMilliseconds = INFINITY;
+    for (uint32_t i = 0; i < numRepetitions; ++i)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        bvh = build();
+        auto end = std::chrono::high_resolution_clock::now();
+        bestMilliseconds = std::min(bestMilliseconds, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return bestMilliseconds;
+}
+
+int RunBvhBuildBenchmark(int argc, char** argv)
+{
+    BvhBenchmarkOptions options;
+    if (!ParseBvhBenchmarkOptions(argc, argv, options))
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless bvh-build [scene.pbrt] [options]\n\n"
+            "Builds BVHs with an increasing number of threads and reports build times and tree quality,\n"
+            "then compares build time against trace performance of all builders.\n\n"
+            "Options:\n"
+            "  --triangles <n>   Size of the generated scene if no pbrt file is given (default 1000000)\n"
+            "  --threads <n>     Highest number of threads to measure, doubling from 1 (default all hardware threads)\n"
+            "  --repeat <n>      Builds per configuration, the fastest one is reported (default 3)\n"
+            "  --rays <n>        Rays traced to compare the builders, 0 skips tracing (default 1000000)");
+        return 1;
+    }
+
+    std::unique_ptr<CpuScene> scene = options.sceneFilePath.empty() ?
+        GenerateSphereScene(options.numGeneratedTriangles) : CpuScene::LoadPbrtScene(options.sceneFilePath);
+    if (!scene)
+        return 1;
+    const std::vector<Aabb> triangleBounds = ComputeTriangleBounds(*scene);
+    const double numMegaTriangles = triangleBounds.size() * 1e-6;
+    LogPrint(LogLevel::Info, "%u triangles in %u meshes", (unsigned int)triangleBounds.size(), (unsigned int)scene->meshes.size());
+
+    Bvh bvh;
+    const double medianMilliseconds = MeasureBuild(options.numRepetitions, [&] { return Bvh::BuildMedianSplit(triangleBounds); }, bvh);
+    LogPrint(LogLevel::Info, "%-24s %9.2f ms %8.2f MTris/s  %9u nodes  depth %2u  SAH cost %.2f",
+        "median split, 1 thread", medianMilliseconds, numMegaTriangles / medianMilliseconds * 1e3,
+        (unsigned int)bvh.nodes.size(), bvh.ComputeDepth(), bvh.ComputeSahCost());
+
+    const double serialMilliseconds = MeasureBuild(options.numRepetitions, [&] { return Bvh::BuildBinnedSah(triangleBounds); }, bvh);
+    LogPrint(LogLevel::Info, "%-24s %9.2f ms %8.2f MTris/s  %9u nodes  depth %2u  SAH cost %.2f",
+        "binned SAH, no pool", serialMilliseconds, numMegaTriangles / serialMilliseconds * 1e3,
+        (unsigned int)bvh.nodes.size(), bvh.ComputeDepth(), bvh.ComputeSahCost());
+
+    // Doubling thread counts, with the maximum thread count last even if it is not a power of two.
+    const uint32_t maxThreads = options.maxThreads ? options.maxThreads : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<uint32_t> threadCounts;
+    for (uint32_t numThreads = 1; numThreads < maxThreads; numThreads *= 2)
+        threadCounts.push_back(numThreads);
+    threadCounts.push_back(maxThreads);
+
+    for (uint32_t numThreads : threadCounts)
+    {
+        ThreadPool threadPool(numThreads);
+        const double milliseconds = MeasureBuild(options.numRepetitions, [&] { return Bvh::BuildBinnedSah(triangleBounds, BvhSahSettings(), &threadPool); }, bvh);
+        char label[64];
+        snprintf(label, sizeof(label), "binned SAH, %u threads", numThreads);
+        LogPrint(LogLevel::Info, "%-24s %9.2f ms %8.2f MTris/s  %9u nodes  depth %2u  SAH cost %.2f  speedup %.2fx",
+            label, milliseconds, numMegaTriangles / milliseconds * 1e3,
+            (unsigned int)bvh.nodes.size(), bvh.ComputeDepth(), bvh.ComputeSahCost(), serialMilliseconds / milliseconds);
+    }
+
+    // Build time against trace performance of all builders, using all threads for both.
+    struct NamedBuilder
+    {
+        const char* name;
+        BvhBuilder builder;
+    };
+    const NamedBuilder builders[] =
+    {
+        { "linear", BvhBuilder::Linear },
+        { "PLOC", BvhBuilder::Ploc },
+        { "binned SAH", BvhBuilder::BinnedSah },
+    };
+    ThreadPool threadPool(maxThreads);
+    const std::vector<Ray> rays = GenerateSurfaceRays(*scene, options.numRays);
+    LogPrint(LogLevel::Info, "\nBuilders on %u threads, tracing %u rays from random surface points:", maxThreads, options.numRays);
+    for (const NamedBuilder& namedBuilder : builders)
+    {
+        const double milliseconds = MeasureBuild(options.numRepetitions, [&] { return Bvh::Build(namedBuilder.builder, triangleBounds, &threadPool); }, bvh);
+        double megaRaysPerSecond = 0.0;
+        uint32_t numHits = 0;
+        if (!rays.empty())
+            numHits = TraceRays(SceneIntersector(*scene, &threadPool, namedBuilder.builder), rays, false, threadPool, megaRaysPerSecond);
+        LogPrint(LogLevel::Info, "%-24s %9.2f ms %8.2f MTris/s  %9u nodes  depth %2u  SAH cost %6.2f  %7.2f MRays/s  %u hits",
+            namedBuilder.name, milliseconds, numMegaTriangles / milliseconds * 1e3,
+            (unsigned int)bvh.nodes.size(), bvh.ComputeDepth(), bvh.ComputeSahCost(), megaRaysPerSecond, numHits);
+    }
+
+    return 0;
+}
+
+int RunBvhTraceBenchmark(int argc, char** argv)
+{
+    BvhBenchmarkOptions options;
+    if (!ParseBvhBenchmarkOptions(argc, argv, options) || options.numRays == 0)
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless bvh-trace [scene.pbrt] [options]\n\n"
+            "Compares ray throughput of the binary BVH against the 8 wide BVH with AVX2 traversal,\n"
+            "for camera rays, diffuse bounces and shadow rays starting at the camera ray hits.\n\n"
+            "Options:\n"
+            "  --triangles <n>   Size of the generated scene if no pbrt file is given (default 1000000)\n"
+            "  --threads <n>     Number of threads to trace on (default all hardware threads)\n"
+            "  --repeat <n>      Runs per ray set, the fastest one is reported (default 3)\n"
+            "  --rays <n>        Number of camera rays (default 1000000)");
+        return 1;
+    }
+
+    std::unique_ptr<CpuScene> scene = options.sceneFilePath.empty() ?
+        GenerateSphereScene(options.numGeneratedTriangles) : CpuScene::LoadPbrtScene(options.sceneFilePath);
+    if (!scene)
+        return 1;
+
+    ThreadPool threadPool(options.maxThreads);
+    const SceneIntersector binaryIntersector(*scene, &threadPool, BvhBuilder::BinnedSah, BvhLayout::Binary);
+    const SceneIntersector intersector(*scene, &threadPool, BvhBuilder::BinnedSah);
+    const Bvh8& bvh8 = intersector.GetBvh8();
+    LogPrint(LogLevel::Info, "%u triangles, binary BVH %u nodes (%.1f MB)", binaryIntersector.GetNumTriangles(),
+        binaryIntersector.GetNumBinaryNodes(), binaryIntersector.GetNodeMemorySize() / (1024.0 * 1024.0));
+    LogPrint(LogLevel::Info, "Moller-Trumbore triangles %.1f bytes per triangle", binaryIntersector.GetTriangleMemorySize() / static_cast<double>(binaryIntersector.GetNumTriangles()));
+    if (bvh8.nodes.empty())
+    {
+        LogPrint(LogLevel::Info, "AVX2 is not available, the 8 wide BVH is not used");
+    }
+    else
+    {
+        LogPrint(LogLevel::Info, "8 wide BVH %u nodes (%.1f MB), depth %u instead of %u", (unsigned int)bvh8.nodes.size(),
+            bvh8.nodes.size() * sizeof(Bvh8Node) / (1024.0 * 1024.0), bvh8.ComputeDepth(), binaryIntersector.GetBinaryDepth());
+        LogPrint(LogLevel::Info, "Triangle blocks of 8 %.1f bytes per triangle", intersector.GetTriangleMemorySize() / static_cast<double>(intersector.GetNumTriangles()));
+    }
+
+    struct RaySet
+    {
+        const char* name;
+        std::vector<Ray> rays;
+        bool occlusionOnly;
+    };
+    RaySet raySets[] =
+    {
+        { "primary", GeneratePrimaryRays(*scene, options.numRays), false },
+        { "diffuse", {}, false },
+        { "shadow", {}, true },
+    };
+    GenerateSecondaryRays(*scene, binaryIntersector, raySets[0].rays, raySets[1].rays, raySets[2].rays);
+
+    // Hit counts may differ slightly: the binary BVH uses Moller-Trumbore, which both misses rays through shared edges
+    // and hits the triangle a ray starts on more often than the watertight test used with the 8 wide BVH.
+    LogPrint(LogLevel::Info, "\nTracing on %u threads:", threadPool.GetNumThreads());
+    for (const RaySet& raySet : raySets)
+    {
+        if (raySet.rays.empty())
+        {
+            LogPrint(LogLevel::Info, "%-8s no rays", raySet.name);
+            continue;
+        }
+
+        double binaryMegaRaysPerSecond = 0.0;
+        double megaRaysPerSecond = 0.0;
+        uint32_t binaryNumHits = 0;
+        uint32_t numHits = 0;
+        for (uint32_t i = 0; i < options.numRepetitions; ++i)
+        {
+            double binaryRun, run;
+            binaryNumHits = TraceRays(binaryIntersector, raySet.rays, raySet.occlusionOnly, threadPool, binaryRun);
+            numHits = TraceRays(intersector, raySet.rays, raySet.occlusionOnly, threadPool, run);
+            binaryMegaRaysPerSecond = std::max(binaryMegaRaysPerSecond, binaryRun);
+            megaRaysPerSecond = std::max(megaRaysPerSecond, run);
+        }
+        LogPrint(LogLevel::Info,
+            "%-8s %8u rays  binary %7.2f MRays/s  %s %7.2f MRays/s  speedup %.2fx  hits %u / %u",
+            raySet.name, (unsigned int)raySet.rays.size(), binaryMegaRaysPerSecond, bvh8.nodes.empty() ? "binary" : "8 wide",
+            megaRaysPerSecond, megaRaysPerSecond / binaryMegaRaysPerSecond, binaryNumHits, numHits);
+    }
+
+    return 0;
+}
+
+int RunBvhSpatialSplitBenchmark(int argc, char** argv)
+{
+    BvhBenchmarkOptions options;
+    options.numGeneratedTriangles = 100000;
+    if (!ParseBvhBenchmarkOptions(argc, argv, options) || options.numRays == 0)
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless bvh-spatial [scene.pbrt] [options]\n\n"
+            "Compares the binned SAH BVH against spatial splits (SBVH) with different memory budgets in tree quality,\n"
+            "then the trace performance of both for camera, diffuse and shadow rays. The generated scene is a room\n"
+            "crossed by long thin rods, whose bounding boxes overlap just like those of large and thin triangles in\n"
+            "architectural scenes.\n\n"
+            "Options:\n"
+            "  --triangles <n>   Size of the generated scene if no pbrt file is given (default 100000)\n"
+            "  --threads <n>     Number of threads to build and trace on (default all hardware threads)\n"
+            "  --repeat <n>      Runs per build and ray set, the fastest one is reported (default 3)\n"
+            "  --rays <n>        Number of camera rays (default 1000000)");
+        return 1;
+    }
+
+    std::unique_ptr<CpuScene> scene = options.sceneFilePath.empty() ?
+        GenerateRodScene(options.numGeneratedTriangles) : CpuScene::LoadPbrtScene(options.sceneFilePath);
+    if (!scene)
+        return 1;
+    const std::vector<Aabb> triangleBounds = ComputeTriangleBounds(*scene);
+    const std::vector<Float3> triangleVertices = ComputeTriangleVertices(*scene);
+    const uint32_t numTriangles = static_cast<uint32_t>(triangleBounds.size());
+    LogPrint(LogLevel::Info, "%u triangles in %u meshes", numTriangles, (unsigned int)scene->meshes.size());
+
+    ThreadPool threadPool(options.maxThreads);
+    Bvh bvh;
+    const double binnedMilliseconds = MeasureBuild(options.numRepetitions, [&] { return Bvh::BuildBinnedSah(triangleBounds, BvhSahSettings(), &threadPool); }, bvh);
+    const float binnedSahCost = bvh.ComputeSahCost();
+    LogPrint(LogLevel::Info, "%-26s %9.2f ms  %9u nodes  %.2f references per triangle  SAH cost %7.2f",
+        "binned SAH", binnedMilliseconds, (unsigned int)bvh.nodes.size(), bvh.primitiveIndices.size() / static_cast<double>(numTriangles), binnedSahCost);
+
+    const float budgets[] = { 1.1f, 1.25f, 1.5f, 2.0f, 3.0f };
+    for (float budget : budgets)
+    {
+        BvhSpatialSplitSettings settings;
+        settings.maxReferencesPerPrimitive = budget;
+        const double milliseconds = MeasureBuild(options.numRepetitions, [&] { return Bvh::BuildSpatialSplits(triangleVertices, settings, &threadPool); }, bvh);
+        const float sahCost = bvh.ComputeSahCost();
+        char label[64];
+        snprintf(label, sizeof(label), "spatial splits, budget %.2f", budget);
+        LogPrint(LogLevel::Info, "%-26s %9.2f ms  %9u nodes  %.2f references per triangle  SAH cost %7.2f (%.0f%% of binned SAH)",
+            label, milliseconds, (unsigned int)bvh.nodes.size(), bvh.primitiveIndices.size() / static_cast<double>(numTriangles),
+            sahCost, sahCost / binnedSahCost * 100.0f);
+    }
+
+    // Default settings from here on, the ones the renderer uses.
+    const SceneIntersector binnedIntersector(*scene, &threadPool, BvhBuilder::BinnedSah);
+    const SceneIntersector spatialIntersector(*scene, &threadPool, BvhBuilder::SpatialSplits);
+    LogPrint(LogLevel::Info, "\nTriangle data %.1f bytes per triangle with binned SAH, %.1f with spatial splits",
+        binnedIntersector.GetTriangleMemorySize() / static_cast<double>(numTriangles), spatialIntersector.GetTriangleMemorySize() / static_cast<double>(numTriangles));
+
+    struct RaySet
+    {
+        const char* name;
+        std::vector<Ray> rays;
+        bool occlusionOnly;
+    };
+    RaySet raySets[] =
+    {
+        { "primary", GeneratePrimaryRays(*scene, options.numRays), false },
+        { "diffuse", {}, false },
+        { "shadow", {}, true },
+    };
+    GenerateSecondaryRays(*scene, binnedIntersector, raySets[0].rays, raySets[1].rays, raySets[2].rays);
+
+    // Both use the same triangle test, every ray has to give the same result no matter which leaf a triangle is found in.
+    bool sameHits = true;
+    LogPrint(LogLevel::Info, "Tracing on %u threads:", threadPool.GetNumThreads());
+    for (const RaySet& raySet : raySets)
+    {
+        if (raySet.rays.empty())
+        {
+            LogPrint(LogLevel::Info, "%-8s no rays", raySet.name);
+            continue;
+        }
+
+        double binnedMegaRaysPerSecond = 0.0;
+        double spatialMegaRaysPerSecond = 0.0;
+        uint32_t binnedNumHits = 0;
+        uint32_t spatialNumHits = 0;
+        for (uint32_t i = 0; i < options.numRepetitions; ++i)
+        {
+            double binnedRun, spatialRun;
+            binnedNumHits = TraceRays(binnedIntersector, raySet.rays, raySet.occlusionOnly, threadPool, binnedRun);
+            spatialNumHits = TraceRays(spatialIntersector, raySet.rays, raySet.occlusionOnly, threadPool, spatialRun);
+            binnedMegaRaysPerSecond = std::max(binnedMegaRaysPerSecond, binnedRun);
+            spatialMegaRaysPerSecond = std::max(spatialMegaRaysPerSecond, spatialRun);
+        }
+        sameHits &= binnedNumHits == spatialNumHits;
+        LogPrint(binnedNumHits == spatialNumHits ? LogLevel::Info : LogLevel::Failure,
+            "%-8s %8u rays  binned SAH %7.2f MRays/s  spatial splits %7.2f MRays/s  speedup %.2fx  hits %u / %u",
+            raySet.name, (unsigned int)raySet.rays.size(), binnedMegaRaysPerSecond, spatialMegaRaysPerSecond,
+            spatialMegaRaysPerSecond / binnedMegaRaysPerSecond, binnedNumHits, spatialNumHits);
+    }
+
+    return sameHits ? 0 : 1;
+}
+
+int RunBvhQuantizationTest(int argc, char** argv)
+{
+    BvhBenchmarkOptions options;
+    if (!ParseBvhBenchmarkOptions(argc, argv, options) || options.numRays == 0)
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless bvh-quantized [scene.pbrt] [options]\n\n"
+            "Compares the 8 wide BVH with full precision nodes against quantized nodes in memory and ray throughput.\n"
+            "Fails if a quantized child box does not contain the exact one or if any hit is missed.\n\n"
+            "Options:\n"
+            "  --triangles <n>   Size of the generated scene if no pbrt file is given (default 1000000)\n"
+            "  --threads <n>     Number of threads to trace on (default all hardware threads)\n"
+            "  --repeat <n>      Runs per ray set, the fastest one is reported (default 3)\n"
+            "  --rays <n>        Number of camera rays (default 1000000)");
+        return 1;
+    }
+    if (!CpuSupportsAvx2())
+    {
+        LogPrint(LogLevel::Failure, "AVX2 is not available, the 8 wide BVH is not used on this cpu");
+        return 1;
+    }
+
+    std::unique_ptr<CpuScene> scene = options.sceneFilePath.empty() ?
+        GenerateSphereScene(options.numGeneratedTriangles) : CpuScene::LoadPbrtScene(options.sceneFilePath);
+    if (!scene)
+        return 1;
+
+    ThreadPool threadPool(options.maxThreads);
+    const SceneIntersector intersector(*scene, &threadPool, BvhBuilder::BinnedSah, BvhLayout::Wide);
+    const SceneIntersector quantizedIntersector(*scene, &threadPool, BvhBuilder::BinnedSah, BvhLayout::WideQuantized);
+    const uint32_t numTriangles = intersector.GetNumTriangles();
+    const uint32_t numNodes = static_cast<uint32_t>(intersector.GetBvh8().nodes.size());
+    const double nodeMegabytes = intersector.GetNodeMemorySize() / (1024.0 * 1024.0);
+    const double quantizedNodeMegabytes = quantizedIntersector.GetNodeMemorySize() / (1024.0 * 1024.0);
+    const double triangleBytes = intersector.GetTriangleMemorySize() / static_cast<double>(numTriangles);
+    LogPrint(LogLevel::Info, "%u triangles, %u nodes, triangle blocks %.1f bytes per triangle", numTriangles, numNodes, triangleBytes);
+    // Totals are everything the intersectors hold, not only the nodes and triangle blocks they traverse.
+    LogPrint(LogLevel::Info, "full precision  %3u bytes per node  %8.1f MB  %5.1f node bytes per triangle  total %6.1f MB, %5.1f bytes per triangle",
+        (unsigned int)sizeof(Bvh8Node), nodeMegabytes, intersector.GetNodeMemorySize() / static_cast<double>(numTriangles),
+        intersector.GetMemorySize() / (1024.0 * 1024.0), intersector.GetMemorySize() / static_cast<double>(numTriangles));
+    LogPrint(LogLevel::Info, "quantized       %3u bytes per node  %8.1f MB  %5.1f node bytes per triangle  total %6.1f MB, %5.1f bytes per triangle",
+        (unsigned int)sizeof(QuantizedBvh8Node), quantizedNodeMegabytes, quantizedIntersector.GetNodeMemorySize() / static_cast<double>(numTriangles),
+        quantizedIntersector.GetMemorySize() / (1024.0 * 1024.0), quantizedIntersector.GetMemorySize() / static_cast<double>(numTriangles));
+
+    // The intersectors keep only the nodes they traverse, the full precision ones are quantized once more for the check.
+    const Bvh8& bvh8 = intersector.GetBvh8();
+    std::vector<uint32_t> leafOrder;
+    const uint32_t numNonConservative = QuantizedBvh8::Quantize(bvh8, leafOrder).CountNonConservativeBounds(bvh8);
+    LogPrint(numNonConservative == 0 ? LogLevel::Success : LogLevel::Failure, "%u of %u quantized child boxes do not contain the exact box",
+        numNonConservative, (unsigned int)leafOrder.size() + numNodes - 1);
+
+    struct RaySet
+    {
+        const char* name;
+        std::vector<Ray> rays;
+        bool occlusionOnly;
+    };
+    RaySet raySets[] =
+    {
+        { "primary", GeneratePrimaryRays(*scene, options.numRays), false },
+        { "diffuse", {}, false },
+        { "shadow", {}, true },
+        { "surface", GenerateSurfaceRays(*scene, options.numRays), false },
+    };
+    GenerateSecondaryRays(*scene, intersector, raySets[0].rays, raySets[1].rays, raySets[2].rays);
+
+    // Both test the same triangle blocks and quantized boxes are never smaller, so no hit may be lost.
+    // Closer hits are possible though: a ray leaving a surface right at tMin may enter a box that was flat before
+    // and find a self intersection the full precision box culled.
+    uint32_t numMissed = 0;
+    LogPrint(LogLevel::Info, "\nTracing on %u threads:", threadPool.GetNumThreads());
+    for (const RaySet& raySet : raySets)
+    {
+        if (raySet.rays.empty())
+        {
+            LogPrint(LogLevel::Info, "%-8s no rays", raySet.name);
+            continue;
+        }
+
+        double megaRaysPerSecond = 0.0;
+        double quantizedMegaRaysPerSecond = 0.0;
+        for (uint32_t i = 0; i < options.numRepetitions; ++i)
+        {
+            double run, quantizedRun;
+            TraceRays(intersector, raySet.rays, raySet.occlusionOnly, threadPool, run);
+            TraceRays(quantizedIntersector, raySet.rays, raySet.occlusionOnly, threadPool, quantizedRun);
+            megaRaysPerSecond = std::max(megaRaysPerSecond, run);
+            quantizedMegaRaysPerSecond = std::max(quantizedMegaRaysPerSecond, quantizedRun);
+        }
+        const HitComparison comparison = CompareHits(intersector, quantizedIntersector, raySet.rays, raySet.occlusionOnly, threadPool);
+        numMissed += comparison.numMissed;
+        LogPrint(comparison.numMissed == 0 ? LogLevel::Info : LogLevel::Failure,
+            "%-8s %8u rays  full precision %7.2f MRays/s  quantized %7.2f MRays/s  (%+.1f%%)  %u missed, %u closer hits",
+            raySet.name, (unsigned int)raySet.rays.size(), megaRaysPerSecond, quantizedMegaRaysPerSecond,
+            (quantizedMegaRaysPerSecond / megaRaysPerSecond - 1.0) * 100.0, comparison.numMissed, comparison.numCloser);
+    }
+
+    return numNonConservative == 0 && numMissed == 0 ? 0 : 1;
+}
+
+// Motion of an instance: it spins around its own vertical axis and bobs up and down, some also orbit the scene center.
+struct InstanceAnimation
+{
+    Float3 position;
+    float scale;
+    float spinSpeed;        // Radians per second.
+    float orbitSpeed;       // Radians per second, 0 for instances that stay in place.
+    float phase;
+};
+
+static std::vector<InstanceAnimation> GenerateInstanceAnimations(uint32_t numInstances, float sceneSize)
+{
+    std::vector<InstanceAnimation> animations(numInstances);
+    std::mt19937 random(4);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    for (InstanceAnimation& animation : animations)
+    {
+        animation.position = Float3(uniform(random) * 2.0f - 1.0f, uniform(random) * 2.0f - 1.0f, uniform(random) * 2.0f - 1.0f) * sceneSize;
+        animation.scale = 0.3f + uniform(random) * 0.7f;
+        animation.spinSpeed = (uniform(random) * 2.0f - 1.0f) * 3.0f;
+        animation.orbitSpeed = uniform(random) < 0.1f ? 0.5f : 0.0f;
+        animation.phase = uniform(random) * 6.2831853f;
+    }
+    return animations;
+}
+
+static void AnimateInstances(const std::vector<InstanceAnimation>& animations, float time, std::vector<Float3x4>& transforms)
+{
+    transforms.resize(animations.size());
+    for (size_t i = 0; i < animations.size(); ++i)
+    {
+        const InstanceAnimation& animation = animations[i];
+        const float orbitAngle = animation.orbitSpeed * time;
+        const Float3 position(animation.position.x * cosf(orbitAngle) - animation.position.z * sinf(orbitAngle),
+                              animation.position.y + sinf(animation.phase + time * 2.0f) * animation.scale,
+                              animation.position.x * sinf(orbitAngle) + animation.position.z * cosf(orbitAngle));
+        const float spin = animation.phase + animation.spinSpeed * time;
+        const float cosSpin = cosf(spin) * animation.scale;
+        const float sinSpin = sinf(spin) * animation.scale;
+        transforms[i] = { { { cosSpin, 0.0f, sinSpin, position.x }, { 0.0f, animation.scale, 0.0f, position.y }, { -sinSpin, 0.0f, cosSpin, position.z } } };
+    }
+}
+
+// Closest hits of all rays, t is INFINITY for misses.
+static std::vector<float> TraceInstances(const InstancedSceneIntersector& intersector, const std::vector<Ray>& rays, ThreadPool& threadPool, double& megaRaysPerSecond)
+{
+    std::vector<float> hitDistances(rays.size());
+    auto start = std::chrono::high_resolution_clock::now();
+    threadPool.ParallelFor(0, static_cast<uint32_t>(rays.size()), 4096, [&](uint32_t begin, uint32_t end)
+    {
+        RayHit hit;
+        uint32_t instanceIndex;
+        for (uint32_t i = begin; i < end; ++i)
+            hitDistances[i] = intersector.Intersect(rays[i], hit, instanceIndex) ? hit.t : INFINITY;
+    });
+    auto end = std::chrono::high_resolution_clock::now();
+    megaRaysPerSecond = rays.size() / std::chrono::duration<double>(end - start).count() * 1e-6;
+    return hitDistances;
+}
+
+int RunBvhInstanceBenchmark(int argc, char** argv)
+{
+    BvhBenchmarkOptions options;
+    if (!ParseBvhBenchmarkOptions(argc, argv, options) || options.numInstances == 0 || options.numFrames == 0 || options.numRays == 0)
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless bvh-instances [options]\n\n"
+            "Animates instances of a few objects and measures the per frame cost of refitting or rebuilding the top level\n"
+            "BVH, then compares trace performance after the last frame. Checks the hits against the same instances flattened\n"
+            "into a single BVH.\n\n"
+            "Options:\n"
+            "  --instances <n>   Number of instances (default 100000)\n"
+            "  --frames <n>      Number of animated frames at 30 frames per second (default 30)\n"
+            "  --threads <n>     Number of threads to update and trace on (default all hardware threads)\n"
+            "  --rays <n>        Number of camera rays (default 1000000)");
+        return 1;
+    }
+
+    // Ellipsoids, so that spinning them changes their bounds.
+    ThreadPool threadPool(options.maxThreads);
+    const uint32_t numObjects = 4;
+    std::vector<CpuScene> objectScenes(numObjects);
+    std::vector<std::unique_ptr<SceneIntersector>> objects;
+    uint32_t numObjectTriangles = 0;
+    size_t objectMemorySize = 0;
+    for (uint32_t i = 0; i < numObjects; ++i)
+    {
+        CpuScene::Mesh mesh;
+        mesh.materialIndex = 0;
+        mesh.isEmitter = false;
+        mesh.areaLightRadiance = Float3(0.0f);
+        AppendSphere(mesh, Float3(0.0f), 1.0f, 8 + i * 8, 16 + i * 16);
+        for (Float3& position : mesh.positions)
+            position *= Float3(1.0f, 0.3f + i * 0.2f, 0.5f);
+        objectScenes[i].meshes.push_back(std::move(mesh));
+        objects.emplace_back(new SceneIntersector(objectScenes[i], &threadPool));
+        numObjectTriangles += objects.back()->GetNumTriangles();
+        objectMemorySize += objects.back()->GetMemorySize();
+    }
+
+    const float sceneSize = 2.0f * cbrtf(static_cast<float>(options.numInstances));
+    const std::vector<InstanceAnimation> animations = GenerateInstanceAnimations(options.numInstances, sceneSize);
+    std::vector<Float3x4> transforms;
+    AnimateInstances(animations, 0.0f, transforms);
+    std::vector<SceneIntersectorInstance> instances(options.numInstances);
+    uint64_t numInstancedTriangles = 0;
+    for (uint32_t i = 0; i < options.numInstances; ++i)
+    {
+        instances[i] = { objects[i % numObjects].get(), transforms[i] };
+        numInstancedTriangles += instances[i].object->GetNumTriangles();
+    }
+
+    InstancedSceneIntersector refitted(instances, &threadPool, BvhBuilder::BinnedSah);
+    InstancedSceneIntersector rebuilt(instances, &threadPool, BvhBuilder::BinnedSah);
+    InstancedSceneIntersector rebuiltLinear(instances, &threadPool, BvhBuilder::Linear);
+    const float initialSahCost = refitted.GetBvh().ComputeSahCost();
+    LogPrint(LogLevel::Info, "%u instances of %u objects with %u triangles, %.1f M triangles in total",
+        options.numInstances, numObjects, numObjectTriangles, numInstancedTriangles * 1e-6);
+    LogPrint(LogLevel::Info, "Objects %.1f MB, top level %.1f MB, flattened about %.0f MB",
+        objectMemorySize / (1024.0 * 1024.0), refitted.GetBvh().nodes.size() * sizeof(BvhNode) / (1024.0 * 1024.0),
+        numInstancedTriangles * (objectMemorySize / static_cast<double>(numObjectTriangles)) / (1024.0 * 1024.0));
+
+    // Each intersector is updated the same way every frame, the refitted one keeps the tree of frame 0.
+    double animateMilliseconds = 0.0;
+    double refitMilliseconds = 0.0;
+    double rebuildMilliseconds = 0.0;
+    double rebuildLinearMilliseconds = 0.0;
+    auto measure = [&](InstancedSceneIntersector& intersector, bool refit)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        intersector.Update(transforms, refit);
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    };
+    for (uint32_t frame = 1; frame <= options.numFrames; ++frame)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        AnimateInstances(animations, frame / 30.0f, transforms);
+        auto end = std::chrono::high_resolution_clock::now();
+        animateMilliseconds += std::chrono::duration<double, std::milli>(end - start).count();
+        refitMilliseconds += measure(refitted, true);
+        rebuildMilliseconds += measure(rebuilt, false);
+        rebuildLinearMilliseconds += measure(rebuiltLinear, false);
+    }
+
+    // A camera outside of the cube of instances, looking at its center.
+    CpuScene cameraScene;
+    const Float3 cameraPosition(0.0f, sceneSize * 0.5f, -sceneSize * 2.5f);
+    cameraScene.cameras.push_back({ cameraPosition, Normalize(-cameraPosition), Float3(0.0f, 1.0f, 0.0f), 0.8f });
+    const std::vector<Ray> rays = GeneratePrimaryRays(cameraScene, options.numRays);
+
+    struct Variant
+    {
+        const char* name;
+        const InstancedSceneIntersector& intersector;
+        double updateMilliseconds;
+    };
+    const Variant variants[] =
+    {
+        { "refit", refitted, refitMilliseconds },
+        { "rebuild sah", rebuilt, rebuildMilliseconds },
+        { "rebuild linear", rebuiltLinear, rebuildLinearMilliseconds },
+    };
+    LogPrint(LogLevel::Info, "\nSAH cost of the top level at frame 0 %.1f. Per frame on %u threads, animating the transforms takes %.2f ms:",
+        initialSahCost, threadPool.GetNumThreads(), animateMilliseconds / options.numFrames);
+    std::vector<float> referenceHitDistances;
+    uint32_t numDifferent = 0;
+    for (const Variant& variant : variants)
+    {
+        double megaRaysPerSecond;
+        const std::vector<float> hitDistances = TraceInstances(variant.intersector, rays, threadPool, megaRaysPerSecond);
+        if (referenceHitDistances.empty())
+            referenceHitDistances = hitDistances;
+        uint32_t numVariantDifferent = 0;
+        for (size_t i = 0; i < rays.size(); ++i)
+            numVariantDifferent += hitDistances[i] != referenceHitDistances[i] ? 1 : 0;
+        numDifferent += numVariantDifferent;
+        LogPrint(numVariantDifferent == 0 ? LogLevel::Info : LogLevel::Failure,
+            "%-15s update %7.2f ms  SAH cost %7.1f  %6.2f MRays/s after frame %u  %u different hits",
+            variant.name, variant.updateMilliseconds / options.numFrames, variant.intersector.GetBvh().ComputeSahCost(),
+            megaRaysPerSecond, options.numFrames, numVariantDifferent);
+    }
+
+    // Flattening all instances into one BVH gives the same hits up to the rounding of the transformed vertices.
+    // Only a subset is checked, otherwise the flattened scene would not fit into memory.
+    const uint32_t numCheckedInstances = std::min(options.numInstances, 1000u);
+    std::vector<SceneIntersectorInstance> checkedInstances;
+    CpuScene flattenedScene;
+    for (uint32_t i = 0; i < numCheckedInstances; ++i)
+    {
+        checkedInstances.push_back({ instances[i].object, transforms[i] });
+        CpuScene::Mesh mesh = objectScenes[i % numObjects].meshes[0];
+        for (Float3& position : mesh.positions)
+            position = transforms[i].TransformPoint(position);
+        flattenedScene.meshes.push_back(std::move(mesh));
+    }
+    const InstancedSceneIntersector checked(checkedInstances, &threadPool);
+    const SceneIntersector flattened(flattenedScene, &threadPool);
+    // Aims at the checked instances, which are spread over the whole cube.
+    std::vector<Ray> checkRays;
+    std::mt19937 random(5);
+    std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+    for (uint32_t i = 0; i < options.numRays / 10; ++i)
+    {
+        const Float3x4& transform = transforms[random() % numCheckedInstances];
+        const Float3 target = transform.TransformPoint(Float3(offset(random), offset(random), offset(random)));
+        checkRays.push_back({ cameraPosition, DefaultRayTMin, Normalize(target - cameraPosition), DefaultRayTMax });
+    }
+    double megaRaysPerSecond;
+    const std::vector<float> checkedHitDistances = TraceInstances(checked, checkRays, threadPool, megaRaysPerSecond);
+    uint32_t numMismatches = 0;
+    uint32_t numHits = 0;
+    for (size_t i = 0; i < checkRays.size(); ++i)
+    {
+        RayHit hit;
+        const float flattenedDistance = flattened.Intersect(checkRays[i], hit) ? hit.t : INFINITY;
+        numHits += flattenedDistance != INFINITY ? 1 : 0;
+        if (flattenedDistance == INFINITY || checkedHitDistances[i] == INFINITY)
+            numMismatches += flattenedDistance != checkedHitDistances[i] ? 1 : 0;
+        else
+            numMismatches += fabsf(flattenedDistance - checkedHitDistances[i]) > flattenedDistance * 1e-4f ? 1 : 0;
+    }
+    // Rays grazing a silhouette may go either way.
+    const bool flattenedMatches = numMismatches <= checkRays.size() / 10000;
+    LogPrint(flattenedMatches ? LogLevel::Success : LogLevel::Failure, "\n%u of %u rays (%u hits) differ from %u flattened instances",
+        numMismatches, (unsigned int)checkRays.size(), numHits, numCheckedInstances);
+
+    return numDifferent == 0 && flattenedMatches ? 0 : 1;
+}
+
+// Generated scenes have neither materials nor vertex normals. Adds a grey matte material and smooth normals, so that
+// the path tracer can render them.
+void PrepareGeneratedSceneForRendering(CpuScene& scene)
+{
+    scene.materials.push_back({ CpuScene::MATERIAL_MATTE, scene.GetTextureIndexForColor(Float3(0.5f)), Float3(1.0f), Float3(0.0f), 1.0f });
+    for (CpuScene::Mesh& mesh : scene.meshes)
+    {
+        if (!mesh.vertices.empty())
+            continue;
+        std::vector<Float3> normals(mesh.positions.size(), Float3(0.0f));
+        for (size_t i = 0; i < mesh.indices.size(); i += 3)
+        {
+            const Float3& v0 = mesh.positions[mesh.indices[i + 0]];
+            // Not normalized, so larger triangles contribute more.
+            const Float3 normal = Cross(mesh.positions[mesh.indices[i + 1]] - v0, mesh.positions[mesh.indices[i + 2]] - v0);
+            for (int vertex = 0; vertex < 3; ++vertex)
+                normals[mesh.indices[i + vertex]] += normal;
+        }
+        for (const Float3& normal : normals)
+            mesh.vertices.push_back({ Normalize(normal), Float2(0.0f, 0.0f) });
+    }
+}
+
+int RunBvhLazyBenchmark(int argc, char** argv)
+{
+    BvhBenchmarkOptions options;
+    if (!ParseBvhBenchmarkOptions(argc, argv, options))
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless bvh-lazy [scene.pbrt] [options]\n\n"
+            "Renders the first frames from every camera, once with the BVH built up front and once with a lazily built BVH.\n"
+            "Reports the time to the first image and how much of the BVH the lazy one had to build. Without a pbrt file, a\n"
+            "generated building is seen from inside, once with doors between its rooms and once without, and a generated\n"
+            "field of spheres from above.\n\n"
+            "Options:\n"
+            "  --triangles <n>   Size of the generated scene if no pbrt file is given (default 1000000)\n"
+            "  --threads <n>     Number of threads to build and render on (default all hardware threads)");
+        return 1;
+    }
+
+    // Without a file, the building is seen from inside and the spheres are seen from above, all of them in view.
+    // Paths in the closed building never leave the camera's room, that is where the lazy BVH pays off.
+    struct BenchmarkScene
+    {
+        const char* name;
+        std::unique_ptr<CpuScene> scene;
+    };
+    std::vector<BenchmarkScene> scenes;
+    if (options.sceneFilePath.empty())
+    {
+        scenes.push_back({ "building", GenerateBuildingScene(options.numGeneratedTriangles) });
+        scenes.push_back({ "closed", GenerateBuildingScene(options.numGeneratedTriangles, false) });
+        scenes.push_back({ "spheres", GenerateSphereScene(options.numGeneratedTriangles) });
+        for (BenchmarkScene& benchmarkScene : scenes)
+            PrepareGeneratedSceneForRendering(*benchmarkScene.scene);
+    }
+    else
+    {
+        scenes.push_back({ "scene", CpuScene::LoadPbrtScene(options.sceneFilePath) });
+        if (!scenes.back().scene)
+            return 1;
+    }
+
+    CpuPathTracer::Settings settings;
+    settings.numThreads = options.maxThreads;
+    const uint32_t width = 640;
+    const uint32_t height = 360;
+    LogPrint(LogLevel::Info, "%u x %u pixels, 1 sample per pixel with %u bounces", width, height, settings.numBounces);
+    for (const BenchmarkScene& benchmarkScene : scenes)
+    {
+        const CpuScene& scene = *benchmarkScene.scene;
+        for (uint32_t cameraIndex = 0; cameraIndex < scene.cameras.size(); ++cameraIndex)
+        {
+            std::vector<float> images[2];
+            for (int lazy = 0; lazy < 2; ++lazy)
+            {
+                settings.lazyBvh = lazy != 0;
+                auto start = std::chrono::high_resolution_clock::now();
+                CpuPathTracer pathTracer(scene, settings);
+                auto built = std::chrono::high_resolution_clock::now();
+                pathTracer.ResizeOutput(width, height);
+                pathTracer.SetCamera(scene.cameras[cameraIndex]);
+                pathTracer.DrawIterations(1);
+                auto firstFrame = std::chrono::high_resolution_clock::now();
+                pathTracer.DrawIterations(1);
+                auto secondFrame = std::chrono::high_resolution_clock::now();
+                images[lazy] = pathTracer.GetOutput();
+
+                const double buildMilliseconds = std::chrono::duration<double, std::milli>(built - start).count();
+                const double firstFrameMilliseconds = std::chrono::duration<double, std::milli>(firstFrame - built).count();
+                const double secondFrameMilliseconds = std::chrono::duration<double, std::milli>(secondFrame - firstFrame).count();
+                LogPrint(LogLevel::Info, "%-8s camera %u %-4s  build %7.1f ms  first frame %7.1f ms  first image after %7.1f ms  next frame %7.1f ms",
+                    benchmarkScene.name, cameraIndex, lazy ? "lazy" : "full", buildMilliseconds, firstFrameMilliseconds,
+                    buildMilliseconds + firstFrameMilliseconds, secondFrameMilliseconds);
+                const LazySceneIntersector* lazyIntersector = pathTracer.GetLazyIntersector();
+                if (lazyIntersector)
+                {
+                    LogPrint(LogLevel::Info, "%24sbuilt %u of %u subtrees with %.1f%% of the triangles, %.1f ms summed over all threads", "",
+                        lazyIntersector->GetNumBuiltSubtrees(), lazyIntersector->GetNumSubtrees(),
+                        lazyIntersector->GetNumBuiltTriangles() * 100.0 / std::max(1u, lazyIntersector->GetNumTriangles()), lazyIntersector->GetSubtreeBuildSeconds() * 1e3);
+                }
+            }
+
+            // Same paths up to the order in which hits at equal distances are found.
+            uint32_t numDifferentPixels = 0;
+            for (size_t i = 0; i < images[0].size(); i += 4)
+                numDifferentPixels += memcmp(&images[0][i], &images[1][i], sizeof(float) * 3) != 0 ? 1 : 0;
+            LogPrint(LogLevel::Info, "%24s%u of %u pixels differ\n", "", numDifferentPixels, width * height);
+        }
+    }
+
+    return 0;
+}
+
+int RunBvhCacheBenchmark(int argc, char** argv)
+{
+    BvhBenchmarkOptions options;
+    if (!ParseBvhBenchmarkOptions(argc, argv, options) || options.numRays == 0)
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless bvh-cache [scene.pbrt] [options]\n\n"
+            "Compares building a BVH with mapping it from a cache file, for every layout. Checks that the mapped BVH finds\n"
+            "the same hits and that changed geometry and damaged files make it rebuild. The cache file is written to the\n"
+            "working directory and removed afterwards.\n\n"
+            "Options:\n"
+            "  --triangles <n>   Size of the generated scene if no pbrt file is given (default 1000000)\n"
+            "  --threads <n>     Number of threads to build and trace on (default all hardware threads)\n"
+            "  --rays <n>        Number of camera rays (default 1000000)");
+        return 1;
+    }
+
+    std::unique_ptr<CpuScene> scene = options.sceneFilePath.empty() ?
+        GenerateSphereScene(options.numGeneratedTriangles) : CpuScene::LoadPbrtScene(options.sceneFilePath);
+    if (!scene)
+        return 1;
+
+    ThreadPool threadPool(options.maxThreads);
+    const std::string cacheFilePath = "lightdam-headless-bvh-cache-benchmark.bvh";
+    const std::vector<Ray> rays = GeneratePrimaryRays(*scene, options.numRays);
+    auto milliseconds = [](std::chrono::high_resolution_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
+    struct Layout
+    {
+        const char* name;
+        BvhLayout layout;
+    };
+    const Layout layouts[] =
+    {
+        { "binary", BvhLayout::Binary },
+        { "wide", BvhLayout::Wide },
+        { "quantized", BvhLayout::WideQuantized },
+    };
+    bool passed = true;
+    LogPrint(LogLevel::Info, "%u triangles, %u camera rays, %u threads. The cache file stays in the OS file cache between the runs.",
+        (unsigned int)ComputeTriangleBounds(*scene).size(), (unsigned int)rays.size(), threadPool.GetNumThreads());
+    for (const Layout& layout : layouts)
+    {
+        if (layout.layout != BvhLayout::Binary && !CpuSupportsAvx2())
+            continue;
+
+        std::remove(cacheFilePath.c_str());
+        auto start = std::chrono::high_resolution_clock::now();
+        std::unique_ptr<SceneIntersector> built(new SceneIntersector(*scene, &threadPool, BvhBuilder::BinnedSah, layout.layout));
+        const double buildMilliseconds = milliseconds(start);
+        built.reset();
+        start = std::chrono::high_resolution_clock::now();
+        built = SceneIntersector::LoadOrBuild(*scene, cacheFilePath, &threadPool, BvhBuilder::BinnedSah, layout.layout);
+        const double buildAndWriteMilliseconds = milliseconds(start);
+        start = std::chrono::high_resolution_clock::now();
+        std::unique_ptr<SceneIntersector> mapped = SceneIntersector::LoadOrBuild(*scene, cacheFilePath, &threadPool, BvhBuilder::BinnedSah, layout.layout);
+        const double mapMilliseconds = milliseconds(start);
+
+        // The first trace of the mapped BVH pays for page faults, the built one is already in memory.
+        double builtMegaRaysPerSecond, mappedMegaRaysPerSecond;
+        TraceRays(*mapped, rays, false, threadPool, mappedMegaRaysPerSecond);
+        TraceRays(*built, rays, false, threadPool, builtMegaRaysPerSecond);
+        const HitComparison comparison = CompareHits(*built, *mapped, rays, false, threadPool);
+        const bool sameHits = mapped->IsLoadedFromCache() && comparison.numMissed == 0 && comparison.numCloser == 0;
+        passed &= sameHits;
+        LogPrint(sameHits ? LogLevel::Info : LogLevel::Failure,
+            "%-9s  build %8.1f ms  build and write %8.1f ms  hash and map %6.1f ms (%.1f MB)  first trace built %6.2f MRays/s  mapped %6.2f MRays/s  %u different hits",
+            layout.name, buildMilliseconds, buildAndWriteMilliseconds, mapMilliseconds,
+            (mapped->GetNodeMemorySize() + mapped->GetTriangleMemorySize()) / (1024.0 * 1024.0),
+            builtMegaRaysPerSecond, mappedMegaRaysPerSecond, comparison.numMissed + comparison.numCloser);
+    }
+
+    // A moved vertex has to invalidate the file, it is rewritten for the moved vertex and not used once it is moved back.
+    CpuScene::Mesh& mesh = scene->meshes[0];
+    const Float3 position = mesh.positions[mesh.indices[0]];
+    mesh.positions[mesh.indices[0]] = position + Float3(0.0f, 1e-3f, 0.0f);
+    const bool rebuiltChanged = !SceneIntersector::LoadOrBuild(*scene, cacheFilePath, &threadPool)->IsLoadedFromCache();
+    mesh.positions[mesh.indices[0]] = position;
+    const bool rebuiltRestored = !SceneIntersector::LoadOrBuild(*scene, cacheFilePath, &threadPool)->IsLoadedFromCache();
+    LogPrint(rebuiltChanged && rebuiltRestored ? LogLevel::Success : LogLevel::Failure, "Rebuilt after a vertex moved: %s, after it moved back: %s",
+        rebuiltChanged ? "yes" : "no", rebuiltRestored ? "yes" : "no");
+    passed &= rebuiltChanged && rebuiltRestored;
+
+    // A file cut short, like after running out of disk space.
+    std::vector<char> truncated;
+    {
+        MappedFile file;
+        if (file.Open(cacheFilePath))
+            truncated.assign(file.GetData(), file.GetData() + file.GetSize() / 2);
+    }
+    std::ofstream(cacheFilePath.c_str(), std::ios::binary).write(truncated.data(), truncated.size());
+    const bool rebuiltTruncated = !SceneIntersector::LoadOrBuild(*scene, cacheFilePath, &threadPool)->IsLoadedFromCache();
+    LogPrint(rebuiltTruncated ? LogLevel::Success : LogLevel::Failure, "Rebuilt after the file was cut short: %s", rebuiltTruncated ? "yes" : "no");
+    passed &= rebuiltTruncated;
+
+    std::remove(cacheFilePath.c_str());
+    return passed ? 0 : 1;
+}
+
+// Closest hit distance of the camera ray through the center of every pixel, INFINITY for misses. Rays are traced in
+// packets of 8x8 pixels, either one by one or with IntersectPacket.
+static std::vector<float> TraceCameraRays(const SceneIntersector& intersector, const CpuScene::CameraDefinition& camera, uint32_t width, uint32_t height,
+                                          bool usePackets, ThreadPool& threadPool, double& megaRaysPerSecond)
+{
+    const uint32_t packetSize = 8;
+    const uint32_t numPacketsX = (width + packetSize - 1) / packetSize;
+    const uint32_t numPacketsY = (height + packetSize - 1) / packetSize;
+    Float3 cameraU, cameraV, cameraW;
+    camera.ComputeCameraParams(static_cast<float>(width) / height, cameraU, cameraV, cameraW);
+
+    std::vector<float> distances(width * height, INFINITY);
+    auto start = std::chrono::high_resolution_clock::now();
+    threadPool.ParallelFor(0, numPacketsX * numPacketsY, 16, [&](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t packetIndex = begin; packetIndex < end; ++packetIndex)
+        {
+            const uint32_t minX = (packetIndex % numPacketsX) * packetSize;
+            const uint32_t minY = (packetIndex / numPacketsX) * packetSize;
+            const uint32_t maxX = std::min(minX + packetSize, width);
+            const uint32_t maxY = std::min(minY + packetSize, height);
+            RayPacket packet;
+            packet.origin = camera.position;
+            packet.tMin = DefaultRayTMin;
+            packet.tMax = DefaultRayTMax;
+            packet.numRays = 0;
+            for (uint32_t y = minY; y < maxY; ++y)
+            {
+                for (uint32_t x = minX; x < maxX; ++x)
+                {
+                    const float screenCoordX = ((x + 0.5f) / width) * 2.0f - 1.0f;
+                    const float screenCoordY = ((y + 0.5f) / height) * 2.0f - 1.0f;
+                    packet.directions[packet.numRays++] = Normalize(screenCoordX * cameraU + screenCoordY * cameraV + cameraW);
+                }
+            }
+
+            RayHit hits[RayPacket::MaxNumRays];
+            uint64_t hitMask = 0;
+            if (usePackets)
+                hitMask = intersector.IntersectPacket(packet, hits);
+            else
+            {
+                for (uint32_t i = 0; i < packet.numRays; ++i)
+                    hitMask |= intersector.Intersect({ packet.origin, packet.tMin, packet.directions[i], packet.tMax }, hits[i]) ? 1ull << i : 0;
+            }
+
+            uint32_t rayIndex = 0;
+            for (uint32_t y = minY; y < maxY; ++y)
+            {
+                for (uint32_t x = minX; x < maxX; ++x, ++rayIndex)
+                {
+                    if (hitMask & (1ull << rayIndex))
+                        distances[y * width + x] = hits[rayIndex].t;
+                }
+            }
+        }
+    });
+    auto end = std::chrono::high_resolution_clock::now();
+    megaRaysPerSecond = width * height / std::chrono::duration<double>(end - start).count() * 1e-6;
+    return distances;
+}
+
+int RunBvhPacketBenchmark(int argc, char** argv)
+{
+    BvhBenchmarkOptions options;
+    if (!ParseBvhBenchmarkOptions(argc, argv, options))
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless bvh-packets [scene.pbrt] [options]\n\n"
+            "Compares tracing camera rays one by one with tracing them in packets of 8x8 pixels, for both wide layouts. Checks\n"
+            "that packets find the same hits and renders direct lighting and full paths with and without packets. Without a\n"
+            "pbrt file, a generated building is seen from inside and a generated field of spheres from above.\n\n"
+            "Options:\n"
+            "  --triangles <n>   Size of the generated scene if no pbrt file is given (default 1000000)\n"
+            "  --threads <n>     Number of threads to build and trace on (default all hardware threads)\n"
+            "  --repeat <n>      Number of times every measurement is repeated, the best one is reported (default 3)");
+        return 1;
+    }
+    if (!CpuSupportsAvx2())
+    {
+        LogPrint(LogLevel::Failure, "Ray packets need the wide layouts, which need AVX2");
+        return 1;
+    }
+
+    struct BenchmarkScene
+    {
+        const char* name;
+        std::unique_ptr<CpuScene> scene;
+    };
+    std::vector<BenchmarkScene> scenes;
+    if (options.sceneFilePath.empty())
+    {
+        scenes.push_back({ "building", GenerateBuildingScene(options.numGeneratedTriangles) });
+        scenes.push_back({ "spheres", GenerateSphereScene(options.numGeneratedTriangles) });
+        for (BenchmarkScene& benchmarkScene : scenes)
+            PrepareGeneratedSceneForRendering(*benchmarkScene.scene);
+    }
+    else
+    {
+        scenes.push_back({ "scene", CpuScene::LoadPbrtScene(options.sceneFilePath) });
+        if (!scenes.back().scene || scenes.back().scene->cameras.empty())
+            return 1;
+    }
+
+    struct Layout
+    {
+        const char* name;
+        BvhLayout layout;
+    };
+    const Layout layouts[] =
+    {
+        { "wide", BvhLayout::Wide },
+        { "quantized", BvhLayout::WideQuantized },
+    };
+    ThreadPool threadPool(options.maxThreads);
+    const uint32_t width = 1280;
+    const uint32_t height = 720;
+    bool passed = true;
+    LogPrint(LogLevel::Info, "%u x %u camera rays through pixel centers, %u threads", width, height, threadPool.GetNumThreads());
+    for (const BenchmarkScene& benchmarkScene : scenes)
+    {
+        const CpuScene& scene = *benchmarkScene.scene;
+        for (const Layout& layout : layouts)
+        {
+            const SceneIntersector intersector(scene, &threadPool, BvhBuilder::BinnedSah, layout.layout);
+            double bestMegaRaysPerSecond[2] = { 0.0, 0.0 };
+            std::vector<float> distances[2];
+            for (uint32_t repetition = 0; repetition < options.numRepetitions; ++repetition)
+            {
+                for (int usePackets = 0; usePackets < 2; ++usePackets)
+                {
+                    double megaRaysPerSecond;
+                    distances[usePackets] = TraceCameraRays(intersector, scene.cameras[0], width, height, usePackets != 0, threadPool, megaRaysPerSecond);
+                    bestMegaRaysPerSecond[usePackets] = std::max(bestMegaRaysPerSecond[usePackets], megaRaysPerSecond);
+                }
+            }
+
+            // Same triangles are tested in the same way, only the order in which hits at equal distances are found may differ.
+            uint32_t numMissed = 0, numCloser = 0, numHits = 0;
+            for (size_t i = 0; i < distances[0].size(); ++i)
+            {
+                numHits += distances[0][i] < INFINITY ? 1 : 0;
+                numMissed += distances[1][i] > distances[0][i] ? 1 : 0;
+                numCloser += distances[1][i] < distances[0][i] ? 1 : 0;
+            }
+            const bool sameHits = numMissed == 0 && numCloser == 0;
+            passed &= sameHits;
+            LogPrint(sameHits ? LogLevel::Info : LogLevel::Failure, "%-8s %-9s  single rays %7.2f MRays/s  packets %7.2f MRays/s  (%.2fx)  %u hits, %u missed, %u closer",
+                benchmarkScene.name, layout.name, bestMegaRaysPerSecond[0], bestMegaRaysPerSecond[1], bestMegaRaysPerSecond[1] / bestMegaRaysPerSecond[0],
+                numHits, numMissed, numCloser);
+        }
+
+        // Rays per second of whole frames, including shading and shadow rays that are still traced one by one.
+        CpuPathTracer::Settings settings;
+        settings.numThreads = options.maxThreads;
+        settings.bvhLayout = BvhLayout::Wide;
+        const uint32_t bounceCounts[] = { 1, settings.numBounces };
+        for (uint32_t numBounces : bounceCounts)
+        {
+            settings.numBounces = numBounces;
+            double bestMegaRaysPerSecond[2] = { 0.0, 0.0 };
+            std::vector<float> images[2];
+            for (int usePackets = 0; usePackets < 2; ++usePackets)
+            {
+                settings.primaryRayPackets = usePackets != 0;
+                CpuPathTracer pathTracer(scene, settings);
+                pathTracer.ResizeOutput(width, height);
+                pathTracer.SetCamera(scene.cameras[0]);
+                for (uint32_t repetition = 0; repetition < options.numRepetitions; ++repetition)
+                {
+                    pathTracer.RestartSampling();
+                    auto start = std::chrono::high_resolution_clock::now();
+                    pathTracer.DrawIterations(1);
+                    auto end = std::chrono::high_resolution_clock::now();
+                    bestMegaRaysPerSecond[usePackets] = std::max(bestMegaRaysPerSecond[usePackets],
+                        pathTracer.GetNumRaysTraced() / std::chrono::duration<double>(end - start).count() * 1e-6);
+                }
+                images[usePackets] = pathTracer.GetOutput();
+            }
+
+            uint32_t numDifferentPixels = 0;
+            for (size_t i = 0; i < images[0].size(); i += 4)
+                numDifferentPixels += memcmp(&images[0][i], &images[1][i], sizeof(float) * 3) != 0 ? 1 : 0;
+            LogPrint(LogLevel::Info, "%-8s render %u %-7s  single rays %7.2f MRays/s  packets %7.2f MRays/s  (%.2fx)  %u of %u pixels differ",
+                benchmarkScene.name, numBounces, numBounces == 1 ? "bounce" : "bounces", bestMegaRaysPerSecond[0], bestMegaRaysPerSecond[1],
+                bestMegaRaysPerSecond[1] / bestMegaRaysPerSecond[0], numDifferentPixels, width * height);
+        }
+    }
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+// Entry points of the subcommands, argv[0] is the name of the command.
+int RunRngTest(int argc, char** argv);
+int RunRngBenchmark(int argc, char** argv);
+int RunHaltonTest(int argc, char** argv);
+int RunSobolTest(int argc, char** argv);
+int RunRender(int argc, char** argv);
+int RunWavefrontBenchmark(int argc, char** argv);
+int RunShadingBenchmark(int argc, char** argv);
+int RunSchedulerBenchmark(int argc, char** argv);
+int RunNumaBenchmark(int argc, char** argv);
+int RunBvhBuildBenchmark(int argc, char** argv);
+int RunBvhTraceBenchmark(int argc, char** argv);
+int RunBvhSpatialSplitBenchmark(int argc, char** argv);
+int RunBvhQuantizationTest(int argc, char** argv);
+int RunBvhInstanceBenchmark(int argc, char** argv);
+int RunBvhLazyBenchmark(int argc, char** argv);
+int RunBvhCacheBenchmark(int argc, char** argv);
+int RunBvhPacketBenchmark(int argc, char** argv);
+int RunTriangleTest(int argc, char** argv);
+int RunBrdfTest(int argc, char** argv);
+int RunJobTest(int argc, char** argv);
+int RunMemoryBenchmark(int argc, char** argv);
+int RunMeshMergeTest(int argc, char** argv);
+int RunPbrtParseBenchmark(int argc, char** argv);
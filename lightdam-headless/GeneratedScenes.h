@@ -0,0 +1,12 @@
+#pragma once
+
+#include "../lightdam/cpu/CpuScene.h"
+
+#include <memory>
+
+// Scenes generated by the benchmark commands, defined in BvhCommands.cpp.
+
+// Grid of rooms with furniture, seen from a room in the middle. Without doors, no ray leaves the camera's room.
+std::unique_ptr<CpuScene> GenerateBuildingScene(uint32_t numTriangles, bool doors = true);
+// Adds a material and vertex normals to a generated scene.
+void PrepareGeneratedSceneForRendering(CpuScene& scene);
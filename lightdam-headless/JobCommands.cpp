@@ -0,0 +1,312 @@
+#include "Commands.h"
+#include "../lightdam/ThreadPool.h"
+#include "../lightdam/ErrorHandling.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static bool CheckParallelFor(ThreadPool& threadPool)
+{
+    const uint32_t count = 10007;
+    for (uint32_t grainSize : { 0u, 1u, 7u, 100000u })
+    {
+        std::vector<std::atomic<uint32_t>> visits(count);
+        for (auto& numVisits : visits)
+            numVisits = 0;
+        threadPool.ParallelFor(3, count, grainSize, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; ++i)
+                ++visits[i];
+        });
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (visits[i] != (i >= 3 ? 1u : 0u))
+            {
+                LogPrint(LogLevel::Failure, "ParallelFor with grain size %u visited element %u %u times", grainSize, i, (unsigned int)visits[i]);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Binary tree of tasks, every task spawns two children until the depth is reached.
+static void SpawnTaskTree(ThreadPool::TaskGroup& group, uint32_t depth, std::atomic<uint32_t>& numTasks)
+{
+    ++numTasks;
+    if (depth == 0)
+        return;
+    group.Run([&group, depth, &numTasks] { SpawnTaskTree(group, depth - 1, numTasks); });
+    group.Run([&group, depth, &numTasks] { SpawnTaskTree(group, depth - 1, numTasks); });
+}
+
+static bool CheckNestedTasks(ThreadPool& threadPool)
+{
+    const uint32_t depth = 14;
+    std::atomic<uint32_t> numTasks(0);
+    {
+        ThreadPool::TaskGroup group(threadPool);
+        SpawnTaskTree(group, depth, numTasks);
+        group.Wait();
+    }
+    const uint32_t expectedNumTasks = (1u << (depth + 1)) - 1;
+    if (numTasks != expectedNumTasks)
+    {
+        LogPrint(LogLevel::Failure, "Task tree ran %u of %u tasks", (unsigned int)numTasks, expectedNumTasks);
+        return false;
+    }
+    return true;
+}
+
+static bool CheckJobDependencies(ThreadPool& threadPool)
+{
+    // Chain: every job appends its index, the order needs to be kept.
+    const uint32_t chainLength = 1000;
+    std::vector<uint32_t> order;
+    ThreadPool::JobHandle previous;
+    for (uint32_t i = 0; i < chainLength; ++i)
+        previous = threadPool.Schedule([&order, i] { order.push_back(i); }, nullptr, previous ? std::vector<ThreadPool::JobHandle>{ previous } : std::vector<ThreadPool::JobHandle>());
+    threadPool.Wait(previous);
+    for (uint32_t i = 0; i < chainLength; ++i)
+    {
+        if (order.size() != chainLength || order[i] != i)
+        {
+            LogPrint(LogLevel::Failure, "Job chain ran out of order");
+            return false;
+        }
+    }
+
+    // Diamonds: the last job sees both middle jobs done, which both see the first one done.
+    for (int diamond = 0; diamond < 1000; ++diamond)
+    {
+        std::atomic<uint32_t> state(0);
+        std::atomic<bool> failed(false);
+        auto top = threadPool.Schedule([&] { state |= 1; });
+        auto left = threadPool.Schedule([&] { failed = failed || (state & 1) == 0; state |= 2; }, nullptr, { top });
+        auto right = threadPool.Schedule([&] { failed = failed || (state & 1) == 0; state |= 4; }, nullptr, { top });
+        // Depending on a job that is already done is fine.
+        threadPool.Wait(top);
+        auto bottom = threadPool.Schedule([&] { failed = failed || state != 7; }, nullptr, { left, right, top });
+        threadPool.Wait(bottom);
+        if (failed || !left->IsDone() || !right->IsDone())
+        {
+            LogPrint(LogLevel::Failure, "Job ran before its dependencies were done");
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool CheckMainThreadCallbacks(ThreadPool& threadPool)
+{
+    const uint32_t numJobs = 100;
+    const std::thread::id mainThreadId = std::this_thread::get_id();
+    std::atomic<uint32_t> numCallbacks(0);
+    std::atomic<uint32_t> numCallbacksOnOtherThreads(0);
+    std::vector<ThreadPool::JobHandle> jobs;
+    for (uint32_t i = 0; i < numJobs; ++i)
+    {
+        jobs.push_back(threadPool.Schedule([&]
+        {
+            threadPool.RunOnMainThread([&]
+            {
+                ++numCallbacks;
+                if (std::this_thread::get_id() != mainThreadId)
+                    ++numCallbacksOnOtherThreads;
+            });
+        }));
+    }
+    auto all = threadPool.Schedule([] {}, nullptr, jobs);
+    threadPool.Wait(all);
+    if (numCallbacks != 0)
+    {
+        LogPrint(LogLevel::Failure, "Main thread callbacks ran before ExecuteMainThreadCallbacks");
+        return false;
+    }
+    const uint32_t numExecuted = threadPool.ExecuteMainThreadCallbacks();
+    if (numExecuted != numJobs || numCallbacks != numJobs || numCallbacksOnOtherThreads != 0)
+    {
+        LogPrint(LogLevel::Failure, "%u of %u main thread callbacks ran, %u on other threads", (unsigned int)numCallbacks, numJobs, (unsigned int)numCallbacksOnOtherThreads);
+        return false;
+    }
+    return true;
+}
+
+static bool CheckTimingHook(ThreadPool& threadPool)
+{
+    std::atomic<uint32_t> numNamedTasks(0);
+    std::atomic<uint32_t> numTasks(0);
+    threadPool.SetTaskTimingHook([&](const char* name, double queuedSeconds, double runSeconds)
+    {
+        ++numTasks;
+        if (name && strcmp(name, "timed") == 0 && queuedSeconds >= 0.0 && runSeconds >= 0.0)
+            ++numNamedTasks;
+    });
+    {
+        ThreadPool::TaskGroup group(threadPool);
+        for (int i = 0; i < 100; ++i)
+            group.Run([] {}, "timed");
+    }
+    threadPool.SetTaskTimingHook(nullptr);
+    if (numNamedTasks != 100 || numTasks != 100)
+    {
+        LogPrint(LogLevel::Failure, "Timing hook saw %u tasks, %u of them with their name", (unsigned int)numTasks, (unsigned int)numNamedTasks);
+        return false;
+    }
+    return true;
+}
+
+template<typename Function>
+static double MeasureSeconds(const Function& function)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    function();
+    return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+static void RunJobBenchmark(ThreadPool& threadPool, uint32_t numJobs)
+{
+    std::atomic<uint32_t> sum(0);
+    auto report = [&](const char* name, double seconds)
+    {
+        LogPrint(LogLevel::Info, "%-28s %8.2f MJobs/s  %7.1f ns/job", name, numJobs / seconds * 1e-6, seconds / numJobs * 1e9);
+    };
+
+    report("task group, from main", MeasureSeconds([&]
+    {
+        ThreadPool::TaskGroup group(threadPool);
+        for (uint32_t i = 0; i < numJobs; ++i)
+            group.Run([&sum] { ++sum; });
+        group.Wait();
+    }));
+
+    // Tasks spawned by tasks go to the queues of the workers.
+    const uint32_t numSpawners = threadPool.GetNumThreads() * 4;
+    report("task group, from tasks", MeasureSeconds([&]
+    {
+        ThreadPool::TaskGroup group(threadPool);
+        for (uint32_t spawner = 0; spawner < numSpawners; ++spawner)
+        {
+            group.Run([&group, &sum, spawner, numSpawners, numJobs]
+            {
+                for (uint32_t i = spawner; i < numJobs; i += numSpawners)
+                    group.Run([&sum] { ++sum; });
+            });
+        }
+        group.Wait();
+    }));
+
+    report("parallel for, grain 1", MeasureSeconds([&]
+    {
+        threadPool.ParallelFor(0, numJobs, 1, [&sum](uint32_t begin, uint32_t end) { sum += end - begin; });
+    }));
+
+    report("jobs, no dependencies", MeasureSeconds([&]
+    {
+        std::vector<ThreadPool::JobHandle> jobs;
+        jobs.reserve(numJobs);
+        for (uint32_t i = 0; i < numJobs; ++i)
+            jobs.push_back(threadPool.Schedule([&sum] { ++sum; }));
+        threadPool.Wait(threadPool.Schedule([] {}, nullptr, jobs));
+    }));
+
+    const uint32_t chainLength = std::min(numJobs, 100000u);
+    const double chainSeconds = MeasureSeconds([&]
+    {
+        ThreadPool::JobHandle previous = threadPool.Schedule([&sum] { ++sum; });
+        for (uint32_t i = 1; i < chainLength; ++i)
+            previous = threadPool.Schedule([&sum] { ++sum; }, nullptr, { previous });
+        threadPool.Wait(previous);
+    });
+    LogPrint(LogLevel::Info, "%-28s %8.2f MJobs/s  %7.1f ns/job", "jobs, chained", chainLength / chainSeconds * 1e-6, chainSeconds / chainLength * 1e9);
+
+    // Round trip of a single job to an idle pool and back, the waiting thread takes it if no worker is faster.
+    const uint32_t numRoundTrips = 10000;
+    std::vector<double> latencies(numRoundTrips);
+    for (uint32_t i = 0; i < numRoundTrips; ++i)
+        latencies[i] = MeasureSeconds([&] { threadPool.Wait(threadPool.Schedule([&sum] { ++sum; })); });
+    std::sort(latencies.begin(), latencies.end());
+    LogPrint(LogLevel::Info, "%-28s median %.2f us, 99th percentile %.2f us", "single job round trip", latencies[numRoundTrips / 2] * 1e6, latencies[numRoundTrips * 99 / 100] * 1e6);
+
+    // Time from queuing to start, seen by the timing hook.
+    std::mutex queuedMutex;
+    std::vector<double> queuedSeconds;
+    queuedSeconds.reserve(numJobs);
+    threadPool.SetTaskTimingHook([&](const char*, double queued, double)
+    {
+        std::lock_guard<std::mutex> lock(queuedMutex);
+        queuedSeconds.push_back(queued);
+    });
+    const double timedSeconds = MeasureSeconds([&]
+    {
+        ThreadPool::TaskGroup group(threadPool);
+        for (uint32_t i = 0; i < numJobs; ++i)
+            group.Run([&sum] { ++sum; });
+        group.Wait();
+    });
+    threadPool.SetTaskTimingHook(nullptr);
+    std::sort(queuedSeconds.begin(), queuedSeconds.end());
+    report("task group, timed", timedSeconds);
+    LogPrint(LogLevel::Info, "%-28s median %.2f us, 99th percentile %.2f us", "queued time of timed tasks",
+        queuedSeconds[queuedSeconds.size() / 2] * 1e6, queuedSeconds[queuedSeconds.size() * 99 / 100] * 1e6);
+}
+
+int RunJobTest(int argc, char** argv)
+{
+    uint32_t numThreads = 0;
+    uint32_t numJobs = 1000000;
+    bool validArguments = true;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            numThreads = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+            numJobs = strtoul(argv[++i], nullptr, 10);
+        else
+            validArguments = false;
+    }
+    if (!validArguments || numJobs == 0)
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless job-test [options]\n\n"
+            "Checks parallel for, nested tasks, job dependencies, main thread callbacks and timing hooks of the thread pool\n"
+            "and measures the scheduling overhead of empty jobs.\n\n"
+            "Options:\n"
+            "  --threads <n>     Number of threads including the main thread (default all hardware threads)\n"
+            "  --jobs <n>        Number of jobs per measurement (default 1000000)");
+        return 1;
+    }
+
+    ThreadPool threadPool(numThreads);
+    LogPrint(LogLevel::Info, "%u threads", threadPool.GetNumThreads());
+
+    struct Check
+    {
+        const char* name;
+        bool (*run)(ThreadPool&);
+    };
+    const Check checks[] =
+    {
+        { "parallel for", CheckParallelFor },
+        { "nested tasks", CheckNestedTasks },
+        { "job dependencies", CheckJobDependencies },
+        { "main thread callbacks", CheckMainThreadCallbacks },
+        { "timing hook", CheckTimingHook },
+    };
+    bool passed = true;
+    for (const Check& check : checks)
+    {
+        const bool checkPassed = check.run(threadPool);
+        LogPrint(checkPassed ? LogLevel::Success : LogLevel::Failure, "%-28s %s", check.name, checkPassed ? "passed" : "FAILED");
+        passed = passed && checkPassed;
+    }
+
+    RunJobBenchmark(threadPool, numJobs);
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,615 @@
+#include "Commands.h"
+#include "GeneratedScenes.h"
+#include "../lightdam/cpu/CpuPathTracer.h"
+#include "../lightdam/ErrorHandling.h"
+#include "../external/stb/stb_image_write.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct RenderOptions
+{
+    std::string sceneFilePath;
+    uint32_t numGeneratedTriangles = 0;     // Renders a generated building instead of the scene file if not 0.
+    std::string outputFilePath = "render.pfm";
+    uint32_t samplesPerPixel = 64;
+    uint32_t width = 0;     // 0 uses the scene's resolution.
+    uint32_t height = 0;
+    uint32_t cameraIndex = 0;
+    CpuScene::ImportSettings importSettings;
+    CpuPathTracer::Settings settings;
+};
+
+static bool ParseRenderOptions(int argc, char** argv, RenderOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* option = argv[i];
+        if (option[0] != '-')
+        {
+            options.sceneFilePath = option;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+            return false;
+        const char* value = argv[++i];
+        if (strcmp(option, "--triangles") == 0)
+            options.numGeneratedTriangles = strtoul(value, nullptr, 10);
+        else if (strcmp(option, "--merge-small-meshes") == 0)
+            options.importSettings.smallMeshTriangles = strtoul(value, nullptr, 10);
+        else if (strcmp(option, "--spp") == 0)
+            options.samplesPerPixel = strtoul(value, nullptr, 10);
+        else if (strcmp(option, "--width") == 0)
+            options.width = strtoul(value, nullptr, 10);
+        else if (strcmp(option, "--height") == 0)
+            options.height = strtoul(value, nullptr, 10);
+        else if (strcmp(option, "--camera") == 0)
+            options.cameraIndex = strtoul(value, nullptr, 10);
+        else if (strcmp(option, "--threads") == 0)
+            options.settings.numThreads = strtoul(value, nullptr, 10);
+        else if (strcmp(option, "--bounces") == 0)
+            options.settings.numBounces = strtoul(value, nullptr, 10);
+        else if (strcmp(option, "--seed") == 0)
+            options.settings.seed = strtoull(value, nullptr, 10);
+        else if (strcmp(option, "--russian-roulette") == 0)
+            options.settings.russianRoulette = strtoul(value, nullptr, 10) != 0;
+        else if (strcmp(option, "--path-length-filter") == 0)
+        {
+            options.settings.enablePathLengthFilter = true;
+            options.settings.pathLengthFilterMax = strtof(value, nullptr);
+        }
+        else if (strcmp(option, "--bvh") == 0)
+        {
+            if (strcmp(value, "linear") == 0)
+                options.settings.bvhBuilder = BvhBuilder::Linear;
+            else if (strcmp(value, "ploc") == 0)
+                options.settings.bvhBuilder = BvhBuilder::Ploc;
+            else if (strcmp(value, "sah") == 0)
+                options.settings.bvhBuilder = BvhBuilder::BinnedSah;
+            else if (strcmp(value, "sbvh") == 0)
+                options.settings.bvhBuilder = BvhBuilder::SpatialSplits;
+            else
+                return false;
+        }
+        else if (strcmp(option, "--bvh-layout") == 0)
+        {
+            if (strcmp(value, "binary") == 0)
+                options.settings.bvhLayout = BvhLayout::Binary;
+            else if (strcmp(value, "wide") == 0)
+                options.settings.bvhLayout = BvhLayout::Wide;
+            else if (strcmp(value, "quantized") == 0)
+                options.settings.bvhLayout = BvhLayout::WideQuantized;
+            else
+                return false;
+        }
+        else if (strcmp(option, "--lazy-bvh") == 0)
+            options.settings.lazyBvh = strtoul(value, nullptr, 10) != 0;
+        else if (strcmp(option, "--bvh-cache") == 0)
+            options.settings.bvhCache = strtoul(value, nullptr, 10) != 0;
+        else if (strcmp(option, "--packets") == 0)
+            options.settings.primaryRayPackets = strtoul(value, nullptr, 10) != 0;
+        else if (strcmp(option, "--wavefront") == 0)
+            options.settings.wavefront = strtoul(value, nullptr, 10) != 0;
+        else if (strcmp(option, "--work-stealing") == 0)
+            options.settings.workStealing = strtoul(value, nullptr, 10) != 0;
+        else if (strcmp(option, "--specialized-shading") == 0)
+            options.settings.specializedShading = strtoul(value, nullptr, 10) != 0;
+        else if (strcmp(option, "--wide-shading") == 0)
+            options.settings.wideShading = strtoul(value, nullptr, 10) != 0;
+        else if (strcmp(option, "--numa") == 0)
+            options.settings.numaAware = strtoul(value, nullptr, 10) != 0;
+        else if (strcmp(option, "--emulate-numa-nodes") == 0)
+            options.settings.emulatedNumaNodes = strtoul(value, nullptr, 10);
+        else if (strcmp(option, "--output") == 0)
+            options.outputFilePath = value;
+        else
+            return false;
+    }
+
+    return (!options.sceneFilePath.empty() || options.numGeneratedTriangles > 0) && options.samplesPerPixel > 0 &&
+           options.settings.numBounces > 0 && options.settings.numBounces <= CpuPathTracer::MaxNumBounces;
+}
+
+// Loads the scene file or generates a building, null if that failed or the camera does not exist.
+static std::unique_ptr<CpuScene> LoadSceneForRendering(const RenderOptions& options)
+{
+    std::unique_ptr<CpuScene> scene;
+    if (options.numGeneratedTriangles > 0)
+    {
+        scene = GenerateBuildingScene(options.numGeneratedTriangles);
+        PrepareGeneratedSceneForRendering(*scene);
+    }
+    else
+    {
+        scene = CpuScene::LoadPbrtScene(options.sceneFilePath, nullptr, options.importSettings);
+        if (!scene)
+            return nullptr;
+    }
+    if (options.cameraIndex >= scene->cameras.size())
+    {
+        LogPrint(LogLevel::Failure, "Scene has only %u cameras", (unsigned int)scene->cameras.size());
+        return nullptr;
+    }
+    return scene;
+}
+
+static bool HasExtension(const std::string& filePath, const char* extension)
+{
+    const size_t length = strlen(extension);
+    return filePath.size() >= length && filePath.compare(filePath.size() - length, length, extension) == 0;
+}
+
+// Portable float map, rows are stored bottom to top.
+static bool WritePfm(const std::string& filePath, const std::vector<float>& accumulation, uint32_t width, uint32_t height)
+{
+    std::ofstream file(filePath, std::ios::binary);
+    if (!file)
+        return false;
+    file << "PF\n" << width << " " << height << "\n-1.0\n"; // Negative scale means little endian.
+
+    std::vector<float> row(width * 3);
+    for (uint32_t y = height; y-- > 0;)
+    {
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            const float* rgba = &accumulation[(y * width + x) * 4];
+            for (int c = 0; c < 3; ++c)
+                row[x * 3 + c] = rgba[c] / rgba[3];
+        }
+        file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+    }
+    return file.good();
+}
+
+// Same conversion as FrameCapture::CaptureCurrentFrame's bmp output.
+static bool WriteBmp(const std::string& filePath, const std::vector<float>& accumulation, uint32_t width, uint32_t height)
+{
+    std::vector<uint8_t> bmpData(width * height * 3);
+    for (uint32_t i = 0; i < width * height; ++i)
+    {
+        const float* rgba = &accumulation[i * 4];
+        for (int c = 0; c < 3; ++c)
+            bmpData[i * 3 + c] = (uint8_t)std::min(powf(rgba[c] / rgba[3], 1.0f / 2.2f) * 255, 255.0f);
+    }
+    return stbi_write_bmp(filePath.c_str(), (int)width, (int)height, 3, bmpData.data()) != 0;
+}
+
+int RunRender(int argc, char** argv)
+{
+    RenderOptions options;
+    if (!ParseRenderOptions(argc, argv, options))
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless render <scene.pbrt> [options]\n\n"
+            "Options:\n"
+            "  --triangles <n>            Renders a generated building with about n triangles instead of a scene file\n"
+            "  --merge-small-meshes <n>   Merges meshes with fewer than n triangles by material and light on import (default 0, off)\n"
+            "  --spp <n>                  Samples per pixel (default 64)\n"
+            "  --width <n>                Output width (default from scene)\n"
+            "  --height <n>               Output height (default from scene)\n"
+            "  --camera <n>               Index of the scene camera (default 0)\n"
+            "  --bounces <n>              Maximum number of bounces, 1 is direct lighting only (default 8)\n"
+            "  --path-length-filter <x>   Discards light paths longer than x\n"
+            "  --russian-roulette <0|1>   Enables russian roulette (default 0)\n"
+            "  --threads <n>              Number of worker threads (default all hardware threads)\n"
+            "  --seed <n>                 Random seed (default 0)");
+        // LogPrint formats into a fixed size buffer.
+        LogPrint(LogLevel::Info,
+            "  --bvh <builder>            linear, ploc, sah or sbvh, trades build time for trace performance (default sah)\n"
+            "  --bvh-layout <layout>      binary, wide or quantized, wide layouts need AVX2 (default wide). quantized saves\n"
+            "                             node memory but traces shadow rays about 30% slower\n"
+            "  --lazy-bvh <0|1>           Builds parts of the BVH only once rays reach them, always with sah (default 0)\n"
+            "  --bvh-cache <0|1>          Maps the BVH from a .bvh file next to the scene, written on first use (default 0)\n"
+            "  --packets <0|1>            Traces camera rays in packets of 8x8 pixels with the wide layouts (default 1)\n"
+            "  --wavefront <0|1>          Traces waves of paths stage by stage with hits sorted by material (default 0)");
+        LogPrint(LogLevel::Info,
+            "  --work-stealing <0|1>      Threads take tiles along a Hilbert curve and steal from each other (default 1)\n"
+            "  --specialized-shading <0|1> Wavefront only: shades hits with kernels compiled per material type (default 1)\n"
+            "  --wide-shading <0|1>       With specialized shading: evaluates the BRDFs of 8 hits at once (default 1)\n"
+            "  --numa <0|1>               Pins threads to NUMA nodes, each with its own copy of BVH and textures (default 1)\n"
+            "  --emulate-numa-nodes <n>   Splits the processors into n nodes instead of detecting them (default 0)\n"
+            "  --output <file>            .pfm (linear) or .bmp (gamma 2.2) output (default render.pfm)");
+        return 1;
+    }
+
+    auto scene = LoadSceneForRendering(options);
+    if (!scene)
+        return 1;
+
+    auto buildStart = std::chrono::high_resolution_clock::now();
+    CpuPathTracer pathTracer(*scene, options.settings);
+    auto buildEnd = std::chrono::high_resolution_clock::now();
+    const SceneIntersector* intersector = pathTracer.GetIntersector();
+    const LazySceneIntersector* lazyIntersector = pathTracer.GetLazyIntersector();
+    if (lazyIntersector)
+    {
+        LogPrint(LogLevel::Info, "Built top of the lazy BVH over %u triangles in %.1f ms (%u subtrees)",
+            lazyIntersector->GetNumTriangles(), std::chrono::duration<double, std::milli>(buildEnd - buildStart).count(), lazyIntersector->GetNumSubtrees());
+    }
+    else if (intersector->IsLoadedFromCache())
+    {
+        LogPrint(LogLevel::Info, "Mapped BVH over %u triangles from the cache file in %.1f ms (%.1f MB nodes, %.1f MB triangles)",
+            intersector->GetNumTriangles(), std::chrono::duration<double, std::milli>(buildEnd - buildStart).count(),
+            intersector->GetNodeMemorySize() / (1024.0 * 1024.0), intersector->GetTriangleMemorySize() / (1024.0 * 1024.0));
+    }
+    else
+    {
+        LogPrint(LogLevel::Info, "Built BVH over %u triangles in %.1f ms (%u nodes, depth %u)",
+            intersector->GetNumTriangles(), std::chrono::duration<double, std::milli>(buildEnd - buildStart).count(),
+            intersector->GetNumBinaryNodes(), intersector->GetBinaryDepth());
+        const Bvh8& bvh8 = intersector->GetBvh8();
+        const QuantizedBvh8& quantizedBvh8 = intersector->GetQuantizedBvh8();
+        if (!bvh8.nodes.empty())
+            LogPrint(LogLevel::Info, "Collapsed to 8 wide BVH for AVX2 traversal (%u nodes, depth %u)", (unsigned int)bvh8.nodes.size(), bvh8.ComputeDepth());
+        if (!quantizedBvh8.nodes.empty())
+            LogPrint(LogLevel::Info, "Collapsed to quantized 8 wide BVH for AVX2 traversal (%u nodes, %.1f MB)",
+                (unsigned int)quantizedBvh8.nodes.size(), intersector->GetNodeMemorySize() / (1024.0 * 1024.0));
+        LogPrint(LogLevel::Info, "BVH and triangles take %.1f MB", intersector->GetMemorySize() / (1024.0 * 1024.0));
+    }
+
+    const uint32_t width = options.width ? options.width : pathTracer.GetOutputWidth();
+    const uint32_t height = options.height ? options.height : pathTracer.GetOutputHeight();
+    pathTracer.ResizeOutput(width, height);
+    pathTracer.SetCamera(scene->cameras[options.cameraIndex]);
+
+    // Render in batches to report progress, a batch spans enough iterations for the threads to stay busy.
+    const uint32_t batchSize = 8;
+    auto renderStart = std::chrono::high_resolution_clock::now();
+    while (pathTracer.GetIterationNumber() < options.samplesPerPixel)
+    {
+        pathTracer.DrawIterations(std::min(batchSize, options.samplesPerPixel - pathTracer.GetIterationNumber()));
+        const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - renderStart).count();
+        LogPrint(LogLevel::Info, "%u/%u spp, %.1f s, %.2f MRays/s", pathTracer.GetIterationNumber(), options.samplesPerPixel,
+            seconds, pathTracer.GetNumRaysTraced() / seconds * 1e-6);
+    }
+
+    if (lazyIntersector)
+    {
+        LogPrint(LogLevel::Info, "Lazy BVH built %u of %u subtrees with %.1f%% of the triangles, %.1f ms summed over all threads",
+            lazyIntersector->GetNumBuiltSubtrees(), lazyIntersector->GetNumSubtrees(),
+            lazyIntersector->GetNumBuiltTriangles() * 100.0 / std::max(1u, lazyIntersector->GetNumTriangles()), lazyIntersector->GetSubtreeBuildSeconds() * 1e3);
+    }
+
+    const bool written = HasExtension(options.outputFilePath, ".bmp") ?
+        WriteBmp(options.outputFilePath, pathTracer.GetOutput(), width, height) :
+        WritePfm(options.outputFilePath, pathTracer.GetOutput(), width, height);
+    if (!written)
+    {
+        LogPrint(LogLevel::Failure, "Failed to write %s", options.outputFilePath.c_str());
+        return 1;
+    }
+    LogPrint(LogLevel::Success, "Wrote %s", options.outputFilePath.c_str());
+    return 0;
+}
+
+// Renders options.samplesPerPixel iterations in the same batches as render, returns the time it took.
+static double RenderForBenchmark(const CpuScene& scene, const RenderOptions& options, std::vector<float>& image, uint32_t& width, uint32_t& height, uint64_t& numRays,
+                                 CpuPathTracer::SchedulingStats* schedulingStats = nullptr)
+{
+    CpuPathTracer pathTracer(scene, options.settings);
+    width = options.width ? options.width : pathTracer.GetOutputWidth();
+    height = options.height ? options.height : pathTracer.GetOutputHeight();
+    pathTracer.ResizeOutput(width, height);
+    pathTracer.SetCamera(scene.cameras[options.cameraIndex]);
+
+    const uint32_t batchSize = 8;
+    auto renderStart = std::chrono::high_resolution_clock::now();
+    while (pathTracer.GetIterationNumber() < options.samplesPerPixel)
+        pathTracer.DrawIterations(std::min(batchSize, options.samplesPerPixel - pathTracer.GetIterationNumber()));
+    const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - renderStart).count();
+
+    image = pathTracer.GetOutput();
+    numRays = pathTracer.GetNumRaysTraced();
+    if (schedulingStats)
+        *schedulingStats = pathTracer.GetSchedulingStats();
+    return seconds;
+}
+
+static uint32_t CountDifferentPixels(const std::vector<float>& imageA, const std::vector<float>& imageB)
+{
+    uint32_t numDifferentPixels = 0;
+    for (size_t i = 0; i < imageA.size(); i += 4)
+        numDifferentPixels += memcmp(&imageA[i], &imageB[i], sizeof(float) * 4) != 0 ? 1 : 0;
+    return numDifferentPixels;
+}
+
+// Root mean square of the difference relative to that of imageB, for images that only match up to rounding.
+static double ComputeRelativeDifference(const std::vector<float>& imageA, const std::vector<float>& imageB)
+{
+    double differenceSq = 0.0;
+    double referenceSq = 0.0;
+    for (size_t i = 0; i < imageA.size(); ++i)
+    {
+        differenceSq += (static_cast<double>(imageA[i]) - imageB[i]) * (static_cast<double>(imageA[i]) - imageB[i]);
+        referenceSq += static_cast<double>(imageB[i]) * imageB[i];
+    }
+    return referenceSq > 0.0 ? sqrt(differenceSq / referenceSq) : 0.0;
+}
+
+// Wide shading follows the scalar BRDF functions up to rounding, paths only rarely take a different turn because of it.
+static const double MaxWideShadingDifference = 1e-3;
+
+int RunWavefrontBenchmark(int argc, char** argv)
+{
+    RenderOptions options;
+    options.samplesPerPixel = 8;
+    if (!ParseRenderOptions(argc, argv, options))
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless wavefront-benchmark <scene.pbrt> [render options]\n\n"
+            "Renders the scene once path by path and in waves of paths, once with scalar and once with 8 wide shading, with\n"
+            "the same options as render and 8 samples per pixel by default. Reports the throughput of all three and checks\n"
+            "that the image of scalar shading is the same and that of wide shading differs only by rounding.");
+        return 1;
+    }
+
+    auto scene = LoadSceneForRendering(options);
+    if (!scene)
+        return 1;
+
+    const char* names[] = { "path", "wavefront", "wide" };
+    std::vector<float> images[3];
+    double megaRaysPerSecond[3];
+    for (int mode = 0; mode < 3; ++mode)
+    {
+        options.settings.wavefront = mode != 0;
+        options.settings.wideShading = mode == 2;
+        uint32_t width, height;
+        uint64_t numRays;
+        const double seconds = RenderForBenchmark(*scene, options, images[mode], width, height, numRays);
+        megaRaysPerSecond[mode] = numRays / seconds * 1e-6;
+        LogPrint(LogLevel::Info, "%-10s %u x %u, %u spp in %6.2f s  %7.2f MRays/s  %7.2f MSamples/s", names[mode], width, height,
+            options.samplesPerPixel, seconds, megaRaysPerSecond[mode], static_cast<double>(width) * height * options.samplesPerPixel / seconds * 1e-6);
+    }
+
+    // Paths take the same random numbers and sum up their radiance in the same order either way.
+    const uint32_t numDifferentPixels = CountDifferentPixels(images[0], images[1]);
+    LogPrint(numDifferentPixels == 0 ? LogLevel::Success : LogLevel::Failure, "Wavefront is %.2fx as fast, %u of %u pixels differ",
+        megaRaysPerSecond[1] / megaRaysPerSecond[0], numDifferentPixels, (unsigned int)(images[0].size() / 4));
+    const double wideDifference = ComputeRelativeDifference(images[2], images[0]);
+    LogPrint(wideDifference <= MaxWideShadingDifference ? LogLevel::Success : LogLevel::Failure, "Wide shading is %.2fx as fast as scalar shading, relative difference %.2g",
+        megaRaysPerSecond[2] / megaRaysPerSecond[1], wideDifference);
+    return numDifferentPixels == 0 && wideDifference <= MaxWideShadingDifference ? 0 : 1;
+}
+
+// Splits every mesh that is not a light into single triangles and gives them a matte, a metal and a substrate version of
+// the mesh's material in turn. Neighboring pixels then hit different material types, which is the worst case for
+// picking the shading code per hit.
+static std::unique_ptr<CpuScene> MixMaterials(const CpuScene& scene)
+{
+    std::unique_ptr<CpuScene> mixedScene(new CpuScene(scene));
+    mixedScene->meshes.clear();
+    mixedScene->materials.clear();
+    for (const CpuScene::Material& material : scene.materials)
+    {
+        CpuScene::Material matte = material;
+        matte.type = CpuScene::MATERIAL_MATTE;
+        // Gold.
+        CpuScene::Material metal = material;
+        metal.type = CpuScene::MATERIAL_METAL;
+        metal.eta = Float3(0.143f, 0.374f, 1.442f);
+        metal.ks = Float3(3.983f, 2.385f, 1.603f);
+        metal.roughness = 0.3f;
+        CpuScene::Material substrate = material;
+        substrate.type = CpuScene::MATERIAL_SUBSTRATE;
+        substrate.ks = Float3(0.04f);
+        substrate.roughness = 0.2f;
+        mixedScene->materials.insert(mixedScene->materials.end(), { matte, metal, substrate });
+    }
+
+    for (const CpuScene::Mesh& mesh : scene.meshes)
+    {
+        if (mesh.isEmitter)
+        {
+            CpuScene::Mesh light = mesh;
+            light.materialIndex = mesh.materialIndex * 3;
+            mixedScene->meshes.push_back(std::move(light));
+            continue;
+        }
+        for (uint32_t triangle = 0; triangle < mesh.indices.size() / 3; ++triangle)
+        {
+            CpuScene::Mesh part;
+            part.name = mesh.name;
+            part.materialIndex = mesh.materialIndex * 3 + triangle % 3;
+            part.isEmitter = false;
+            part.areaLightRadiance = mesh.areaLightRadiance;
+            for (int corner = 0; corner < 3; ++corner)
+            {
+                const uint32_t index = mesh.indices[triangle * 3 + corner];
+                part.positions.push_back(mesh.positions[index]);
+                part.vertices.push_back(mesh.vertices[index]);
+                part.indices.push_back(corner);
+            }
+            mixedScene->meshes.push_back(std::move(part));
+        }
+    }
+    return mixedScene;
+}
+
+int RunShadingBenchmark(int argc, char** argv)
+{
+    RenderOptions options;
+    options.samplesPerPixel = 8;
+    if (!ParseRenderOptions(argc, argv, options))
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless shading-benchmark <scene.pbrt> [render options]\n\n"
+            "Gives every triangle of the scene a matte, metal or substrate material in turn and renders it with wavefront\n"
+            "rendering, once picking the shading kernel for every hit and twice shading runs of hits with the same material\n"
+            "with kernels compiled for their material type and features, with scalar and with 8 wide shading. Uses the\n"
+            "same options as render and 8 samples per pixel by default. Reports the throughput of all three and checks that\n"
+            "the images of scalar shading are the same and that of wide shading differs only by rounding.");
+        return 1;
+    }
+
+    auto scene = LoadSceneForRendering(options);
+    if (!scene)
+        return 1;
+    scene = MixMaterials(*scene);
+    LogPrint(LogLevel::Info, "Split the scene into %u meshes with %u materials", (unsigned int)scene->meshes.size(), (unsigned int)scene->materials.size());
+
+    options.settings.wavefront = true;
+    const char* names[] = { "per hit", "specialized", "wide" };
+    std::vector<float> images[3];
+    double megaSamplesPerSecond[3];
+    for (int mode = 0; mode < 3; ++mode)
+    {
+        options.settings.specializedShading = mode != 0;
+        options.settings.wideShading = mode == 2;
+        uint32_t width, height;
+        uint64_t numRays;
+        const double seconds = RenderForBenchmark(*scene, options, images[mode], width, height, numRays);
+        megaSamplesPerSecond[mode] = static_cast<double>(width) * height * options.samplesPerPixel / seconds * 1e-6;
+        LogPrint(LogLevel::Info, "%-12s %u x %u, %u spp in %6.2f s  %7.2f MRays/s  %7.2f MSamples/s", names[mode], width, height,
+            options.samplesPerPixel, seconds, numRays / seconds * 1e-6, megaSamplesPerSecond[mode]);
+    }
+
+    // Shading order does not matter for the result of a path.
+    const uint32_t numDifferentPixels = CountDifferentPixels(images[0], images[1]);
+    LogPrint(numDifferentPixels == 0 ? LogLevel::Success : LogLevel::Failure, "Specialized shading is %.2fx as fast, %u of %u pixels differ",
+        megaSamplesPerSecond[1] / megaSamplesPerSecond[0], numDifferentPixels, (unsigned int)(images[0].size() / 4));
+    const double wideDifference = ComputeRelativeDifference(images[2], images[0]);
+    LogPrint(wideDifference <= MaxWideShadingDifference ? LogLevel::Success : LogLevel::Failure, "Wide shading is %.2fx as fast as scalar shading, relative difference %.2g",
+        megaSamplesPerSecond[2] / megaSamplesPerSecond[1], wideDifference);
+    return numDifferentPixels == 0 && wideDifference <= MaxWideShadingDifference ? 0 : 1;
+}
+
+int RunSchedulerBenchmark(int argc, char** argv)
+{
+    RenderOptions options;
+    options.samplesPerPixel = 8;
+    if (!ParseRenderOptions(argc, argv, options))
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless scheduler-benchmark <scene.pbrt> [render options]\n\n"
+            "Renders the scene with 1, 2, 4, ... up to --threads threads (default all hardware threads), once with threads\n"
+            "taking tiles in rows and once with work stealing. Uses the same options as render and 8 samples per pixel by\n"
+            "default. Reports throughput, speedup over one thread and the share of the time the threads had tiles to work on,\n"
+            "and checks that all images are the same. Use --triangles instead of a scene file for a large generated scene.");
+        return 1;
+    }
+
+    auto scene = LoadSceneForRendering(options);
+    if (!scene)
+        return 1;
+
+    const uint32_t maxNumThreads = options.settings.numThreads ? options.settings.numThreads : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<uint32_t> threadCounts;
+    for (uint32_t numThreads = 1; numThreads < maxNumThreads; numThreads *= 2)
+        threadCounts.push_back(numThreads);
+    threadCounts.push_back(maxNumThreads);
+
+    std::vector<float> referenceImage;
+    uint32_t numDifferentImages = 0;
+    double singleThreadMegaSamplesPerSecond[2] = { 0.0, 0.0 };
+    for (uint32_t numThreads : threadCounts)
+    {
+        for (int workStealing = 0; workStealing < 2; ++workStealing)
+        {
+            options.settings.numThreads = numThreads;
+            options.settings.workStealing = workStealing != 0;
+            std::vector<float> image;
+            uint32_t width, height;
+            uint64_t numRays;
+            CpuPathTracer::SchedulingStats stats;
+            const double seconds = RenderForBenchmark(*scene, options, image, width, height, numRays, &stats);
+            const double megaSamplesPerSecond = static_cast<double>(width) * height * options.samplesPerPixel / seconds * 1e-6;
+            if (numThreads == 1)
+                singleThreadMegaSamplesPerSecond[workStealing] = megaSamplesPerSecond;
+
+            // Tiles are independent of each other, so neither the scheduler nor the number of threads changes the image.
+            if (referenceImage.empty())
+                referenceImage = std::move(image);
+            else if (CountDifferentPixels(referenceImage, image) != 0)
+                ++numDifferentImages;
+
+            LogPrint(LogLevel::Info, "%2u threads %-13s %6.2f s  %7.2f MSamples/s  %5.2fx  %5.1f%% busy  %6u tiles  %5u steals  %5u splits",
+                numThreads, workStealing ? "work stealing" : "rows", seconds, megaSamplesPerSecond, megaSamplesPerSecond / singleThreadMegaSamplesPerSecond[workStealing],
+                stats.GetUtilization() * 100.0, stats.tiles.numTiles, stats.tiles.numSteals, stats.tiles.numSplits);
+        }
+    }
+
+    LogPrint(numDifferentImages == 0 ? LogLevel::Success : LogLevel::Failure, "%u of %u images differ from the first one",
+        numDifferentImages, (unsigned int)threadCounts.size() * 2 - 1);
+    return numDifferentImages == 0 ? 0 : 1;
+}
+
+int RunNumaBenchmark(int argc, char** argv)
+{
+    RenderOptions options;
+    options.samplesPerPixel = 8;
+    if (!ParseRenderOptions(argc, argv, options))
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless numa-benchmark <scene.pbrt> [render options]\n\n"
+            "Prints the NUMA nodes of the machine and renders the scene with 1, 2, 4, ... up to --threads threads (default all\n"
+            "hardware threads), once with a single copy of the scene and unpinned threads and once NUMA aware, with threads\n"
+            "pinned to the nodes and a copy of the BVH and textures per node. Uses the same options as render and 8 samples per\n"
+            "pixel by default. Reports throughput, speedup over one thread and steals across nodes, and checks that all images\n"
+            "are the same. --emulate-numa-nodes splits the processors into nodes on machines with only one.");
+        return 1;
+    }
+
+    const NumaTopology topology = options.settings.emulatedNumaNodes ? NumaTopology::Emulate(options.settings.emulatedNumaNodes) : NumaTopology::Detect();
+    LogPrint(LogLevel::Info, "%u NUMA nodes%s with %u logical processors", topology.GetNumNodes(), options.settings.emulatedNumaNodes ? " (emulated)" : "",
+        topology.GetNumProcessors());
+    for (uint32_t node = 0; node < topology.GetNumNodes(); ++node)
+    {
+        const std::vector<uint32_t>& processors = topology.GetNode(node).processors;
+        LogPrint(LogLevel::Info, "  node %u: %u processors, %u to %u", topology.GetNode(node).osIndex, (unsigned int)processors.size(),
+            processors.front(), processors.back());
+    }
+
+    auto scene = LoadSceneForRendering(options);
+    if (!scene)
+        return 1;
+
+    const uint32_t maxNumThreads = options.settings.numThreads ? options.settings.numThreads : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<uint32_t> threadCounts;
+    for (uint32_t numThreads = 1; numThreads < maxNumThreads; numThreads *= 2)
+        threadCounts.push_back(numThreads);
+    threadCounts.push_back(maxNumThreads);
+
+    std::vector<float> referenceImage;
+    uint32_t numDifferentImages = 0;
+    double singleThreadMegaSamplesPerSecond[2] = { 0.0, 0.0 };
+    for (uint32_t numThreads : threadCounts)
+    {
+        for (int numaAware = 0; numaAware < 2; ++numaAware)
+        {
+            options.settings.numThreads = numThreads;
+            options.settings.numaAware = numaAware != 0;
+            std::vector<float> image;
+            uint32_t width, height;
+            uint64_t numRays;
+            CpuPathTracer::SchedulingStats stats;
+            const double seconds = RenderForBenchmark(*scene, options, image, width, height, numRays, &stats);
+            const double megaSamplesPerSecond = static_cast<double>(width) * height * options.samplesPerPixel / seconds * 1e-6;
+            if (numThreads == 1)
+                singleThreadMegaSamplesPerSecond[numaAware] = megaSamplesPerSecond;
+
+            // Replicas are exact copies, so neither they nor the threads they are used by change the image.
+            if (referenceImage.empty())
+                referenceImage = std::move(image);
+            else if (CountDifferentPixels(referenceImage, image) != 0)
+                ++numDifferentImages;
+
+            LogPrint(LogLevel::Info, "%2u threads %-11s %u replicas  %6.2f s  %7.2f MSamples/s  %5.2fx  %5.1f%% busy  %5u steals  %5u remote",
+                numThreads, numaAware ? "NUMA aware" : "shared", stats.numNodes, seconds, megaSamplesPerSecond,
+                megaSamplesPerSecond / singleThreadMegaSamplesPerSecond[numaAware], stats.GetUtilization() * 100.0, stats.tiles.numSteals,
+                stats.tiles.numRemoteSteals);
+        }
+    }
+
+    LogPrint(numDifferentImages == 0 ? LogLevel::Success : LogLevel::Failure, "%u of %u images differ from the first one",
+        numDifferentImages, (unsigned int)threadCounts.size() * 2 - 1);
+    return numDifferentImages == 0 ? 0 : 1;
+}
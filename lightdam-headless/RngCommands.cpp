@@ -0,0 +1,300 @@
+#include "Commands.h"
+#include "../lightdam/RandomNumberGenerator.h"
+#include "../lightdam/RandomTestBattery.h"
+#include "../lightdam/CpuFeatures.h"
+#include "../lightdam/ErrorHandling.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static bool ParseSizeOption(int argc, char** argv, const char* option, uint64_t& value)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], option) == 0)
+        {
+            if (i + 1 >= argc)
+                return false;
+            value = strtoull(argv[i + 1], nullptr, 10);
+        }
+    }
+    return true;
+}
+
+// Stream ids of neighboring pixels, the usual way these generators are used.
+static void GetNeighboringStreamIds(uint64_t streamIds[8], bool scramble)
+{
+    for (uint64_t lane = 0; lane < 8; ++lane)
+        streamIds[lane] = scramble ? ScrambleStreamId(lane) : lane;
+}
+
+// Published known answers, so a wrong constant or rotation fails even if the output still looks random.
+// Philox4x32-10 from kat_vectors of Random123, PCG32 from pcg32-demo (seed 42, stream 54) of pcg-c-basic.
+static bool CheckKnownAnswers()
+{
+    struct PhiloxKnownAnswer
+    {
+        uint32_t counter[4];
+        uint32_t key[2];
+        uint32_t output[4];
+    };
+    const PhiloxKnownAnswer philoxKnownAnswers[] =
+    {
+        { { 0x00000000, 0x00000000, 0x00000000, 0x00000000 }, { 0x00000000, 0x00000000 }, { 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 } },
+        { { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff }, { 0xffffffff, 0xffffffff }, { 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd } },
+        { { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 }, { 0xa4093822, 0x299f31d0 }, { 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 } },
+    };
+    bool success = true;
+    for (const PhiloxKnownAnswer& knownAnswer : philoxKnownAnswers)
+    {
+        uint32_t output[4];
+        Philox4x32(knownAnswer.counter, knownAnswer.key, output);
+        if (memcmp(output, knownAnswer.output, sizeof(output)) != 0)
+        {
+            LogPrint(LogLevel::Failure, "  Philox4x32-10 of counter %08x %08x %08x %08x, key %08x %08x is %08x %08x %08x %08x instead of %08x %08x %08x %08x",
+                knownAnswer.counter[0], knownAnswer.counter[1], knownAnswer.counter[2], knownAnswer.counter[3], knownAnswer.key[0], knownAnswer.key[1],
+                output[0], output[1], output[2], output[3], knownAnswer.output[0], knownAnswer.output[1], knownAnswer.output[2], knownAnswer.output[3]);
+            success = false;
+        }
+    }
+
+    const uint32_t pcgKnownAnswer[] = { 0xa15c02b7, 0x7b47f409, 0xba1d3330, 0x83d2f293, 0xbfa4784b, 0xcbed606e };
+    Pcg32 pcg(42, 54);
+    for (uint32_t expected : pcgKnownAnswer)
+    {
+        const uint32_t output = pcg.NextUInt();
+        if (output != expected)
+        {
+            LogPrint(LogLevel::Failure, "  PCG32 with seed 42, stream 54 returned %08x instead of %08x", output, expected);
+            success = false;
+            break;
+        }
+    }
+    return success;
+}
+
+// The eight wide generators have to produce exactly the numbers of eight scalar ones, also when starting or ending within a Philox block
+// and after jumping ahead.
+static bool CheckWideGenerators(uint64_t seed)
+{
+    uint64_t streamIds[8];
+    GetNeighboringStreamIds(streamIds, true);
+    // Odd counts so that Philox goes through partial blocks.
+    const uint64_t counts[] = { 3, 1, 64, 5, 1021 };
+    const uint64_t pcgAdvance = 1000003;
+
+    PhiloxStream8 philox8(seed, streamIds, 2);
+    Pcg32x8 pcg8(seed, streamIds);
+    PhiloxStream philox[8];
+    Pcg32 pcg[8];
+    for (int lane = 0; lane < 8; ++lane)
+    {
+        philox[lane] = PhiloxStream(seed, streamIds[lane], 2);
+        pcg[lane] = Pcg32(seed, streamIds[lane]);
+    }
+
+    uint64_t numPhiloxMismatches = 0, numPcgMismatches = 0;
+    std::vector<uint32_t> output;
+    std::vector<float> floatOutput;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (uint64_t count : counts)
+        {
+            output.resize(count * 8);
+            philox8.Generate(output.data(), count);
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                for (int lane = 0; lane < 8; ++lane)
+                    numPhiloxMismatches += output[i * 8 + lane] != philox[lane].NextUInt();
+            }
+            pcg8.Generate(output.data(), count);
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                for (int lane = 0; lane < 8; ++lane)
+                    numPcgMismatches += output[i * 8 + lane] != pcg[lane].NextUInt();
+            }
+
+            floatOutput.resize(count * 8);
+            philox8.GenerateFloats(floatOutput.data(), count);
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                for (int lane = 0; lane < 8; ++lane)
+                    numPhiloxMismatches += floatOutput[i * 8 + lane] != philox[lane].NextFloat();
+            }
+            pcg8.GenerateFloats(floatOutput.data(), count);
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                for (int lane = 0; lane < 8; ++lane)
+                    numPcgMismatches += floatOutput[i * 8 + lane] != pcg[lane].NextFloat();
+            }
+        }
+
+        // Second pass continues after a jump.
+        philox8.Seek(philox8.GetIndex() + pcgAdvance);
+        pcg8.Advance(pcgAdvance);
+        for (int lane = 0; lane < 8; ++lane)
+        {
+            philox[lane].Seek(philox[lane].GetIndex() + pcgAdvance);
+            pcg[lane].Advance(pcgAdvance);
+        }
+    }
+
+    const char* implementation = CpuSupportsAvx2() ? "AVX2" : "scalar fallback";
+    LogPrint(numPhiloxMismatches == 0 ? LogLevel::Success : LogLevel::Failure, "  Philox x8 (%s): %llu numbers differ from PhiloxStream",
+        implementation, (unsigned long long)numPhiloxMismatches);
+    LogPrint(numPcgMismatches == 0 ? LogLevel::Success : LogLevel::Failure, "  PCG32 x8 (%s): %llu numbers differ from Pcg32",
+        implementation, (unsigned long long)numPcgMismatches);
+    return numPhiloxMismatches == 0 && numPcgMismatches == 0;
+}
+
+int RunRngTest(int argc, char** argv)
+{
+    uint64_t numbersPerTest = 1 << 24;
+    uint64_t seed = 0;
+    if (!ParseSizeOption(argc, argv, "--numbers", numbersPerTest) || !ParseSizeOption(argc, argv, "--seed", seed) || numbersPerTest < 4096)
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless rng-test [options]\n\n"
+            "Checks the generators against published known answers, the eight wide generators against the scalar ones\n"
+            "and runs a battery of statistical tests on all of them.\n\n"
+            "Options:\n"
+            "  --numbers <n>   Numbers consumed per test, at least 4096 (default 16777216)\n"
+            "  --seed <n>      Seed for all generators (default 0)");
+        return 1;
+    }
+    numbersPerTest &= ~7ull;
+
+    uint64_t streamIds[8];
+    GetNeighboringStreamIds(streamIds, false);
+    uint64_t scrambledStreamIds[8];
+    GetNeighboringStreamIds(scrambledStreamIds, true);
+
+    PhiloxStream philox(seed);
+    Pcg32 pcg(seed);
+    PhiloxStream8 philox8(seed, streamIds);
+    Pcg32x8 pcg8(seed, scrambledStreamIds);
+
+    struct NamedGenerator
+    {
+        const char* name;
+        RandomTestBattery::Generator generator;
+    };
+    const NamedGenerator generators[] =
+    {
+        { "Philox", [&](uint32_t* output, size_t count) { for (size_t i = 0; i < count; ++i) output[i] = philox.NextUInt(); } },
+        { "PCG32", [&](uint32_t* output, size_t count) { for (size_t i = 0; i < count; ++i) output[i] = pcg.NextUInt(); } },
+        // Interleaved output of neighboring streams, tests independence between streams.
+        { "Philox x8, stream ids 0-7", [&](uint32_t* output, size_t count) { philox8.Generate(output, count / 8); } },
+        { "PCG32 x8, scrambled stream ids 0-7", [&](uint32_t* output, size_t count) { pcg8.Generate(output, count / 8); } },
+    };
+
+    LogPrint(LogLevel::Info, "Known answers:");
+    const bool knownAnswersMatch = CheckKnownAnswers();
+    LogPrint(knownAnswersMatch ? LogLevel::Success : LogLevel::Failure, "  %s", knownAnswersMatch ? "Philox4x32-10 and PCG32 match their reference implementations" : "Mismatch");
+    LogPrint(LogLevel::Info, "Eight wide generators:");
+    const bool wideGeneratorsMatch = CheckWideGenerators(seed);
+
+    bool anyFailure = !knownAnswersMatch || !wideGeneratorsMatch;
+    for (const NamedGenerator& namedGenerator : generators)
+    {
+        LogPrint(LogLevel::Info, "%s:", namedGenerator.name);
+        for (const RandomTestBattery::Result& result : RandomTestBattery::Run(namedGenerator.generator, (size_t)numbersPerTest))
+        {
+            const LogLevel logLevel = result.IsFailure() ? LogLevel::Failure : (result.IsSuspicious() ? LogLevel::Warning : LogLevel::Success);
+            LogPrint(logLevel, "  %-26s statistic %14.3f  p = %.5f", result.name, result.statistic, result.pValue);
+            anyFailure |= result.IsFailure();
+        }
+    }
+    return anyFailure ? 1 : 0;
+}
+
+template<typename Function>
+static void Benchmark(const char* name, uint64_t numNumbers, Function function)
+{
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    const uint32_t checksum = function();
+    const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+    LogPrint(LogLevel::Info, "  %-16s %8.1f M numbers/s (checksum %08x)", name, numNumbers / seconds * 1e-6, checksum);
+}
+
+int RunRngBenchmark(int argc, char** argv)
+{
+    uint64_t numNumbers = 1 << 26;
+    if (!ParseSizeOption(argc, argv, "--numbers", numNumbers) || numNumbers < 8)
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless rng-benchmark [options]\n\n"
+            "Options:\n"
+            "  --numbers <n>   Numbers generated per generator (default 67108864)");
+        return 1;
+    }
+    numNumbers &= ~7ull;
+
+    LogPrint(LogLevel::Info, "Generating %llu numbers per generator, AVX2 %s:", (unsigned long long)numNumbers, CpuSupportsAvx2() ? "available" : "not available");
+
+    // Generate into a cache sized buffer, the way per-tile sample generation would.
+    const uint64_t bufferSize = 8 * 1024;
+    std::vector<uint32_t> buffer(bufferSize);
+    auto xorBuffer = [&]() { uint32_t checksum = 0; for (uint32_t x : buffer) checksum ^= x; return checksum; };
+
+    uint64_t streamIds[8];
+    GetNeighboringStreamIds(streamIds, true);
+
+    Benchmark("std::mt19937", numNumbers, [&]() {
+        std::mt19937 generator(0);
+        uint32_t checksum = 0;
+        for (uint64_t i = 0; i < numNumbers; i += bufferSize)
+        {
+            for (uint32_t& x : buffer)
+                x = generator();
+            checksum ^= xorBuffer();
+        }
+        return checksum;
+    });
+    Benchmark("PhiloxStream", numNumbers, [&]() {
+        PhiloxStream generator(0);
+        uint32_t checksum = 0;
+        for (uint64_t i = 0; i < numNumbers; i += bufferSize)
+        {
+            for (uint32_t& x : buffer)
+                x = generator.NextUInt();
+            checksum ^= xorBuffer();
+        }
+        return checksum;
+    });
+    Benchmark("Pcg32", numNumbers, [&]() {
+        Pcg32 generator(0);
+        uint32_t checksum = 0;
+        for (uint64_t i = 0; i < numNumbers; i += bufferSize)
+        {
+            for (uint32_t& x : buffer)
+                x = generator.NextUInt();
+            checksum ^= xorBuffer();
+        }
+        return checksum;
+    });
+    Benchmark("PhiloxStream8", numNumbers, [&]() {
+        PhiloxStream8 generator(0, streamIds);
+        uint32_t checksum = 0;
+        for (uint64_t i = 0; i < numNumbers; i += bufferSize)
+        {
+            generator.Generate(buffer.data(), bufferSize / 8);
+            checksum ^= xorBuffer();
+        }
+        return checksum;
+    });
+    Benchmark("Pcg32x8", numNumbers, [&]() {
+        Pcg32x8 generator(0, streamIds);
+        uint32_t checksum = 0;
+        for (uint64_t i = 0; i < numNumbers; i += bufferSize)
+        {
+            generator.Generate(buffer.data(), bufferSize / 8);
+            checksum ^= xorBuffer();
+        }
+        return checksum;
+    });
+    return 0;
+}
@@ -0,0 +1,347 @@
+#include "Commands.h"
+#include "../lightdam/HaltonSampler.h"
+#include "../lightdam/RandomNumberGenerator.h"
+#include "../lightdam/SobolSampler.h"
+#include "../lightdam/ErrorHandling.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static bool IsSameFloat(float a, float b)
+{
+    return memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+// Compares table lookup and incremental evaluation of all bases with ComputeHaltonSequence over the given index range.
+// Returns the number of mismatches.
+static uint64_t CheckHaltonRange(const HaltonSampler& sampler, uint32_t firstIndex, uint32_t numIndices)
+{
+    uint64_t numMismatches = 0;
+    for (int baseIdx = 0; baseIdx < MaxHaltonBaseIdx; ++baseIdx)
+    {
+        HaltonSampler::Dimension dimension = sampler.GetDimension(baseIdx, firstIndex);
+        for (uint32_t i = 0; i < numIndices; ++i, dimension.Next())
+        {
+            const uint32_t index = firstIndex + i;
+            const float reference = ComputeHaltonSequence(static_cast<int>(index), baseIdx);
+            if (!IsSameFloat(sampler.Sample(index, baseIdx), reference) || !IsSameFloat(dimension.Get(), reference))
+            {
+                if (numMismatches < 5)
+                {
+                    LogPrint(LogLevel::Failure, "  Base %u index %u: reference %.9g, table %.9g, incremental %.9g", HaltonPrimes[baseIdx], index,
+                        reference, sampler.Sample(index, baseIdx), dimension.Get());
+                }
+                ++numMismatches;
+            }
+        }
+    }
+    return numMismatches;
+}
+
+int RunHaltonTest(int argc, char** argv)
+{
+    uint32_t numIndices = 1 << 18;
+    uint32_t numBenchmarkSamples = 1 << 25;
+    bool validArguments = true;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--indices") == 0 && i + 1 < argc)
+            numIndices = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+            numBenchmarkSamples = strtoul(argv[++i], nullptr, 10);
+        else
+            validArguments = false;
+    }
+    if (!validArguments || numIndices == 0 || numIndices > 0x40000000u)
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless halton-test [options]\n\n"
+            "Checks that HaltonSampler returns the exact floats of ComputeHaltonSequence for all bases, both through its table of\n"
+            "per base functions and its incremental dimensions, then compares their speed.\n\n"
+            "Options:\n"
+            "  --indices <n>    Indices checked per base at the start and at the end of the index range (default 262144)\n"
+            "  --samples <n>    Samples per benchmark (default 33554432)");
+        return 1;
+    }
+
+    // ComputeHaltonSequence takes int indices, the end of its range has the most digits.
+    const HaltonSampler sampler;
+    const uint32_t lastIndex = 0x7FFFFFFFu;
+    uint64_t numMismatches = CheckHaltonRange(sampler, 0, numIndices);
+    numMismatches += CheckHaltonRange(sampler, lastIndex - numIndices + 1, numIndices);
+    const uint64_t numChecked = 2ull * numIndices * MaxHaltonBaseIdx;
+    LogPrint(numMismatches == 0 ? LogLevel::Success : LogLevel::Failure, "%llu of %llu samples differ from ComputeHaltonSequence",
+        (unsigned long long)numMismatches, (unsigned long long)numChecked);
+
+    // Scrambled samples have no reference, table and incremental evaluation need to agree and stay in [0, 1).
+    const HaltonSampler scrambledSampler(HaltonSampler::Mode::Scrambled, 7);
+    uint64_t numScrambledMismatches = 0;
+    for (int baseIdx = 0; baseIdx < MaxHaltonBaseIdx; ++baseIdx)
+    {
+        HaltonSampler::Dimension dimension = scrambledSampler.GetDimension(baseIdx, 5);
+        for (uint32_t index = 5; index < numIndices + 5; ++index, dimension.Next())
+        {
+            const float sample = scrambledSampler.Sample(index, baseIdx);
+            if (!IsSameFloat(sample, dimension.Get()) || sample < 0.0f || sample >= 1.0f)
+                ++numScrambledMismatches;
+        }
+    }
+    LogPrint(numScrambledMismatches == 0 ? LogLevel::Success : LogLevel::Failure, "%llu of %llu scrambled samples differ between table and incremental or are outside [0, 1)",
+        (unsigned long long)numScrambledMismatches, (unsigned long long)(numIndices * MaxHaltonBaseIdx));
+
+    // The first four bases, as used for the camera and the first bounce.
+    struct Benchmark
+    {
+        const char* name;
+        float (*function)(const HaltonSampler& sampler, uint32_t numSamples);
+    };
+    const Benchmark benchmarks[] =
+    {
+        { "ComputeHaltonSequence", [](const HaltonSampler&, uint32_t numSamples)
+            {
+                float sum = 0.0f;
+                for (uint32_t i = 0; i < numSamples; ++i)
+                    sum += ComputeHaltonSequence(static_cast<int>(i >> 2), i & 3);
+                return sum;
+            } },
+        { "HaltonSampler::Sample", [](const HaltonSampler& sampler, uint32_t numSamples)
+            {
+                float sum = 0.0f;
+                for (uint32_t i = 0; i < numSamples; ++i)
+                    sum += sampler.Sample(i >> 2, i & 3);
+                return sum;
+            } },
+        { "HaltonSampler::Dimension", [](const HaltonSampler& sampler, uint32_t numSamples)
+            {
+                HaltonSampler::Dimension dimensions[4];
+                for (int baseIdx = 0; baseIdx < 4; ++baseIdx)
+                    dimensions[baseIdx] = sampler.GetDimension(baseIdx);
+                float sum = 0.0f;
+                for (uint32_t i = 0; i < numSamples; i += 4)
+                {
+                    for (HaltonSampler::Dimension& dimension : dimensions)
+                    {
+                        sum += dimension.Get();
+                        dimension.Next();
+                    }
+                }
+                return sum;
+            } },
+    };
+    double referenceSeconds = 0.0;
+    float checksum = 0.0f;
+    for (const Benchmark& benchmark : benchmarks)
+    {
+        const auto start = std::chrono::high_resolution_clock::now();
+        checksum += benchmark.function(sampler, numBenchmarkSamples);
+        const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        if (referenceSeconds == 0.0)
+            referenceSeconds = seconds;
+        LogPrint(LogLevel::Info, "%-26s %8.1f M samples/s  %.2fx", benchmark.name, numBenchmarkSamples / seconds * 1e-6, referenceSeconds / seconds);
+    }
+    LogPrint(LogLevel::Info, "(checksum %g)", checksum);
+
+    return numMismatches == 0 && numScrambledMismatches == 0 ? 0 : 1;
+}
+
+// Smallest t for which the 2^numPointsLog2 points of two raw Sobol dimensions form a (t, m, 2)-net, i.e. every elementary
+// interval of area 2^(t - m) holds exactly 2^t points. 0 is perfect stratification in all aspect ratios.
+static uint32_t ComputeSobolPairQuality(uint32_t dimensionX, uint32_t dimensionY, uint32_t numPointsLog2)
+{
+    const uint32_t numPoints = 1u << numPointsLog2;
+    std::vector<uint32_t> x(numPoints), y(numPoints);
+    for (uint32_t index = 0; index < numPoints; ++index)
+    {
+        x[index] = SobolSampler::SampleUInt(index, dimensionX);
+        y[index] = SobolSampler::SampleUInt(index, dimensionY);
+    }
+
+    std::vector<uint32_t> counts;
+    for (uint32_t t = 0; t < numPointsLog2; ++t)
+    {
+        const uint32_t cellBits = numPointsLog2 - t;
+        bool isNet = true;
+        for (uint32_t xBits = 0; xBits <= cellBits && isNet; ++xBits)
+        {
+            const uint32_t yBits = cellBits - xBits;
+            counts.assign(1u << cellBits, 0);
+            for (uint32_t index = 0; index < numPoints; ++index)
+                ++counts[static_cast<uint32_t>((static_cast<uint64_t>(x[index]) >> (32 - xBits)) << yBits | (static_cast<uint64_t>(y[index]) >> (32 - yBits)))];
+            isNet = std::all_of(counts.begin(), counts.end(), [t](uint32_t count) { return count == (1u << t); });
+        }
+        if (isNet)
+            return t;
+    }
+    return numPointsLog2;
+}
+
+// Integrands over [0, 1)^2 with known integrals.
+struct TestIntegrand
+{
+    const char* name;
+    double integral;
+    float (*function)(float x, float y);
+};
+
+static const TestIntegrand s_testIntegrands[] =
+{
+    { "exp(-(x^2+y^2))", 0.5577462853510335, [](float x, float y) { return expf(-(x * x + y * y)); } },
+    { "4xy", 1.0, [](float x, float y) { return 4.0f * x * y; } },
+    // Discontinuous like visibility.
+    { "quarter disk", 0.7853981633974483, [](float x, float y) { return x * x + y * y < 1.0f ? 1.0f : 0.0f; } },
+};
+
+int RunSobolTest(int argc, char** argv)
+{
+    uint32_t numPixels = 256;
+    uint32_t maxSamplesLog2 = 12;
+    bool validArguments = true;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--pixels") == 0 && i + 1 < argc)
+            numPixels = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--max-samples-log2") == 0 && i + 1 < argc)
+            maxSamplesLog2 = strtoul(argv[++i], nullptr, 10);
+        else
+            validArguments = false;
+    }
+    if (!validArguments || numPixels == 0 || maxSamplesLog2 < 4 || maxSamplesLog2 > 20)
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless sobol-test [options]\n\n"
+            "Checks the stratification of SobolSampler's dimensions and padded samples, then compares the error of integrating\n"
+            "analytic 2D functions with Owen scrambled Sobol, scrambled Halton, the Weyl sequence of Random.hlsl and random numbers.\n\n"
+            "Options:\n"
+            "  --pixels <n>              Independently seeded estimates the RMSE is computed over (default 256)\n"
+            "  --max-samples-log2 <n>    Largest sample count as power of two, 4 to 20 (default 12)");
+        return 1;
+    }
+    bool success = true;
+
+    // Every dimension on its own, for every power of two prefix.
+    uint32_t numUnstratifiedDimensions = 0;
+    for (uint32_t dimension = 0; dimension < SobolSampler::MaxDimensions; ++dimension)
+    {
+        bool stratified = true;
+        for (uint32_t numPointsLog2 = 1; numPointsLog2 <= 10 && stratified; ++numPointsLog2)
+        {
+            std::vector<uint32_t> counts(1u << numPointsLog2, 0);
+            for (uint32_t index = 0; index < (1u << numPointsLog2); ++index)
+                ++counts[SobolSampler::SampleUInt(index, dimension) >> (32 - numPointsLog2)];
+            stratified = std::all_of(counts.begin(), counts.end(), [](uint32_t count) { return count == 1; });
+        }
+        if (!stratified)
+            ++numUnstratifiedDimensions;
+    }
+    LogPrint(numUnstratifiedDimensions == 0 ? LogLevel::Success : LogLevel::Failure, "%u of %u dimensions are not stratified in 1D for up to 1024 points",
+        numUnstratifiedDimensions, SobolSampler::MaxDimensions);
+    success &= numUnstratifiedDimensions == 0;
+
+    // Quality of the 2D projections the Joe & Kuo direction numbers were chosen for.
+    const uint32_t qualityPointsLog2 = 10;
+    uint32_t maxNeighborT = 0, sumNeighborT = 0;
+    for (uint32_t dimension = 0; dimension + 1 < SobolSampler::MaxDimensions; ++dimension)
+    {
+        const uint32_t t = ComputeSobolPairQuality(dimension, dimension + 1, qualityPointsLog2);
+        maxNeighborT = std::max(maxNeighborT, t);
+        sumNeighborT += t;
+    }
+    const uint32_t numFirstDimensions = 32;
+    uint32_t maxFirstT = 0, sumFirstT = 0;
+    for (uint32_t dimensionX = 0; dimensionX < numFirstDimensions; ++dimensionX)
+    {
+        for (uint32_t dimensionY = dimensionX + 1; dimensionY < numFirstDimensions; ++dimensionY)
+        {
+            const uint32_t t = ComputeSobolPairQuality(dimensionX, dimensionY, qualityPointsLog2);
+            maxFirstT = std::max(maxFirstT, t);
+            sumFirstT += t;
+        }
+    }
+    LogPrint(LogLevel::Info, "2D projections of %u points as (t, m, 2)-nets: neighboring dimensions t <= %u (mean %.2f), all pairs of the first %u t <= %u (mean %.2f)",
+        1u << qualityPointsLog2, maxNeighborT, static_cast<double>(sumNeighborT) / (SobolSampler::MaxDimensions - 1),
+        numFirstDimensions, maxFirstT, static_cast<double>(sumFirstT) / (numFirstDimensions * (numFirstDimensions - 1) / 2));
+
+    // Owen scrambling keeps the first two dimensions a (0, m, 2)-net, so every padded dimension set has to be one.
+    uint32_t numNetViolations = 0;
+    for (uint32_t dimensionSet = 0; dimensionSet < 16; ++dimensionSet)
+    {
+        for (uint32_t numPointsLog2 = 2; numPointsLog2 <= 12; numPointsLog2 += 2)
+        {
+            const uint32_t numPoints = 1u << numPointsLog2;
+            for (uint32_t xBits = 0; xBits <= numPointsLog2; ++xBits)
+            {
+                const uint32_t yBits = numPointsLog2 - xBits;
+                std::vector<uint32_t> counts(numPoints, 0);
+                for (uint32_t index = 0; index < numPoints; ++index)
+                {
+                    float sample[2];
+                    SobolSampler::SamplePadded2D(index, dimensionSet, 1234, sample);
+                    const uint32_t cellX = static_cast<uint32_t>(sample[0] * (1u << xBits));
+                    const uint32_t cellY = static_cast<uint32_t>(sample[1] * (1u << yBits));
+                    ++counts[(cellX << yBits) | cellY];
+                }
+                if (!std::all_of(counts.begin(), counts.end(), [](uint32_t count) { return count == 1; }))
+                    ++numNetViolations;
+            }
+        }
+    }
+    LogPrint(numNetViolations == 0 ? LogLevel::Success : LogLevel::Failure, "%u elementary interval violations of padded 2D samples", numNetViolations);
+    success &= numNetViolations == 0;
+
+    // Every pixel is an independent estimate: its own seed for the scrambled sequences, its own offset for the Weyl sequence,
+    // as RayGen.hlsl does it, and its own stream for random numbers.
+    enum Estimator { SobolPadded, SobolLastDimensions, HaltonScrambled, Weyl, Random, NumEstimators };
+    const char* estimatorNames[NumEstimators] = { "Sobol padded", "Sobol dims 1022-23", "Halton scrambled", "Weyl", "Random" };
+    const HaltonSampler halton(HaltonSampler::Mode::Scrambled, 0);
+    LogPrint(LogLevel::Info, "\nRMSE over %u pixels:", numPixels);
+    for (const TestIntegrand& integrand : s_testIntegrands)
+    {
+        LogPrint(LogLevel::Info, "%s", integrand.name);
+        for (uint32_t numSamplesLog2 = 4; numSamplesLog2 <= maxSamplesLog2; numSamplesLog2 += 2)
+        {
+            const uint32_t numSamples = 1u << numSamplesLog2;
+            double squaredErrors[NumEstimators] = {};
+            for (uint32_t pixel = 0; pixel < numPixels; ++pixel)
+            {
+                const uint32_t seed = pixel * 2654435761u;
+                Pcg32 random(0, pixel);
+                double sums[NumEstimators] = {};
+                for (uint32_t index = 0; index < numSamples; ++index)
+                {
+                    float padded[2];
+                    SobolSampler::SamplePadded2D(index, 3, seed, padded);
+                    sums[SobolPadded] += integrand.function(padded[0], padded[1]);
+                    sums[SobolLastDimensions] += integrand.function(SobolSampler::Sample(index, SobolSampler::MaxDimensions - 2, seed),
+                                                                    SobolSampler::Sample(index, SobolSampler::MaxDimensions - 1, seed));
+                    // Scrambled Halton shares its permutations between pixels, a random offset per pixel decorrelates them.
+                    const uint32_t haltonIndex = index + (seed >> 20);
+                    sums[HaltonScrambled] += integrand.function(halton.Sample(haltonIndex, 0), halton.Sample(haltonIndex, 1));
+                    const uint32_t weylIndex = index + 1 + seed;
+                    sums[Weyl] += integrand.function(((weylIndex * 12664745u) & 0xFFFFFF) / 16777216.0f, ((weylIndex * 9560333u) & 0xFFFFFF) / 16777216.0f);
+                    const float randomX = random.NextFloat();
+                    sums[Random] += integrand.function(randomX, random.NextFloat());
+                }
+                for (int estimator = 0; estimator < NumEstimators; ++estimator)
+                    squaredErrors[estimator] += pow(sums[estimator] / numSamples - integrand.integral, 2.0);
+            }
+
+            char line[256];
+            int length = snprintf(line, sizeof(line), "  %5u samples:", numSamples);
+            double rmse[NumEstimators];
+            for (int estimator = 0; estimator < NumEstimators; ++estimator)
+            {
+                rmse[estimator] = sqrt(squaredErrors[estimator] / numPixels);
+                length += snprintf(line + length, sizeof(line) - length, "  %s %.2e", estimatorNames[estimator], rmse[estimator]);
+            }
+            // Both Sobol variants have to beat random numbers from the first few samples on.
+            const bool beatsRandom = numSamples < 64 || (rmse[SobolPadded] < rmse[Random] && rmse[SobolLastDimensions] < rmse[Random]);
+            LogPrint(beatsRandom ? LogLevel::Info : LogLevel::Failure, "%s", line);
+            success &= beatsRandom;
+        }
+    }
+    return success ? 0 : 1;
+}
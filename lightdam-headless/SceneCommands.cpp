@@ -0,0 +1,930 @@
+#include "Commands.h"
+#include "GeneratedScenes.h"
+#include "../lightdam/cpu/CpuPathTracer.h"
+#include "../lightdam/cpu/PbrtTextParser.h"
+#include "../lightdam/cpu/SceneIntersector.h"
+#include "../lightdam/ErrorHandling.h"
+#include "../lightdam/ThreadPool.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <Psapi.h>
+#else
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Peak and current resident memory of the process in bytes.
+static void GetResidentMemory(size_t& peakBytes, size_t& currentBytes)
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters = {};
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    peakBytes = counters.PeakWorkingSetSize;
+    currentBytes = counters.WorkingSetSize;
+#else
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    peakBytes = static_cast<size_t>(usage.ru_maxrss) * 1024;
+    currentBytes = 0;
+    if (FILE* file = fopen("/proc/self/statm", "r"))
+    {
+        unsigned long long numPages, numResidentPages;
+        if (fscanf(file, "%llu %llu", &numPages, &numResidentPages) == 2)
+            currentBytes = static_cast<size_t>(numResidentPages) * sysconf(_SC_PAGESIZE);
+        fclose(file);
+    }
+#endif
+}
+
+// Anonymous memory that the kernel actually backs with transparent huge pages, 0 if unknown.
+static size_t GetTransparentHugePageBytes()
+{
+    size_t bytes = 0;
+#ifndef _WIN32
+    if (FILE* file = fopen("/proc/self/smaps_rollup", "r"))
+    {
+        char line[256];
+        while (fgets(line, sizeof(line), file))
+        {
+            unsigned long long kiloBytes;
+            if (sscanf(line, "AnonHugePages: %llu kB", &kiloBytes) == 1)
+                bytes = static_cast<size_t>(kiloBytes) * 1024;
+        }
+        fclose(file);
+    }
+#endif
+    return bytes;
+}
+
+// Counts data TLB misses of loads of the calling thread and all threads it starts after the counter was created,
+// while the counter is enabled. Threads only add their misses to the count once they exited.
+class DataTlbMissCounter
+{
+public:
+    DataTlbMissCounter()
+        : m_file(-1)
+    {
+#ifndef _WIN32
+        perf_event_attr attributes = {};
+        attributes.size = sizeof(attributes);
+        attributes.type = PERF_TYPE_HW_CACHE;
+        attributes.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attributes.disabled = 1;
+        attributes.inherit = 1;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        m_file = static_cast<int>(syscall(__NR_perf_event_open, &attributes, 0, -1, -1, 0));
+#endif
+    }
+    ~DataTlbMissCounter()
+    {
+#ifndef _WIN32
+        if (m_file >= 0)
+            close(m_file);
+#endif
+    }
+
+    bool IsAvailable() const { return m_file >= 0; }
+
+    // Also enables/disables the counters of the threads started so far.
+    void SetEnabled(bool enabled)
+    {
+#ifndef _WIN32
+        if (m_file >= 0)
+            ioctl(m_file, enabled ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+#endif
+    }
+
+    uint64_t Read() const
+    {
+        uint64_t count = 0;
+#ifndef _WIN32
+        if (m_file >= 0 && read(m_file, &count, sizeof(count)) != sizeof(count))
+            count = 0;
+#endif
+        return count;
+    }
+
+private:
+    int m_file;
+};
+
+// Generated scenes are put together on the heap, this moves their arrays into an arena the same way the importer allocates them.
+static void MoveMeshesToArena(CpuScene& scene, MemoryArena::HugePages hugePages)
+{
+    scene.arena = std::make_shared<MemoryArena>(hugePages);
+    for (CpuScene::Mesh& mesh : scene.meshes)
+    {
+        CpuScene::Mesh arenaMesh(scene.arena.get());
+        arenaMesh.positions.assign(mesh.positions.begin(), mesh.positions.end());
+        arenaMesh.vertices.assign(mesh.vertices.begin(), mesh.vertices.end());
+        arenaMesh.indices.assign(mesh.indices.begin(), mesh.indices.end());
+        mesh.positions = std::move(arenaMesh.positions);
+        mesh.vertices = std::move(arenaMesh.vertices);
+        mesh.indices = std::move(arenaMesh.indices);
+    }
+}
+
+int RunMemoryBenchmark(int argc, char** argv)
+{
+    std::string sceneFilePath;
+    uint32_t numGeneratedTriangles = 0;
+    CpuScene::ImportSettings importSettings;
+    CpuPathTracer::Settings settings;
+    uint32_t samplesPerPixel = 4;
+    bool validArguments = true;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (argv[i][0] != '-')
+            sceneFilePath = argv[i];
+        else if (strcmp(argv[i], "--triangles") == 0 && i + 1 < argc)
+            numGeneratedTriangles = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            settings.numThreads = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--spp") == 0 && i + 1 < argc)
+            samplesPerPixel = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--huge-pages") == 0 && i + 1 < argc)
+        {
+            const char* value = argv[++i];
+            if (strcmp(value, "none") == 0)
+                importSettings.hugePages = MemoryArena::HugePages::None;
+            else if (strcmp(value, "transparent") == 0)
+                importSettings.hugePages = MemoryArena::HugePages::Transparent;
+            else if (strcmp(value, "explicit") == 0)
+                importSettings.hugePages = MemoryArena::HugePages::Explicit;
+            else
+                validArguments = false;
+        }
+        else
+            validArguments = false;
+    }
+    if (!validArguments || (sceneFilePath.empty() && numGeneratedTriangles == 0) || samplesPerPixel == 0)
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless memory-benchmark <scene.pbrt> [options]\n\n"
+            "Loads the scene into an arena with the given huge page backing, reports the peak and current resident memory of\n"
+            "the process and how much of the arena got huge pages, then renders the scene and reports the data TLB misses\n"
+            "(Linux only). Peak memory only ever grows, so compare the backings in separate runs.\n\n"
+            "Options:\n"
+            "  --huge-pages <mode>  none, transparent or explicit (default transparent)\n"
+            "  --triangles <n>      Generated building with about n triangles instead of a scene file, moved into the arena\n"
+            "  --threads <n>        Number of threads for loading and rendering (default all hardware threads)\n"
+            "  --spp <n>            Samples per pixel to render (default 4)");
+        return 1;
+    }
+
+    size_t peakBytesBefore, currentBytesBefore;
+    GetResidentMemory(peakBytesBefore, currentBytesBefore);
+
+    const auto loadStart = std::chrono::high_resolution_clock::now();
+    std::unique_ptr<CpuScene> scene;
+    {
+        ThreadPool threadPool(settings.numThreads);
+        if (numGeneratedTriangles > 0)
+        {
+            scene = GenerateBuildingScene(numGeneratedTriangles);
+            PrepareGeneratedSceneForRendering(*scene);
+            MoveMeshesToArena(*scene, importSettings.hugePages);
+        }
+        else
+            scene = CpuScene::LoadPbrtScene(sceneFilePath, &threadPool, importSettings);
+    }
+    if (!scene)
+        return 1;
+    const double loadSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - loadStart).count();
+
+    size_t peakBytes, currentBytes;
+    GetResidentMemory(peakBytes, currentBytes);
+    size_t sceneBytes = 0;
+    uint64_t numTriangles = 0;
+    for (const CpuScene::Mesh& mesh : scene->meshes)
+    {
+        sceneBytes += mesh.positions.size() * sizeof(Float3) + mesh.vertices.size() * sizeof(CpuScene::Vertex) + mesh.indices.size() * sizeof(uint32_t);
+        numTriangles += mesh.indices.size() / 3;
+    }
+    for (const CpuScene::Texture& texture : scene->textures)
+        sceneBytes += texture.srgbTexels.size();
+
+    const MemoryArena::Stats arenaStats = scene->arena ? scene->arena->GetStats() : MemoryArena::Stats();
+    LogPrint(LogLevel::Info, "Loaded %u meshes with %llu triangles in %.2f s, %.1f MB of mesh and texture data",
+        (unsigned int)scene->meshes.size(), (unsigned long long)numTriangles, loadSeconds, sceneBytes / (1024.0 * 1024.0));
+    LogPrint(LogLevel::Info, "Arena: %.1f MB allocated in %u blocks of %.1f MB in total, %.1f MB with huge pages requested, %.1f MB of the process backed by transparent huge pages",
+        arenaStats.allocatedBytes / (1024.0 * 1024.0), arenaStats.numBlocks, arenaStats.reservedBytes / (1024.0 * 1024.0),
+        arenaStats.hugePageBytes / (1024.0 * 1024.0), GetTransparentHugePageBytes() / (1024.0 * 1024.0));
+    LogPrint(LogLevel::Info, "Resident memory: peak %.1f MB while loading (%.2fx the scene data), %.1f MB after loading, %.1f MB before",
+        (peakBytes - std::min(peakBytes, currentBytesBefore)) / (1024.0 * 1024.0), sceneBytes ? static_cast<double>(peakBytes - std::min(peakBytes, currentBytesBefore)) / sceneBytes : 0.0,
+        (currentBytes - std::min(currentBytes, currentBytesBefore)) / (1024.0 * 1024.0), currentBytesBefore / (1024.0 * 1024.0));
+
+    if (scene->cameras.empty())
+        scene->cameras.push_back({ Float3(0.0f), Float3(0.0f, 0.0f, 1.0f), Float3(0.0f, 1.0f, 0.0f), 1.0f });
+
+    // The counter needs to exist before the pool's threads are started, their misses are added once the path tracer is destroyed.
+    uint64_t numSamples;
+    double renderSeconds;
+    DataTlbMissCounter tlbMissCounter;
+    {
+        CpuPathTracer pathTracer(*scene, settings);
+        pathTracer.SetCamera(scene->cameras[0]);
+        const auto renderStart = std::chrono::high_resolution_clock::now();
+        tlbMissCounter.SetEnabled(true);
+        pathTracer.DrawIterations(samplesPerPixel);
+        tlbMissCounter.SetEnabled(false);
+        renderSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - renderStart).count();
+        numSamples = static_cast<uint64_t>(pathTracer.GetOutputWidth()) * pathTracer.GetOutputHeight() * samplesPerPixel;
+    }
+    const uint64_t numTlbMisses = tlbMissCounter.Read();
+
+    if (tlbMissCounter.IsAvailable())
+    {
+        LogPrint(LogLevel::Info, "Rendering: %.2f MSamples/s, %llu data TLB misses, %.1f per sample",
+            numSamples / renderSeconds * 1e-6, (unsigned long long)numTlbMisses, static_cast<double>(numTlbMisses) / numSamples);
+    }
+    else
+        LogPrint(LogLevel::Info, "Rendering: %.2f MSamples/s, data TLB misses can't be counted on this system", numSamples / renderSeconds * 1e-6);
+    return 0;
+}
+
+// Cuts every mesh into pieces of the given number of triangles, like exporters that write a mesh per polygon group.
+// Pieces cycle through three copies of their material, every 16th piece of a mesh that is not an emitter becomes one,
+// so that merging has to keep materials and lights apart.
+static void SplitMeshes(CpuScene& scene, uint32_t trianglesPerPiece)
+{
+    const uint32_t numMaterials = static_cast<uint32_t>(scene.materials.size());
+    for (uint32_t copy = 0; copy < 2; ++copy)
+    {
+        for (uint32_t materialIdx = 0; materialIdx < numMaterials; ++materialIdx)
+            scene.materials.push_back(scene.materials[materialIdx]);
+    }
+
+    std::vector<CpuScene::Mesh> pieces;
+    for (const CpuScene::Mesh& mesh : scene.meshes)
+    {
+        const uint32_t numTriangles = static_cast<uint32_t>(mesh.indices.size() / 3);
+        std::vector<uint32_t> pieceVertexIndices(mesh.positions.size(), UINT32_MAX);
+        for (uint32_t firstTriangle = 0, pieceIdx = 0; firstTriangle < numTriangles; firstTriangle += trianglesPerPiece, ++pieceIdx)
+        {
+            CpuScene::Mesh piece;
+            piece.name = mesh.name + " " + std::to_string(pieceIdx);
+            piece.materialIndex = mesh.materialIndex + (pieceIdx % 3) * numMaterials;
+            piece.isEmitter = mesh.isEmitter || pieceIdx % 16 == 15;
+            piece.areaLightRadiance = mesh.isEmitter ? mesh.areaLightRadiance : (piece.isEmitter ? Float3(2.0f) : Float3(0.0f));
+            const uint32_t endTriangle = std::min(firstTriangle + trianglesPerPiece, numTriangles);
+            for (uint32_t i = firstTriangle * 3; i < endTriangle * 3; ++i)
+            {
+                const uint32_t index = mesh.indices[i];
+                if (pieceVertexIndices[index] == UINT32_MAX)
+                {
+                    pieceVertexIndices[index] = static_cast<uint32_t>(piece.positions.size());
+                    piece.positions.push_back(mesh.positions[index]);
+                    piece.vertices.push_back(mesh.vertices[index]);
+                }
+                piece.indices.push_back(pieceVertexIndices[index]);
+            }
+            for (uint32_t i = firstTriangle * 3; i < endTriangle * 3; ++i)
+                pieceVertexIndices[mesh.indices[i]] = UINT32_MAX;
+            pieces.push_back(std::move(piece));
+        }
+    }
+    scene.meshes = std::move(pieces);
+
+    scene.areaLights.clear();
+    for (const CpuScene::Mesh& mesh : scene.meshes)
+    {
+        if (mesh.isEmitter)
+            scene.AddAreaLights(mesh);
+    }
+}
+
+// Material, light and all vertex data of a triangle, sorted lists of them are equal for scenes with the same triangles.
+typedef std::array<float, 5 + 3 * 8> TriangleRecord;
+
+static std::vector<TriangleRecord> GetSortedTriangles(const CpuScene& scene)
+{
+    std::vector<TriangleRecord> triangles;
+    for (const CpuScene::Mesh& mesh : scene.meshes)
+    {
+        for (size_t i = 0; i < mesh.indices.size(); i += 3)
+        {
+            TriangleRecord triangle = { static_cast<float>(mesh.materialIndex), mesh.isEmitter ? 1.0f : 0.0f,
+                                        mesh.areaLightRadiance.x, mesh.areaLightRadiance.y, mesh.areaLightRadiance.z };
+            for (int vertex = 0; vertex < 3; ++vertex)
+            {
+                const uint32_t index = mesh.indices[i + vertex];
+                const Float3& position = mesh.positions[index];
+                const CpuScene::Vertex& attributes = mesh.vertices[index];
+                const float values[8] = { position.x, position.y, position.z, attributes.normal.x, attributes.normal.y, attributes.normal.z,
+                                          attributes.texcoord.x, attributes.texcoord.y };
+                std::copy(values, values + 8, triangle.begin() + 5 + vertex * 8);
+            }
+            triangles.push_back(triangle);
+        }
+    }
+    std::sort(triangles.begin(), triangles.end());
+    return triangles;
+}
+
+typedef std::array<float, 3 * 6 + 4> AreaLightRecord;
+
+static std::vector<AreaLightRecord> GetSortedAreaLights(const CpuScene& scene)
+{
+    std::vector<AreaLightRecord> lights;
+    for (const CpuScene::AreaLightTriangle& light : scene.areaLights)
+    {
+        AreaLightRecord record;
+        for (int vertex = 0; vertex < 3; ++vertex)
+        {
+            const float values[6] = { light.positions[vertex].x, light.positions[vertex].y, light.positions[vertex].z,
+                                      light.normals[vertex].x, light.normals[vertex].y, light.normals[vertex].z };
+            std::copy(values, values + 6, record.begin() + vertex * 6);
+        }
+        record[18] = light.emittedRadiance.x;
+        record[19] = light.emittedRadiance.y;
+        record[20] = light.emittedRadiance.z;
+        record[21] = light.area;
+        lights.push_back(record);
+    }
+    std::sort(lights.begin(), lights.end());
+    return lights;
+}
+
+// Buffers, descriptors and shader binding table records the GPU path tracer needs for a scene with the given number of meshes,
+// see Scene::UploadMesh, PathTracer::CreateDescriptorHeap and PathTracer::CreateShaderBindingTable.
+static void PrintGpuMeshOverhead(const char* label, const CpuScene& scene)
+{
+    const uint32_t numMeshes = static_cast<uint32_t>(scene.meshes.size());
+    LogPrint(LogLevel::Info, "%-8s %8u meshes  %8u buffers  %8u descriptors  %8u shader records  %8u area light triangles",
+        label, numMeshes, numMeshes * 4, 4 + numMeshes * 2 + static_cast<uint32_t>(scene.textures.size()), 3 + numMeshes * 2, (unsigned int)scene.areaLights.size());
+}
+
+int RunMeshMergeTest(int argc, char** argv)
+{
+    std::string sceneFilePath;
+    uint32_t numGeneratedTriangles = 0;
+    uint32_t trianglesPerPiece = 0;
+    uint32_t smallMeshTriangles = 1024;
+    uint32_t numRays = 1 << 18;
+    bool validArguments = true;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (argv[i][0] != '-')
+            sceneFilePath = argv[i];
+        else if (strcmp(argv[i], "--triangles") == 0 && i + 1 < argc)
+            numGeneratedTriangles = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--split") == 0 && i + 1 < argc)
+            trianglesPerPiece = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--small-mesh-triangles") == 0 && i + 1 < argc)
+            smallMeshTriangles = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--rays") == 0 && i + 1 < argc)
+            numRays = strtoul(argv[++i], nullptr, 10);
+        else
+            validArguments = false;
+    }
+    if (!validArguments || (sceneFilePath.empty() && numGeneratedTriangles == 0))
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless mesh-merge-test <scene.pbrt> [options]\n\n"
+            "Loads the scene without merging, merges its small meshes and reports the number of meshes, buffers, descriptors and\n"
+            "shader binding table records the GPU path tracer would need before and after. Checks that the merged scene has exactly\n"
+            "the same triangles with the same materials and lights, and that rays hit the same surfaces in both.\n\n"
+            "Options:\n"
+            "  --triangles <n>             Generated building with about n triangles instead of a scene file\n"
+            "  --split <n>                 Cuts all meshes into pieces of n triangles first, with varying materials and lights\n"
+            "  --small-mesh-triangles <n>  Meshes with fewer triangles are merged (default %u)\n"
+            "  --rays <n>                  Camera rays traced through both scenes (default 262144)", smallMeshTriangles);
+        return 1;
+    }
+
+    ThreadPool threadPool;
+    std::unique_ptr<CpuScene> scene;
+    if (numGeneratedTriangles > 0)
+    {
+        scene = GenerateBuildingScene(numGeneratedTriangles);
+        PrepareGeneratedSceneForRendering(*scene);
+    }
+    else
+    {
+        CpuScene::ImportSettings importSettings;
+        importSettings.smallMeshTriangles = 0;
+        scene = CpuScene::LoadPbrtScene(sceneFilePath, &threadPool, importSettings);
+    }
+    if (!scene)
+        return 1;
+    if (trianglesPerPiece > 0)
+        SplitMeshes(*scene, trianglesPerPiece);
+
+    CpuScene mergedScene = *scene;
+    const auto mergeStart = std::chrono::high_resolution_clock::now();
+    mergedScene.MergeSmallMeshes(smallMeshTriangles);
+    const double mergeSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - mergeStart).count();
+
+    PrintGpuMeshOverhead("Before", *scene);
+    PrintGpuMeshOverhead("Merged", mergedScene);
+    LogPrint(LogLevel::Info, "Merging meshes with fewer than %u triangles took %.1f ms\n", smallMeshTriangles, mergeSeconds * 1000.0);
+
+    bool equivalent = true;
+    const std::vector<TriangleRecord> triangles = GetSortedTriangles(*scene);
+    const std::vector<TriangleRecord> mergedTriangles = GetSortedTriangles(mergedScene);
+    const bool sameTriangles = triangles == mergedTriangles;
+    LogPrint(sameTriangles ? LogLevel::Success : LogLevel::Failure, "%s triangles with materials, lights and vertex data (%u before, %u merged)",
+        sameTriangles ? "Same" : "Different", (unsigned int)triangles.size(), (unsigned int)mergedTriangles.size());
+    equivalent &= sameTriangles;
+
+    const bool sameAreaLights = GetSortedAreaLights(*scene) == GetSortedAreaLights(mergedScene);
+    LogPrint(sameAreaLights ? LogLevel::Success : LogLevel::Failure, "%s area light triangles", sameAreaLights ? "Same" : "Different");
+    equivalent &= sameAreaLights;
+
+    if (numRays > 0)
+    {
+        const CpuScene::CameraDefinition camera = scene->cameras.empty() ?
+            CpuScene::CameraDefinition{ Float3(0.0f), Float3(0.0f, 0.0f, 1.0f), Float3(0.0f, 1.0f, 0.0f), 1.0f } : scene->cameras[0];
+        Float3 cameraU, cameraV, cameraW;
+        camera.ComputeCameraParams(4.0f / 3.0f, cameraU, cameraV, cameraW);
+        std::mt19937 random(0);
+        std::uniform_real_distribution<float> screenCoord(-1.0f, 1.0f);
+        std::vector<Ray> rays(numRays);
+        for (Ray& ray : rays)
+            ray = { camera.position, DefaultRayTMin, Normalize(screenCoord(random) * cameraU + screenCoord(random) * cameraV + cameraW), DefaultRayTMax };
+
+        // Distance and surface of the closest hit need to match, several triangles at the exact same distance may be found in either scene.
+        const SceneIntersector intersector(*scene, &threadPool);
+        const SceneIntersector mergedIntersector(mergedScene, &threadPool);
+        std::atomic<uint32_t> numHits(0);
+        std::atomic<uint32_t> numDifferent(0);
+        threadPool.ParallelFor(0, numRays, 4096, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t rayIdx = begin; rayIdx < end; ++rayIdx)
+            {
+                RayHit hit, mergedHit;
+                const bool isHit = intersector.Intersect(rays[rayIdx], hit);
+                if (isHit != mergedIntersector.Intersect(rays[rayIdx], mergedHit))
+                    ++numDifferent;
+                else if (isHit)
+                {
+                    const CpuScene::Mesh& mesh = scene->meshes[hit.meshIndex];
+                    const CpuScene::Mesh& mergedMesh = mergedScene.meshes[mergedHit.meshIndex];
+                    if (hit.t != mergedHit.t || mesh.materialIndex != mergedMesh.materialIndex || mesh.isEmitter != mergedMesh.isEmitter)
+                        ++numDifferent;
+                    ++numHits;
+                }
+            }
+        }, "MeshMergeRays");
+        LogPrint(numDifferent == 0 ? LogLevel::Success : LogLevel::Failure, "%u of %u camera rays (%u hits) differ",
+            numDifferent.load(), numRays, numHits.load());
+        equivalent &= numDifferent == 0;
+    }
+
+    return equivalent ? 0 : 1;
+}
+
+// Writes a mesh as binary PLY file in one of three layouts. Layout 0 is what exporters usually write and only takes the fast
+// paths of PlyMeshReader, 1 has no texcoords and quads, 2 is big endian with double positions and an extra face property.
+static void WritePlyMesh(const CpuScene::Mesh& mesh, const std::string& path, uint32_t layout)
+{
+    // Two consecutive triangles that share the first corner and the edge in between are written as a quad,
+    // which the reader splits into the same two triangles again.
+    std::vector<uint32_t> faces;
+    uint32_t numFaces = 0;
+    for (size_t i = 0; i < mesh.indices.size(); i += 3, ++numFaces)
+    {
+        const uint32_t* triangle = &mesh.indices[i];
+        const bool isQuad = layout > 0 && i + 3 < mesh.indices.size() && triangle[3] == triangle[0] && triangle[4] == triangle[2];
+        faces.push_back(isQuad ? 4 : 3);
+        faces.insert(faces.end(), triangle, triangle + 3);
+        if (isQuad)
+        {
+            faces.push_back(triangle[5]);
+            i += 3;
+        }
+    }
+
+    std::string text = "ply\nformat ";
+    text += layout == 2 ? "binary_big_endian" : "binary_little_endian";
+    text += " 1.0\ncomment Generated by lightdam-headless pbrt-parse-benchmark\nelement vertex " + std::to_string(mesh.positions.size()) + "\n";
+    text += layout == 2 ? "property double x\nproperty double y\nproperty double z\n" : "property float x\nproperty float y\nproperty float z\n";
+    text += "property float nx\nproperty float ny\nproperty float nz\n";
+    if (layout == 0)
+        text += "property float u\nproperty float v\n";
+    text += "element face " + std::to_string(numFaces) + "\n";
+    if (layout == 2)
+        text += "property uchar flags\nproperty list int int vertex_index\n";
+    else
+        text += layout == 0 ? "property list uchar int vertex_indices\n" : "property list uchar uint vertex_indices\n";
+    text += "end_header\n";
+
+    auto append = [&text, layout](auto value)
+    {
+        char bytes[sizeof(value)];
+        memcpy(bytes, &value, sizeof(value));
+        if (layout == 2)
+            std::reverse(bytes, bytes + sizeof(value));
+        text.append(bytes, sizeof(value));
+    };
+    for (size_t vertexIdx = 0; vertexIdx < mesh.positions.size(); ++vertexIdx)
+    {
+        const Float3& position = mesh.positions[vertexIdx];
+        const CpuScene::Vertex& vertex = mesh.vertices[vertexIdx];
+        if (layout == 2)
+        {
+            append(static_cast<double>(position.x));
+            append(static_cast<double>(position.y));
+            append(static_cast<double>(position.z));
+        }
+        else
+        {
+            append(position.x);
+            append(position.y);
+            append(position.z);
+        }
+        append(vertex.normal.x);
+        append(vertex.normal.y);
+        append(vertex.normal.z);
+        if (layout == 0)
+        {
+            append(vertex.texcoord.x);
+            append(vertex.texcoord.y);
+        }
+    }
+    for (size_t i = 0; i < faces.size(); i += faces[i] + 1)
+    {
+        if (layout == 2)
+        {
+            append(static_cast<uint8_t>(0));
+            append(static_cast<int32_t>(faces[i]));
+        }
+        else
+            append(static_cast<uint8_t>(faces[i]));
+        for (uint32_t cornerIdx = 1; cornerIdx <= faces[i]; ++cornerIdx)
+            append(faces[i + cornerIdx]);
+    }
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file || fwrite(text.data(), 1, text.size(), file) != text.size())
+        LogPrint(LogLevel::Failure, "Failed to write %s", path.c_str());
+    if (file)
+        fclose(file);
+}
+
+static std::string GetPlyMeshFilePath(const std::string& filePrefix, uint32_t meshIdx)
+{
+    return filePrefix + "-mesh-" + std::to_string(meshIdx) + ".ply";
+}
+
+// Writes the meshes of a generated scene as pbrt text the way exporters do, a main file with camera and materials that
+// includes the given number of files with the meshes. Meshes are either inline triangle meshes or plymesh shapes with
+// their own PLY file. Returns the path of the main file.
+static std::string WriteGeneratedPbrtScene(const CpuScene& scene, const std::string& filePrefix, uint32_t numIncludes, bool plyMeshes)
+{
+    std::string text;
+    auto append = [&text](const char* format, auto... arguments)
+    {
+        char buffer[256];
+        const int length = snprintf(buffer, sizeof(buffer), format, arguments...);
+        text.append(buffer, std::min<size_t>(length, sizeof(buffer) - 1));
+    };
+    auto writeFile = [&text](const std::string& path)
+    {
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file || fwrite(text.data(), 1, text.size(), file) != text.size())
+            LogPrint(LogLevel::Failure, "Failed to write %s", path.c_str());
+        if (file)
+            fclose(file);
+        text.clear();
+    };
+
+    const CpuScene::CameraDefinition& camera = scene.cameras[0];
+    const Float3 lookAt = camera.position + camera.direction;
+    append("# Generated by lightdam-headless pbrt-parse-benchmark\n");
+    append("LookAt %.9g %.9g %.9g  %.9g %.9g %.9g  %.9g %.9g %.9g\n", camera.position.x, camera.position.y, camera.position.z,
+           lookAt.x, lookAt.y, lookAt.z, camera.up.x, camera.up.y, camera.up.z);
+    append("Camera \"perspective\" \"float fov\" [ %.9g ]\n", camera.fovRad * (180.0f / 3.14159265f));
+    append("Film \"image\" \"integer xresolution\" [ 1280 ] \"integer yresolution\" [ 720 ]\n\nWorldBegin\n");
+    append("MakeNamedMaterial \"grey\" \"string type\" [ \"matte\" ] \"rgb Kd\" [ 0.5 0.5 0.5 ]\n");
+    for (uint32_t includeIdx = 0; includeIdx < numIncludes; ++includeIdx)
+        append("Include \"%s-%u.pbrt\"\n", filePrefix.substr(filePrefix.find_last_of("/\\") + 1).c_str(), includeIdx);
+    append("WorldEnd\n");
+    writeFile(filePrefix + ".pbrt");
+
+    // Consecutive meshes go into the same file, so that they are parsed in their original order.
+    const uint32_t numMeshes = static_cast<uint32_t>(scene.meshes.size());
+    for (uint32_t includeIdx = 0; includeIdx < numIncludes; ++includeIdx)
+    {
+        for (uint32_t meshIdx = includeIdx * numMeshes / numIncludes; meshIdx < (includeIdx + 1) * numMeshes / numIncludes; ++meshIdx)
+        {
+            const CpuScene::Mesh& mesh = scene.meshes[meshIdx];
+            append("AttributeBegin\n  NamedMaterial \"grey\"\n");
+            if (mesh.isEmitter)
+                append("  AreaLightSource \"diffuse\" \"rgb L\" [ %.9g %.9g %.9g ]\n", mesh.areaLightRadiance.x, mesh.areaLightRadiance.y, mesh.areaLightRadiance.z);
+            if (plyMeshes)
+            {
+                const std::string plyFilePath = GetPlyMeshFilePath(filePrefix, meshIdx);
+                WritePlyMesh(mesh, plyFilePath, meshIdx % 3);
+                append("  Shape \"plymesh\" \"string filename\" [ \"%s\" ]\nAttributeEnd\n", plyFilePath.substr(plyFilePath.find_last_of("/\\") + 1).c_str());
+                continue;
+            }
+            append("  Shape \"trianglemesh\"\n    \"integer indices\" [");
+            for (size_t i = 0; i < mesh.indices.size(); ++i)
+                append(i % 12 == 0 ? "\n      %u" : " %u", mesh.indices[i]);
+            append("\n    ]\n    \"point P\" [");
+            for (size_t i = 0; i < mesh.positions.size(); ++i)
+                append(i % 4 == 0 ? "\n      %.9g %.9g %.9g" : "  %.9g %.9g %.9g", mesh.positions[i].x, mesh.positions[i].y, mesh.positions[i].z);
+            append("\n    ]\n    \"normal N\" [");
+            for (size_t i = 0; i < mesh.vertices.size(); ++i)
+                append(i % 4 == 0 ? "\n      %.9g %.9g %.9g" : "  %.9g %.9g %.9g", mesh.vertices[i].normal.x, mesh.vertices[i].normal.y, mesh.vertices[i].normal.z);
+            append("\n    ]\nAttributeEnd\n");
+        }
+        writeFile(filePrefix + "-" + std::to_string(includeIdx) + ".pbrt");
+    }
+    return filePrefix + ".pbrt";
+}
+
+// Shapes of the generated scene need to come out of the parser with exactly the numbers they were written with.
+static uint32_t CountDifferentShapes(const CpuScene& scene, const pbrt::Scene& pbrtScene)
+{
+    const std::vector<pbrt::Shape::SP>& shapes = pbrtScene.world->shapes;
+    uint32_t numDifferent = static_cast<uint32_t>(std::max(shapes.size(), scene.meshes.size()) - std::min(shapes.size(), scene.meshes.size()));
+    for (size_t meshIdx = 0; meshIdx < std::min(shapes.size(), scene.meshes.size()); ++meshIdx)
+    {
+        const CpuScene::Mesh& mesh = scene.meshes[meshIdx];
+        const auto shape = shapes[meshIdx]->as<pbrt::TriangleMesh>();
+        bool same = shape && shape->vertex.size() == mesh.positions.size() && shape->normal.size() == mesh.vertices.size() &&
+                    shape->index.size() * 3 == mesh.indices.size() && (shape->areaLight != nullptr) == mesh.isEmitter;
+        for (size_t i = 0; same && i < mesh.positions.size(); ++i)
+        {
+            same = shape->vertex[i].x == mesh.positions[i].x && shape->vertex[i].y == mesh.positions[i].y && shape->vertex[i].z == mesh.positions[i].z &&
+                   shape->normal[i].x == mesh.vertices[i].normal.x && shape->normal[i].y == mesh.vertices[i].normal.y && shape->normal[i].z == mesh.vertices[i].normal.z;
+        }
+        // Only PLY files have texcoords.
+        same = same && (shape->texcoord.empty() || shape->texcoord.size() == mesh.vertices.size());
+        for (size_t i = 0; same && i < shape->texcoord.size(); ++i)
+            same = shape->texcoord[i].x == mesh.vertices[i].texcoord.x && shape->texcoord[i].y == mesh.vertices[i].texcoord.y;
+        same = same && memcmp(shape->index.data(), mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t)) == 0;
+        if (!same)
+            ++numDifferent;
+    }
+    return numDifferent;
+}
+
+// Counts and world space bounds of all triangles, to compare scenes from different parsers.
+struct PbrtSceneSummary
+{
+    uint64_t numInstances = 0;
+    uint64_t numShapes = 0;
+    uint64_t numTriangles = 0;
+    uint64_t numVertices = 0;
+    uint64_t numEmitters = 0;
+    Float3 boundsMin = Float3(std::numeric_limits<float>::max());
+    Float3 boundsMax = Float3(-std::numeric_limits<float>::max());
+};
+
+static PbrtSceneSummary SummarizePbrtScene(pbrt::Scene& scene)
+{
+    scene.makeSingleLevel();
+    PbrtSceneSummary summary;
+    for (const pbrt::Instance::SP& instance : scene.world->instances)
+    {
+        ++summary.numInstances;
+        for (const pbrt::Shape::SP& shape : instance->object->shapes)
+        {
+            const auto mesh = shape->as<pbrt::TriangleMesh>();
+            if (!mesh)
+                continue;
+            ++summary.numShapes;
+            summary.numTriangles += mesh->index.size();
+            summary.numVertices += mesh->vertex.size();
+            if (mesh->areaLight)
+                ++summary.numEmitters;
+            for (const pbrt::vec3f& vertex : mesh->vertex)
+            {
+                const pbrt::vec3f position = instance->xfm * vertex;
+                summary.boundsMin = Min(summary.boundsMin, Float3(position.x, position.y, position.z));
+                summary.boundsMax = Max(summary.boundsMax, Float3(position.x, position.y, position.z));
+            }
+        }
+    }
+    return summary;
+}
+
+static void PrintPbrtSceneSummary(const char* label, const PbrtSceneSummary& summary)
+{
+    LogPrint(LogLevel::Info, "%-12s %6llu instances %8llu shapes %10llu triangles %10llu vertices %6llu emitters, bounds (%g %g %g) to (%g %g %g)", label,
+        (unsigned long long)summary.numInstances, (unsigned long long)summary.numShapes, (unsigned long long)summary.numTriangles,
+        (unsigned long long)summary.numVertices, (unsigned long long)summary.numEmitters,
+        summary.boundsMin.x, summary.boundsMin.y, summary.boundsMin.z, summary.boundsMax.x, summary.boundsMax.y, summary.boundsMax.z);
+}
+
+static bool AreSummariesEqual(const PbrtSceneSummary& a, const PbrtSceneSummary& b)
+{
+    // Transformations are applied in a different order, positions may differ in the last bits.
+    auto close = [](float x, float y) { return fabsf(x - y) <= 1e-4f * std::max(1.0f, std::max(fabsf(x), fabsf(y))); };
+    return a.numShapes == b.numShapes && a.numTriangles == b.numTriangles && a.numVertices == b.numVertices && a.numEmitters == b.numEmitters &&
+           close(a.boundsMin.x, b.boundsMin.x) && close(a.boundsMin.y, b.boundsMin.y) && close(a.boundsMin.z, b.boundsMin.z) &&
+           close(a.boundsMax.x, b.boundsMax.x) && close(a.boundsMax.y, b.boundsMax.y) && close(a.boundsMax.z, b.boundsMax.z);
+}
+
+// Numbers the way exporters write them, checked against strtod. Returns the number of differences.
+static uint32_t CheckNumberParsing(uint32_t numNumbers)
+{
+    std::mt19937 random(0);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::string text;
+    std::vector<size_t> offsets;
+    for (uint32_t numberIdx = 0; numberIdx < numNumbers; ++numberIdx)
+    {
+        char buffer[64];
+        const double magnitude = pow(10.0, uniform(random) * 16.0 - 8.0) * (random() % 2 ? -1.0 : 1.0);
+        switch (numberIdx % 6)
+        {
+        case 0: snprintf(buffer, sizeof(buffer), "%.9g", static_cast<float>(uniform(random) * magnitude)); break;
+        case 1: snprintf(buffer, sizeof(buffer), "%.17g", uniform(random) * magnitude); break;
+        case 2: snprintf(buffer, sizeof(buffer), "%f", uniform(random) * 1000.0 - 500.0); break;
+        case 3: snprintf(buffer, sizeof(buffer), "%.6e", uniform(random) * magnitude); break;
+        case 4: snprintf(buffer, sizeof(buffer), "%d", static_cast<int>(random() % 2000000) - 1000000); break;
+        default: snprintf(buffer, sizeof(buffer), "%.25f", uniform(random)); break;
+        }
+        offsets.push_back(text.size());
+        text += buffer;
+        text += ' ';
+    }
+
+    uint32_t numDifferent = 0;
+    double fastSeconds = 0.0, strtodSeconds = 0.0;
+    std::vector<double> values(numNumbers);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint32_t numberIdx = 0; numberIdx < numNumbers; ++numberIdx)
+    {
+        const char* number = text.data() + offsets[numberIdx];
+        if (ParsePbrtNumber(number, text.data() + text.size(), values[numberIdx]) != strchr(number, ' '))
+            ++numDifferent;
+    }
+    fastSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    start = std::chrono::high_resolution_clock::now();
+    for (uint32_t numberIdx = 0; numberIdx < numNumbers; ++numberIdx)
+    {
+        const double value = strtod(text.data() + offsets[numberIdx], nullptr);
+        if (memcmp(&value, &values[numberIdx], sizeof(double)) != 0)
+            ++numDifferent;
+    }
+    strtodSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    LogPrint(numDifferent == 0 ? LogLevel::Success : LogLevel::Failure, "%u of %u numbers differ from strtod, %.1f M numbers/s vs. %.1f M numbers/s with strtod",
+        numDifferent, numNumbers, numNumbers / fastSeconds * 1e-6, numNumbers / strtodSeconds * 1e-6);
+    return numDifferent;
+}
+
+int RunPbrtParseBenchmark(int argc, char** argv)
+{
+    std::string sceneFilePath;
+    uint32_t numGeneratedTriangles = 0;
+    uint32_t numIncludes = 8;
+    uint32_t numThreads = 0;
+    bool keepFiles = false;
+    bool plyMeshes = false;
+    bool validArguments = true;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (argv[i][0] != '-')
+            sceneFilePath = argv[i];
+        else if (strcmp(argv[i], "--triangles") == 0 && i + 1 < argc)
+            numGeneratedTriangles = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--ply") == 0)
+            plyMeshes = true;
+        else if (strcmp(argv[i], "--includes") == 0 && i + 1 < argc)
+            numIncludes = std::max(1ul, strtoul(argv[++i], nullptr, 10));
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            numThreads = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--keep") == 0)
+            keepFiles = true;
+        else
+            validArguments = false;
+    }
+    if (!validArguments || (sceneFilePath.empty() && numGeneratedTriangles == 0))
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless pbrt-parse-benchmark <scene.pbrt> [options]\n\n"
+            "Checks the number parser against strtod, then parses the scene with ParsePbrtTextScene on one and on all threads\n"
+            "and with pbrt-parser's importPBRT, reports MB/s of all three and checks that they found the same geometry.\n"
+            "GB/s and triangles/s of reading the binary PLY files of plymesh shapes are reported separately.\n\n"
+            "Options:\n"
+            "  --triangles <n>  Writes a generated building with about n triangles to pbrt files in the working directory instead\n"
+            "                   of reading a scene file, the parsed shapes need to be exactly the generated ones\n"
+            "  --ply            Writes every generated mesh to its own binary PLY file, using three different layouts\n"
+            "  --includes <n>   Number of files the generated meshes are spread over (default 8)\n"
+            "  --keep           Keeps the generated files\n"
+            "  --threads <n>    Number of threads (default all hardware threads)");
+        return 1;
+    }
+
+    bool success = CheckNumberParsing(1000000) == 0;
+
+    std::unique_ptr<CpuScene> generatedScene;
+    if (numGeneratedTriangles > 0)
+    {
+        generatedScene = GenerateBuildingScene(numGeneratedTriangles);
+        PrepareGeneratedSceneForRendering(*generatedScene);
+        sceneFilePath = WriteGeneratedPbrtScene(*generatedScene, "pbrt-parse-benchmark", numIncludes, plyMeshes);
+    }
+
+    ThreadPool threadPool(numThreads);
+    struct Run
+    {
+        const char* label;
+        ThreadPool* threadPool;
+        bool pbrtParser;
+    };
+    const std::string threadsLabel = std::to_string(threadPool.GetNumThreads()) + (threadPool.GetNumThreads() == 1 ? " thread" : " threads");
+    const Run runs[] = { { "1 thread", nullptr, false }, { threadsLabel.c_str(), &threadPool, false }, { "pbrt-parser", nullptr, true } };
+    PbrtSceneSummary summaries[3];
+    bool parsed[3] = {};
+    double singleThreadedSeconds = 0.0;
+    for (int runIdx = 0; runIdx < 3; ++runIdx)
+    {
+        const Run& run = runs[runIdx];
+        PbrtTextParserStats stats;
+        pbrt::Scene::SP scene;
+        const auto start = std::chrono::high_resolution_clock::now();
+        try
+        {
+            scene = run.pbrtParser ? pbrt::importPBRT(sceneFilePath) : ParsePbrtTextScene(sceneFilePath, run.threadPool, &stats);
+        }
+        catch (std::exception& exception)
+        {
+            LogPrint(LogLevel::Failure, "%s: %s", run.label, exception.what());
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        if (!scene)
+        {
+            LogPrint(run.pbrtParser ? LogLevel::Warning : LogLevel::Failure, "%-12s failed to parse the scene%s", run.label,
+                run.pbrtParser ? "" : " or needs pbrt-parser for it");
+            success &= run.pbrtParser;
+            continue;
+        }
+
+        if (!run.pbrtParser)
+        {
+            if (!run.threadPool)
+                singleThreadedSeconds = seconds;
+            LogPrint(LogLevel::Info, "%-12s %7.3f s  %7.1f MB/s  %6.1f M numbers/s  %.2fx  (%u files with %.1f MB, %.3f s tokenizing, %.3f s creating shapes)",
+                run.label, seconds, stats.numBytes / seconds / (1024.0 * 1024.0), stats.numNumbers / seconds * 1e-6, singleThreadedSeconds / seconds,
+                (unsigned int)stats.numFiles, stats.numBytes / (1024.0 * 1024.0), stats.tokenizeSeconds, stats.buildSeconds);
+            if (stats.numPlyFiles > 0)
+            {
+                LogPrint(LogLevel::Info, "%-12s %7.3f s  %7.2f GB/s  %6.1f M triangles/s  (%u PLY files with %.1f MB)", "", stats.plySeconds,
+                    stats.numPlyBytes / stats.plySeconds / (1024.0 * 1024.0 * 1024.0), stats.numPlyTriangles / stats.plySeconds * 1e-6,
+                    (unsigned int)stats.numPlyFiles, stats.numPlyBytes / (1024.0 * 1024.0));
+            }
+            if (generatedScene)
+            {
+                const uint32_t numDifferent = CountDifferentShapes(*generatedScene, *scene);
+                LogPrint(numDifferent == 0 ? LogLevel::Success : LogLevel::Failure, "%-12s %u of %u shapes differ from the generated meshes",
+                    run.label, numDifferent, (unsigned int)generatedScene->meshes.size());
+                success &= numDifferent == 0;
+            }
+        }
+        else
+            LogPrint(LogLevel::Info, "%-12s %7.3f s  %.2fx", run.label, seconds, singleThreadedSeconds / seconds);
+        summaries[runIdx] = SummarizePbrtScene(*scene);
+        parsed[runIdx] = true;
+    }
+
+    LogPrint(LogLevel::Info, "");
+    for (int runIdx = 0; runIdx < 3; ++runIdx)
+    {
+        if (parsed[runIdx])
+            PrintPbrtSceneSummary(runs[runIdx].label, summaries[runIdx]);
+    }
+    for (int runIdx = 1; runIdx < 3; ++runIdx)
+    {
+        if (parsed[0] && parsed[runIdx])
+        {
+            const bool equal = AreSummariesEqual(summaries[0], summaries[runIdx]);
+            LogPrint(equal ? LogLevel::Success : LogLevel::Failure, "%s geometry with %s", equal ? "Same" : "Different", runs[runIdx].label);
+            success &= equal;
+        }
+    }
+
+    if (generatedScene && !keepFiles)
+    {
+        std::remove(sceneFilePath.c_str());
+        for (uint32_t includeIdx = 0; includeIdx < numIncludes; ++includeIdx)
+            std::remove(("pbrt-parse-benchmark-" + std::to_string(includeIdx) + ".pbrt").c_str());
+        for (uint32_t meshIdx = 0; plyMeshes && meshIdx < generatedScene->meshes.size(); ++meshIdx)
+            std::remove(GetPlyMeshFilePath("pbrt-parse-benchmark", meshIdx).c_str());
+    }
+    return success ? 0 : 1;
+}
@@ -0,0 +1,245 @@
+#include "Commands.h"
+#include "../lightdam/cpu/SceneIntersector.h"
+#include "../lightdam/cpu/TriangleBlock.h"
+#include "../lightdam/CpuFeatures.h"
+#include "../lightdam/ErrorHandling.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+// Sphere made from a subdivided cube, every vertex is computed from integer grid coordinates only.
+// Vertices on the edges between cube faces are therefore bit identical for the triangles of both faces.
+static CpuScene::Mesh GenerateCubeSphere(uint32_t subdivisions, const Float3& center, float radius)
+{
+    CpuScene::Mesh mesh;
+    mesh.materialIndex = 0;
+    mesh.isEmitter = false;
+    mesh.areaLightRadiance = Float3(0.0f);
+
+    auto gridPosition = [&](int x, int y, int z)
+    {
+        const float scale = 2.0f / subdivisions;
+        return center + Normalize(Float3(x * scale - 1.0f, y * scale - 1.0f, z * scale - 1.0f)) * radius;
+    };
+    const int n = static_cast<int>(subdivisions);
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        for (int side = 0; side <= n; side += n)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                for (int j = 0; j < n; ++j)
+                {
+                    int corners[4][3];
+                    const int quad[4][2] = { { i, j }, { i + 1, j }, { i + 1, j + 1 }, { i, j + 1 } };
+                    for (int c = 0; c < 4; ++c)
+                    {
+                        corners[c][axis] = side;
+                        corners[c][(axis + 1) % 3] = quad[c][0];
+                        corners[c][(axis + 2) % 3] = quad[c][1];
+                    }
+                    const uint32_t first = static_cast<uint32_t>(mesh.positions.size());
+                    for (int c = 0; c < 4; ++c)
+                        mesh.positions.push_back(gridPosition(corners[c][0], corners[c][1], corners[c][2]));
+                    mesh.indices.insert(mesh.indices.end(), { first, first + 1, first + 2, first, first + 2, first + 3 });
+                }
+            }
+        }
+    }
+    return mesh;
+}
+
+// Disk of triangles around a shared center vertex in the z = 0 plane.
+static CpuScene::Mesh GenerateFan(uint32_t numTriangles)
+{
+    CpuScene::Mesh mesh;
+    mesh.materialIndex = 0;
+    mesh.isEmitter = false;
+    mesh.areaLightRadiance = Float3(0.0f);
+    mesh.positions.push_back(Float3(0.0f));
+    for (uint32_t i = 0; i < numTriangles; ++i)
+    {
+        const float angle = i * 2.0f * 3.14159265f / numTriangles;
+        mesh.positions.push_back(Float3(cosf(angle), sinf(angle), 0.0f));
+    }
+    for (uint32_t i = 0; i < numTriangles; ++i)
+        mesh.indices.insert(mesh.indices.end(), { 0, 1 + i, 1 + (i + 1) % numTriangles });
+    return mesh;
+}
+
+struct RobustnessResult
+{
+    uint32_t numRays = 0;
+    uint32_t numMisses = 0;
+    float maxBaryError = 0.0f;  // Distance between ray hit point and the point given by the barycentrics.
+};
+
+// All rays are expected to hit, since they are aimed at the inside of a closed surface or at the center of a fan.
+static RobustnessResult TraceRobustnessRays(const SceneIntersector& intersector, const CpuScene& scene, const std::vector<Ray>& rays)
+{
+    RobustnessResult result;
+    for (const Ray& ray : rays)
+    {
+        ++result.numRays;
+        RayHit hit;
+        if (!intersector.Intersect(ray, hit))
+        {
+            ++result.numMisses;
+            continue;
+        }
+
+        const CpuScene::Mesh& mesh = scene.meshes[hit.meshIndex];
+        const Float3 baryPosition = BarycentricLerp(mesh.positions[mesh.indices[hit.primitiveIndex * 3 + 0]],
+            mesh.positions[mesh.indices[hit.primitiveIndex * 3 + 1]], mesh.positions[mesh.indices[hit.primitiveIndex * 3 + 2]], hit.bary);
+        result.maxBaryError = std::max(result.maxBaryError, Length(baryPosition - (ray.origin + hit.t * ray.direction)));
+    }
+    return result;
+}
+
+// Rays from inside the sphere through every vertex and edge midpoint, where neighboring triangles meet.
+static std::vector<Ray> GenerateSphereRobustnessRays(const CpuScene::Mesh& mesh, const Float3& origin)
+{
+    std::vector<Ray> rays;
+    for (size_t i = 0; i < mesh.indices.size(); i += 3)
+    {
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            const Float3& v0 = mesh.positions[mesh.indices[i + corner]];
+            const Float3& v1 = mesh.positions[mesh.indices[i + (corner + 1) % 3]];
+            rays.push_back({ origin, 0.0f, Normalize(v0 - origin), DefaultRayTMax });
+            rays.push_back({ origin, 0.0f, Normalize((v0 + v1) * 0.5f - origin), DefaultRayTMax });
+        }
+    }
+    return rays;
+}
+
+// Intersects the rays in groups of raysPerBlock with consecutive blocks, numRepetitions times. Returns the number of hits.
+TARGET_AVX2 static uint32_t IntersectBlocks(const std::vector<TriangleBlock8>& blocks, const std::vector<Ray>& rays, uint32_t raysPerBlock, uint32_t numRepetitions)
+{
+    uint32_t numHits = 0;
+    for (uint32_t repetition = 0; repetition < numRepetitions; ++repetition)
+    {
+        for (size_t i = 0; i < rays.size(); ++i)
+        {
+            const WatertightRay watertightRay = PrepareWatertightRay(rays[i].origin, rays[i].direction, rays[i].tMin);
+            float tMax = rays[i].tMax;
+            uint32_t lane;
+            Float2 bary;
+            bool frontFace;
+            numHits += IntersectTriangleBlock8<false>(blocks[i / raysPerBlock], watertightRay, tMax, lane, bary, frontFace) ? 1 : 0;
+        }
+    }
+    return numHits;
+}
+
+int RunTriangleTest(int argc, char** argv)
+{
+    uint32_t subdivisions = 32;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--subdivisions") == 0 && i + 1 < argc)
+            subdivisions = strtoul(argv[++i], nullptr, 10);
+        else
+            subdivisions = 0;
+    }
+    if (subdivisions == 0)
+    {
+        LogPrint(LogLevel::Info,
+            "Usage: lightdam-headless triangle-test [options]\n\n"
+            "Shoots rays at shared edges and vertices of closed meshes, compares Moller-Trumbore with the watertight\n"
+            "8 wide test and measures the throughput of the latter.\n\n"
+            "Options:\n"
+            "  --subdivisions <n>   Quads per cube face edge of the test sphere (default 32)");
+        return 1;
+    }
+    if (!CpuSupportsAvx2())
+    {
+        LogPrint(LogLevel::Failure, "AVX2 is not available, the watertight 8 wide intersector is not used on this cpu");
+        return 1;
+    }
+
+    LogPrint(LogLevel::Info, "Triangle data: %u bytes per triangle for Moller-Trumbore, %u bytes per block of 8 (%.0f bytes per triangle if full)",
+        (unsigned int)(sizeof(Float3) * 3 + sizeof(uint32_t) * 2), (unsigned int)sizeof(TriangleBlock8), sizeof(TriangleBlock8) / 8.0);
+
+    // Off center sphere and an origin that is not its center, so the vertices are not symmetric around the ray origin.
+    const Float3 sphereCenter(0.3f, -0.2f, 0.1f);
+    const Float3 sphereOrigin = sphereCenter + Float3(0.1f, 0.05f, -0.07f);
+    CpuScene sphereScene;
+    sphereScene.meshes.push_back(GenerateCubeSphere(subdivisions, sphereCenter, 1.0f));
+    const std::vector<Ray> sphereRays = GenerateSphereRobustnessRays(sphereScene.meshes[0], sphereOrigin);
+
+    // Fan center seen from random points above it.
+    CpuScene fanScene;
+    fanScene.meshes.push_back(GenerateFan(subdivisions * 4));
+    std::vector<Ray> fanRays(sphereRays.size());
+    std::mt19937 random(0);
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    for (Ray& ray : fanRays)
+    {
+        ray.origin = Float3(uniform(random), uniform(random), uniform(random) * 0.5f + 1.0f);
+        ray.direction = Normalize(-ray.origin);
+        ray.tMin = 0.0f;
+        ray.tMax = DefaultRayTMax;
+    }
+
+    struct TestCase
+    {
+        const char* name;
+        const CpuScene& scene;
+        const std::vector<Ray>& rays;
+    };
+    const TestCase testCases[] =
+    {
+        { "sphere edges", sphereScene, sphereRays },
+        { "fan center", fanScene, fanRays },
+    };
+    bool watertight = true;
+    for (const TestCase& testCase : testCases)
+    {
+        const SceneIntersector mollerTrumbore(testCase.scene, nullptr, BvhBuilder::BinnedSah, BvhLayout::Binary);
+        const SceneIntersector blocks(testCase.scene, nullptr, BvhBuilder::BinnedSah, BvhLayout::Wide);
+        const RobustnessResult mollerTrumboreResult = TraceRobustnessRays(mollerTrumbore, testCase.scene, testCase.rays);
+        const RobustnessResult blocksResult = TraceRobustnessRays(blocks, testCase.scene, testCase.rays);
+        watertight &= blocksResult.numMisses == 0;
+        LogPrint(blocksResult.numMisses == 0 ? LogLevel::Success : LogLevel::Failure,
+            "%-14s %7u rays  Moller-Trumbore %5u misses  watertight %5u misses  (barycentrics off by at most %.2g / %.2g)",
+            testCase.name, blocksResult.numRays, mollerTrumboreResult.numMisses, blocksResult.numMisses,
+            mollerTrumboreResult.maxBaryError, blocksResult.maxBaryError);
+    }
+
+    // Throughput with blocks in the L1 cache. Every ray goes through one of the triangles of the block it is tested
+    // against, so there is no early out and the numbers are a lower bound.
+    std::vector<TriangleBlock8> blocks;
+    const CpuScene::Mesh& sphere = sphereScene.meshes[0];
+    for (uint32_t triangle = 0; triangle + 8 <= sphere.indices.size() / 3 && blocks.size() < 64; triangle += 8)
+    {
+        TriangleBlock8 block = {};
+        for (uint32_t lane = 0; lane < 8; ++lane)
+        {
+            for (int vertex = 0; vertex < 3; ++vertex)
+            {
+                const Float3& position = sphere.positions[sphere.indices[(triangle + lane) * 3 + vertex]];
+                for (int axis = 0; axis < 3; ++axis)
+                    block.vertices[vertex][axis][lane] = position[axis];
+            }
+        }
+        blocks.push_back(block);
+    }
+    // GenerateSphereRobustnessRays makes 6 rays per triangle.
+    const uint32_t raysPerBlock = 6 * 8;
+    const std::vector<Ray> blockRays(sphereRays.begin(), sphereRays.begin() + blocks.size() * raysPerBlock);
+    const uint32_t numRepetitions = 1000;
+    auto start = std::chrono::high_resolution_clock::now();
+    const uint32_t numHits = IntersectBlocks(blocks, blockRays, raysPerBlock, numRepetitions);
+    auto end = std::chrono::high_resolution_clock::now();
+    const double numBlockTests = static_cast<double>(blockRays.size()) * numRepetitions;
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    LogPrint(LogLevel::Info, "Watertight 8 wide test: %.1f M blocks/s, %.1f M triangle intersections/s (%.1f%% hits)",
+        numBlockTests / seconds * 1e-6, numBlockTests * 8 / seconds * 1e-6, numHits * 100.0 / numBlockTests);
+
+    return watertight ? 0 : 1;
+}
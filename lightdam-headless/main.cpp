@@ -0,0 +1,64 @@
+#include "Commands.h"
+#include "../lightdam/ErrorHandling.h"
+
+#include <cstring>
+
+struct Command
+{
+    const char* name;
+    const char* description;
+    int (*run)(int argc, char** argv);
+};
+
+static const Command commands[] =
+{
+    { "rng-test", "Runs the statistical test battery on the random number generators", RunRngTest },
+    { "rng-benchmark", "Measures random number generator throughput", RunRngBenchmark },
+    { "halton-test", "Checks the Halton sampler against ComputeHaltonSequence and compares their throughput", RunHaltonTest },
+    { "sobol-test", "Checks the stratification of the Sobol sampler and compares its error with Halton, Weyl and random samples", RunSobolTest },
+    { "render", "Renders a pbrt scene with the CPU path tracer", RunRender },
+    { "wavefront-benchmark", "Compares the throughput of wavefront rendering with tracing one path at a time", RunWavefrontBenchmark },
+    { "shading-benchmark", "Compares shading kernels compiled per material type with picking them per hit on a mixed material scene", RunShadingBenchmark },
+    { "scheduler-benchmark", "Compares work stealing with taking tiles in rows for 1 up to all threads", RunSchedulerBenchmark },
+    { "numa-benchmark", "Compares NUMA aware rendering with a single copy of the scene for 1 up to all threads", RunNumaBenchmark },
+    { "bvh-build", "Compares BVH builders in build time, tree quality and trace performance", RunBvhBuildBenchmark },
+    { "bvh-trace", "Compares binary and 8 wide BVH traversal for camera, diffuse and shadow rays", RunBvhTraceBenchmark },
+    { "bvh-spatial", "Compares binned SAH and spatial split BVHs in tree quality and trace performance", RunBvhSpatialSplitBenchmark },
+    { "bvh-quantized", "Checks quantized 8 wide BVH nodes for missed hits and compares memory and trace performance", RunBvhQuantizationTest },
+    { "bvh-instances", "Measures per frame refit and rebuild cost of the top level BVH over animated instances", RunBvhInstanceBenchmark },
+    { "bvh-lazy", "Compares the time to the first image with a lazily built BVH against one built up front", RunBvhLazyBenchmark },
+    { "bvh-cache", "Compares building a BVH with mapping it from a cache file and checks that stale files are rebuilt", RunBvhCacheBenchmark },
+    { "bvh-packets", "Compares tracing camera rays in 8x8 packets against single rays and checks that both find the same hits", RunBvhPacketBenchmark },
+    { "triangle-test", "Checks the watertight triangle intersector on shared edges and measures its throughput", RunTriangleTest },
+    { "brdf-test", "Checks the 8 wide BRDF functions against the scalar ones and compares their throughput", RunBrdfTest },
+    { "job-test", "Checks the thread pool's tasks, jobs and callbacks and measures its scheduling overhead", RunJobTest },
+    { "memory-benchmark", "Reports peak memory of loading a scene into the arena and TLB misses of rendering it", RunMemoryBenchmark },
+    { "mesh-merge-test", "Merges small meshes by material and checks that the scene stays the same", RunMeshMergeTest },
+    { "pbrt-parse-benchmark", "Measures MB/s of the pbrt text parser and GB/s of its PLY reader against pbrt-parser, checks numbers and shapes", RunPbrtParseBenchmark },
+};
+
+static void PrintUsage()
+{
+    LogPrint(LogLevel::Info, "Usage: lightdam-headless <command> [options]\n\nCommands:");
+    for (const Command& command : commands)
+        LogPrint(LogLevel::Info, "  %-20s %s", command.name, command.description);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    for (const Command& command : commands)
+    {
+        if (strcmp(argv[1], command.name) == 0)
+            return command.run(argc - 1, argv + 1);
+    }
+
+    LogPrint(LogLevel::Failure, "Unknown command \"%s\"", argv[1]);
+    PrintUsage();
+    return 1;
+}
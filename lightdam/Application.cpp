@@ -7,8 +7,11 @@
 #include "ToneMapper.h"
 #include "ErrorHandling.h"
 #include "FrameCapture.h"
+#include "ThreadPool.h"
 
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 
 #include <dxgi1_6.h>
 #include "../external/d3dx12.h"
@@ -23,6 +26,7 @@
 
 Application::Application(int argc, char** argv)
     : m_window(new Window(L"LightDam", L"LightDam", 1280, 768))
+    , m_threadPool(new ThreadPool())
     , m_shaderDirectoryWatcher(L"shaders")
 {
     CreateDeviceAndSwapChain();
@@ -40,10 +44,16 @@ Application::Application(int argc, char** argv)
     m_activeCamera.SetPosition(DirectX::XMVectorSet(0.0f, 0.0f, -1.0f, 0.0f));
     m_activeCamera.SetUp(DirectX::XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
 
-    if (argc > 1)
-        LoadScene(argv[1]);
-    else
-        LoadScene("");
+    // lightdam [scene.pbrt] [--merge-small-meshes <n>]
+    std::string sceneFilePath;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--merge-small-meshes") == 0 && i + 1 < argc)
+            m_smallMeshTriangles = strtoul(argv[++i], nullptr, 10);
+        else
+            sceneFilePath = argv[i];
+    }
+    LoadScene(sceneFilePath);
 
     m_window->AddProcHandler([this](HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam) {
         if (message == WM_SIZE)
@@ -58,6 +68,8 @@ Application::Application(int argc, char** argv)
 Application::~Application()
 {
     m_swapChain->GetGraphicsCommandQueue().WaitUntilAllGPUWorkIsFinished();
+    // Finishes outstanding screenshots.
+    m_threadPool.reset();
 
     m_commandList = nullptr;
     for (int i = 0; i < SwapChain::MaxFramesInFlight; ++i)
@@ -120,6 +132,9 @@ void Application::Run()
             }
             m_onRenderFinishedCallbacks.clear();
         }
+
+        // Results of jobs.
+        m_threadPool->ExecuteMainThreadCallbacks();
     }
 }
 
@@ -129,7 +144,11 @@ void Application::LoadScene(const std::string& pbrtFileName)
     if (pbrtFileName.empty())
         newScene = nullptr; //Scene::LoadTestScene(m_swapChain->GetGraphicsCommandQueue(), m_device.Get());
     else
-        newScene = Scene::LoadPbrtScene(pbrtFileName, m_swapChain->GetGraphicsCommandQueue(), m_device.Get());
+    {
+        CpuScene::ImportSettings importSettings;
+        importSettings.smallMeshTriangles = m_smallMeshTriangles;
+        newScene = Scene::LoadPbrtScene(pbrtFileName, m_swapChain->GetGraphicsCommandQueue(), m_device.Get(), m_threadPool.get(), importSettings);
+    }
     if (!newScene)
         return;
     m_scene = std::move(newScene);
@@ -162,7 +181,7 @@ void Application::SaveImage(FrameCapture::FileFormat format, const char* filenam
     }
     else
         screenshotName = filename;
-    WaitForGPUOnNextFrameFinishAndExecute([this, format, screenshotName]() { m_frameCapture->GetStagingDataAndWriteFile(screenshotName, format); });
+    WaitForGPUOnNextFrameFinishAndExecute([this, format, screenshotName]() { m_frameCapture->GetStagingDataAndWriteFile(screenshotName, format, *m_threadPool); });
 }
 
 void Application::CreateDeviceAndSwapChain()
@@ -44,6 +44,7 @@ private:
     std::unique_ptr<class PathTracer> m_pathTracer;
     std::unique_ptr<class ToneMapper> m_toneMapper;
     std::unique_ptr<class FrameCapture> m_frameCapture;
+    std::unique_ptr<class ThreadPool> m_threadPool;
     ControllableCamera m_activeCamera;
     DirectoryWatcher m_shaderDirectoryWatcher;
 
@@ -53,6 +54,8 @@ private:
     ComPtr<struct ID3D12Device5>             m_device;
 
     bool m_renderIterationQueued = false;
+    // CpuScene::ImportSettings::smallMeshTriangles of all scenes, from --merge-small-meshes.
+    uint32_t m_smallMeshTriangles = 0;
 
     std::vector<OnRenderFinishedCallback> m_onRenderFinishedCallbacks;
 };
@@ -0,0 +1,506 @@
+#include "BlueNoise.h"
+#include "MathUtils.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <limits>
+#include <random>
+#include <thread>
+
+bool BlueNoiseSettings::IsValid() const
+{
+    return IsPowerOfTwo(width) && IsPowerOfTwo(height) && IsPowerOfTwo(numSlices) &&
+           sigmaSpatial > 0.0f && sigmaTemporal > 0.0f &&
+           initialPatternDensity > 0.0f && initialPatternDensity < 1.0f;
+}
+
+// In-place radix-2 FFT of count (power of two) elements that are stride apart.
+static void Fft(std::complex<double>* data, uint32_t count, uint32_t stride, bool inverse)
+{
+    for (uint32_t i = 1, j = 0; i < count; ++i)
+    {
+        uint32_t bit = count >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+            std::swap(data[i * stride], data[j * stride]);
+    }
+
+    const double pi = 3.14159265358979323846;
+    for (uint32_t length = 2; length <= count; length <<= 1)
+    {
+        const double angle = (inverse ? 2.0 : -2.0) * pi / length;
+        const std::complex<double> rootStep(std::cos(angle), std::sin(angle));
+        for (uint32_t start = 0; start < count; start += length)
+        {
+            std::complex<double> root(1.0, 0.0);
+            for (uint32_t k = 0; k < length / 2; ++k)
+            {
+                std::complex<double>& a = data[(start + k) * stride];
+                std::complex<double>& b = data[(start + k + length / 2) * stride];
+                const std::complex<double> t = b * root;
+                b = a - t;
+                a += t;
+                root *= rootStep;
+            }
+        }
+    }
+
+    if (inverse)
+    {
+        for (uint32_t i = 0; i < count; ++i)
+            data[i * stride] /= count;
+    }
+}
+
+static void Fft2D(std::complex<double>* data, uint32_t width, uint32_t height, bool inverse)
+{
+    for (uint32_t y = 0; y < height; ++y)
+        Fft(data + y * width, width, 1, inverse);
+    for (uint32_t x = 0; x < width; ++x)
+        Fft(data + x, height, width, inverse);
+}
+
+// Void and cluster state for a single mask.
+//
+// Energy only increases while adding points and only decreases while removing points.
+// Finding the tightest cluster (max energy of all set pixels) and the largest void (min energy of all unset pixels) is therefore
+// done with a two level cache of row and slice extrema which for the most part can be kept up to date without rescanning.
+class VoidAndCluster
+{
+public:
+    VoidAndCluster(const BlueNoiseSettings& settings, uint32_t spatialRadius, uint32_t temporalRadius, const float* spatialKernel, const float* temporalKernel);
+
+    void SetInitialPattern(const std::vector<uint8_t>& pattern);
+    const std::vector<uint8_t>& GetPattern() const { return m_isSet; }
+
+    // Searches for the tightest cluster or largest void respectively.
+    uint32_t FindCluster() { return m_clusterCache.FindBest(*this); }
+    uint32_t FindVoid()    { return m_voidCache.FindBest(*this); }
+
+    void Toggle(uint32_t pixel);
+
+    // Only enabled caches are kept up to date.
+    void EnableCaches(bool cluster, bool voids);
+
+private:
+    void ComputeEnergy();
+    void OnEnergyChanged(uint32_t pixel, float oldEnergy, bool wasSet);
+
+    struct ExtremumCache
+    {
+        // Cluster search looks for the maximum energy of all set pixels, void search for the minimum energy of all unset pixels.
+        bool searchCluster;
+        bool enabled = false;
+
+        std::vector<uint32_t> rowBestPixel;
+        std::vector<uint32_t> sliceBestRow;
+        std::vector<uint8_t> rowDirty;
+        std::vector<uint8_t> sliceDirty;
+        std::vector<uint32_t> dirtyRows;
+        std::vector<uint32_t> dirtySlices;
+
+        float Key(const VoidAndCluster& state, uint32_t pixel) const
+        {
+            if (searchCluster)
+                return state.m_isSet[pixel] ? state.m_energy[pixel] : -std::numeric_limits<float>::infinity();
+            else
+                return state.m_isSet[pixel] ? std::numeric_limits<float>::infinity() : state.m_energy[pixel];
+        }
+        bool IsBetter(float a, float b) const { return searchCluster ? a > b : a < b; }
+
+        void Reset(const VoidAndCluster& state);
+        void MarkRowDirty(const VoidAndCluster& state, uint32_t row);
+        void OnKeyChanged(const VoidAndCluster& state, uint32_t pixel, float oldKey, float newKey);
+        void OnRowImproved(const VoidAndCluster& state, uint32_t row, float rowKey);
+        uint32_t FindBest(const VoidAndCluster& state);
+    };
+
+    const BlueNoiseSettings& m_settings;
+    const uint32_t m_spatialRadius;
+    const uint32_t m_temporalRadius;
+    const float* m_spatialKernel;
+    const float* m_temporalKernel;
+    const uint32_t m_numRows;
+
+    std::vector<float> m_energy;
+    std::vector<uint8_t> m_isSet;
+
+    ExtremumCache m_clusterCache;
+    ExtremumCache m_voidCache;
+};
+
+VoidAndCluster::VoidAndCluster(const BlueNoiseSettings& settings, uint32_t spatialRadius, uint32_t temporalRadius, const float* spatialKernel, const float* temporalKernel)
+    : m_settings(settings)
+    , m_spatialRadius(spatialRadius)
+    , m_temporalRadius(temporalRadius)
+    , m_spatialKernel(spatialKernel)
+    , m_temporalKernel(temporalKernel)
+    , m_numRows(settings.height * settings.numSlices)
+    , m_energy((size_t)settings.width * settings.height * settings.numSlices, 0.0f)
+    , m_isSet(m_energy.size(), 0)
+{
+    m_clusterCache.searchCluster = true;
+    m_voidCache.searchCluster = false;
+}
+
+void VoidAndCluster::SetInitialPattern(const std::vector<uint8_t>& pattern)
+{
+    assert(pattern.size() == m_isSet.size());
+    m_isSet = pattern;
+    ComputeEnergy();
+    if (m_clusterCache.enabled)
+        m_clusterCache.Reset(*this);
+    if (m_voidCache.enabled)
+        m_voidCache.Reset(*this);
+}
+
+void VoidAndCluster::EnableCaches(bool cluster, bool voids)
+{
+    if (cluster && !m_clusterCache.enabled)
+        m_clusterCache.Reset(*this);
+    if (voids && !m_voidCache.enabled)
+        m_voidCache.Reset(*this);
+    m_clusterCache.enabled = cluster;
+    m_voidCache.enabled = voids;
+}
+
+void VoidAndCluster::ComputeEnergy()
+{
+    const uint32_t width = m_settings.width;
+    const uint32_t height = m_settings.height;
+    const uint32_t sliceSize = width * height;
+
+    // Spatial part: Convolve every slice with the wrapped spatial kernel via FFT.
+    std::vector<std::complex<double>> kernelSpectrum(sliceSize);
+    const int spatialRadius = (int)m_spatialRadius;
+    for (int dy = -spatialRadius; dy <= spatialRadius; ++dy)
+    {
+        for (int dx = -spatialRadius; dx <= spatialRadius; ++dx)
+        {
+            const uint32_t x = (uint32_t)(dx + (int)width) % width;
+            const uint32_t y = (uint32_t)(dy + (int)height) % height;
+            kernelSpectrum[y * width + x] += m_spatialKernel[(dy + spatialRadius) * (2 * spatialRadius + 1) + dx + spatialRadius];
+        }
+    }
+    Fft2D(kernelSpectrum.data(), width, height, false);
+
+    std::vector<std::complex<double>> slice(sliceSize);
+    for (uint32_t z = 0; z < m_settings.numSlices; ++z)
+    {
+        const uint8_t* isSet = &m_isSet[z * sliceSize];
+        for (uint32_t i = 0; i < sliceSize; ++i)
+            slice[i] = isSet[i] ? 1.0 : 0.0;
+        Fft2D(slice.data(), width, height, false);
+        for (uint32_t i = 0; i < sliceSize; ++i)
+            slice[i] *= kernelSpectrum[i];
+        Fft2D(slice.data(), width, height, true);
+        float* energy = &m_energy[z * sliceSize];
+        for (uint32_t i = 0; i < sliceSize; ++i)
+            energy[i] = (float)slice[i].real();
+    }
+
+    // Temporal part: Only a handful of taps, direct convolution is faster than another FFT.
+    const int temporalRadius = (int)m_temporalRadius;
+    const int numSlices = (int)m_settings.numSlices;
+    for (int z = 0; z < numSlices; ++z)
+    {
+        for (int dz = -temporalRadius; dz <= temporalRadius; ++dz)
+        {
+            if (dz == 0)
+                continue;
+            const float weight = m_temporalKernel[dz + temporalRadius];
+            const uint8_t* source = &m_isSet[((z + dz + numSlices) % numSlices) * sliceSize];
+            float* energy = &m_energy[z * sliceSize];
+            for (uint32_t i = 0; i < sliceSize; ++i)
+                energy[i] += source[i] * weight;
+        }
+    }
+}
+
+void VoidAndCluster::Toggle(uint32_t pixel)
+{
+    const uint32_t width = m_settings.width;
+    const uint32_t height = m_settings.height;
+    const uint32_t sliceSize = width * height;
+    const int px = (int)(pixel % width);
+    const int py = (int)(pixel / width % height);
+    const int pz = (int)(pixel / sliceSize);
+
+    const bool wasSet = m_isSet[pixel] != 0;
+    m_isSet[pixel] = wasSet ? 0 : 1;
+    const float sign = wasSet ? -1.0f : 1.0f;
+    OnEnergyChanged(pixel, m_energy[pixel], wasSet);
+
+    const int spatialRadius = (int)m_spatialRadius;
+    const float* kernel = m_spatialKernel;
+    for (int dy = -spatialRadius; dy <= spatialRadius; ++dy)
+    {
+        const uint32_t rowStart = pz * sliceSize + (uint32_t)(py + dy + (int)height) % height * width;
+        for (int dx = -spatialRadius; dx <= spatialRadius; ++dx, ++kernel)
+        {
+            const uint32_t target = rowStart + (uint32_t)(px + dx + (int)width) % width;
+            const float oldEnergy = m_energy[target];
+            m_energy[target] += sign * *kernel;
+            OnEnergyChanged(target, oldEnergy, m_isSet[target] != 0);
+        }
+    }
+
+    const int temporalRadius = (int)m_temporalRadius;
+    const int numSlices = (int)m_settings.numSlices;
+    for (int dz = -temporalRadius; dz <= temporalRadius; ++dz)
+    {
+        if (dz == 0)
+            continue;
+        const uint32_t target = (uint32_t)((pz + dz + numSlices) % numSlices) * sliceSize + (uint32_t)(py * (int)width + px);
+        const float oldEnergy = m_energy[target];
+        m_energy[target] += sign * m_temporalKernel[dz + temporalRadius];
+        OnEnergyChanged(target, oldEnergy, m_isSet[target] != 0);
+    }
+}
+
+void VoidAndCluster::OnEnergyChanged(uint32_t pixel, float oldEnergy, bool wasSet)
+{
+    // Reconstruct the old keys from old energy & set state.
+    const float inf = std::numeric_limits<float>::infinity();
+    if (m_clusterCache.enabled)
+        m_clusterCache.OnKeyChanged(*this, pixel, wasSet ? oldEnergy : -inf, m_clusterCache.Key(*this, pixel));
+    if (m_voidCache.enabled)
+        m_voidCache.OnKeyChanged(*this, pixel, wasSet ? inf : oldEnergy, m_voidCache.Key(*this, pixel));
+}
+
+void VoidAndCluster::ExtremumCache::Reset(const VoidAndCluster& state)
+{
+    rowBestPixel.resize(state.m_numRows);
+    sliceBestRow.resize(state.m_settings.numSlices);
+    rowDirty.assign(state.m_numRows, 1);
+    sliceDirty.assign(state.m_settings.numSlices, 1);
+    dirtyRows.resize(state.m_numRows);
+    for (uint32_t row = 0; row < state.m_numRows; ++row)
+        dirtyRows[row] = row;
+    dirtySlices.resize(state.m_settings.numSlices);
+    for (uint32_t slice = 0; slice < state.m_settings.numSlices; ++slice)
+        dirtySlices[slice] = slice;
+}
+
+void VoidAndCluster::ExtremumCache::MarkRowDirty(const VoidAndCluster& state, uint32_t row)
+{
+    if (rowDirty[row])
+        return;
+    rowDirty[row] = 1;
+    dirtyRows.push_back(row);
+
+    // Slice only needs to be rescanned if it was relying on this row.
+    const uint32_t slice = row / state.m_settings.height;
+    if (!sliceDirty[slice] && sliceBestRow[slice] == row)
+    {
+        sliceDirty[slice] = 1;
+        dirtySlices.push_back(slice);
+    }
+}
+
+void VoidAndCluster::ExtremumCache::OnRowImproved(const VoidAndCluster& state, uint32_t row, float rowKey)
+{
+    const uint32_t slice = row / state.m_settings.height;
+    if (sliceDirty[slice] || sliceBestRow[slice] == row)
+        return;
+    if (IsBetter(rowKey, Key(state, rowBestPixel[sliceBestRow[slice]])))
+        sliceBestRow[slice] = row;
+}
+
+void VoidAndCluster::ExtremumCache::OnKeyChanged(const VoidAndCluster& state, uint32_t pixel, float oldKey, float newKey)
+{
+    const uint32_t row = pixel / state.m_settings.width;
+    if (rowDirty[row])
+        return;
+
+    const uint32_t rowBest = rowBestPixel[row];
+    if (rowBest == pixel)
+    {
+        if (IsBetter(oldKey, newKey))
+            MarkRowDirty(state, row);
+        else
+            OnRowImproved(state, row, newKey);
+    }
+    else if (IsBetter(newKey, Key(state, rowBest)))
+    {
+        rowBestPixel[row] = pixel;
+        OnRowImproved(state, row, newKey);
+    }
+}
+
+uint32_t VoidAndCluster::ExtremumCache::FindBest(const VoidAndCluster& state)
+{
+    const uint32_t width = state.m_settings.width;
+    const uint32_t height = state.m_settings.height;
+
+    for (uint32_t row : dirtyRows)
+    {
+        uint32_t best = row * width;
+        float bestKey = Key(state, best);
+        for (uint32_t pixel = best + 1; pixel < (row + 1) * width; ++pixel)
+        {
+            const float key = Key(state, pixel);
+            if (IsBetter(key, bestKey))
+            {
+                bestKey = key;
+                best = pixel;
+            }
+        }
+        rowBestPixel[row] = best;
+        rowDirty[row] = 0;
+    }
+    // Rows that were dirty may now be better than what their (not dirty) slice knows of.
+    for (uint32_t row : dirtyRows)
+        OnRowImproved(state, row, Key(state, rowBestPixel[row]));
+    dirtyRows.clear();
+
+    for (uint32_t slice : dirtySlices)
+    {
+        uint32_t best = slice * height;
+        float bestKey = Key(state, rowBestPixel[best]);
+        for (uint32_t row = best + 1; row < (slice + 1) * height; ++row)
+        {
+            const float key = Key(state, rowBestPixel[row]);
+            if (IsBetter(key, bestKey))
+            {
+                bestKey = key;
+                best = row;
+            }
+        }
+        sliceBestRow[slice] = best;
+        sliceDirty[slice] = 0;
+    }
+    dirtySlices.clear();
+
+    uint32_t best = rowBestPixel[sliceBestRow[0]];
+    float bestKey = Key(state, best);
+    for (uint32_t slice = 1; slice < state.m_settings.numSlices; ++slice)
+    {
+        const uint32_t pixel = rowBestPixel[sliceBestRow[slice]];
+        const float key = Key(state, pixel);
+        if (IsBetter(key, bestKey))
+        {
+            bestKey = key;
+            best = pixel;
+        }
+    }
+    return best;
+}
+
+static std::vector<float> ComputeGaussianWeights(uint32_t radius, float sigma)
+{
+    std::vector<float> weights(2 * radius + 1);
+    for (uint32_t i = 0; i < weights.size(); ++i)
+    {
+        const float d = (float)i - (float)radius;
+        weights[i] = std::exp(-d * d / (2.0f * sigma * sigma));
+    }
+    return weights;
+}
+
+BlueNoiseGenerator::BlueNoiseGenerator(const BlueNoiseSettings& settings)
+    : m_settings(settings)
+{
+    assert(settings.IsValid());
+
+    // 3.5 sigma covers all but a negligible part of the gaussian. Must not overlap itself after wrapping.
+    m_spatialRadius = std::min((uint32_t)std::ceil(settings.sigmaSpatial * 3.5f), (std::min(settings.width, settings.height) - 1) / 2);
+    m_temporalRadius = std::min((uint32_t)std::ceil(settings.sigmaTemporal * 3.5f), (settings.numSlices - 1) / 2);
+
+    const std::vector<float> spatialWeights = ComputeGaussianWeights(m_spatialRadius, settings.sigmaSpatial);
+    m_spatialKernel.resize(spatialWeights.size() * spatialWeights.size());
+    for (size_t y = 0; y < spatialWeights.size(); ++y)
+    {
+        for (size_t x = 0; x < spatialWeights.size(); ++x)
+            m_spatialKernel[y * spatialWeights.size() + x] = spatialWeights[x] * spatialWeights[y];
+    }
+    m_temporalKernel = ComputeGaussianWeights(m_temporalRadius, settings.sigmaTemporal);
+}
+
+std::vector<uint32_t> BlueNoiseGenerator::GenerateRanks(uint32_t seed) const
+{
+    const uint32_t numPixels = m_settings.width * m_settings.height * m_settings.numSlices;
+    VoidAndCluster state(m_settings, m_spatialRadius, m_temporalRadius, m_spatialKernel.data(), m_temporalKernel.data());
+
+    // Initial binary pattern: White noise, then move the tightest cluster into the largest void until it no longer changes anything.
+    const uint32_t numInitialPoints = std::max(1u, (uint32_t)(numPixels * m_settings.initialPatternDensity));
+    std::vector<uint8_t> initialPattern(numPixels, 0);
+    {
+        std::mt19937 randomGenerator(seed);
+        for (uint32_t numSet = 0; numSet < numInitialPoints; )
+        {
+            uint32_t pixel = randomGenerator() % numPixels;
+            numSet += initialPattern[pixel] ? 0 : 1;
+            initialPattern[pixel] = 1;
+        }
+        state.SetInitialPattern(initialPattern);
+        state.EnableCaches(true, true);
+        for (uint32_t iteration = 0; iteration < numPixels; ++iteration)
+        {
+            const uint32_t cluster = state.FindCluster();
+            state.Toggle(cluster);
+            const uint32_t largestVoid = state.FindVoid();
+            if (largestVoid == cluster)
+            {
+                state.Toggle(cluster);
+                break;
+            }
+            state.Toggle(largestVoid);
+        }
+        initialPattern = state.GetPattern();
+    }
+
+    std::vector<uint32_t> ranks(numPixels);
+
+    // Phase 1: Remove tightest clusters from the initial pattern.
+    state.EnableCaches(true, false);
+    state.SetInitialPattern(initialPattern);
+    for (uint32_t rank = numInitialPoints; rank > 0; --rank)
+    {
+        const uint32_t cluster = state.FindCluster();
+        state.Toggle(cluster);
+        ranks[cluster] = rank - 1;
+    }
+
+    // Phase 2 & 3: Fill largest voids starting again with the initial pattern.
+    // With a linear energy function, the tightest cluster of unset pixels is the same as the largest void of set pixels,
+    // so unlike the original paper there is no need to switch to an inverted pattern halfway through.
+    state.EnableCaches(false, true);
+    state.SetInitialPattern(initialPattern);
+    for (uint32_t rank = numInitialPoints; rank < numPixels; ++rank)
+    {
+        const uint32_t largestVoid = state.FindVoid();
+        state.Toggle(largestVoid);
+        ranks[largestVoid] = rank;
+    }
+
+    return ranks;
+}
+
+std::vector<uint8_t> BlueNoiseGenerator::GenerateTexture(uint32_t numChannels, uint32_t seed, uint32_t numThreads) const
+{
+    const uint32_t numPixels = m_settings.width * m_settings.height * m_settings.numSlices;
+    std::vector<uint8_t> texture((size_t)numPixels * numChannels);
+
+    auto generateChannel = [&](uint32_t channel)
+    {
+        const std::vector<uint32_t> ranks = GenerateRanks(seed + channel);
+        for (uint32_t pixel = 0; pixel < numPixels; ++pixel)
+            texture[(size_t)pixel * numChannels + channel] = (uint8_t)((uint64_t)ranks[pixel] * 256 / numPixels);
+    };
+
+    numThreads = std::max(1u, std::min(numThreads, numChannels));
+    for (uint32_t firstChannel = 0; firstChannel < numChannels; firstChannel += numThreads)
+    {
+        std::vector<std::thread> threads;
+        for (uint32_t channel = firstChannel; channel < std::min(firstChannel + numThreads, numChannels); ++channel)
+            threads.emplace_back(generateChannel, channel);
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    return texture;
+}
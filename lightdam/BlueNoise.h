@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Spatiotemporal blue noise generation with the void and cluster method.
+//
+// Follows Wolfe et al. 2022, "Spatiotemporal Blue Noise Masks": Every slice is a 2D blue noise mask and the values of every pixel
+// over all slices form a 1D blue noise sequence. Achieved by a cross shaped energy function: points only repel each other if they
+// are either on the same slice or on the same pixel.
+//
+// Full energy evaluations go through an FFT, all other updates are incremental.
+// All dimensions wrap around and need to be powers of two.
+struct BlueNoiseSettings
+{
+    uint32_t width = 128;
+    uint32_t height = 128;
+    uint32_t numSlices = 64;
+
+    float sigmaSpatial = 1.9f;
+    float sigmaTemporal = 1.9f;
+
+    // Fraction of pixels set in the initial binary pattern.
+    float initialPatternDensity = 0.1f;
+
+    bool IsValid() const;
+};
+
+class BlueNoiseGenerator
+{
+public:
+    BlueNoiseGenerator(const BlueNoiseSettings& settings);
+
+    // Ranks of all pixels (a permutation of 0 to width*height*numSlices-1), one slice after another.
+    std::vector<uint32_t> GenerateRanks(uint32_t seed) const;
+
+    // Generates numChannels independent masks, numThreads at a time and quantizes them to 8 bit.
+    // Result is interleaved per pixel (e.g. RGBA) with all slices stacked vertically, i.e. a width x (height * numSlices) image.
+    std::vector<uint8_t> GenerateTexture(uint32_t numChannels, uint32_t seed, uint32_t numThreads) const;
+
+private:
+    BlueNoiseSettings m_settings;
+    uint32_t m_spatialRadius;
+    uint32_t m_temporalRadius;
+
+    // Truncated gaussians, (2r+1)^2 spatial and 2r+1 temporal entries.
+    std::vector<float> m_spatialKernel;
+    std::vector<float> m_temporalKernel;
+};
@@ -0,0 +1,59 @@
+#include "CpuFeatures.h"
+#include <cstdint>
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#else
+    #include <cpuid.h>
+#endif
+
+static void CpuId(uint32_t leaf, uint32_t subleaf, uint32_t registers[4])
+{
+#if defined(_MSC_VER)
+    int values[4];
+    __cpuidex(values, (int)leaf, (int)subleaf);
+    for (int i = 0; i < 4; ++i)
+        registers[i] = (uint32_t)values[i];
+#else
+    __cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+static uint64_t ReadXcr0()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+static bool QueryAvx2Support()
+{
+    uint32_t registers[4];
+    CpuId(0, 0, registers);
+    if (registers[0] < 7)
+        return false;
+
+    // OS needs to save ymm registers (OSXSAVE and XCR0 bits for xmm & ymm).
+    CpuId(1, 0, registers);
+    const bool hasOsxsave = (registers[2] & (1u << 27)) != 0;
+    const bool hasFma = (registers[2] & (1u << 12)) != 0;
+    const bool hasPopcnt = (registers[2] & (1u << 23)) != 0;
+    if (!hasOsxsave || !hasFma || !hasPopcnt || (ReadXcr0() & 0x6) != 0x6)
+        return false;
+
+    CpuId(7, 0, registers);
+    const bool hasAvx2 = (registers[1] & (1u << 5)) != 0;
+    const bool hasBmi1 = (registers[1] & (1u << 3)) != 0;
+    const bool hasBmi2 = (registers[1] & (1u << 8)) != 0;
+    return hasAvx2 && hasBmi1 && hasBmi2;
+}
+
+bool CpuSupportsAvx2()
+{
+    static const bool supported = QueryAvx2Support();
+    return supported;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+// Marks a function that may use AVX2 intrinsics. Only call it if CpuSupportsAvx2() returned true.
+// MSVC allows intrinsics of any instruction set without this, gcc and clang need it to enable them per function.
+#if defined(_MSC_VER) && !defined(__clang__)
+    #define TARGET_AVX2
+#else
+    #define TARGET_AVX2 __attribute__((target("avx2,fma,bmi,bmi2,popcnt")))
+#endif
+
+// Whether both cpu and OS support AVX2 (and FMA, BMI1/2, POPCNT which come with all AVX2 cpus). Result is cached.
+bool CpuSupportsAvx2();
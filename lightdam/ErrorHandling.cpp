@@ -1,4 +1,6 @@
 #include "ErrorHandling.h"
+
+#ifdef _WIN32
 #include <Windows.h>
 
 std::string HrToString(HRESULT hr)
@@ -30,3 +32,17 @@ void detail::LogPrint(LogLevel logLevel, const char* message)
 
     OutputDebugStringA(message);
 }
+#else
+void detail::LogPrint(LogLevel logLevel, const char* message)
+{
+    const char* color = "\x1b[0m";
+    if (logLevel == LogLevel::Failure)
+        color = "\x1b[91m";
+    else if (logLevel == LogLevel::Warning)
+        color = "\x1b[33m";
+    else if (logLevel == LogLevel::Success)
+        color = "\x1b[92m";
+
+    printf("%s%s\x1b[0m", color, message);
+}
+#endif
@@ -1,7 +1,11 @@
 #pragma once
 
+#include <cstdio>
+#include <cstring>
 #include <stdexcept>
 #include <string>
+
+#ifdef _WIN32
 #include <winerror.h>
 
 std::string HrToString(HRESULT hr);
@@ -25,6 +29,7 @@ inline void ThrowIfFailed(HRESULT hr)
     if (FAILED(hr))
         throw HResultException(hr);
 }
+#endif
 
 enum class LogLevel
 {
@@ -43,7 +48,12 @@ template<typename ...Args>
 inline void LogPrint(LogLevel logLevel, const char* format, Args&&... args)
 {
     char buffer[1024];
+#ifdef _WIN32
     sprintf_s(buffer, format, args...);
     strcat_s(buffer, "\n");
+#else
+    snprintf(buffer, sizeof(buffer) - 1, format, args...);
+    strcat(buffer, "\n");
+#endif
     detail::LogPrint(logLevel, buffer);
 }
\ No newline at end of file
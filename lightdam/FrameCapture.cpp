@@ -1,8 +1,11 @@
 #include "FrameCapture.h"
 #include "ErrorHandling.h"
 #include "MathUtils.h"
+#include "ThreadPool.h"
 #include <fstream>
 #include <algorithm>
+#include <cstring>
+#include <memory>
 #include "../external/d3dx12.h"
 #include "../external/stb/stb_image_write.h"
 
@@ -43,20 +46,20 @@ static bool WritePfm(const float* rgba, uint32_t width, uint32_t height, const s
 static bool WriteBmp(const float* rgba, uint32_t width, uint32_t height, const std::string& filename)
 {
     std::vector<uint8_t> bmpData(width * height * 3);
-    const float* colorHdr = rgba;
+    uint64_t rowPitch = Align(width * sizeof(float) * 4, D3D12_TEXTURE_DATA_PITCH_ALIGNMENT) / sizeof(float);
     for (uint32_t y = 0; y < height; ++y)
     {
+        const float* color = rgba + y * rowPitch;
         for (uint32_t x = 0; x < width; ++x)
         {
             // We store iteration count in the last channel, need to normalize
             uint8_t* colorLdr = &bmpData[(y * width + x) * 3];
-            colorLdr[0] = (uint8_t)std::min(powf(rgba[0] / rgba[3], 1.0f / 2.2f) * 255, 255.0f);
-            colorLdr[1] = (uint8_t)std::min(powf(rgba[1] / rgba[3], 1.0f / 2.2f) * 255, 255.0f);
-            colorLdr[2] = (uint8_t)std::min(powf(rgba[2] / rgba[3], 1.0f / 2.2f) * 255, 255.0f);
+            colorLdr[0] = (uint8_t)std::min(powf(color[0] / color[3], 1.0f / 2.2f) * 255, 255.0f);
+            colorLdr[1] = (uint8_t)std::min(powf(color[1] / color[3], 1.0f / 2.2f) * 255, 255.0f);
+            colorLdr[2] = (uint8_t)std::min(powf(color[2] / color[3], 1.0f / 2.2f) * 255, 255.0f);
 
-            rgba += 4;
+            color += 4;
         }
-        rgba = Align(rgba, D3D12_TEXTURE_DATA_PITCH_ALIGNMENT);
     }
     return stbi_write_bmp(filename.c_str(), (int)width, (int)height, 3, bmpData.data()) != 0;
 }
@@ -100,23 +103,39 @@ void FrameCapture::CopyTextureToStaging(const TextureResource& sourceResource, I
     m_holdsUnsavedCopy = true;
 }
 
-void FrameCapture::GetStagingDataAndWriteFile(const std::string& filename, FileFormat format)
+void FrameCapture::GetStagingDataAndWriteFile(const std::string& filename, FileFormat format, ThreadPool& threadPool)
 {
-    ScopedResourceMap resourceMap(m_stagingResource);
-    bool result = false;
-    switch (format)
+    // The staging resource may be reused by the next capture before the file is written.
+    const uint32_t width = m_lastCopiedTextureWidth;
+    const uint32_t height = m_lastCopiedTextureHeight;
+    const uint64_t rowPitch = Align(width * sizeof(float) * 4, D3D12_TEXTURE_DATA_PITCH_ALIGNMENT) / sizeof(float);
+    std::shared_ptr<std::vector<float>> rgba(new std::vector<float>(rowPitch * height));
     {
-    case FileFormat::Pfm:
-        result = WritePfm((float*)resourceMap.Get(), m_lastCopiedTextureWidth, m_lastCopiedTextureHeight, filename);
-        break;
-    case FileFormat::Bmp:
-        result = WriteBmp((float*)resourceMap.Get(), m_lastCopiedTextureWidth, m_lastCopiedTextureHeight, filename);
-        break;
+        ScopedResourceMap resourceMap(m_stagingResource);
+        // The last row is not necessarily padded.
+        memcpy(rgba->data(), resourceMap.Get(), std::min<uint64_t>(rgba->size() * sizeof(float), m_stagingResource.GetSizeInBytes()));
     }
     m_holdsUnsavedCopy = false;
 
-    if (result)
-        LogPrint(LogLevel::Success, "Wrote screenshot to %s", filename.c_str());
-    else
-        LogPrint(LogLevel::Failure, "Error writing screenshot to %s", filename.c_str());
+    threadPool.Schedule([rgba, width, height, filename, format, &threadPool]()
+    {
+        bool result = false;
+        switch (format)
+        {
+        case FileFormat::Pfm:
+            result = WritePfm(rgba->data(), width, height, filename);
+            break;
+        case FileFormat::Bmp:
+            result = WriteBmp(rgba->data(), width, height, filename);
+            break;
+        }
+
+        threadPool.RunOnMainThread([result, filename]()
+        {
+            if (result)
+                LogPrint(LogLevel::Success, "Wrote screenshot to %s", filename.c_str());
+            else
+                LogPrint(LogLevel::Failure, "Error writing screenshot to %s", filename.c_str());
+        });
+    }, "WriteScreenshot");
 }
@@ -5,6 +5,8 @@
 #include <cstdint>
 #include <string>
 
+class ThreadPool;
+
 class FrameCapture
 {
 public:
@@ -18,9 +20,9 @@ public:
     };
     static const char* s_fileFormatExtensions[2];
 
-    // Retrieves data from the staging resource and safes it to file.
-    // User needs to ensure copy already "arrived" there.
-    void GetStagingDataAndWriteFile(const std::string& filename, FileFormat format);
+    // Retrieves data from the staging resource and safes it to file in a job.
+    // User needs to ensure copy already "arrived" there. The result is logged from ThreadPool::ExecuteMainThreadCallbacks.
+    void GetStagingDataAndWriteFile(const std::string& filename, FileFormat format, ThreadPool& threadPool);
 
     bool GetHoldsUnsavedCopy() const { return m_holdsUnsavedCopy; }
 
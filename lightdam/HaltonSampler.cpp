@@ -0,0 +1,128 @@
+#include "HaltonSampler.h"
+#include <array>
+#include <random>
+#include <utility>
+
+using RadicalInverseFunction = float(*)(uint32_t);
+using ScrambledRadicalInverseFunction = float(*)(uint32_t, const uint16_t*);
+
+template<size_t... BaseIndices>
+static std::array<RadicalInverseFunction, MaxHaltonBaseIdx> CreateRadicalInverseTable(std::index_sequence<BaseIndices...>)
+{
+    return { &RadicalInverse<HaltonPrimes[BaseIndices]>... };
+}
+
+template<size_t... BaseIndices>
+static std::array<ScrambledRadicalInverseFunction, MaxHaltonBaseIdx> CreateScrambledRadicalInverseTable(std::index_sequence<BaseIndices...>)
+{
+    return { &ScrambledRadicalInverse<HaltonPrimes[BaseIndices]>... };
+}
+
+template<size_t... BaseIndices>
+static std::array<const float*, MaxHaltonBaseIdx> CreateDigitWeightTable(std::index_sequence<BaseIndices...>)
+{
+    return { g_haltonDigitWeights<HaltonPrimes[BaseIndices]>.weights... };
+}
+
+static const auto s_radicalInverseFunctions = CreateRadicalInverseTable(std::make_index_sequence<MaxHaltonBaseIdx>());
+static const auto s_scrambledRadicalInverseFunctions = CreateScrambledRadicalInverseTable(std::make_index_sequence<MaxHaltonBaseIdx>());
+static const auto s_digitWeights = CreateDigitWeightTable(std::make_index_sequence<MaxHaltonBaseIdx>());
+
+HaltonSampler::HaltonSampler(Mode mode, uint32_t scrambleSeed)
+    : m_mode(mode)
+    , m_permutationOffsets()
+{
+    if (mode != Mode::Scrambled)
+        return;
+
+    uint32_t totalPermutationSize = 0;
+    for (int baseIdx = 0; baseIdx < MaxHaltonBaseIdx; ++baseIdx)
+    {
+        m_permutationOffsets[baseIdx] = totalPermutationSize;
+        totalPermutationSize += HaltonPrimes[baseIdx];
+    }
+    m_permutations.resize(totalPermutationSize);
+
+    // Random digit permutation per base.
+    // Fisher-Yates by hand instead of std::shuffle, so tables are identical with every standard library.
+    std::mt19937 randomGenerator(scrambleSeed);
+    for (int baseIdx = 0; baseIdx < MaxHaltonBaseIdx; ++baseIdx)
+    {
+        uint16_t* permutation = &m_permutations[m_permutationOffsets[baseIdx]];
+        const uint32_t base = HaltonPrimes[baseIdx];
+        for (uint32_t digit = 0; digit < base; ++digit)
+            permutation[digit] = (uint16_t)digit;
+        for (uint32_t i = base - 1; i > 0; --i)
+            std::swap(permutation[i], permutation[randomGenerator() % (i + 1)]);
+    }
+}
+
+float HaltonSampler::Sample(uint32_t index, int baseIdx) const
+{
+    assert(baseIdx < MaxHaltonBaseIdx);
+
+    if (m_mode == Mode::Scrambled)
+        return s_scrambledRadicalInverseFunctions[baseIdx](index, &m_permutations[m_permutationOffsets[baseIdx]]);
+    else
+        return s_radicalInverseFunctions[baseIdx](index);
+}
+
+HaltonSampler::Dimension HaltonSampler::GetDimension(int baseIdx, uint32_t startIndex) const
+{
+    assert(baseIdx < MaxHaltonBaseIdx);
+
+    const uint16_t* permutation = m_mode == Mode::Scrambled ? &m_permutations[m_permutationOffsets[baseIdx]] : nullptr;
+    return Dimension(HaltonPrimes[baseIdx], s_digitWeights[baseIdx], permutation, startIndex);
+}
+
+HaltonSampler::Dimension::Dimension(uint32_t base, const float* digitWeights, const uint16_t* permutation, uint32_t index)
+    : m_base(base)
+    , m_digitWeights(digitWeights)
+    , m_permutation(permutation)
+{
+    Seek(index);
+}
+
+void HaltonSampler::Dimension::Seek(uint32_t index)
+{
+    m_index = index;
+    m_numDigits = 0;
+    for (; index > 0; index /= m_base)
+        m_digits[m_numDigits++] = (uint16_t)(index % m_base);
+    for (uint32_t digit = m_numDigits; digit < sizeof(m_digits) / sizeof(m_digits[0]); ++digit)
+        m_digits[digit] = 0;
+}
+
+void HaltonSampler::Dimension::Next()
+{
+    if (++m_index == 0)
+    {
+        Seek(0);
+        return;
+    }
+
+    uint32_t digit = 0;
+    while (++m_digits[digit] == m_base)
+        m_digits[digit++] = 0;
+    if (digit >= m_numDigits)
+        m_numDigits = digit + 1;
+}
+
+float HaltonSampler::Dimension::Get() const
+{
+    float r = 0.0f;
+    if (!m_permutation)
+    {
+        // Same order of operations as ComputeHaltonSequence, least significant digit first.
+        for (uint32_t digit = 0; digit < m_numDigits; ++digit)
+            r += m_digitWeights[digit] * m_digits[digit];
+        return r;
+    }
+
+    // See ScrambledRadicalInverse.
+    for (uint32_t digit = 0; digit < m_numDigits; ++digit)
+        r += m_digitWeights[digit] * m_permutation[m_digits[digit]];
+    const float lastWeight = m_numDigits > 0 ? m_digitWeights[m_numDigits - 1] : 1.0f;
+    r += lastWeight * m_permutation[0] / (m_base - 1);
+    return r < HaltonOneMinusEpsilon ? r : HaltonOneMinusEpsilon;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "MathUtils.h"
+#include <cstdint>
+#include <vector>
+
+// Primes used as bases for the Halton sequence. Index into this table is the "baseIdx" used throughout.
+constexpr uint32_t HaltonPrimes[MaxHaltonBaseIdx] = {
+    2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131, 137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223, 227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293
+};
+
+// Largest float smaller than one.
+constexpr float HaltonOneMinusEpsilon = 0.99999994f;
+
+constexpr uint32_t CountHaltonDigits(uint32_t value, uint32_t base)
+{
+    uint32_t numDigits = 0;
+    for (; value > 0; value /= base)
+        ++numDigits;
+    return numDigits;
+}
+
+// Weight of every digit of a radical inverse, i.e. 1/b, 1/b^2, ...
+// Computed by repeated division exactly like ComputeHaltonSequence does, so results are bit identical.
+template<uint32_t Base>
+struct HaltonDigitWeights
+{
+    // Number of base-b digits needed to represent any 32 bit index.
+    static constexpr uint32_t NumDigits = CountHaltonDigits(0xFFFFFFFFu, Base);
+
+    constexpr HaltonDigitWeights() : weights()
+    {
+        float f = 1.0f;
+        for (uint32_t i = 0; i < NumDigits; ++i)
+        {
+            f /= Base;
+            weights[i] = f;
+        }
+    }
+
+    float weights[NumDigits];
+};
+
+template<uint32_t Base>
+constexpr HaltonDigitWeights<Base> g_haltonDigitWeights{};
+
+// Radical inverse with the base known at compile time.
+// The compiler turns division and modulo by the constant base into multiply-shift sequences.
+// Produces the exact same floats as ComputeHaltonSequence(index, baseIdx) for HaltonPrimes[baseIdx] == Base.
+template<uint32_t Base>
+float RadicalInverse(uint32_t index)
+{
+    const float* weights = g_haltonDigitWeights<Base>.weights;
+    float r = 0.0f;
+    for (uint32_t digit = 0; index > 0; ++digit)
+    {
+        r += weights[digit] * (index % Base);
+        index /= Base;
+    }
+    return r;
+}
+
+// Radical inverse with a digit permutation applied to every digit (including the infinite tail of zeros).
+template<uint32_t Base>
+float ScrambledRadicalInverse(uint32_t index, const uint16_t* permutation)
+{
+    const float* weights = g_haltonDigitWeights<Base>.weights;
+    float r = 0.0f;
+    float lastWeight = 1.0f;
+    for (uint32_t digit = 0; index > 0; ++digit)
+    {
+        lastWeight = weights[digit];
+        r += lastWeight * permutation[index % Base];
+        index /= Base;
+    }
+    // All remaining digits are zero, their permuted sum is a geometric series.
+    r += lastWeight * permutation[0] / (Base - 1);
+    return r < HaltonOneMinusEpsilon ? r : HaltonOneMinusEpsilon;
+}
+
+// Halton sampler supporting the plain and the scrambled (random digit permutation) variant.
+//
+// Random access goes through a table of radical inverse functions specialized per base.
+// For consecutive indices use Dimension which avoids integer divisions altogether.
+class HaltonSampler
+{
+public:
+    enum class Mode
+    {
+        Unscrambled,
+        Scrambled,
+    };
+
+    HaltonSampler(Mode mode = Mode::Unscrambled, uint32_t scrambleSeed = 0);
+
+    Mode GetMode() const { return m_mode; }
+
+    // Value of the sequence with the given index for the dimension given by its base index.
+    float Sample(uint32_t index, int baseIdx) const;
+
+    // Incremental iterator over one dimension of the sequence.
+    // Keeps the digits of the current index, so advancing is a digit increment with carry and evaluating is a multiply-add per digit.
+    class Dimension
+    {
+    public:
+        Dimension() = default;
+
+        float Get() const;
+        uint32_t GetIndex() const { return m_index; }
+
+        void Next();
+        void Seek(uint32_t index);
+
+    private:
+        friend class HaltonSampler;
+        Dimension(uint32_t base, const float* digitWeights, const uint16_t* permutation, uint32_t index);
+
+        uint32_t m_base = 2;
+        const float* m_digitWeights = nullptr;
+        const uint16_t* m_permutation = nullptr; // nullptr if unscrambled
+        uint32_t m_index = 0;
+        uint32_t m_numDigits = 0;
+        uint16_t m_digits[32] = {};
+    };
+
+    // Returns an incremental iterator for the given dimension, starting at startIndex.
+    Dimension GetDimension(int baseIdx, uint32_t startIndex = 0) const;
+
+private:
+    Mode m_mode;
+
+    // Concatenated digit permutations for all bases, empty if unscrambled.
+    std::vector<uint16_t> m_permutations;
+    uint32_t m_permutationOffsets[MaxHaltonBaseIdx];
+};
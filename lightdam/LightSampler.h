@@ -1,26 +1,28 @@
 #pragma once
 
-#include "Scene.h"
+#include "cpu/CpuScene.h"
+#include "HaltonSampler.h"
 
 class LightSampler
 {
 public:
     struct LightSample
     {
-        DirectX::SimpleMath::Vector3 position;
+        Float3 position;
         float _padding0;
-        DirectX::SimpleMath::Vector3 normal; // todo: pack normal!
+        Float3 normal; // todo: pack normal!
         float _padding1;
-        DirectX::SimpleMath::Vector3 intensity;
+        Float3 intensity;
         float _padding2;
     };
 
-    LightSampler(const std::vector<Scene::AreaLightTriangle>& triangles);
+    LightSampler(const std::vector<CpuScene::AreaLightTriangle>& triangles);
 
     void GenerateRandomSamples(int samplingSeed, LightSample* destinationBuffer, uint32_t numSamples, float positionOffsetFromAreaLightTriangle = 0.00001f);
 
 private:
-    const std::vector<Scene::AreaLightTriangle>& m_areaLights;
+    const std::vector<CpuScene::AreaLightTriangle>& m_areaLights;
+    HaltonSampler m_haltonSampler;
     float m_totalAreaLightFlux;
     float m_totalAreaLightArea;
 
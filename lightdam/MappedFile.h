@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read only memory mapping of a whole file. Pages are read from disk when they are first accessed,
+// so opening is cheap no matter how large the file is.
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    void operator = (const MappedFile&) = delete;
+
+    // Closes the previously opened file. Returns false if the file can't be opened or is empty.
+    bool Open(const std::string& filePath);
+    void Close();
+
+    // Start of the file, aligned to the page size. Null if no file is open.
+    const uint8_t* GetData() const  { return m_data; }
+    size_t GetSize() const          { return m_size; }
+
+private:
+    const uint8_t* m_data;
+    size_t m_size;
+};
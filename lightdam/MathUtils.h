@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cassert>
+#include <cstdint>
 
 template<typename T>
 bool IsPowerOfTwo(T x)
@@ -18,6 +19,7 @@ Value Align(Value v, Alignment powerOf2Alignment)
 }
 
 constexpr int MaxHaltonBaseIdx = 62;
+// Straightforward reference implementation, see HaltonSampler for the fast paths.
 float ComputeHaltonSequence(int index, int baseIdx);
 
 constexpr float PI = 3.14159265358979323846f;
@@ -0,0 +1,172 @@
+#include "MemoryArena.h"
+#include "ErrorHandling.h"
+#include <algorithm>
+#include <atomic>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+static const size_t HugePageSize = 2 * 1024 * 1024;
+
+static size_t AlignUp(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+// Warns only once per process, failing again for every block is no news.
+static void WarnExplicitHugePagesUnavailable(const char* reason)
+{
+    static std::atomic<bool> warned(false);
+    if (!warned.exchange(true))
+        LogPrint(LogLevel::Warning, "Explicit huge pages are not available (%s), using regular pages instead", reason);
+}
+
+#ifdef _WIN32
+// Large pages can only be allocated by processes that have the lock pages in memory privilege enabled.
+static bool EnableLockMemoryPrivilege()
+{
+    HANDLE token;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+        return false;
+    TOKEN_PRIVILEGES privileges = {};
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    bool enabled = LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid) &&
+                   AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) && GetLastError() == ERROR_SUCCESS;
+    CloseHandle(token);
+    return enabled;
+}
+#endif
+
+MemoryArena::MemoryArena(HugePages hugePages, size_t blockSize)
+    : m_hugePages(hugePages)
+    , m_blockSize(AlignUp(blockSize, HugePageSize))
+    , m_current(nullptr)
+    , m_end(nullptr)
+    , m_allocatedBytes(0)
+{
+}
+
+MemoryArena::~MemoryArena()
+{
+    for (const Block& block : m_blocks)
+        FreeBlock(block);
+}
+
+void* MemoryArena::Allocate(size_t size, size_t alignment)
+{
+    size = std::max<size_t>(size, 1);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_allocatedBytes += size;
+
+    // Blocks are page aligned, a dedicated one fits any alignment up to that.
+    if (size > m_blockSize / 4)
+    {
+        const Block block = AllocateBlock(size);
+        m_blocks.push_back(block);
+        return block.memory;
+    }
+
+    uint8_t* memory = reinterpret_cast<uint8_t*>(AlignUp(reinterpret_cast<uintptr_t>(m_current), alignment));
+    if (!m_current || memory + size > m_end)
+    {
+        // The rest of the previous block is left unused.
+        const Block block = AllocateBlock(m_blockSize);
+        m_blocks.push_back(block);
+        memory = block.memory;
+        m_end = block.memory + block.size;
+    }
+    m_current = memory + size;
+    return memory;
+}
+
+MemoryArena::Stats MemoryArena::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats stats;
+    stats.allocatedBytes = m_allocatedBytes;
+    stats.numBlocks = static_cast<uint32_t>(m_blocks.size());
+    for (const Block& block : m_blocks)
+    {
+        stats.reservedBytes += block.size;
+        if (block.hugePages)
+            stats.hugePageBytes += block.size;
+    }
+    return stats;
+}
+
+MemoryArena::Block MemoryArena::AllocateBlock(size_t minSize)
+{
+    Block block = { nullptr, AlignUp(minSize, HugePageSize), false };
+
+#ifdef _WIN32
+    if (m_hugePages == HugePages::Explicit)
+    {
+        static const bool privilegeEnabled = EnableLockMemoryPrivilege();
+        const size_t largePageSize = GetLargePageMinimum();
+        if (privilegeEnabled && largePageSize > 0)
+        {
+            const size_t size = AlignUp(minSize, largePageSize);
+            block.memory = static_cast<uint8_t*>(VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE));
+            if (block.memory)
+            {
+                block.size = size;
+                block.hugePages = true;
+                return block;
+            }
+        }
+        WarnExplicitHugePagesUnavailable(privilegeEnabled ? "not enough contiguous physical memory" : "no SeLockMemoryPrivilege");
+    }
+    // Committed memory only gets physical pages once it is touched.
+    block.memory = static_cast<uint8_t*>(VirtualAlloc(nullptr, block.size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+    if (!block.memory)
+        throw std::bad_alloc();
+#else
+    if (m_hugePages == HugePages::Explicit)
+    {
+        void* memory = mmap(nullptr, block.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED)
+        {
+            block.memory = static_cast<uint8_t*>(memory);
+            block.hugePages = true;
+            return block;
+        }
+        WarnExplicitHugePagesUnavailable("no free pages in the hugetlb pool");
+    }
+    if (m_hugePages == HugePages::None)
+    {
+        void* memory = mmap(nullptr, block.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            throw std::bad_alloc();
+        block.memory = static_cast<uint8_t*>(memory);
+        return block;
+    }
+
+    // Transparent huge pages need 2 MB aligned ranges, the mapping is made larger and trimmed to alignment.
+    void* memory = mmap(nullptr, block.size + HugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        throw std::bad_alloc();
+    uint8_t* mapping = static_cast<uint8_t*>(memory);
+    block.memory = reinterpret_cast<uint8_t*>(AlignUp(reinterpret_cast<uintptr_t>(mapping), HugePageSize));
+    if (block.memory != mapping)
+        munmap(mapping, block.memory - mapping);
+    munmap(block.memory + block.size, mapping + HugePageSize - block.memory);
+#ifdef MADV_HUGEPAGE
+    block.hugePages = madvise(block.memory, block.size, MADV_HUGEPAGE) == 0;
+#endif
+#endif
+
+    return block;
+}
+
+void MemoryArena::FreeBlock(const Block& block)
+{
+#ifdef _WIN32
+    VirtualFree(block.memory, 0, MEM_RELEASE);
+#else
+    munmap(block.memory, block.size);
+#endif
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump allocator for data that lives as long as the scene and is freed all at once.
+// Memory comes from the OS in large blocks that can be backed by huge pages, which cuts TLB misses when rays
+// touch vertices and indices all over a big scene.
+class MemoryArena
+{
+public:
+    enum class HugePages
+    {
+        None,
+        Transparent,    // Linux: 2 MB aligned blocks marked for transparent huge pages. Same as None on Windows.
+        Explicit,       // Reserved huge pages on Linux, large pages on Windows (needs SeLockMemoryPrivilege). Falls back to Transparent.
+    };
+
+    explicit MemoryArena(HugePages hugePages = HugePages::None, size_t blockSize = 64 * 1024 * 1024);
+    ~MemoryArena();
+
+    MemoryArena(const MemoryArena&) = delete;
+    void operator = (const MemoryArena&) = delete;
+
+    // Thread safe. Memory is not initialized. Allocations larger than a quarter of the block size get a block of their own.
+    void* Allocate(size_t size, size_t alignment = 64);
+
+    struct Stats
+    {
+        size_t allocatedBytes = 0;      // Sum of all allocations.
+        size_t reservedBytes = 0;       // Sum of all blocks, physical memory is only used for the pages that were touched.
+        size_t hugePageBytes = 0;       // Blocks that got huge pages (Explicit) or were marked for them (Transparent).
+        uint32_t numBlocks = 0;
+    };
+    Stats GetStats() const;
+    HugePages GetHugePages() const { return m_hugePages; }
+
+private:
+    struct Block
+    {
+        uint8_t* memory;
+        size_t size;
+        bool hugePages;
+    };
+    Block AllocateBlock(size_t minSize);
+    static void FreeBlock(const Block& block);
+
+    const HugePages m_hugePages;
+    const size_t m_blockSize;
+
+    mutable std::mutex m_mutex;
+    std::vector<Block> m_blocks;
+    // Free part of the last block with small allocations.
+    uint8_t* m_current;
+    uint8_t* m_end;
+    size_t m_allocatedBytes;
+};
+
+// Standard allocator on top of an arena, uses the heap if there is none.
+// Memory from the arena is only freed with it, so containers that grow step by step should stay on the heap.
+// Moved containers keep their arena, copies are made on the heap and don't depend on it.
+// Elements are default initialized instead of value initialized, resizing an array of plain structs leaves them uninitialized
+// so that they are written only once by whoever fills them.
+template<typename T>
+class ArenaAllocator
+{
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    ArenaAllocator(MemoryArena* arena = nullptr) : m_arena(arena) {}
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : m_arena(other.GetArena()) {}
+
+    T* allocate(size_t count)
+    {
+        if (m_arena)
+            return static_cast<T*>(m_arena->Allocate(count * sizeof(T), alignof(T) > 64 ? alignof(T) : 64));
+        return static_cast<T*>(::operator new(count * sizeof(T)));
+    }
+    void deallocate(T* pointer, size_t)
+    {
+        if (!m_arena)
+            ::operator delete(pointer);
+    }
+
+    template<typename U>
+    void construct(U* pointer)
+    {
+        ::new(static_cast<void*>(pointer)) U;
+    }
+    template<typename U, typename... Args>
+    void construct(U* pointer, Args&&... args)
+    {
+        ::new(static_cast<void*>(pointer)) U(std::forward<Args>(args)...);
+    }
+
+    ArenaAllocator select_on_container_copy_construction() const { return ArenaAllocator(); }
+
+    MemoryArena* GetArena() const { return m_arena; }
+
+private:
+    MemoryArena* m_arena;
+};
+
+template<typename T, typename U>
+bool operator == (const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.GetArena() == b.GetArena(); }
+template<typename T, typename U>
+bool operator != (const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.GetArena() != b.GetArena(); }
@@ -0,0 +1,149 @@
+#include "NumaTopology.h"
+#include <algorithm>
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h>
+#elif defined(__linux__)
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#endif
+
+#if defined(__linux__)
+// Parses a sysfs cpu list like "0-3,8-11".
+static std::vector<uint32_t> ParseCpuList(const char* list)
+{
+    std::vector<uint32_t> processors;
+    const char* position = list;
+    while (*position >= '0' && *position <= '9')
+    {
+        char* end;
+        const uint32_t first = strtoul(position, &end, 10);
+        uint32_t last = first;
+        if (*end == '-')
+            last = strtoul(end + 1, &end, 10);
+        for (uint32_t processor = first; processor <= last; ++processor)
+            processors.push_back(processor);
+        position = *end == ',' ? end + 1 : end;
+    }
+    return processors;
+}
+#endif
+
+NumaTopology NumaTopology::Detect()
+{
+    NumaTopology topology;
+
+#ifdef _WIN32
+    ULONG highestNode = 0;
+    if (GetNumaHighestNodeNumber(&highestNode))
+    {
+        for (ULONG osIndex = 0; osIndex <= highestNode; ++osIndex)
+        {
+            GROUP_AFFINITY affinity = {};
+            if (!GetNumaNodeProcessorMaskEx(static_cast<USHORT>(osIndex), &affinity))
+                continue;
+            Node node;
+            node.osIndex = osIndex;
+            for (uint32_t bit = 0; bit < 64; ++bit)
+            {
+                if (affinity.Mask & (KAFFINITY(1) << bit))
+                    node.processors.push_back(affinity.Group * 64 + bit);
+            }
+            // Nodes with memory but without processors are of no use for pinning threads.
+            if (!node.processors.empty())
+                topology.m_nodes.push_back(std::move(node));
+        }
+    }
+#elif defined(__linux__)
+    if (DIR* directory = opendir("/sys/devices/system/node"))
+    {
+        while (dirent* entry = readdir(directory))
+        {
+            unsigned int osIndex;
+            char rest;
+            if (sscanf(entry->d_name, "node%u%c", &osIndex, &rest) != 1)
+                continue;
+            char path[256];
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", osIndex);
+            FILE* file = fopen(path, "r");
+            if (!file)
+                continue;
+            char list[4096] = {};
+            const bool read = fgets(list, sizeof(list), file) != nullptr;
+            fclose(file);
+            Node node;
+            node.osIndex = osIndex;
+            if (read)
+                node.processors = ParseCpuList(list);
+            if (!node.processors.empty())
+                topology.m_nodes.push_back(std::move(node));
+        }
+        closedir(directory);
+    }
+    std::sort(topology.m_nodes.begin(), topology.m_nodes.end(), [](const Node& a, const Node& b) { return a.osIndex < b.osIndex; });
+#endif
+
+    if (topology.m_nodes.empty())
+        return Emulate(1);
+    return topology;
+}
+
+NumaTopology NumaTopology::Emulate(uint32_t numNodes)
+{
+    const uint32_t numProcessors = std::max(1u, std::thread::hardware_concurrency());
+    numNodes = std::max(1u, numNodes);
+    NumaTopology topology;
+    for (uint32_t nodeIndex = 0; nodeIndex < numNodes; ++nodeIndex)
+    {
+        Node node;
+        node.osIndex = nodeIndex;
+        for (uint32_t processor = nodeIndex * numProcessors / numNodes; processor < (nodeIndex + 1) * numProcessors / numNodes; ++processor)
+            node.processors.push_back(processor);
+        if (node.processors.empty())
+            node.processors.push_back(nodeIndex % numProcessors);
+        topology.m_nodes.push_back(std::move(node));
+    }
+    return topology;
+}
+
+uint32_t NumaTopology::GetNumProcessors() const
+{
+    uint32_t numProcessors = 0;
+    for (const Node& node : m_nodes)
+        numProcessors += static_cast<uint32_t>(node.processors.size());
+    return numProcessors;
+}
+
+uint32_t NumaTopology::GetNodeOfThread(uint32_t threadIndex, uint32_t numThreads) const
+{
+    return static_cast<uint32_t>(static_cast<uint64_t>(threadIndex) * m_nodes.size() / std::max(1u, numThreads));
+}
+
+bool NumaTopology::PinCurrentThread(uint32_t node) const
+{
+    const std::vector<uint32_t>& processors = m_nodes[node].processors;
+#ifdef _WIN32
+    // A node lies within a single processor group.
+    GROUP_AFFINITY affinity = {};
+    affinity.Group = static_cast<WORD>(processors.front() / 64);
+    for (uint32_t processor : processors)
+        affinity.Mask |= KAFFINITY(1) << (processor % 64);
+    return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (uint32_t processor : processors)
+    {
+        if (processor < CPU_SETSIZE)
+            CPU_SET(processor, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
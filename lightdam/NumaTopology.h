@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// NUMA nodes of the machine and the logical processors that belong to them.
+// Memory is placed on the node of the thread that first touches it, on Windows and Linux alike, so data allocated
+// and filled by a thread pinned to a node ends up in that node's memory.
+class NumaTopology
+{
+public:
+    struct Node
+    {
+        uint32_t osIndex;                   // Node number of the OS.
+        std::vector<uint32_t> processors;   // Logical processor numbers, on Windows processor group * 64 + number in the group.
+    };
+
+    // Reads the topology from sysfs on Linux and from GetNumaNodeProcessorMaskEx on Windows.
+    // Falls back to a single node with all hardware threads on other platforms or if that fails.
+    static NumaTopology Detect();
+    // Splits the processors of the machine into numNodes nodes of about the same size, to exercise NUMA code paths on
+    // machines with a single node. Nodes share processors if there are fewer processors than nodes.
+    static NumaTopology Emulate(uint32_t numNodes);
+
+    uint32_t GetNumNodes() const                { return static_cast<uint32_t>(m_nodes.size()); }
+    const Node& GetNode(uint32_t node) const    { return m_nodes[node]; }
+    uint32_t GetNumProcessors() const;
+
+    // Node a thread of a pool of numThreads threads runs on, so that consecutive threads fill up one node after another.
+    uint32_t GetNodeOfThread(uint32_t threadIndex, uint32_t numThreads) const;
+
+    // Restricts the calling thread to the processors of a node. Returns false if the OS refused.
+    bool PinCurrentThread(uint32_t node) const;
+
+private:
+    std::vector<Node> m_nodes;
+};
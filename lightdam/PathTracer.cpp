@@ -75,6 +75,7 @@ void PathTracer::SetScene(Scene& scene)
     CreateRaytracingPipelineObject();
     CreateShaderBindingTable(scene);
     m_lightSampler.reset(new LightSampler(scene.GetAreaLights()));
+    m_numBlueNoiseSlices = scene.GetBlueNoiseTexture().GetArraySize();
 }
 
 void PathTracer::SetPathLengthFilterEnabled(bool enablePathLengthFilter, Application& application)
@@ -105,10 +106,11 @@ void PathTracer::DrawIteration(ID3D12GraphicsCommandList4* commandList, const Ca
     auto globalConstants = m_frameConstantBuffer.GetData<GlobalConstants>(frameIndex);
     activeCamera.ComputeCameraParams((float)m_outputResource.GetWidth() / m_outputResource.GetHeight(), globalConstants->CameraU, globalConstants->CameraV, globalConstants->CameraW);
     globalConstants->CameraPosition = activeCamera.GetPosition();
-    globalConstants->GlobalJitter.x = ComputeHaltonSequence(m_frameNumber, 0);
-    globalConstants->GlobalJitter.y = ComputeHaltonSequence(m_frameNumber, 1);
+    globalConstants->GlobalJitter.x = m_haltonSampler.Sample(m_frameNumber, 0);
+    globalConstants->GlobalJitter.y = m_haltonSampler.Sample(m_frameNumber, 1);
     globalConstants->FrameNumber = m_frameNumber;
-    globalConstants->FrameSeed = (uint32_t)(((double)ComputeHaltonSequence(m_frameNumber, 2)) * std::numeric_limits<uint32_t>::max()); //m_randomGenerator();
+    // Seed changes only once we went through all blue noise slices, otherwise it would destroy the temporal blue noise properties.
+    globalConstants->FrameSeed = (uint32_t)(((double)m_haltonSampler.Sample(m_frameNumber / m_numBlueNoiseSlices, 2)) * std::numeric_limits<uint32_t>::max()); //m_randomGenerator.NextUInt();
     globalConstants->PathLengthFilterMax = m_pathLengthFilterMax;
     m_lightSampler->GenerateRandomSamples(m_frameNumber, m_areaLightSamples.GetData<LightSampler::LightSample>(frameIndex), m_numAreaLightSamples);
 
@@ -179,12 +181,14 @@ void PathTracer::CreateDescriptorHeap(const Scene& scene)
 
         D3D12_SHADER_RESOURCE_VIEW_DESC blueNoise = {};
         blueNoise.Format = DXGI_FORMAT_R32_UINT; // scene.GetBlueNoiseTexture().GetFormat();
-        blueNoise.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+        blueNoise.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
         blueNoise.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-        blueNoise.Texture2D.MostDetailedMip = 0;
-        blueNoise.Texture2D.MipLevels = -1;
-        blueNoise.Texture2D.PlaneSlice = 0;
-        blueNoise.Texture2D.ResourceMinLODClamp = 0.0f;
+        blueNoise.Texture2DArray.MostDetailedMip = 0;
+        blueNoise.Texture2DArray.MipLevels = -1;
+        blueNoise.Texture2DArray.FirstArraySlice = 0;
+        blueNoise.Texture2DArray.ArraySize = scene.GetBlueNoiseTexture().GetArraySize();
+        blueNoise.Texture2DArray.PlaneSlice = 0;
+        blueNoise.Texture2DArray.ResourceMinLODClamp = 0.0f;
 
         m_device->CreateShaderResourceView(scene.GetBlueNoiseTexture().Get(), &blueNoise, descriptorHandle);
     }
@@ -278,7 +282,7 @@ void PathTracer::WriteOutputBufferDescriptorsToDescriptorHeap()
 void PathTracer::RestartSampling()
 {
     m_frameNumber = 0;
-    m_randomGenerator.seed(randomSeed);
+    m_randomGenerator.Seed(randomSeed);
 }
 
 bool PathTracer::LoadShaders(bool throwOnFailure)
@@ -5,8 +5,9 @@
 #include "dx12/DynamicConstantBuffer.h"
 #include "dx12/RaytracingShaderBindingTable.h"
 #include "LightSampler.h"
+#include "HaltonSampler.h"
 #include "Camera.h"
-#include <random>
+#include "RandomNumberGenerator.h"
 
 struct IDxcBlob;
 class Scene;
@@ -83,7 +84,9 @@ private:
     RaytracingShaderBindingTable m_shaderBindingTable;
 
     uint32_t m_frameNumber;
-    std::mt19937 m_randomGenerator;
+    uint32_t m_numBlueNoiseSlices = 1;
+    Pcg32 m_randomGenerator;
+    HaltonSampler m_haltonSampler;
 
     const uint32_t m_descriptorHeapIncrementSize;
 
@@ -0,0 +1,304 @@
+#include "RandomNumberGenerator.h"
+#include "CpuFeatures.h"
+#include <immintrin.h>
+
+static const uint32_t PhiloxMultiplier0 = 0xD2511F53u;
+static const uint32_t PhiloxMultiplier1 = 0xCD9E8D57u;
+static const uint32_t PhiloxKeyIncrement0 = 0x9E3779B9u;
+static const uint32_t PhiloxKeyIncrement1 = 0xBB67AE85u;
+static const int PhiloxNumRounds = 10;
+
+static const uint64_t PcgMultiplier = 6364136223846793005ull;
+
+void Philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t output[4])
+{
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int round = 0; round < PhiloxNumRounds; ++round)
+    {
+        const uint64_t product0 = (uint64_t)PhiloxMultiplier0 * c0;
+        const uint64_t product1 = (uint64_t)PhiloxMultiplier1 * c2;
+        c0 = (uint32_t)(product1 >> 32) ^ c1 ^ k0;
+        c2 = (uint32_t)(product0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t)product1;
+        c3 = (uint32_t)product0;
+        k0 += PhiloxKeyIncrement0;
+        k1 += PhiloxKeyIncrement1;
+    }
+    output[0] = c0;
+    output[1] = c1;
+    output[2] = c2;
+    output[3] = c3;
+}
+
+PhiloxStream::PhiloxStream(uint64_t seed, uint64_t streamId, uint64_t index)
+    : m_key{ (uint32_t)seed, (uint32_t)(seed >> 32) }
+    , m_streamId{ (uint32_t)streamId, (uint32_t)(streamId >> 32) }
+    , m_index(index)
+    , m_block{}
+    , m_blockIndex(~0ull)
+{
+}
+
+uint32_t PhiloxStream::NextUInt()
+{
+    const uint64_t blockIndex = m_index / 4;
+    if (blockIndex != m_blockIndex)
+    {
+        const uint32_t counter[4] = { (uint32_t)blockIndex, (uint32_t)(blockIndex >> 32), m_streamId[0], m_streamId[1] };
+        Philox4x32(counter, m_key, m_block);
+        m_blockIndex = blockIndex;
+    }
+    return m_block[m_index++ % 4];
+}
+
+void Pcg32::Seed(uint64_t seed, uint64_t streamId)
+{
+    // Same seeding as the reference implementation (pcg32_srandom_r).
+    m_state = 0;
+    m_increment = (streamId << 1) | 1;
+    NextUInt();
+    m_state += seed;
+    NextUInt();
+}
+
+uint32_t Pcg32::NextUInt()
+{
+    const uint64_t oldState = m_state;
+    m_state = oldState * PcgMultiplier + m_increment;
+    const uint32_t xorShifted = (uint32_t)(((oldState >> 18) ^ oldState) >> 27);
+    const uint32_t rotation = (uint32_t)(oldState >> 59);
+    return (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+}
+
+// Brown 1994, "Random Number Generation with Arbitrary Stride"
+static uint64_t AdvanceLcg(uint64_t state, uint64_t delta, uint64_t multiplier, uint64_t increment)
+{
+    uint64_t accumulatedMultiplier = 1;
+    uint64_t accumulatedIncrement = 0;
+    for (; delta > 0; delta >>= 1)
+    {
+        if (delta & 1)
+        {
+            accumulatedMultiplier *= multiplier;
+            accumulatedIncrement = accumulatedIncrement * multiplier + increment;
+        }
+        increment = (multiplier + 1) * increment;
+        multiplier *= multiplier;
+    }
+    return accumulatedMultiplier * state + accumulatedIncrement;
+}
+
+void Pcg32::Advance(uint64_t delta)
+{
+    m_state = AdvanceLcg(m_state, delta, PcgMultiplier, m_increment);
+}
+
+// Converts in chunks, so no extra memory is needed for the integer results.
+template<typename GenerateFunction>
+static void GenerateFloatsInChunks(float* output, uint64_t count, GenerateFunction generate)
+{
+    const uint64_t chunkSize = 64;
+    uint32_t chunk[chunkSize * 8];
+    for (uint64_t i = 0; i < count; i += chunkSize)
+    {
+        const uint64_t numInChunk = count - i < chunkSize ? count - i : chunkSize;
+        generate(chunk, numInChunk);
+        for (uint64_t j = 0; j < numInChunk * 8; ++j)
+            output[i * 8 + j] = RandomUIntToFloat(chunk[j]);
+    }
+}
+
+PhiloxStream8::PhiloxStream8(uint64_t seed, const uint64_t streamIds[8], uint64_t index)
+    : m_key{ (uint32_t)seed, (uint32_t)(seed >> 32) }
+    , m_index(index)
+{
+    for (int lane = 0; lane < 8; ++lane)
+    {
+        m_streamIdLow[lane] = (uint32_t)streamIds[lane];
+        m_streamIdHigh[lane] = (uint32_t)(streamIds[lane] >> 32);
+    }
+}
+
+// High and low 32 bit of the 64 bit products of all eight lanes with a constant.
+TARGET_AVX2 static void MulHiLo8(__m256i a, __m256i multiplier, __m256i& high, __m256i& low)
+{
+    const __m256i productEven = _mm256_mul_epu32(a, multiplier);
+    const __m256i productOdd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), multiplier);
+    low = _mm256_blend_epi32(productEven, _mm256_slli_epi64(productOdd, 32), 0xAA);
+    high = _mm256_blend_epi32(_mm256_srli_epi64(productEven, 32), productOdd, 0xAA);
+}
+
+TARGET_AVX2 static void GeneratePhiloxBlocksAvx2(uint32_t* output, uint64_t firstBlock, uint64_t numBlocks, const uint32_t key[2], const uint32_t streamIdLow[8], const uint32_t streamIdHigh[8])
+{
+    const __m256i multiplier0 = _mm256_set1_epi32((int)PhiloxMultiplier0);
+    const __m256i multiplier1 = _mm256_set1_epi32((int)PhiloxMultiplier1);
+    const __m256i streamLow = _mm256_loadu_si256((const __m256i*)streamIdLow);
+    const __m256i streamHigh = _mm256_loadu_si256((const __m256i*)streamIdHigh);
+
+    // All streams are always at the same position, only the stream id differs between lanes.
+    for (uint64_t block = firstBlock; block < firstBlock + numBlocks; ++block)
+    {
+        __m256i c0 = _mm256_set1_epi32((int)(uint32_t)block);
+        __m256i c1 = _mm256_set1_epi32((int)(uint32_t)(block >> 32));
+        __m256i c2 = streamLow;
+        __m256i c3 = streamHigh;
+        uint32_t k0 = key[0], k1 = key[1];
+        for (int round = 0; round < PhiloxNumRounds; ++round)
+        {
+            __m256i high0, low0, high1, low1;
+            MulHiLo8(c0, multiplier0, high0, low0);
+            MulHiLo8(c2, multiplier1, high1, low1);
+            c0 = _mm256_xor_si256(_mm256_xor_si256(high1, c1), _mm256_set1_epi32((int)k0));
+            c2 = _mm256_xor_si256(_mm256_xor_si256(high0, c3), _mm256_set1_epi32((int)k1));
+            c1 = low1;
+            c3 = low0;
+            k0 += PhiloxKeyIncrement0;
+            k1 += PhiloxKeyIncrement1;
+        }
+
+        __m256i* blockOutput = (__m256i*)(output + (block - firstBlock) * 32);
+        _mm256_storeu_si256(blockOutput + 0, c0);
+        _mm256_storeu_si256(blockOutput + 1, c1);
+        _mm256_storeu_si256(blockOutput + 2, c2);
+        _mm256_storeu_si256(blockOutput + 3, c3);
+    }
+}
+
+void PhiloxStream8::GenerateBlocks(uint32_t* output, uint64_t firstBlock, uint64_t numBlocks) const
+{
+    if (CpuSupportsAvx2())
+    {
+        GeneratePhiloxBlocksAvx2(output, firstBlock, numBlocks, m_key, m_streamIdLow, m_streamIdHigh);
+        return;
+    }
+
+    for (uint64_t block = firstBlock; block < firstBlock + numBlocks; ++block)
+    {
+        uint32_t* blockOutput = output + (block - firstBlock) * 32;
+        for (int lane = 0; lane < 8; ++lane)
+        {
+            const uint32_t counter[4] = { (uint32_t)block, (uint32_t)(block >> 32), m_streamIdLow[lane], m_streamIdHigh[lane] };
+            uint32_t result[4];
+            Philox4x32(counter, m_key, result);
+            for (int i = 0; i < 4; ++i)
+                blockOutput[i * 8 + lane] = result[i];
+        }
+    }
+}
+
+void PhiloxStream8::Generate(uint32_t* output, uint64_t count)
+{
+    // Unaligned start & end go through a temporary block.
+    uint32_t partialBlock[32];
+    while (count > 0 && (m_index % 4 != 0 || count < 4))
+    {
+        GenerateBlocks(partialBlock, m_index / 4, 1);
+        const uint32_t* source = partialBlock + (m_index % 4) * 8;
+        for (int lane = 0; lane < 8; ++lane)
+            output[lane] = source[lane];
+        output += 8;
+        ++m_index;
+        --count;
+    }
+
+    const uint64_t numBlocks = count / 4;
+    GenerateBlocks(output, m_index / 4, numBlocks);
+    output += numBlocks * 32;
+    m_index += numBlocks * 4;
+    count -= numBlocks * 4;
+
+    if (count > 0)
+        Generate(output, count);
+}
+
+void PhiloxStream8::GenerateFloats(float* output, uint64_t count)
+{
+    GenerateFloatsInChunks(output, count, [this](uint32_t* chunk, uint64_t numInChunk) { Generate(chunk, numInChunk); });
+}
+
+Pcg32x8::Pcg32x8(uint64_t seed, const uint64_t streamIds[8])
+{
+    for (int lane = 0; lane < 8; ++lane)
+    {
+        // Same as Pcg32::Seed.
+        m_increment[lane] = (streamIds[lane] << 1) | 1;
+        m_state[lane] = AdvanceLcg(0, 1, PcgMultiplier, m_increment[lane]) + seed;
+        m_state[lane] = AdvanceLcg(m_state[lane], 1, PcgMultiplier, m_increment[lane]);
+    }
+}
+
+// Lower 64 bit of the product of four 64 bit lanes.
+TARGET_AVX2 static __m256i MulLo64(__m256i a, __m256i b)
+{
+    const __m256i lowProduct = _mm256_mul_epu32(a, b);
+    const __m256i crossProduct0 = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b);
+    const __m256i crossProduct1 = _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32));
+    return _mm256_add_epi64(lowProduct, _mm256_slli_epi64(_mm256_add_epi64(crossProduct0, crossProduct1), 32));
+}
+
+// PCG output function on four 64 bit states, result in the low 32 bit of every 64 bit lane.
+TARGET_AVX2 static __m256i PcgOutput4(__m256i state)
+{
+    const __m256i xorShifted = _mm256_srli_epi64(_mm256_xor_si256(_mm256_srli_epi64(state, 18), state), 27);
+    const __m256i rotation = _mm256_srli_epi64(state, 59);
+    const __m256i leftRotation = _mm256_and_si256(_mm256_sub_epi32(_mm256_set1_epi64x(32), rotation), _mm256_set1_epi64x(31));
+    return _mm256_or_si256(_mm256_srlv_epi32(xorShifted, rotation), _mm256_sllv_epi32(xorShifted, leftRotation));
+}
+
+TARGET_AVX2 static void GeneratePcgAvx2(uint32_t* output, uint64_t count, uint64_t state[8], const uint64_t increment[8])
+{
+    const __m256i multiplier = _mm256_set1_epi64x((long long)PcgMultiplier);
+    const __m256i increment0 = _mm256_loadu_si256((const __m256i*)increment);
+    const __m256i increment1 = _mm256_loadu_si256((const __m256i*)(increment + 4));
+    __m256i state0 = _mm256_loadu_si256((const __m256i*)state);
+    __m256i state1 = _mm256_loadu_si256((const __m256i*)(state + 4));
+
+    // Gathers the low 32 bit of every 64 bit lane into the lower half.
+    const __m256i packLowHalves = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        const __m256i result0 = _mm256_permutevar8x32_epi32(PcgOutput4(state0), packLowHalves);
+        const __m256i result1 = _mm256_permutevar8x32_epi32(PcgOutput4(state1), packLowHalves);
+        _mm256_storeu_si256((__m256i*)(output + i * 8), _mm256_permute2x128_si256(result0, result1, 0x20));
+
+        state0 = _mm256_add_epi64(MulLo64(state0, multiplier), increment0);
+        state1 = _mm256_add_epi64(MulLo64(state1, multiplier), increment1);
+    }
+
+    _mm256_storeu_si256((__m256i*)state, state0);
+    _mm256_storeu_si256((__m256i*)(state + 4), state1);
+}
+
+void Pcg32x8::Generate(uint32_t* output, uint64_t count)
+{
+    if (CpuSupportsAvx2())
+    {
+        GeneratePcgAvx2(output, count, m_state, m_increment);
+        return;
+    }
+
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        for (int lane = 0; lane < 8; ++lane)
+        {
+            const uint64_t oldState = m_state[lane];
+            m_state[lane] = oldState * PcgMultiplier + m_increment[lane];
+            const uint32_t xorShifted = (uint32_t)(((oldState >> 18) ^ oldState) >> 27);
+            const uint32_t rotation = (uint32_t)(oldState >> 59);
+            output[i * 8 + lane] = (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+        }
+    }
+}
+
+void Pcg32x8::GenerateFloats(float* output, uint64_t count)
+{
+    GenerateFloatsInChunks(output, count, [this](uint32_t* chunk, uint64_t numInChunk) { Generate(chunk, numInChunk); });
+}
+
+void Pcg32x8::Advance(uint64_t delta)
+{
+    for (int lane = 0; lane < 8; ++lane)
+        m_state[lane] = AdvanceLcg(m_state[lane], delta, PcgMultiplier, m_increment[lane]);
+}
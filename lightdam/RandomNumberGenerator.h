@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+
+// Counter based and skip-ahead capable random number generators.
+// Use these wherever random numbers need to be reproducible per pixel/thread/job, independent of the execution order.
+
+// Random number in [0, 1) from the upper 24 bit.
+inline float RandomUIntToFloat(uint32_t x)
+{
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+// SplitMix64 finalizer. PCG streams with neighboring stream ids (and the same seed) are visibly correlated,
+// so pass pixel/thread indices through this before using them as a Pcg32 stream id.
+inline uint64_t ScrambleStreamId(uint64_t streamId)
+{
+    streamId = (streamId ^ (streamId >> 30)) * 0xbf58476d1ce4e5b9ull;
+    streamId = (streamId ^ (streamId >> 27)) * 0x94d049bb133111ebull;
+    return streamId ^ (streamId >> 31);
+}
+
+// Philox4x32-10, Salmon et al. 2011, "Parallel Random Numbers: As Easy as 1, 2, 3"
+// Pure function of (counter, key): Jumping to any position is free.
+void Philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t output[4]);
+
+// A single stream of Philox numbers.
+// The key is the seed, the counter is (index of the block of four numbers, stream id), so there are 2^64 streams of 2^66 numbers each.
+class PhiloxStream
+{
+public:
+    PhiloxStream(uint64_t seed = 0, uint64_t streamId = 0, uint64_t index = 0);
+
+    uint32_t NextUInt();
+    float NextFloat() { return RandomUIntToFloat(NextUInt()); }
+
+    // Position in the stream, counted in 32 bit numbers.
+    void Seek(uint64_t index) { m_index = index; }
+    uint64_t GetIndex() const { return m_index; }
+
+private:
+    uint32_t m_key[2];
+    uint32_t m_streamId[2];
+    uint64_t m_index;
+
+    uint32_t m_block[4];
+    uint64_t m_blockIndex; // Block currently stored in m_block, ~0 if none.
+};
+
+// PCG32 (XSH RR 64/32), O'Neill 2014, "PCG: A Family of Simple Fast Space-Efficient Statistically Good Algorithms for Random Number Generation"
+// 2^63 streams with a period of 2^64 each. Advance jumps in O(log n).
+// Stream ids should be scrambled (see ScrambleStreamId), Philox doesn't have this problem.
+class Pcg32
+{
+public:
+    Pcg32(uint64_t seed = 0x853c49e6748fea9bull, uint64_t streamId = 0xda3e39cb94b95bdbull) { Seed(seed, streamId); }
+
+    void Seed(uint64_t seed, uint64_t streamId = 0xda3e39cb94b95bdbull);
+
+    uint32_t NextUInt();
+    float NextFloat() { return RandomUIntToFloat(NextUInt()); }
+
+    // Jumps delta numbers ahead. Negative jumps work as well by wrapping around (i.e. pass 2^64 - n).
+    void Advance(uint64_t delta);
+
+    // Allows use with the standard library distributions.
+    using result_type = uint32_t;
+    static constexpr uint32_t min() { return 0; }
+    static constexpr uint32_t max() { return 0xFFFFFFFFu; }
+    uint32_t operator()() { return NextUInt(); }
+
+private:
+    uint64_t m_state;
+    uint64_t m_increment;
+};
+
+// Eight Philox streams generated at once with AVX2 (falls back to scalar code if not available).
+// Lane i produces exactly the same numbers as PhiloxStream(seed, streamIds[i]).
+class PhiloxStream8
+{
+public:
+    PhiloxStream8(uint64_t seed, const uint64_t streamIds[8], uint64_t index = 0);
+
+    // Writes count numbers of every stream, interleaved: output[i * 8 + lane]
+    void Generate(uint32_t* output, uint64_t count);
+    // Same as Generate but converted to floats in [0, 1).
+    void GenerateFloats(float* output, uint64_t count);
+
+    void Seek(uint64_t index) { m_index = index; }
+    uint64_t GetIndex() const { return m_index; }
+
+private:
+    void GenerateBlocks(uint32_t* output, uint64_t firstBlock, uint64_t numBlocks) const;
+
+    uint32_t m_key[2];
+    uint32_t m_streamIdLow[8];
+    uint32_t m_streamIdHigh[8];
+    uint64_t m_index;
+};
+
+// Eight PCG32 streams generated at once with AVX2 (falls back to scalar code if not available).
+// Lane i produces exactly the same numbers as Pcg32(seed, streamIds[i]).
+class Pcg32x8
+{
+public:
+    Pcg32x8(uint64_t seed, const uint64_t streamIds[8]);
+
+    // Writes count numbers of every stream, interleaved: output[i * 8 + lane]
+    void Generate(uint32_t* output, uint64_t count);
+    // Same as Generate but converted to floats in [0, 1).
+    void GenerateFloats(float* output, uint64_t count);
+
+    void Advance(uint64_t delta);
+
+private:
+    uint64_t m_state[8];
+    uint64_t m_increment[8];
+};
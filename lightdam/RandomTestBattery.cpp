@@ -0,0 +1,214 @@
+#include "RandomTestBattery.h"
+#include <algorithm>
+#include <cmath>
+
+// Regularized upper incomplete gamma function Q(a, x), Numerical Recipes style.
+static double UpperIncompleteGammaRegularized(double a, double x)
+{
+    if (x <= 0.0)
+        return 1.0;
+
+    const double logPrefactor = a * std::log(x) - x - std::lgamma(a);
+    if (x < a + 1.0)
+    {
+        // Series for P(a, x).
+        double term = 1.0 / a;
+        double sum = term;
+        for (double n = a + 1.0; std::abs(term) > std::abs(sum) * 1e-15; n += 1.0)
+        {
+            term *= x / n;
+            sum += term;
+        }
+        return 1.0 - sum * std::exp(logPrefactor);
+    }
+
+    // Continued fraction (modified Lentz) for Q(a, x).
+    const double tiny = 1e-300;
+    double b = x + 1.0 - a;
+    double c = 1.0 / tiny;
+    double d = 1.0 / b;
+    double h = d;
+    for (int i = 1; i < 100000; ++i)
+    {
+        const double an = -i * (i - a);
+        b += 2.0;
+        d = an * d + b;
+        d = std::abs(d) < tiny ? tiny : d;
+        c = b + an / c;
+        c = std::abs(c) < tiny ? tiny : c;
+        d = 1.0 / d;
+        const double delta = d * c;
+        h *= delta;
+        if (std::abs(delta - 1.0) < 1e-15)
+            break;
+    }
+    return std::exp(logPrefactor) * h;
+}
+
+static RandomTestBattery::Result ChiSquareResult(const char* name, const std::vector<double>& observed, const std::vector<double>& expected)
+{
+    double chiSquare = 0.0;
+    for (size_t i = 0; i < observed.size(); ++i)
+        chiSquare += (observed[i] - expected[i]) * (observed[i] - expected[i]) / expected[i];
+    const double degreesOfFreedom = (double)observed.size() - 1.0;
+    return { name, chiSquare, UpperIncompleteGammaRegularized(degreesOfFreedom * 0.5, chiSquare * 0.5) };
+}
+
+static RandomTestBattery::Result NormalResult(const char* name, double z)
+{
+    return { name, z, 0.5 * std::erfc(z / std::sqrt(2.0)) };
+}
+
+static uint32_t PopCount(uint32_t x)
+{
+    x = x - ((x >> 1) & 0x55555555u);
+    x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+    return (((x + (x >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24;
+}
+
+// Fraction of set bits.
+static RandomTestBattery::Result MonobitTest(const std::vector<uint32_t>& numbers)
+{
+    uint64_t numOnes = 0;
+    for (uint32_t x : numbers)
+        numOnes += PopCount(x);
+    const double numBits = numbers.size() * 32.0;
+    return NormalResult("Monobit", (numOnes - numBits * 0.5) / std::sqrt(numBits * 0.25));
+}
+
+// Every bit position on its own, catches weak low bits.
+static RandomTestBattery::Result BitPositionTest(const std::vector<uint32_t>& numbers)
+{
+    uint64_t counts[32] = {};
+    for (uint32_t x : numbers)
+    {
+        for (int bit = 0; bit < 32; ++bit)
+            counts[bit] += (x >> bit) & 1;
+    }
+    // Sum of 32 squared standard normals.
+    double chiSquare = 0.0;
+    for (int bit = 0; bit < 32; ++bit)
+    {
+        const double deviation = counts[bit] - numbers.size() * 0.5;
+        chiSquare += deviation * deviation / (numbers.size() * 0.25);
+    }
+    return { "Bit positions", chiSquare, UpperIncompleteGammaRegularized(16.0, chiSquare * 0.5) };
+}
+
+static RandomTestBattery::Result ByteFrequencyTest(const std::vector<uint32_t>& numbers)
+{
+    std::vector<double> observed(256, 0.0);
+    for (uint32_t x : numbers)
+    {
+        for (int byte = 0; byte < 4; ++byte)
+            observed[(x >> (byte * 8)) & 0xFF] += 1.0;
+    }
+    return ChiSquareResult("Byte frequency", observed, std::vector<double>(256, numbers.size() * 4.0 / 256.0));
+}
+
+// Distribution of pairs of consecutive numbers, 8 bit taken from each.
+static RandomTestBattery::Result SerialPairTest(const char* name, const std::vector<uint32_t>& numbers, int shift)
+{
+    std::vector<double> observed(65536, 0.0);
+    const size_t numPairs = numbers.size() / 2;
+    for (size_t i = 0; i < numPairs; ++i)
+        observed[((numbers[i * 2] >> shift) & 0xFF) << 8 | ((numbers[i * 2 + 1] >> shift) & 0xFF)] += 1.0;
+    return ChiSquareResult(name, observed, std::vector<double>(65536, numPairs / 65536.0));
+}
+
+// Hamming weights of consecutive numbers should be independent.
+static RandomTestBattery::Result HammingWeightPairTest(const std::vector<uint32_t>& numbers)
+{
+    // Classes <=13, 14, ..., 18, >=19.
+    const int numClasses = 7;
+    auto weightClass = [](uint32_t weight) { return weight <= 13 ? 0 : (weight >= 19 ? numClasses - 1 : (int)weight - 13); };
+
+    double classProbabilities[numClasses] = {};
+    for (int weight = 0; weight <= 32; ++weight)
+        classProbabilities[weightClass(weight)] += std::exp(std::lgamma(33.0) - std::lgamma(weight + 1.0) - std::lgamma(33.0 - weight) - 32.0 * std::log(2.0));
+
+    std::vector<double> observed(numClasses * numClasses, 0.0);
+    std::vector<double> expected(numClasses * numClasses, 0.0);
+    const size_t numPairs = numbers.size() - 1;
+    for (size_t i = 0; i < numPairs; ++i)
+        observed[weightClass(PopCount(numbers[i])) * numClasses + weightClass(PopCount(numbers[i + 1]))] += 1.0;
+    for (int a = 0; a < numClasses; ++a)
+    {
+        for (int b = 0; b < numClasses; ++b)
+            expected[a * numClasses + b] = numPairs * classProbabilities[a] * classProbabilities[b];
+    }
+    // Overlapping pairs make this not quite a chi-square distribution, but close enough for catching gross failures.
+    return ChiSquareResult("Hamming weight pairs", observed, expected);
+}
+
+// Marsaglia's birthday spacings: 4096 birthdays in a year of 2^32 days, duplicate spacings are Poisson distributed with lambda 4.
+static RandomTestBattery::Result BirthdaySpacingsTest(const std::vector<uint32_t>& numbers)
+{
+    const size_t numBirthdays = 4096;
+    const double lambda = (double)numBirthdays * numBirthdays * numBirthdays / (4.0 * 4294967296.0);
+    const size_t numRepetitions = numbers.size() / numBirthdays;
+
+    std::vector<uint32_t> birthdays(numBirthdays);
+    std::vector<uint32_t> spacings(numBirthdays);
+    uint64_t numDuplicates = 0;
+    for (size_t repetition = 0; repetition < numRepetitions; ++repetition)
+    {
+        std::copy(numbers.begin() + repetition * numBirthdays, numbers.begin() + (repetition + 1) * numBirthdays, birthdays.begin());
+        std::sort(birthdays.begin(), birthdays.end());
+        spacings[0] = birthdays[0];
+        for (size_t i = 1; i < numBirthdays; ++i)
+            spacings[i] = birthdays[i] - birthdays[i - 1];
+        std::sort(spacings.begin(), spacings.end());
+        for (size_t i = 1; i < numBirthdays; ++i)
+            numDuplicates += spacings[i] == spacings[i - 1] ? 1 : 0;
+    }
+
+    // Sum of Poisson variables is Poisson, which is close to normal for large lambda.
+    const double expected = lambda * numRepetitions;
+    return NormalResult("Birthday spacings", (numDuplicates - expected) / std::sqrt(expected));
+}
+
+// Lengths of gaps between numbers falling into [0, 1/16).
+static RandomTestBattery::Result GapTest(const std::vector<uint32_t>& numbers)
+{
+    const int maxGap = 63;
+    const double probability = 1.0 / 16.0;
+
+    std::vector<double> observed(maxGap + 1, 0.0);
+    size_t numGaps = 0;
+    int gap = 0;
+    for (uint32_t x : numbers)
+    {
+        if ((x >> 28) == 0)
+        {
+            observed[std::min(gap, maxGap)] += 1.0;
+            ++numGaps;
+            gap = 0;
+        }
+        else
+            ++gap;
+    }
+
+    std::vector<double> expected(maxGap + 1);
+    for (int i = 0; i < maxGap; ++i)
+        expected[i] = numGaps * probability * std::pow(1.0 - probability, i);
+    expected[maxGap] = numGaps * std::pow(1.0 - probability, maxGap);
+    return ChiSquareResult("Gap", observed, expected);
+}
+
+std::vector<RandomTestBattery::Result> RandomTestBattery::Run(const Generator& generator, size_t numbersPerTest)
+{
+    std::vector<uint32_t> numbers(numbersPerTest);
+    auto next = [&]() -> const std::vector<uint32_t>& { generator(numbers.data(), numbers.size()); return numbers; };
+
+    std::vector<Result> results;
+    results.push_back(MonobitTest(next()));
+    results.push_back(BitPositionTest(next()));
+    results.push_back(ByteFrequencyTest(next()));
+    results.push_back(SerialPairTest("Serial pairs (high bits)", next(), 24));
+    results.push_back(SerialPairTest("Serial pairs (low bits)", next(), 0));
+    results.push_back(HammingWeightPairTest(next()));
+    results.push_back(BirthdaySpacingsTest(next()));
+    results.push_back(GapTest(next()));
+    return results;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Small statistical test battery for 32 bit random number generators, in the spirit of PractRand/TestU01's SmallCrush.
+// Meant to catch broken implementations and bad seeding/stream setups, not to certify a generator.
+class RandomTestBattery
+{
+public:
+    // Fills the buffer with the next count numbers of the generator under test.
+    using Generator = std::function<void(uint32_t* output, size_t count)>;
+
+    struct Result
+    {
+        const char* name;
+        double statistic;
+        // Probability of a statistic at least this large. Too close to 0 or 1 are both failures.
+        double pValue;
+
+        bool IsFailure() const    { return pValue < 1e-6 || pValue > 1.0 - 1e-6; }
+        bool IsSuspicious() const { return pValue < 1e-3 || pValue > 1.0 - 1e-3; }
+    };
+
+    // Runs all tests, every test consumes numbersPerTest numbers.
+    static std::vector<Result> Run(const Generator& generator, size_t numbersPerTest = 1 << 24);
+};
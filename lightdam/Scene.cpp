@@ -8,50 +8,17 @@
 
 #include "../external/d3dx12.h"
 #include "../external/stb/stb_image.h"
-#include "pbrtParser/Scene.h"
 
-#include <fstream>
 #include <algorithm>
 
 #include <wrl/client.h>
 using namespace Microsoft::WRL;
 
-static DirectX::XMFLOAT3 PbrtVecToXMFloat(pbrt::vec3f v)
+static DirectX::XMFLOAT3 Float3ToXMFloat(Float3 v)
 {
     return DirectX::XMFLOAT3{ v.x, v.y, v.z };
 }
 
-static DirectX::XMFLOAT2 PbrtVecToXMFloat(pbrt::vec2f v)
-{
-    return DirectX::XMFLOAT2{ v.x, v.y };
-}
-
-static DirectX::XMVECTOR PbrtVecToXMVector(pbrt::vec3f v)
-{
-    return DirectX::XMLoadFloat3(&PbrtVecToXMFloat(v));
-}
-
-static std::string GetDirectory(const std::string& path)
-{
-    size_t lastSlash = path.find_last_of('/');
-    size_t lastBackSlash = path.find_last_of('\\');
-    size_t lastDelimiter = std::string::npos;
-
-    if (lastSlash != std::string::npos)
-    {
-        if (lastBackSlash == std::string::npos)
-            lastDelimiter = lastSlash;
-        else
-            lastDelimiter = std::max(lastSlash, lastBackSlash);
-    }
-    else if (lastBackSlash != std::string::npos)
-        lastDelimiter = lastBackSlash;
-    else
-        return "";
-
-    return path.substr(0, lastDelimiter);
-}
-
 static ComPtr<ID3D12GraphicsCommandList4> CreateTemporaryCommandList(ID3D12Device* device)
 {
     ComPtr<ID3D12CommandAllocator> commandAllocator;
@@ -62,324 +29,95 @@ static ComPtr<ID3D12GraphicsCommandList4> CreateTemporaryCommandList(ID3D12Devic
     return commandList;
 }
 
-static void AddAreaLights(const DirectX::XMFLOAT3* positions, const Scene::Vertex* vertices, uint32_t* indices, uint32_t numTriangles, DirectX::SimpleMath::Vector3 emittedRadiance, std::vector<Scene::AreaLightTriangle>& outAreaLights)
-{
-    const auto firstNewAreaLightIdx = outAreaLights.size();
-    outAreaLights.resize(outAreaLights.size() + numTriangles);
-
-    float totalArea = 0.0f;
-    for (uint32_t triangleIdx = 0; triangleIdx < numTriangles; ++triangleIdx)
-    {
-        Scene::AreaLightTriangle& areaLightTriangle = outAreaLights[firstNewAreaLightIdx + triangleIdx];
-        areaLightTriangle.positions[0] = positions[indices[triangleIdx * 3 + 0]];
-        areaLightTriangle.positions[1] = positions[indices[triangleIdx * 3 + 1]];
-        areaLightTriangle.positions[2] = positions[indices[triangleIdx * 3 + 2]];
-        areaLightTriangle.normals[0] = vertices[indices[triangleIdx * 3 + 0]].normal;
-        areaLightTriangle.normals[1] = vertices[indices[triangleIdx * 3 + 1]].normal;
-        areaLightTriangle.normals[2] = vertices[indices[triangleIdx * 3 + 2]].normal;
-        areaLightTriangle.area = (areaLightTriangle.positions[1] - areaLightTriangle.positions[0]).Cross(areaLightTriangle.positions[2] - areaLightTriangle.positions[0]).Length() * 0.5f;
-        areaLightTriangle.emittedRadiance = emittedRadiance;
-        totalArea += areaLightTriangle.area;
-    }
-}
-
-static void GenerateNormalsIfMissing(const pbrt::TriangleMesh::SP& triangleShape)
+static Scene::Mesh UploadMesh(uint32_t index, const CpuScene::Mesh& cpuMesh, const CpuScene::Material& material, ID3D12Device5* device, ResourceUploadBatch& resourceUpload)
 {
-    if (!triangleShape->normal.empty())
-        return;
-        
-    triangleShape->normal.resize(triangleShape->vertex.size());
-    memset(triangleShape->normal.data(), 0, sizeof(pbrt::vec3f) * triangleShape->normal.size());
-
-    for (auto triangle : triangleShape->index)
-    {
-        auto v1 = triangleShape->vertex[triangle.x];
-        auto v2 = triangleShape->vertex[triangle.y];
-        auto v3 = triangleShape->vertex[triangle.z];
-        auto triangleNormal = pbrt::math::cross(v2 - v1, v3 - v1);
-        triangleShape->normal[triangle.x] = triangleShape->normal[triangle.x] + triangleNormal;
-        triangleShape->normal[triangle.y] = triangleShape->normal[triangle.y] + triangleNormal;
-        triangleShape->normal[triangle.z] = triangleShape->normal[triangle.z] + triangleNormal;
-    }
-    for (auto& normal : triangleShape->normal)
-        normal = pbrt::math::normalize(normal);
-}
-
-struct Material
-{
-    uint32_t DiffuseTextureIndex;
-
-    uint32_t MaterialType;
-    DirectX::XMFLOAT3 Eta;
-    DirectX::XMFLOAT3 Ks;
-    float Roughness;
-};
-
-static uint32_t LoadPbrtTexture(const std::string& sceneDirectory, const pbrt::Texture::SP& texture, Scene::TextureManager& textures, ResourceUploadBatch& resourceUpload, ID3D12Device* device)
-{
-    const auto& imageTexture = texture->as<pbrt::ImageTexture>();
-    if (!imageTexture)
-    {
-        LogPrint(LogLevel::Warning, "Texture type '%s' not supported", texture->toString().c_str());
-        return textures.GetTextureIndexForColor(DirectX::XMFLOAT3(0.5f, 0.5f, 0.5f), resourceUpload, device);
-    }
-
-    return textures.GetTextureIndexForFile(sceneDirectory + "/" + imageTexture->fileName, resourceUpload, device);
-}
-
-static Material LoadPbrtMaterial( const std::string& sceneDirectory, const pbrt::Material::SP& material, Scene::TextureManager& textures, ResourceUploadBatch& resourceUpload, ID3D12Device* device)
-{
-    Material output = {};
-
-    if (const auto matteMaterial = material->as<pbrt::MatteMaterial>())
-    {
-        output.MaterialType = Scene::MATERIAL_MATTE;
-        if (matteMaterial->map_kd)
-            output.DiffuseTextureIndex = LoadPbrtTexture(sceneDirectory, matteMaterial->map_kd, textures, resourceUpload, device);
-        else
-            output.DiffuseTextureIndex = textures.GetTextureIndexForColor(PbrtVecToXMFloat(matteMaterial->kd), resourceUpload, device);
-
-        if (matteMaterial->sigma != 0.0f || matteMaterial->map_sigma)
-            LogPrint(LogLevel::Warning, "Sigma parameter in matte material '%s' not supported", matteMaterial->name.c_str());
-    }
-    else if (const auto substrateMaterial = material->as<pbrt::SubstrateMaterial>())
-    {
-        if (substrateMaterial->map_kd)
-            output.DiffuseTextureIndex = LoadPbrtTexture(sceneDirectory, substrateMaterial->map_kd, textures, resourceUpload, device);
-        else
-            output.DiffuseTextureIndex = textures.GetTextureIndexForColor(PbrtVecToXMFloat(substrateMaterial->kd), resourceUpload, device);
-
-        output.MaterialType = Scene::MATERIAL_SUBSTRATE;
-        output.Eta = DirectX::XMFLOAT3(0, 0, 0); // Dielectric!
-        output.Ks = PbrtVecToXMFloat(substrateMaterial->ks);
-        output.Roughness = substrateMaterial->uRoughness;
-
-        if (substrateMaterial->map_ks)
-            LogPrint(LogLevel::Warning, "Map KS parameter in substrate material '%s' not supported", substrateMaterial->name.c_str());
-        if (substrateMaterial->map_bump)
-            LogPrint(LogLevel::Warning, "Bump parameter in substrate material '%s' not supported", substrateMaterial->name.c_str());
-        if (substrateMaterial->uRoughness != substrateMaterial->vRoughness)
-            LogPrint(LogLevel::Warning, "Non uniform roughness in substrate material '%s' not supported", substrateMaterial->name.c_str());
-    }
-    else if (const auto metalMaterial = material->as<pbrt::MetalMaterial>())
-    {
-        output.MaterialType = Scene::MATERIAL_METAL;
-        output.Eta = PbrtVecToXMFloat(metalMaterial->eta);
-        output.Ks = PbrtVecToXMFloat(metalMaterial->k);
-        output.Roughness = metalMaterial->roughness;
-
-        if (metalMaterial->map_roughness)
-            LogPrint(LogLevel::Warning, "Map roughness parameter in metal material '%s' not supported", metalMaterial->name.c_str());
-        if (metalMaterial->map_uRoughness)
-            LogPrint(LogLevel::Warning, "Map uroughness parameter in metal material '%s' not supported", metalMaterial->name.c_str());
-        if (metalMaterial->map_vRoughness)
-            LogPrint(LogLevel::Warning, "Map vroughness parameter in metal material '%s' not supported", metalMaterial->name.c_str());
-        if (metalMaterial->uRoughness != metalMaterial->vRoughness)
-            LogPrint(LogLevel::Warning, "Non uniform roughness in metal material '%s' not supported", metalMaterial->name.c_str());
-        if (metalMaterial->remapRoughness)
-            LogPrint(LogLevel::Warning, "remapRoughness in metal material '%s' not supported", metalMaterial->name.c_str());
-        if (metalMaterial->map_bump)
-            LogPrint(LogLevel::Warning, "map_bump in metal material '%s' not supported", metalMaterial->name.c_str());
-        if (!metalMaterial->spectrum_eta.spd.empty() || !metalMaterial->spectrum_k.spd.empty())
-            LogPrint(LogLevel::Warning, "Spectrum for eta/k in metal material '%s' not supported", metalMaterial->name.c_str());
-    }
-
-    else
-    {
-        output.MaterialType = Scene::MATERIAL_MATTE;
-        output.DiffuseTextureIndex = textures.GetTextureIndexForColor(DirectX::XMFLOAT3(0.5f, 0.5f, 0.5f), resourceUpload, device);
-        LogPrint(LogLevel::Warning, "Material type of material '%s' not supported", material->name.c_str());
-    }
-
-    return output;
-}
-
-static Scene::Mesh LoadPbrtMesh(uint32_t index, const pbrt::TriangleMesh::SP& triangleShape, const pbrt::Instance::SP& instance, ID3D12Device5* device, 
-                                std::vector<Scene::AreaLightTriangle>& outAreaLights, ResourceUploadBatch& resourceUpload, Scene::MeshConstants*& outMeshConstantUploadBuffer)
-{
-    // Generate normals on the shape, so we can use the binary format of the pbrt library next time.
-    GenerateNormalsIfMissing(triangleShape);
-
     Scene::Mesh mesh;
-    mesh.positionBuffer = GraphicsResource::CreateStaticBuffer(Utf8toUtf16(instance->object->name + " Positions").c_str(), sizeof(DirectX::XMFLOAT3) * triangleShape->vertex.size(), device);
-    mesh.vertexBuffer = GraphicsResource::CreateStaticBuffer(Utf8toUtf16(instance->object->name + " VB").c_str(), sizeof(Scene::Vertex) * triangleShape->vertex.size(), device);
-    mesh.vertexCount = (uint32_t)triangleShape->vertex.size();
-    uint64_t indexbufferSize = sizeof(uint32_t) * triangleShape->index.size() * 3;
-    mesh.indexBuffer = GraphicsResource::CreateStaticBuffer(Utf8toUtf16(instance->object->name + " IB").c_str(), indexbufferSize, device);
-    mesh.indexCount = (uint32_t)triangleShape->index.size() * 3;
-    mesh.constantBuffer = GraphicsResource::CreateStaticBuffer(Utf8toUtf16(instance->object->name + " CB").c_str(), sizeof(Scene::MeshConstants), device);
-    
-    // Positions
-    std::vector<DirectX::XMFLOAT3> positions(triangleShape->vertex.size());
-    DirectX::XMFLOAT3* positionBufferUploadData = (DirectX::XMFLOAT3*)resourceUpload.CreateAndMapUploadBuffer(mesh.positionBuffer, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-    for (size_t vertexIdx = 0; vertexIdx < triangleShape->vertex.size(); ++vertexIdx)
-        positionBufferUploadData[vertexIdx] = PbrtVecToXMFloat(instance->xfm * triangleShape->vertex[vertexIdx]);
-
-    // Vertices.
-    auto normalTransformation = pbrt::math::inverse_transpose(instance->xfm.l);
-    std::vector<Scene::Vertex> vertices(triangleShape->vertex.size());
-    for (size_t vertexIdx = 0; vertexIdx < triangleShape->vertex.size(); ++vertexIdx)
-    {
-        auto normal = triangleShape->normal[vertexIdx];
-        if (triangleShape->reverseOrientation)
-            normal = -normal;
-        vertices[vertexIdx].normal = PbrtVecToXMFloat(normalTransformation * normal);
-        vertices[vertexIdx].texcoord = DirectX::XMFLOAT2{ 0, 0 };
-    }
-    if (triangleShape->texcoord.size() == triangleShape->vertex.size())
+    mesh.positionBuffer = GraphicsResource::CreateStaticBuffer(Utf8toUtf16(cpuMesh.name + " Positions").c_str(), sizeof(Float3) * cpuMesh.positions.size(), device);
+    mesh.vertexBuffer = GraphicsResource::CreateStaticBuffer(Utf8toUtf16(cpuMesh.name + " VB").c_str(), sizeof(Scene::Vertex) * cpuMesh.vertices.size(), device);
+    mesh.vertexCount = (uint32_t)cpuMesh.vertices.size();
+    uint64_t indexbufferSize = sizeof(uint32_t) * cpuMesh.indices.size();
+    mesh.indexBuffer = GraphicsResource::CreateStaticBuffer(Utf8toUtf16(cpuMesh.name + " IB").c_str(), indexbufferSize, device);
+    mesh.indexCount = (uint32_t)cpuMesh.indices.size();
+    mesh.constantBuffer = GraphicsResource::CreateStaticBuffer(Utf8toUtf16(cpuMesh.name + " CB").c_str(), sizeof(Scene::MeshConstants), device);
+
     {
-        for (size_t vertexIdx = 0; vertexIdx < triangleShape->texcoord.size(); ++vertexIdx)
-            vertices[vertexIdx].texcoord = DirectX::XMFLOAT2{ triangleShape->texcoord[vertexIdx].x, -triangleShape->texcoord[vertexIdx].y };
+        void* positionBufferUploadData = resourceUpload.CreateAndMapUploadBuffer(mesh.positionBuffer, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+        memcpy(positionBufferUploadData, cpuMesh.positions.data(), sizeof(Float3) * cpuMesh.positions.size());
     }
     {
         void* vertexBufferUploadData = resourceUpload.CreateAndMapUploadBuffer(mesh.vertexBuffer, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-        memcpy(vertexBufferUploadData, vertices.data(), sizeof(Scene::Vertex) * triangleShape->vertex.size());
+        memcpy(vertexBufferUploadData, cpuMesh.vertices.data(), sizeof(Scene::Vertex) * cpuMesh.vertices.size());
     }
-
-    // Indices
     {
         void* indexBufferUploadData = resourceUpload.CreateAndMapUploadBuffer(mesh.indexBuffer, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-        memcpy(indexBufferUploadData, triangleShape->index.data(), indexbufferSize);
+        memcpy(indexBufferUploadData, cpuMesh.indices.data(), indexbufferSize);
     }
 
     // Constants
     {
-        void* constantBufferUploadData = resourceUpload.CreateAndMapUploadBuffer(mesh.constantBuffer, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
-        outMeshConstantUploadBuffer = (Scene::MeshConstants*)constantBufferUploadData;
-        outMeshConstantUploadBuffer->MeshIndex = index;
-
-        pbrt::DiffuseAreaLightRGB::SP areaLight = triangleShape->areaLight ? triangleShape->areaLight->as<pbrt::DiffuseAreaLightRGB>() : nullptr;
-        if (areaLight)
-        {
-            AddAreaLights(positionBufferUploadData, vertices.data(), (uint32_t*)triangleShape->index.data(), (uint32_t)triangleShape->index.size(), PbrtVecToXMFloat(areaLight->L), outAreaLights);
-            outMeshConstantUploadBuffer->AreaLightRadiance = PbrtVecToXMFloat(areaLight->L);
-            outMeshConstantUploadBuffer->IsEmitter = 0xFFFFFFFF;
-        }
-        else
-            outMeshConstantUploadBuffer->IsEmitter = 0;
+        Scene::MeshConstants* constants = (Scene::MeshConstants*)resourceUpload.CreateAndMapUploadBuffer(mesh.constantBuffer, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+        constants->MeshIndex = index;
+        constants->MaterialType = material.type;
+        constants->IsEmitter = cpuMesh.isEmitter ? 0xFFFFFFFF : 0;
+        constants->DiffuseTextureIndex = material.diffuseTextureIndex; // Textures are uploaded in the same order.
+        constants->AreaLightRadiance = Float3ToXMFloat(cpuMesh.areaLightRadiance);
+        constants->Roughness = material.roughness;
+        constants->Eta = Float3ToXMFloat(material.eta);
+        constants->RoughnessSq = material.roughness * material.roughness;
+        constants->Ks = Float3ToXMFloat(material.ks);
     }
 
     return mesh;
 }
 
-std::unique_ptr<Scene> Scene::LoadPbrtScene(const std::string& pbrtFilePath, CommandQueue& commandQueue, ID3D12Device5* device)
+std::unique_ptr<Scene> Scene::LoadPbrtScene(const std::string& pbrtFilePath, CommandQueue& commandQueue, ID3D12Device5* device, ThreadPool* threadPool, const CpuScene::ImportSettings& importSettings)
 {
-    pbrt::Scene::SP pbrtScene;
-
-    std::string pbfFilePath = pbrtFilePath.substr(0, pbrtFilePath.find_last_of('.')) + ".pbf";
-    bool pbfFileExists = std::ifstream(pbfFilePath.c_str()).good();
-
-    if (pbfFileExists)
-    {
-        try
-        {
-            pbrtScene = pbrt::Scene::loadFrom(pbfFilePath);
-        }
-        catch (std::exception& exception)
-        {
-            LogPrint(LogLevel::Failure, "Failed to load scene from pbf: %s", exception.what());
-        }
-        LogPrint(LogLevel::Success, "Successfully imported pbrt scene from pbf (%s)", pbrtFilePath.c_str());
-    }
-    else
-    {
-        try
-        {
-            pbrtScene = pbrt::importPBRT(pbrtFilePath);
-        }
-        catch (std::exception& exception)
-        {
-            LogPrint(LogLevel::Failure, "Failed to load scene from pbrt: %s", exception.what());
-        }
-        LogPrint(LogLevel::Success, "Successfully imported pbrt scene from pbrt (%s)", pbrtFilePath.c_str());
-    }
-
-    if (!pbrtScene)
+    auto cpuScene = CpuScene::LoadPbrtScene(pbrtFilePath, threadPool, importSettings);
+    if (!cpuScene)
         return nullptr;
-    LogPrint(LogLevel::Info, "Flattening scene...");
-    pbrtScene->makeSingleLevel();
 
     auto scene = std::unique_ptr<Scene>(new Scene());
 
-    LogPrint(LogLevel::Info, "Importing...");
-
-    scene->m_originFilePath = pbrtFilePath;
-    if (pbrtScene->film)
-    {
-        scene->m_screenHeight = (uint32_t)pbrtScene->film->resolution.y;
-        scene->m_screenWidth = (uint32_t)pbrtScene->film->resolution.x;
-    }
-
-    for (const auto& pbrtCamera : pbrtScene->cameras)
+    for (const auto& cameraDefinition : cpuScene->cameras)
     {
         scene->m_cameras.emplace_back();
         auto& camera = scene->m_cameras.back();
-        camera.SetPosition(PbrtVecToXMVector(pbrtCamera->frame.p));
-        camera.SetUp(DirectX::XMVector3Normalize(PbrtVecToXMVector(pbrtCamera->frame.l.vy)));
-        camera.SetDirection(DirectX::XMVector3Normalize(PbrtVecToXMVector(pbrtCamera->frame.l.vz)));
-        camera.SetFovRad(pbrtCamera->fov * ((float)M_PI / 180.0f));
-        camera.SnapUpToAxis(); // Makes camera easier to control
+        camera.SetPosition(DirectX::XMVectorSet(cameraDefinition.position.x, cameraDefinition.position.y, cameraDefinition.position.z, 0.0f));
+        camera.SetUp(DirectX::XMVectorSet(cameraDefinition.up.x, cameraDefinition.up.y, cameraDefinition.up.z, 0.0f));
+        camera.SetDirection(DirectX::XMVectorSet(cameraDefinition.direction.x, cameraDefinition.direction.y, cameraDefinition.direction.z, 0.0f));
+        camera.SetFovRad(cameraDefinition.fovRad);
     }
 
-    std::string sceneDirectory = GetDirectory(pbrtFilePath);
+    LogPrint(LogLevel::Info, "Uploading...");
 
     auto commandList = CreateTemporaryCommandList(device);
     ResourceUploadBatch uploadBatch(commandList.Get());
 
-    std::unordered_map<pbrt::Material*, Material> loadedMaterials;
-
-    for (const pbrt::Instance::SP& instance : pbrtScene->world->instances)
+    for (const auto& texture : cpuScene->textures)
+        scene->m_textureManager.AddTexture(texture, uploadBatch, device);
+    for (uint32_t meshIdx = 0; meshIdx < (uint32_t)cpuScene->meshes.size(); ++meshIdx)
     {
-        for (const pbrt::Shape::SP& shape : instance->object->shapes)
-        {
-            const auto triangleShape = shape->as<pbrt::TriangleMesh>();
-            if (!triangleShape)
-            {
-                LogPrint(LogLevel::Warning, "Unsupported shape type %s", shape->toString().c_str());
-                continue;
-            }
-
-            Scene::MeshConstants* constantUploadBuffer;
-            scene->m_meshes.push_back(LoadPbrtMesh((uint32_t)scene->m_meshes.size(), triangleShape, instance, device, scene->m_areaLights, uploadBatch, constantUploadBuffer));
-            
-            auto preloadedMaterialIt = loadedMaterials.find(shape->material.get());
-            if (preloadedMaterialIt == loadedMaterials.end())
-                preloadedMaterialIt = loadedMaterials.insert(std::make_pair(shape->material.get(), LoadPbrtMaterial(sceneDirectory, shape->material, scene->m_textureManager, uploadBatch, device))).first;
-            
-            const auto& material = preloadedMaterialIt->second;
-            constantUploadBuffer->DiffuseTextureIndex = material.DiffuseTextureIndex;
-            constantUploadBuffer->MaterialType = material.MaterialType;
-            constantUploadBuffer->Eta = material.Eta;
-            constantUploadBuffer->Ks = material.Ks;
-            constantUploadBuffer->Roughness = material.Roughness;
-            constantUploadBuffer->RoughnessSq = material.Roughness * material.Roughness;
-        }
-        for (const pbrt::LightSource::SP& lightSource : instance->object->lightSources)
-        {
-            // todo.
-        }
+        const auto& cpuMesh = cpuScene->meshes[meshIdx];
+        scene->m_meshes.push_back(UploadMesh(meshIdx, cpuMesh, cpuScene->materials[cpuMesh.materialIndex], device, uploadBatch));
     }
 
-    if (!pbfFileExists)
-    {
-        LogPrint(LogLevel::Info, "Saving pbf file...");
-        pbrtScene->saveTo(pbfFilePath);
-    }
-
-
     // todo: be clever about BLAS/TLAS instances
 
-    //scene->m_meshes.resize(1);
-    //CreateTestTriangle(scene->m_meshes.back(), device);
-
     LogPrint(LogLevel::Info, "Creating accelleration datastructure...");
     scene->CreateAccellerationDataStructure(commandList.Get(), device);
 
-    scene->m_blueNoiseTextureIndex = scene->m_textureManager.GetTextureIndexForFile("shaders/bluenoise128.png", uploadBatch, DXGI_FORMAT_R32_UINT, device);
+    // Generated with bluenoise-generator, one slice per iteration.
+    scene->m_blueNoiseTextureIndex = scene->m_textureManager.GetTextureArrayIndexForFile("shaders/bluenoise128x128x64.png", uploadBatch, DXGI_FORMAT_R32_UINT, device);
 
     commandList->Close();
     commandQueue.WaitUntilExectionIsFinished(commandQueue.ExecuteCommandList(commandList.Get()));    
 
+    // Light sampling still needs the area lights, everything else is on the GPU now.
+    scene->m_screenWidth = cpuScene->screenWidth;
+    scene->m_screenHeight = cpuScene->screenHeight;
+    scene->m_filePath = cpuScene->originFilePath;
+    scene->m_areaLights = std::move(cpuScene->areaLights);
+
     LogPrint(LogLevel::Success, "Successfully loaded scene");
     return scene;
 }
@@ -403,41 +141,38 @@ void Scene::CreateAccellerationDataStructure(ID3D12GraphicsCommandList4* command
 
 const std::string Scene::GetName() const
 {
-    auto lastSlash = m_originFilePath.find_last_of("/\\");
-    auto lastDot = m_originFilePath.find_last_of('.');
-    return m_originFilePath.substr(lastSlash + 1, lastDot - lastSlash - 1);
+    const std::string& originFilePath = m_filePath;
+    auto lastSlash = originFilePath.find_last_of("/\\");
+    auto lastDot = originFilePath.find_last_of('.');
+    return originFilePath.substr(lastSlash + 1, lastDot - lastSlash - 1);
 }
 
-uint32_t Scene::TextureManager::GetTextureIndexForColor(DirectX::XMFLOAT3 color, ResourceUploadBatch& resourceUpload, ID3D12Device* device)
+uint32_t Scene::TextureManager::AddTexture(const CpuScene::Texture& cpuTexture, ResourceUploadBatch& resourceUpload, ID3D12Device* device)
 {
-    std::string textureIdentifier = std::to_string(color.x) + std::to_string(color.y) + std::to_string(color.z);
-    return GetTextureIndexForColor(textureIdentifier, color, resourceUpload, device);
-}
-
-uint32_t Scene::TextureManager::GetTextureIndexForColor(const std::string& textureIdentifier, DirectX::XMFLOAT3 color, ResourceUploadBatch& resourceUpload, ID3D12Device* device)
-{
-    auto identifierIt = m_textureIdentifierToTextureIndex.find(textureIdentifier);
-    if (identifierIt != m_textureIdentifierToTextureIndex.end())
-        return identifierIt->second;
+    TextureResource texture;
+    if (cpuTexture.srgbTexels.empty())
+    {
+        texture = TextureResource::CreateTexture2D(Utf8toUtf16(cpuTexture.identifier).c_str(), DXGI_FORMAT_R32G32B32_FLOAT, 1, 1, 1, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COPY_DEST, device);
+        auto textureData = resourceUpload.CreateAndMapUploadTexture2D(texture, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+        *(DirectX::XMFLOAT3*)textureData.pData = Float3ToXMFloat(cpuTexture.color);
+    }
+    else
+    {
+        texture = TextureResource::CreateTexture2D(Utf8toUtf16(cpuTexture.identifier).c_str(), DXGI_FORMAT_R8G8B8A8_UNORM_SRGB, cpuTexture.width, cpuTexture.height, 1, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COPY_DEST, device);
+        auto textureData = resourceUpload.CreateAndMapUploadTexture2D(texture, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
 
-    auto texture = TextureResource::CreateTexture2D(Utf8toUtf16(textureIdentifier).c_str(), DXGI_FORMAT_R32G32B32_FLOAT, 1, 1, 1, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COPY_DEST, device);
-    auto textureData = resourceUpload.CreateAndMapUploadTexture2D(texture, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-    *(DirectX::XMFLOAT3*)textureData.pData = color;
+        // Copy row by row since rows can have padding!
+        size_t rawRowPitch = (size_t)4 * cpuTexture.width;
+        for (uint32_t rowIdx = 0; rowIdx < cpuTexture.height; ++rowIdx)
+            memcpy((char*)textureData.pData + textureData.RowPitch * rowIdx, cpuTexture.srgbTexels.data() + rawRowPitch * rowIdx, rawRowPitch);
+    }
 
-    m_textureIdentifierToTextureIndex.insert(std::make_pair(textureIdentifier, (uint32_t)m_textures.size()));
+    m_textureIdentifierToTextureIndex.insert(std::make_pair(cpuTexture.identifier, (uint32_t)m_textures.size()));
     m_textures.push_back(std::move(texture));
     return (uint32_t)m_textures.size() - 1;
 }
 
-uint32_t Scene::TextureManager::GetTextureIndexForFile(const std::string& filename, ResourceUploadBatch& resourceUpload, ID3D12Device* device)
-{
-    // todo: Use stbi_is_hdr to detect hdr formats.
-    // todo: Support single channel. (a bit tricky because then we no longer force to 4 channels meaning we need to expand whenever we encounter 3)
-    const DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
-    return GetTextureIndexForFile(filename, resourceUpload, format, device);
-}
-
-uint32_t Scene::TextureManager::GetTextureIndexForFile(const std::string& filename, ResourceUploadBatch& resourceUpload, DXGI_FORMAT format, ID3D12Device* device)
+uint32_t Scene::TextureManager::GetTextureArrayIndexForFile(const std::string& filename, ResourceUploadBatch& resourceUpload, DXGI_FORMAT format, ID3D12Device* device)
 {
     auto identifierIt = m_textureIdentifierToTextureIndex.find(filename);
     if (identifierIt != m_textureIdentifierToTextureIndex.end())
@@ -445,21 +180,35 @@ uint32_t Scene::TextureManager::GetTextureIndexForFile(const std::string& filena
 
     int textureWidth, textureHeight, numComp;
     stbi_uc* loadedImage = stbi_load(filename.c_str(), &textureWidth, &textureHeight, &numComp, 4);
-    if (!loadedImage)
+    std::vector<stbi_uc> fallbackImage;
+    if (!loadedImage || textureHeight % textureWidth != 0)
     {
-        LogPrint(LogLevel::Failure, "Failed to load image from \"%s\": %s", filename.c_str(), stbi_failure_reason());
-        GetTextureIndexForColor(filename, DirectX::XMFLOAT3(1.0f, 0.0f, 1.0f), resourceUpload, device);
-    }
+        if (loadedImage)
+            LogPrint(LogLevel::Failure, "\"%s\" can't be used as texture array, height needs to be a multiple of its width", filename.c_str());
+        else
+            LogPrint(LogLevel::Failure, "Failed to load image from \"%s\": %s", filename.c_str(), stbi_failure_reason());
+        stbi_image_free(loadedImage);
 
-    auto texture = TextureResource::CreateTexture2D(Utf8toUtf16(filename).c_str(), format, (uint32_t)textureWidth, (uint32_t)textureHeight, 1, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COPY_DEST, device);
-    auto textureData = resourceUpload.CreateAndMapUploadTexture2D(texture, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+        // Single black slice.
+        textureWidth = textureHeight = 1;
+        fallbackImage.resize(4, 0);
+        loadedImage = fallbackImage.data();
+    }
+    const uint32_t numSlices = (uint32_t)(textureHeight / textureWidth);
+    const uint32_t sliceHeight = (uint32_t)textureWidth;
 
-    // Copy row by row since rows can have padding!
+    auto texture = TextureResource::CreateTexture2DArray(Utf8toUtf16(filename).c_str(), format, (uint32_t)textureWidth, sliceHeight, numSlices, 1, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COPY_DEST, device);
     size_t rawRowPitch = (size_t)4 * textureWidth;
-    for (int rowIdx = 0; rowIdx < textureHeight; ++rowIdx)
-        memcpy((char*)textureData.pData + textureData.RowPitch * rowIdx, loadedImage + rawRowPitch * rowIdx, rawRowPitch);
+    for (uint32_t sliceIdx = 0; sliceIdx < numSlices; ++sliceIdx)
+    {
+        auto textureData = resourceUpload.CreateAndMapUploadTexture2D(texture, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12CalcSubresource(0, sliceIdx, 0, 1, numSlices));
+        const stbi_uc* slice = loadedImage + rawRowPitch * sliceHeight * sliceIdx;
+        for (uint32_t rowIdx = 0; rowIdx < sliceHeight; ++rowIdx)
+            memcpy((char*)textureData.pData + textureData.RowPitch * rowIdx, slice + rawRowPitch * rowIdx, rawRowPitch);
+    }
 
-    stbi_image_free(loadedImage);
+    if (fallbackImage.empty())
+        stbi_image_free(loadedImage);
 
     m_textureIdentifierToTextureIndex.insert(std::make_pair(filename.c_str(), (uint32_t)m_textures.size()));
     m_textures.push_back(std::move(texture));
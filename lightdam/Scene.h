@@ -3,6 +3,7 @@
 #include "dx12/GraphicsResource.h"
 #include "../external/SimpleMath.h"
 #include "Camera.h"
+#include "cpu/CpuScene.h"
 #include <unordered_map>
 #include <memory>
 #include <vector>
@@ -11,6 +12,7 @@
 class TopLevelAS;
 class CommandQueue;
 class ResourceUploadBatch;
+class ThreadPool;
 
 // A static scene with a DXR Raytracing accelleration structure.
 class Scene
@@ -18,7 +20,9 @@ class Scene
 public:
     // Loads from a PBRT file.
     // Converts to binary format on successful load which will be used automatically if already existing.
-    static std::unique_ptr<Scene> LoadPbrtScene(const std::string& pbrtFilePath, CommandQueue& commandQueue, struct ID3D12Device5* device);
+    // The CpuScene is freed once everything is uploaded, only the area lights are kept for light sampling.
+    static std::unique_ptr<Scene> LoadPbrtScene(const std::string& pbrtFilePath, CommandQueue& commandQueue, struct ID3D12Device5* device, ThreadPool* threadPool = nullptr,
+                                                const CpuScene::ImportSettings& importSettings = CpuScene::ImportSettings());
 
     ~Scene();
 
@@ -37,19 +41,7 @@ public:
     };
 
     // Vertex format used by all vertices in Mesh. (GPU layout)
-    struct Vertex
-    {
-        // Position not needed since everything we need is in the accelleration datastructure!
-        DirectX::SimpleMath::Vector3 normal;
-        DirectX::SimpleMath::Vector2 texcoord;
-    };
-    
-    enum MaterialType
-    {
-        MATERIAL_MATTE = 0,
-        MATERIAL_METAL = 1,
-        MATERIAL_SUBSTRATE = 2,
-    };
+    using Vertex = CpuScene::Vertex;
 
     // Constant buffer format used by all meshes. (GPU layout)
     struct MeshConstants
@@ -67,13 +59,7 @@ public:
     };
 
     // Info struct on an area light (CPU only!)
-    struct AreaLightTriangle
-    {
-        DirectX::SimpleMath::Vector3 positions[3];
-        DirectX::SimpleMath::Vector3 normals[3];
-        DirectX::SimpleMath::Vector3 emittedRadiance; // The amount of emitted radiance at each point and emitted direction.
-        float area;
-    };
+    using AreaLightTriangle = CpuScene::AreaLightTriangle;
 
     const std::vector<Mesh>& GetMeshes() const                  { return m_meshes; }
     const std::vector<TextureResource>& GetTextures() const     { return m_textureManager.m_textures; }
@@ -89,21 +75,19 @@ public:
     void GetScreenSize(uint32_t& width, uint32_t& height) const { width = m_screenWidth; height = m_screenHeight; }
 
     // Where the scene originated from.
-    const std::string& GetFilePath() const { return m_originFilePath; }
+    const std::string& GetFilePath() const { return m_filePath; }
     const std::string GetName() const;
 
     class TextureManager
     {
     public:
-        uint32_t GetTextureIndexForColor(DirectX::XMFLOAT3 color, ResourceUploadBatch& resourceUpload, ID3D12Device* device);
-        uint32_t GetTextureIndexForFile(const std::string& filename, ResourceUploadBatch& resourceUpload, ID3D12Device* device);
-        uint32_t GetTextureIndexForFile(const std::string& filename, ResourceUploadBatch& resourceUpload, DXGI_FORMAT format, ID3D12Device* device);
+        // Uploads a texture loaded by CpuScene.
+        uint32_t AddTexture(const CpuScene::Texture& texture, ResourceUploadBatch& resourceUpload, ID3D12Device* device);
+        // Loads an image of square slices stacked on top of each other as texture array.
+        uint32_t GetTextureArrayIndexForFile(const std::string& filename, ResourceUploadBatch& resourceUpload, DXGI_FORMAT format, ID3D12Device* device);
 
         std::vector<TextureResource> m_textures;
         std::unordered_map<std::string, uint32_t> m_textureIdentifierToTextureIndex;
-
-    private:
-        uint32_t GetTextureIndexForColor(const std::string& textureIdentifier, DirectX::XMFLOAT3 color, ResourceUploadBatch& resourceUpload, ID3D12Device* device);
     };
 
 private:
@@ -111,16 +95,16 @@ private:
 
     void CreateAccellerationDataStructure(ID3D12GraphicsCommandList4* commandList, ID3D12Device5* device);
 
-    std::string m_originFilePath;
+    std::vector<AreaLightTriangle> m_areaLights;
+    uint32_t m_screenWidth;
+    uint32_t m_screenHeight;
+    std::string m_filePath;
 
     std::unique_ptr<TopLevelAS> m_tlas;
     std::vector<std::unique_ptr<class BottomLevelAS>> m_blas;
 
     std::vector<Mesh> m_meshes;
-    std::vector<AreaLightTriangle> m_areaLights;
     std::vector<Camera> m_cameras;
-    uint32_t m_screenWidth = 0;
-    uint32_t m_screenHeight = 0;
 
     TextureManager m_textureManager;
     uint32_t m_blueNoiseTextureIndex;
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+// Owen scrambled Sobol sequence.
+//
+// Scrambling is the hash based nested uniform scramble from Burley 2020, "Practical Hash-based Owen Scrambling"
+// http://www.jcgt.org/published/0009/04/01/
+// The same functions exist in shaders/Sobol.hlsl and produce the same values.
+//
+// For path tracing use the padded variants: Every bounce dimension gets its own 2D/4D Sobol set, decorrelated from the others
+// by an Owen scrambled (=shuffled) sample index. This only relies on the first four Sobol dimensions which have the best stratification,
+// yet all bounce dimensions stay well stratified on their own.
+class SobolSampler
+{
+public:
+    // Number of dimensions we have Joe & Kuo direction numbers for.
+    static constexpr uint32_t MaxDimensions = 1024;
+
+    // Raw Sobol sample as 32 bit fixed point number.
+    static uint32_t SampleUInt(uint32_t index, uint32_t dimension);
+
+    // Owen scrambled Sobol sample in [0, 1).
+    // All samples with the same seed belong to the same scrambled sequence.
+    static float Sample(uint32_t index, uint32_t dimension, uint32_t seed);
+
+    // Padded samples for a dimension set (e.g. one per bounce), each set being an independently shuffled and scrambled 2D/4D Sobol sequence.
+    static void SamplePadded2D(uint32_t index, uint32_t dimensionSet, uint32_t seed, float outSample[2]);
+    static void SamplePadded4D(uint32_t index, uint32_t dimensionSet, uint32_t seed, float outSample[4]);
+
+    // Building blocks, see shaders/Sobol.hlsl for the GPU versions.
+    static uint32_t ReverseBits(uint32_t x);
+    static uint32_t LaineKarrasPermutation(uint32_t x, uint32_t seed);
+    static uint32_t NestedUniformScramble(uint32_t x, uint32_t seed);
+    static uint32_t HashCombine(uint32_t seed, uint32_t value);
+    static float ToUnitFloat(uint32_t x);
+
+    // Direction numbers (32 per dimension) for the given dimension.
+    static const uint32_t* GetDirectionNumbers(uint32_t dimension);
+};
@@ -0,0 +1,251 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+// Pool and queue of the worker running on this thread, tasks it spawns go to its own queue.
+static thread_local const ThreadPool* s_currentPool = nullptr;
+static thread_local uint32_t s_currentQueueIndex = 0;
+
+ThreadPool::ThreadPool(uint32_t numThreads, std::function<void(uint32_t)> onWorkerStart)
+    : m_numQueuedTasks(0)
+    , m_numSleepingWorkers(0)
+    , m_shutdown(false)
+{
+    if (numThreads == 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (uint32_t i = 0; i < numThreads; ++i)
+        m_queues.emplace_back(new TaskQueue());
+    for (uint32_t i = 1; i < numThreads; ++i)
+        m_workers.emplace_back(&ThreadPool::WorkerLoop, this, i, onWorkerStart);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+    }
+    m_taskAvailable.notify_all();
+    for (std::thread& worker : m_workers)
+        worker.join();
+    // Without workers, tasks are left to the destroying thread.
+    while (TryExecuteTask(0)) {}
+}
+
+uint32_t ThreadPool::GetCurrentWorkerIndex() const
+{
+    return s_currentPool == this ? s_currentQueueIndex : 0;
+}
+
+void ThreadPool::Push(std::function<void()> function, const char* name)
+{
+    Task task;
+    task.function = std::move(function);
+    task.name = name;
+    if (m_taskTimingHook)
+        task.queueTime = std::chrono::high_resolution_clock::now();
+
+    TaskQueue& queue = *m_queues[GetCurrentWorkerIndex()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    ++m_numQueuedTasks;
+
+    // A worker going to sleep either sees the new task or is counted here already.
+    if (m_numSleepingWorkers > 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
+        m_taskAvailable.notify_one();
+    }
+}
+
+bool ThreadPool::TryExecuteTask(uint32_t queueIndex)
+{
+    if (m_numQueuedTasks == 0)
+        return false;
+
+    Task task;
+    bool foundTask = false;
+    // Own queue newest first, keeps waiting threads on the tasks they most likely depend on.
+    {
+        TaskQueue& queue = *m_queues[queueIndex];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty())
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            foundTask = true;
+        }
+    }
+    // Other queues oldest first, these are usually the biggest ones.
+    const uint32_t numQueues = static_cast<uint32_t>(m_queues.size());
+    for (uint32_t i = 1; i < numQueues && !foundTask; ++i)
+    {
+        TaskQueue& queue = *m_queues[(queueIndex + i) % numQueues];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty())
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            foundTask = true;
+        }
+    }
+    if (!foundTask)
+        return false;
+    --m_numQueuedTasks;
+
+    if (!m_taskTimingHook)
+    {
+        task.function();
+        return true;
+    }
+    const auto start = std::chrono::high_resolution_clock::now();
+    task.function();
+    const auto end = std::chrono::high_resolution_clock::now();
+    m_taskTimingHook(task.name, std::chrono::duration<double>(start - task.queueTime).count(), std::chrono::duration<double>(end - start).count());
+    return true;
+}
+
+void ThreadPool::WorkerLoop(uint32_t queueIndex, std::function<void(uint32_t)> onWorkerStart)
+{
+    s_currentPool = this;
+    s_currentQueueIndex = queueIndex;
+    if (onWorkerStart)
+        onWorkerStart(queueIndex);
+    while (true)
+    {
+        if (TryExecuteTask(queueIndex))
+            continue;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_shutdown && m_numQueuedTasks == 0)
+            return;
+        ++m_numSleepingWorkers;
+        m_taskAvailable.wait(lock, [this] { return m_shutdown || m_numQueuedTasks > 0; });
+        --m_numSleepingWorkers;
+    }
+}
+
+void ThreadPool::TaskGroup::Run(std::function<void()> task, const char* name)
+{
+    ++m_numPendingTasks;
+    m_pool.Push([this, task = std::move(task)]()
+    {
+        task();
+        --m_numPendingTasks;
+    }, name);
+}
+
+void ThreadPool::TaskGroup::Wait()
+{
+    const uint32_t queueIndex = m_pool.GetCurrentWorkerIndex();
+    while (m_numPendingTasks > 0)
+    {
+        if (!m_pool.TryExecuteTask(queueIndex))
+            std::this_thread::yield();
+    }
+}
+
+ThreadPool::JobHandle ThreadPool::Schedule(std::function<void()> function, const char* name, const std::vector<JobHandle>& dependencies)
+{
+    JobHandle job = std::make_shared<Job>();
+    job->m_function = std::move(function);
+    job->m_name = name;
+    // One extra reference, so that dependencies finishing in the meantime can't queue the job before we are done here.
+    job->m_numPendingDependencies = static_cast<uint32_t>(dependencies.size()) + 1;
+    for (const JobHandle& dependency : dependencies)
+    {
+        {
+            std::lock_guard<std::mutex> lock(dependency->m_mutex);
+            if (!dependency->m_done)
+            {
+                dependency->m_continuations.push_back(job);
+                continue;
+            }
+        }
+        --job->m_numPendingDependencies;
+    }
+    if (--job->m_numPendingDependencies == 0)
+        QueueJob(job);
+    return job;
+}
+
+void ThreadPool::QueueJob(JobHandle job)
+{
+    const char* name = job->m_name;
+    Push([this, job]()
+    {
+        job->m_function();
+        FinishJob(*job);
+    }, name);
+}
+
+void ThreadPool::FinishJob(Job& job)
+{
+    std::vector<JobHandle> continuations;
+    {
+        std::lock_guard<std::mutex> lock(job.m_mutex);
+        job.m_done = true;
+        continuations.swap(job.m_continuations);
+    }
+    // Releases whatever the function captured, handles may live on for much longer.
+    job.m_function = nullptr;
+    for (const JobHandle& continuation : continuations)
+    {
+        if (--continuation->m_numPendingDependencies == 0)
+            QueueJob(continuation);
+    }
+}
+
+void ThreadPool::Wait(const JobHandle& job)
+{
+    const uint32_t queueIndex = GetCurrentWorkerIndex();
+    while (!job->IsDone())
+    {
+        if (!TryExecuteTask(queueIndex))
+            std::this_thread::yield();
+    }
+}
+
+void ThreadPool::ParallelFor(uint32_t begin, uint32_t end, uint32_t grainSize, const std::function<void(uint32_t, uint32_t)>& function, const char* name)
+{
+    if (begin >= end)
+        return;
+    if (grainSize == 0)
+    {
+        const uint32_t numRanges = GetNumThreads() * 4;
+        grainSize = std::max(1u, (end - begin + numRanges - 1) / numRanges);
+    }
+    TaskGroup group(*this);
+    // The calling thread takes the first range itself.
+    const uint32_t firstRangeEnd = end - begin > grainSize ? begin + grainSize : end;
+    for (uint32_t rangeBegin = firstRangeEnd; rangeBegin < end;)
+    {
+        const uint32_t rangeEnd = end - rangeBegin > grainSize ? rangeBegin + grainSize : end;
+        group.Run([&function, rangeBegin, rangeEnd] { function(rangeBegin, rangeEnd); }, name);
+        rangeBegin = rangeEnd;
+    }
+    function(begin, firstRangeEnd);
+    group.Wait();
+}
+
+void ThreadPool::RunOnMainThread(std::function<void()> function)
+{
+    std::lock_guard<std::mutex> lock(m_mainThreadMutex);
+    m_mainThreadCallbacks.push_back(std::move(function));
+}
+
+uint32_t ThreadPool::ExecuteMainThreadCallbacks()
+{
+    std::vector<std::function<void()>> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(m_mainThreadMutex);
+        callbacks.swap(m_mainThreadCallbacks);
+    }
+    // Callbacks queued by these run in the next call.
+    for (const auto& callback : callbacks)
+        callback();
+    return static_cast<uint32_t>(callbacks.size());
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads executing tasks, shared by scene loading, rendering and file output.
+//
+// Every worker has its own queue: tasks spawned by a worker go to the back of its queue and it takes them back newest
+// first, idle workers steal the oldest task of other queues, which are usually the biggest ones. Tasks spawned by
+// other threads go to a queue shared by them. Threads waiting on a TaskGroup or Job execute queued tasks as well, so
+// tasks may spawn and wait for other tasks.
+class ThreadPool
+{
+public:
+    // numThreads includes the thread calling TaskGroup::Wait, 0 uses all hardware threads.
+    // Worker threads call onWorkerStart with their index (1 to numThreads - 1) before they take any task, e.g. to pin themselves to processors.
+    explicit ThreadPool(uint32_t numThreads = 0, std::function<void(uint32_t workerIndex)> onWorkerStart = nullptr);
+    // Finishes all queued tasks.
+    ~ThreadPool();
+
+    uint32_t GetNumThreads() const { return static_cast<uint32_t>(m_workers.size()) + 1; }
+    // Index of the calling thread if it is a worker of this pool, 0 for all other threads.
+    uint32_t GetCurrentWorkerIndex() const;
+
+    // Set of tasks that can be waited on together.
+    class TaskGroup
+    {
+    public:
+        explicit TaskGroup(ThreadPool& pool) : m_pool(pool), m_numPendingTasks(0) {}
+        ~TaskGroup() { Wait(); }
+
+        // name is passed to the timing hook and needs to outlive the task.
+        void Run(std::function<void()> task, const char* name = nullptr);
+        // Helps executing tasks until all tasks of this group (including those they spawned) are done.
+        void Wait();
+
+    private:
+        ThreadPool& m_pool;
+        std::atomic<uint32_t> m_numPendingTasks;
+    };
+
+    // Task that is queued once all jobs it depends on are done, other jobs can in turn continue after it.
+    class Job
+    {
+    public:
+        bool IsDone() const { return m_done; }
+
+    private:
+        friend class ThreadPool;
+
+        std::function<void()> m_function;
+        const char* m_name = nullptr;
+        std::atomic<uint32_t> m_numPendingDependencies{ 0 };
+        std::atomic<bool> m_done{ false };
+        std::mutex m_mutex;
+        std::vector<std::shared_ptr<Job>> m_continuations;
+    };
+    using JobHandle = std::shared_ptr<Job>;
+
+    // Runs function once all dependencies are done. Jobs run even if nobody holds on to their handle.
+    JobHandle Schedule(std::function<void()> function, const char* name = nullptr, const std::vector<JobHandle>& dependencies = std::vector<JobHandle>());
+    // Helps executing tasks until the job is done.
+    void Wait(const JobHandle& job);
+
+    // Calls function(begin, end) for consecutive ranges of at most grainSize elements and waits for all of them.
+    // grainSize 0 makes about four ranges per thread.
+    void ParallelFor(uint32_t begin, uint32_t end, uint32_t grainSize, const std::function<void(uint32_t, uint32_t)>& function, const char* name = nullptr);
+
+    // Queues a function for the next ExecuteMainThreadCallbacks, e.g. to hand over results of a job to the main thread.
+    void RunOnMainThread(std::function<void()> function);
+    // Runs all functions queued with RunOnMainThread so far, returns how many.
+    uint32_t ExecuteMainThreadCallbacks();
+
+    // Called by the executing thread after every task with its name (null if it has none), the time it waited in a queue
+    // and the time it ran. Tasks are only timed while a hook is set, which must not change while tasks are queued.
+    using TaskTimingHook = std::function<void(const char* name, double queuedSeconds, double runSeconds)>;
+    void SetTaskTimingHook(TaskTimingHook hook) { m_taskTimingHook = std::move(hook); }
+
+private:
+    struct Task
+    {
+        std::function<void()> function;
+        const char* name;
+        std::chrono::high_resolution_clock::time_point queueTime;
+    };
+
+    struct TaskQueue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void Push(std::function<void()> function, const char* name);
+    void QueueJob(JobHandle job);
+    void FinishJob(Job& job);
+    bool TryExecuteTask(uint32_t queueIndex);
+    void WorkerLoop(uint32_t queueIndex, std::function<void(uint32_t)> onWorkerStart);
+
+    std::vector<std::thread> m_workers;
+    // Queue 0 is shared by all threads that are not workers of this pool, worker i owns queue i.
+    std::vector<std::unique_ptr<TaskQueue>> m_queues;
+    std::atomic<uint32_t> m_numQueuedTasks;
+    // Workers sleep on the condition variable while no tasks are queued, pushing only locks the mutex if any of them does.
+    std::atomic<uint32_t> m_numSleepingWorkers;
+    std::mutex m_mutex;
+    std::condition_variable m_taskAvailable;
+    bool m_shutdown;
+
+    std::mutex m_mainThreadMutex;
+    std::vector<std::function<void()>> m_mainThreadCallbacks;
+
+    TaskTimingHook m_taskTimingHook;
+};
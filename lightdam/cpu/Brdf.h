@@ -0,0 +1,138 @@
+#pragma once
+
+#include "CpuMath.h"
+#include "../MathUtils.h"
+
+// Scalar port of shaders/Brdf.hlsl (and SampleHemisphereCosine from Random.hlsl), see there for references and comments.
+// Kept as close to the shader code as possible, so CPU and GPU renderings can be compared directly.
+
+inline Float3 SampleHemisphereCosine(Float2 randomSample)
+{
+    const float phi = 2.0f * PI * randomSample.x;
+    const float sinTheta = sqrtf(randomSample.y);
+    return Float3(sinTheta * cosf(phi), sinTheta * sinf(phi), sqrtf(1.0f - randomSample.y));
+}
+
+inline Float3 FresnelDieletricConductorApprox(const Float3& eta, const Float3& etak, float cosTheta)
+{
+    const float cosTheta2 = cosTheta * cosTheta;
+    const Float3 twoEtaCosTheta = 2.0f * eta * cosTheta;
+
+    const Float3 t0 = eta * eta + etak * etak;
+    const Float3 t1 = t0 * cosTheta2;
+    const Float3 rs = (t0 - twoEtaCosTheta + Float3(cosTheta2)) / (t0 + twoEtaCosTheta + Float3(cosTheta2));
+    const Float3 rp = (t1 - twoEtaCosTheta + Float3(1.0f)) / (t1 + twoEtaCosTheta + Float3(1.0f));
+
+    return 0.5f * (rp + rs);
+}
+
+inline Float3 SchlickFresnel(const Float3& eta, float cosTheta)
+{
+    return eta + powf(1.0f - cosTheta, 5.0f) * (Float3(1.0f) - eta);
+}
+
+inline float GGXNormalDistribution(float NdotH, float roughnessSq)
+{
+    const float distribution = NdotH * NdotH * (roughnessSq - 1.0f) + 1.0f;
+    return roughnessSq / (PI * distribution * distribution + 0.00000001f);
+}
+
+inline Float3 SampleGGXNormalDistributionHalfVector(Float2 randomSample, float roughnessSq)
+{
+    const float tanTheta2 = roughnessSq * randomSample.x / (1.0f - randomSample.x);
+    const float cosTheta = 1.0f / sqrtf(1.0f + tanTheta2);
+    const float sinTheta = sqrtf(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+    const float phi = (2.0f * PI) * randomSample.y;
+    return Float3(sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta);
+}
+
+inline float GGXSpecular(float NdotH, float NdotL, float NdotV, float roughnessSq)
+{
+    const float D = GGXNormalDistribution(NdotH, roughnessSq);
+
+    const float termI = NdotL + sqrtf(roughnessSq + (1.0f - roughnessSq) * NdotL * NdotL);
+    const float termO = NdotV + sqrtf(roughnessSq + (1.0f - roughnessSq) * NdotV * NdotV);
+
+    return D / (termI * termO);
+}
+
+inline Float3 EvaluateMicrofacetBrdf(float NdotL, const Float3& toLight, float NdotV, const Float3& toView, const Float3& normal, const Float3& eta, const Float3& k, float roughnessSq)
+{
+    const Float3 h = Normalize(toLight + toView); // half vector
+    // degenerated case
+    if (!std::isfinite(h.x))
+        return Float3(0.0f);
+
+    const float NdotH = Dot(normal, h);
+    const float LdotH = Dot(toLight, h);
+    const Float3 F = FresnelDieletricConductorApprox(eta, k, LdotH);
+    return F * GGXSpecular(NdotH, NdotL, NdotV, roughnessSq);
+}
+
+inline Float3 SampleGGXVisibleNormal(const Float3& toViewTS, float roughness, Float2 randomSample)
+{
+    // Stretch the view vector so we are sampling as though roughness==1
+    const Float3 v = Normalize(Float3(toViewTS.x * roughness, toViewTS.y * roughness, toViewTS.z));
+
+    // Build an orthonormal basis with v, t1, and t2
+    const Float3 t1 = (v.z < 0.999f) ? Normalize(Cross(v, Float3(0.0f, 0.0f, 1.0f))) : Float3(1.0f, 0.0f, 0.0f);
+    const Float3 t2 = Cross(t1, v);
+
+    // Choose a point on a disk with each half of the disk weighted proportionally to its projection onto direction v
+    const float a = 1.0f / (1.0f + v.z);
+    const float r = sqrtf(randomSample.x);
+    const float phi = (randomSample.y < a) ? (randomSample.y / a) * PI : PI + (randomSample.y - a) / (1.0f - a) * PI;
+    const float p1 = r * cosf(phi);
+    const float p2 = r * sinf(phi) * ((randomSample.y < a) ? 1.0f : v.z);
+
+    // Calculate the normal in this stretched tangent space
+    const Float3 n = p1 * t1 + p2 * t2 + sqrtf(std::max(0.0f, 1.0f - p1 * p1 - p2 * p2)) * v;
+
+    // Unstretch and normalize the normal
+    return Normalize(Float3(roughness * n.x, roughness * n.y, std::max(0.0f, n.z)));
+}
+
+inline Float3 EvaluateLambertBrdf(const Float3& diffuse)
+{
+    return diffuse / PI;
+}
+
+inline Float3 EvaluateAshikminShirleyBrdf(float NdotL, const Float3& toLight, float NdotV, const Float3& toView, const Float3& normal, const Float3& k, float roughnessSq, const Float3& diffuse)
+{
+    const Float3 h = Normalize(toLight + toView); // half vector
+    const float NdotH = Dot(normal, h);
+    const float LdotH = Dot(toLight, h);
+
+    const Float3 diffusePart = (28.0f / (23.0f * PI)) * diffuse * (Float3(1.0f) - k) *
+                               (1.0f - powf(1.0f - 0.5f * NdotL, 5.0f)) *
+                               (1.0f - powf(1.0f - 0.5f * NdotV, 5.0f));
+
+    const Float3 specularPart = GGXNormalDistribution(NdotH, roughnessSq) / (4.0f * LdotH * std::max(NdotL, NdotV)) * SchlickFresnel(k, LdotH);
+
+    return diffusePart + specularPart;
+}
+
+inline Float3 SampleAshikminShirleySubstrateBrdf(const Float3& toViewTS, Float2 randomSample, const Float3& k, float roughnessSq, const Float3& diffuse, Float3& throughput)
+{
+    Float3 nextRayDirTS, halfVector;
+    if (randomSample.x < 0.5f)
+    {
+        randomSample.x *= 2.0f;
+        nextRayDirTS = SampleHemisphereCosine(randomSample);
+        halfVector = Normalize(toViewTS + nextRayDirTS);
+    }
+    else
+    {
+        randomSample.x = randomSample.x * 2.0f - 1.0f;
+        halfVector = SampleGGXNormalDistributionHalfVector(randomSample, roughnessSq);
+        nextRayDirTS = Reflect(-toViewTS, halfVector);
+    }
+
+    const Float3 brdf = EvaluateAshikminShirleyBrdf(nextRayDirTS.z, nextRayDirTS, toViewTS.z, toViewTS, Float3(0.0f, 0.0f, 1.0f), k, roughnessSq, diffuse);
+    const float pdf = 0.5f * (
+        nextRayDirTS.z / PI +
+        GGXNormalDistribution(halfVector.z, roughnessSq) * halfVector.z / (4.0f * Dot(toViewTS, halfVector))
+    );
+    throughput = nextRayDirTS.z * brdf / pdf;
+    return nextRayDirTS;
+}
@@ -0,0 +1,371 @@
+#include "Brdf8.h"
+#include "../CpuFeatures.h"
+
+#include <immintrin.h>
+
+// The AVX2 code follows Brdf.h operation by operation, with the same order of additions and multiplications.
+// Divisions by a scalar are multiplications with its reciprocal there as well (see operator/ of Float3).
+
+struct Vector8
+{
+    __m256 x, y, z;
+};
+
+TARGET_AVX2 static inline Vector8 Load8(const Float3Block8& v)
+{
+    return { _mm256_loadu_ps(v.x), _mm256_loadu_ps(v.y), _mm256_loadu_ps(v.z) };
+}
+
+TARGET_AVX2 static inline void Store8(const Vector8& v, Float3Block8& output)
+{
+    _mm256_storeu_ps(output.x, v.x);
+    _mm256_storeu_ps(output.y, v.y);
+    _mm256_storeu_ps(output.z, v.z);
+}
+
+TARGET_AVX2 static inline Vector8 Broadcast8(const Float3& v)
+{
+    return { _mm256_set1_ps(v.x), _mm256_set1_ps(v.y), _mm256_set1_ps(v.z) };
+}
+
+TARGET_AVX2 static inline Vector8 Add8(const Vector8& a, const Vector8& b)
+{
+    return { _mm256_add_ps(a.x, b.x), _mm256_add_ps(a.y, b.y), _mm256_add_ps(a.z, b.z) };
+}
+
+TARGET_AVX2 static inline Vector8 Sub8(const Vector8& a, const Vector8& b)
+{
+    return { _mm256_sub_ps(a.x, b.x), _mm256_sub_ps(a.y, b.y), _mm256_sub_ps(a.z, b.z) };
+}
+
+TARGET_AVX2 static inline Vector8 Mul8(const Vector8& a, const Vector8& b)
+{
+    return { _mm256_mul_ps(a.x, b.x), _mm256_mul_ps(a.y, b.y), _mm256_mul_ps(a.z, b.z) };
+}
+
+TARGET_AVX2 static inline Vector8 Mul8(const Vector8& a, __m256 s)
+{
+    return { _mm256_mul_ps(a.x, s), _mm256_mul_ps(a.y, s), _mm256_mul_ps(a.z, s) };
+}
+
+TARGET_AVX2 static inline Vector8 Div8(const Vector8& a, const Vector8& b)
+{
+    return { _mm256_div_ps(a.x, b.x), _mm256_div_ps(a.y, b.y), _mm256_div_ps(a.z, b.z) };
+}
+
+TARGET_AVX2 static inline __m256 Dot8(const Vector8& a, const Vector8& b)
+{
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a.x, b.x), _mm256_mul_ps(a.y, b.y)), _mm256_mul_ps(a.z, b.z));
+}
+
+TARGET_AVX2 static inline Vector8 Cross8(const Vector8& a, const Vector8& b)
+{
+    return { _mm256_sub_ps(_mm256_mul_ps(a.y, b.z), _mm256_mul_ps(a.z, b.y)),
+             _mm256_sub_ps(_mm256_mul_ps(a.z, b.x), _mm256_mul_ps(a.x, b.z)),
+             _mm256_sub_ps(_mm256_mul_ps(a.x, b.y), _mm256_mul_ps(a.y, b.x)) };
+}
+
+TARGET_AVX2 static inline Vector8 Normalize8(const Vector8& a)
+{
+    return Mul8(a, _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(Dot8(a, a))));
+}
+
+// Lanes of a where mask is set, b elsewhere.
+TARGET_AVX2 static inline Vector8 Select8(__m256 mask, const Vector8& a, const Vector8& b)
+{
+    return { _mm256_blendv_ps(b.x, a.x, mask), _mm256_blendv_ps(b.y, a.y, mask), _mm256_blendv_ps(b.z, a.z, mask) };
+}
+
+TARGET_AVX2 static inline __m256 Pow5(__m256 x)
+{
+    const __m256 x2 = _mm256_mul_ps(x, x);
+    return _mm256_mul_ps(_mm256_mul_ps(x2, x2), x);
+}
+
+// std::max(a, b) returns a if either is NaN, _mm256_max_ps returns its second operand.
+TARGET_AVX2 static inline __m256 StdMax(__m256 a, __m256 b)
+{
+    return _mm256_max_ps(b, a);
+}
+
+// Sine and cosine with the range reduction and minimax polynomials of Cephes' sinf/cosf, accurate to about 1e-7 for |x| < 8192.
+TARGET_AVX2 static inline void SinCos8(__m256 x, __m256& sine, __m256& cosine)
+{
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256 sineSign = _mm256_and_ps(x, signMask);
+    x = _mm256_andnot_ps(signMask, x);
+
+    // Octant of x, rounded up to even so that the remainder lies in [-pi/4, pi/4].
+    __m256i octant = _mm256_cvttps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(1.27323954473516f)));
+    octant = _mm256_and_si256(_mm256_add_epi32(octant, _mm256_set1_epi32(1)), _mm256_set1_epi32(~1));
+    const __m256 y = _mm256_cvtepi32_ps(octant);
+    // pi/4 split into three parts, so that the remainder is exact.
+    x = _mm256_sub_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(0.78515625f)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(2.4187564849853515625e-4f)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(3.77489497744594108e-8f)));
+
+    sineSign = _mm256_xor_ps(sineSign, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(octant, _mm256_set1_epi32(4)), 29)));
+    const __m256 cosineSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_andnot_si256(_mm256_sub_epi32(octant, _mm256_set1_epi32(2)), _mm256_set1_epi32(4)), 29));
+    // Octants 2 and 6 swap the polynomials.
+    const __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(octant, _mm256_set1_epi32(2)), _mm256_set1_epi32(2)));
+
+    const __m256 z = _mm256_mul_ps(x, x);
+    __m256 cosinePolynomial = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(2.443315711809948e-5f), z), _mm256_set1_ps(-1.388731625493765e-3f));
+    cosinePolynomial = _mm256_add_ps(_mm256_mul_ps(cosinePolynomial, z), _mm256_set1_ps(4.166664568298827e-2f));
+    cosinePolynomial = _mm256_mul_ps(_mm256_mul_ps(cosinePolynomial, z), z);
+    cosinePolynomial = _mm256_add_ps(_mm256_sub_ps(cosinePolynomial, _mm256_mul_ps(z, _mm256_set1_ps(0.5f))), _mm256_set1_ps(1.0f));
+    __m256 sinePolynomial = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(-1.9515295891e-4f), z), _mm256_set1_ps(8.3321608736e-3f));
+    sinePolynomial = _mm256_add_ps(_mm256_mul_ps(sinePolynomial, z), _mm256_set1_ps(-1.6666654611e-1f));
+    sinePolynomial = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(sinePolynomial, z), x), x);
+
+    sine = _mm256_xor_ps(_mm256_blendv_ps(sinePolynomial, cosinePolynomial, swap), sineSign);
+    cosine = _mm256_xor_ps(_mm256_blendv_ps(cosinePolynomial, sinePolynomial, swap), cosineSign);
+}
+
+TARGET_AVX2 static inline Vector8 SampleHemisphereCosineAvx2(__m256 randomX, __m256 randomY)
+{
+    __m256 sinPhi, cosPhi;
+    SinCos8(_mm256_mul_ps(_mm256_set1_ps(2.0f * PI), randomX), sinPhi, cosPhi);
+    const __m256 sinTheta = _mm256_sqrt_ps(randomY);
+    return { _mm256_mul_ps(sinTheta, cosPhi), _mm256_mul_ps(sinTheta, sinPhi), _mm256_sqrt_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), randomY)) };
+}
+
+TARGET_AVX2 static inline Vector8 FresnelDieletricConductorApproxAvx2(const Float3& eta, const Float3& etak, __m256 cosTheta)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 cosTheta2 = _mm256_mul_ps(cosTheta, cosTheta);
+    const Vector8 twoEtaCosTheta = Mul8(Broadcast8(2.0f * eta), cosTheta);
+
+    const Vector8 t0 = Broadcast8(eta * eta + etak * etak);
+    const Vector8 t1 = Mul8(t0, cosTheta2);
+    const Vector8 cosTheta2Vector = { cosTheta2, cosTheta2, cosTheta2 };
+    const Vector8 oneVector = { one, one, one };
+    const Vector8 rs = Div8(Add8(Sub8(t0, twoEtaCosTheta), cosTheta2Vector), Add8(Add8(t0, twoEtaCosTheta), cosTheta2Vector));
+    const Vector8 rp = Div8(Add8(Sub8(t1, twoEtaCosTheta), oneVector), Add8(Add8(t1, twoEtaCosTheta), oneVector));
+
+    return Mul8(Add8(rp, rs), _mm256_set1_ps(0.5f));
+}
+
+TARGET_AVX2 static inline Vector8 SchlickFresnelAvx2(const Float3& eta, __m256 cosTheta)
+{
+    const __m256 power = Pow5(_mm256_sub_ps(_mm256_set1_ps(1.0f), cosTheta));
+    return Add8(Broadcast8(eta), Mul8(Broadcast8(Float3(1.0f) - eta), power));
+}
+
+TARGET_AVX2 static inline __m256 GGXNormalDistributionAvx2(__m256 NdotH, __m256 roughnessSq)
+{
+    const __m256 distribution = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(NdotH, NdotH), _mm256_sub_ps(roughnessSq, _mm256_set1_ps(1.0f))), _mm256_set1_ps(1.0f));
+    const __m256 denominator = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(PI), distribution), distribution), _mm256_set1_ps(0.00000001f));
+    return _mm256_div_ps(roughnessSq, denominator);
+}
+
+TARGET_AVX2 static inline Vector8 SampleGGXNormalDistributionHalfVectorAvx2(__m256 randomX, __m256 randomY, __m256 roughnessSq)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 tanTheta2 = _mm256_div_ps(_mm256_mul_ps(roughnessSq, randomX), _mm256_sub_ps(one, randomX));
+    const __m256 cosTheta = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_add_ps(one, tanTheta2)));
+    const __m256 sinTheta = _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(one, _mm256_mul_ps(cosTheta, cosTheta)), _mm256_setzero_ps()));
+    __m256 sinPhi, cosPhi;
+    SinCos8(_mm256_mul_ps(_mm256_set1_ps(2.0f * PI), randomY), sinPhi, cosPhi);
+    return { _mm256_mul_ps(sinTheta, cosPhi), _mm256_mul_ps(sinTheta, sinPhi), cosTheta };
+}
+
+TARGET_AVX2 static inline __m256 GGXSpecularAvx2(__m256 NdotH, __m256 NdotL, __m256 NdotV, __m256 roughnessSq)
+{
+    const __m256 D = GGXNormalDistributionAvx2(NdotH, roughnessSq);
+    const __m256 oneMinusRoughnessSq = _mm256_sub_ps(_mm256_set1_ps(1.0f), roughnessSq);
+    const __m256 termI = _mm256_add_ps(NdotL, _mm256_sqrt_ps(_mm256_add_ps(roughnessSq, _mm256_mul_ps(_mm256_mul_ps(oneMinusRoughnessSq, NdotL), NdotL))));
+    const __m256 termO = _mm256_add_ps(NdotV, _mm256_sqrt_ps(_mm256_add_ps(roughnessSq, _mm256_mul_ps(_mm256_mul_ps(oneMinusRoughnessSq, NdotV), NdotV))));
+    return _mm256_div_ps(D, _mm256_mul_ps(termI, termO));
+}
+
+TARGET_AVX2 static inline Vector8 EvaluateAshikminShirleyBrdfAvx2(__m256 NdotL, const Vector8& toLight, __m256 NdotV, const Vector8& toView, const Vector8& normal,
+                                                                  const Float3& k, __m256 roughnessSq, const Vector8& diffuse)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const Vector8 h = Normalize8(Add8(toLight, toView)); // half vector
+    const __m256 NdotH = Dot8(normal, h);
+    const __m256 LdotH = Dot8(toLight, h);
+
+    const __m256 lightFactor = _mm256_sub_ps(one, Pow5(_mm256_sub_ps(one, _mm256_mul_ps(half, NdotL))));
+    const __m256 viewFactor = _mm256_sub_ps(one, Pow5(_mm256_sub_ps(one, _mm256_mul_ps(half, NdotV))));
+    const Vector8 diffusePart = Mul8(Mul8(Mul8(Mul8(diffuse, _mm256_set1_ps(28.0f / (23.0f * PI))), Broadcast8(Float3(1.0f) - k)), lightFactor), viewFactor);
+
+    const __m256 specularScale = _mm256_div_ps(GGXNormalDistributionAvx2(NdotH, roughnessSq),
+                                               _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(4.0f), LdotH), StdMax(NdotL, NdotV)));
+    const Vector8 specularPart = Mul8(SchlickFresnelAvx2(k, LdotH), specularScale);
+
+    return Add8(diffusePart, specularPart);
+}
+
+TARGET_AVX2 static void SampleHemisphereCosine8Avx2(const float randomX[8], const float randomY[8], Float3Block8& direction)
+{
+    Store8(SampleHemisphereCosineAvx2(_mm256_loadu_ps(randomX), _mm256_loadu_ps(randomY)), direction);
+}
+
+TARGET_AVX2 static void FresnelDieletricConductorApprox8Avx2(const Float3& eta, const Float3& etak, const float cosTheta[8], Float3Block8& fresnel)
+{
+    Store8(FresnelDieletricConductorApproxAvx2(eta, etak, _mm256_loadu_ps(cosTheta)), fresnel);
+}
+
+TARGET_AVX2 static void EvaluateMicrofacetBrdf8Avx2(const float NdotL[8], const Float3Block8& toLight, const float NdotV[8], const Float3Block8& toView, const Float3Block8& normal,
+                                                    const Float3& eta, const Float3& k, float roughnessSq, Float3Block8& brdf)
+{
+    const Vector8 toLight8 = Load8(toLight);
+    const Vector8 h = Normalize8(Add8(toLight8, Load8(toView))); // half vector
+    const __m256 NdotH = Dot8(Load8(normal), h);
+    const __m256 LdotH = Dot8(toLight8, h);
+    const Vector8 F = FresnelDieletricConductorApproxAvx2(eta, k, LdotH);
+    const Vector8 result = Mul8(F, GGXSpecularAvx2(NdotH, _mm256_loadu_ps(NdotL), _mm256_loadu_ps(NdotV), _mm256_set1_ps(roughnessSq)));
+
+    // degenerated case
+    const __m256 finite = _mm256_cmp_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), h.x), _mm256_set1_ps(INFINITY), _CMP_LT_OQ);
+    const __m256 zero = _mm256_setzero_ps();
+    Store8(Select8(finite, result, { zero, zero, zero }), brdf);
+}
+
+TARGET_AVX2 static void SampleGGXVisibleNormal8Avx2(const Float3Block8& toViewTS, float roughness, const float randomX[8], const float randomY[8], Float3Block8& microfacetNormalTS)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 pi = _mm256_set1_ps(PI);
+    const __m256 roughness8 = _mm256_set1_ps(roughness);
+    const __m256 randomX8 = _mm256_loadu_ps(randomX);
+    const __m256 randomY8 = _mm256_loadu_ps(randomY);
+
+    // Stretch the view vector so we are sampling as though roughness==1
+    const Vector8 toView = Load8(toViewTS);
+    const Vector8 v = Normalize8({ _mm256_mul_ps(toView.x, roughness8), _mm256_mul_ps(toView.y, roughness8), toView.z });
+
+    // Build an orthonormal basis with v, t1, and t2
+    const Vector8 t1 = Select8(_mm256_cmp_ps(v.z, _mm256_set1_ps(0.999f), _CMP_LT_OQ), Normalize8(Cross8(v, { zero, zero, one })), { one, zero, zero });
+    const Vector8 t2 = Cross8(t1, v);
+
+    // Choose a point on a disk with each half of the disk weighted proportionally to its projection onto direction v
+    const __m256 a = _mm256_div_ps(one, _mm256_add_ps(one, v.z));
+    const __m256 r = _mm256_sqrt_ps(randomX8);
+    const __m256 lowerHalf = _mm256_cmp_ps(randomY8, a, _CMP_LT_OQ);
+    const __m256 phi = _mm256_blendv_ps(_mm256_add_ps(pi, _mm256_mul_ps(_mm256_div_ps(_mm256_sub_ps(randomY8, a), _mm256_sub_ps(one, a)), pi)),
+                                        _mm256_mul_ps(_mm256_div_ps(randomY8, a), pi), lowerHalf);
+    __m256 sinPhi, cosPhi;
+    SinCos8(phi, sinPhi, cosPhi);
+    const __m256 p1 = _mm256_mul_ps(r, cosPhi);
+    const __m256 p2 = _mm256_mul_ps(_mm256_mul_ps(r, sinPhi), _mm256_blendv_ps(v.z, one, lowerHalf));
+
+    // Calculate the normal in this stretched tangent space
+    const __m256 vScale = _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_sub_ps(one, _mm256_mul_ps(p1, p1)), _mm256_mul_ps(p2, p2)), zero));
+    const Vector8 n = Add8(Add8(Mul8(t1, p1), Mul8(t2, p2)), Mul8(v, vScale));
+
+    // Unstretch and normalize the normal
+    Store8(Normalize8({ _mm256_mul_ps(roughness8, n.x), _mm256_mul_ps(roughness8, n.y), _mm256_max_ps(n.z, zero) }), microfacetNormalTS);
+}
+
+TARGET_AVX2 static void EvaluateAshikminShirleyBrdf8Avx2(const float NdotL[8], const Float3Block8& toLight, const float NdotV[8], const Float3Block8& toView, const Float3Block8& normal,
+                                                         const Float3& k, float roughnessSq, const Float3Block8& diffuse, Float3Block8& brdf)
+{
+    Store8(EvaluateAshikminShirleyBrdfAvx2(_mm256_loadu_ps(NdotL), Load8(toLight), _mm256_loadu_ps(NdotV), Load8(toView), Load8(normal),
+                                           k, _mm256_set1_ps(roughnessSq), Load8(diffuse)), brdf);
+}
+
+TARGET_AVX2 static void SampleAshikminShirleySubstrateBrdf8Avx2(const Float3Block8& toViewTS, const float randomX[8], const float randomY[8], const Float3& k, float roughnessSq,
+                                                                const Float3Block8& diffuse, Float3Block8& nextRayDirTS, Float3Block8& throughput)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 roughnessSq8 = _mm256_set1_ps(roughnessSq);
+    const __m256 randomX8 = _mm256_loadu_ps(randomX);
+    const __m256 randomY8 = _mm256_loadu_ps(randomY);
+    const Vector8 toView = Load8(toViewTS);
+
+    // Both halves are computed for all lanes and blended, diffuse lanes take a cosine distributed direction.
+    const __m256 diffuseLanes = _mm256_cmp_ps(randomX8, _mm256_set1_ps(0.5f), _CMP_LT_OQ);
+    const Vector8 diffuseDir = SampleHemisphereCosineAvx2(_mm256_mul_ps(randomX8, two), randomY8);
+    const Vector8 diffuseHalfVector = Normalize8(Add8(toView, diffuseDir));
+    const Vector8 specularHalfVector = SampleGGXNormalDistributionHalfVectorAvx2(_mm256_sub_ps(_mm256_mul_ps(randomX8, two), one), randomY8, roughnessSq8);
+    const Vector8 reflected = { _mm256_sub_ps(zero, toView.x), _mm256_sub_ps(zero, toView.y), _mm256_sub_ps(zero, toView.z) };
+    const Vector8 specularDir = Sub8(reflected, Mul8(specularHalfVector, _mm256_mul_ps(two, Dot8(specularHalfVector, reflected))));
+    const Vector8 dir = Select8(diffuseLanes, diffuseDir, specularDir);
+    const Vector8 halfVector = Select8(diffuseLanes, diffuseHalfVector, specularHalfVector);
+
+    const Vector8 brdf = EvaluateAshikminShirleyBrdfAvx2(dir.z, dir, toView.z, toView, { zero, zero, one }, k, roughnessSq8, Load8(diffuse));
+    const __m256 specularPdf = _mm256_div_ps(_mm256_mul_ps(GGXNormalDistributionAvx2(halfVector.z, roughnessSq8), halfVector.z),
+                                             _mm256_mul_ps(_mm256_set1_ps(4.0f), Dot8(toView, halfVector)));
+    const __m256 pdf = _mm256_mul_ps(_mm256_set1_ps(0.5f), _mm256_add_ps(_mm256_div_ps(dir.z, _mm256_set1_ps(PI)), specularPdf));
+    Store8(Mul8(Mul8(brdf, dir.z), _mm256_div_ps(one, pdf)), throughput);
+    Store8(dir, nextRayDirTS);
+}
+
+void SampleHemisphereCosine8(const float randomX[8], const float randomY[8], Float3Block8& direction)
+{
+    if (CpuSupportsAvx2())
+    {
+        SampleHemisphereCosine8Avx2(randomX, randomY, direction);
+        return;
+    }
+    for (int lane = 0; lane < 8; ++lane)
+        direction.Set(lane, SampleHemisphereCosine(Float2(randomX[lane], randomY[lane])));
+}
+
+void FresnelDieletricConductorApprox8(const Float3& eta, const Float3& etak, const float cosTheta[8], Float3Block8& fresnel)
+{
+    if (CpuSupportsAvx2())
+    {
+        FresnelDieletricConductorApprox8Avx2(eta, etak, cosTheta, fresnel);
+        return;
+    }
+    for (int lane = 0; lane < 8; ++lane)
+        fresnel.Set(lane, FresnelDieletricConductorApprox(eta, etak, cosTheta[lane]));
+}
+
+void EvaluateMicrofacetBrdf8(const float NdotL[8], const Float3Block8& toLight, const float NdotV[8], const Float3Block8& toView, const Float3Block8& normal,
+                             const Float3& eta, const Float3& k, float roughnessSq, Float3Block8& brdf)
+{
+    if (CpuSupportsAvx2())
+    {
+        EvaluateMicrofacetBrdf8Avx2(NdotL, toLight, NdotV, toView, normal, eta, k, roughnessSq, brdf);
+        return;
+    }
+    for (int lane = 0; lane < 8; ++lane)
+        brdf.Set(lane, EvaluateMicrofacetBrdf(NdotL[lane], toLight.Get(lane), NdotV[lane], toView.Get(lane), normal.Get(lane), eta, k, roughnessSq));
+}
+
+void SampleGGXVisibleNormal8(const Float3Block8& toViewTS, float roughness, const float randomX[8], const float randomY[8], Float3Block8& microfacetNormalTS)
+{
+    if (CpuSupportsAvx2())
+    {
+        SampleGGXVisibleNormal8Avx2(toViewTS, roughness, randomX, randomY, microfacetNormalTS);
+        return;
+    }
+    for (int lane = 0; lane < 8; ++lane)
+        microfacetNormalTS.Set(lane, SampleGGXVisibleNormal(toViewTS.Get(lane), roughness, Float2(randomX[lane], randomY[lane])));
+}
+
+void EvaluateAshikminShirleyBrdf8(const float NdotL[8], const Float3Block8& toLight, const float NdotV[8], const Float3Block8& toView, const Float3Block8& normal,
+                                  const Float3& k, float roughnessSq, const Float3Block8& diffuse, Float3Block8& brdf)
+{
+    if (CpuSupportsAvx2())
+    {
+        EvaluateAshikminShirleyBrdf8Avx2(NdotL, toLight, NdotV, toView, normal, k, roughnessSq, diffuse, brdf);
+        return;
+    }
+    for (int lane = 0; lane < 8; ++lane)
+        brdf.Set(lane, EvaluateAshikminShirleyBrdf(NdotL[lane], toLight.Get(lane), NdotV[lane], toView.Get(lane), normal.Get(lane), k, roughnessSq, diffuse.Get(lane)));
+}
+
+void SampleAshikminShirleySubstrateBrdf8(const Float3Block8& toViewTS, const float randomX[8], const float randomY[8], const Float3& k, float roughnessSq,
+                                         const Float3Block8& diffuse, Float3Block8& nextRayDirTS, Float3Block8& throughput)
+{
+    if (CpuSupportsAvx2())
+    {
+        SampleAshikminShirleySubstrateBrdf8Avx2(toViewTS, randomX, randomY, k, roughnessSq, diffuse, nextRayDirTS, throughput);
+        return;
+    }
+    for (int lane = 0; lane < 8; ++lane)
+    {
+        Float3 laneThroughput;
+        nextRayDirTS.Set(lane, SampleAshikminShirleySubstrateBrdf(toViewTS.Get(lane), Float2(randomX[lane], randomY[lane]), k, roughnessSq, diffuse.Get(lane), laneThroughput));
+        throughput.Set(lane, laneThroughput);
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Brdf.h"
+
+// 8 wide versions of the functions in Brdf.h for batches of shading points with the same material.
+// Material parameters are shared by the batch, everything that differs between shading points is passed as structure of arrays.
+// Uses AVX2 if available and loops over the scalar functions otherwise. Lane i matches the scalar function for the inputs
+// of lane i up to rounding: sin/cos are polynomial approximations and powers are multiplied out.
+
+struct Float3Block8
+{
+    float x[8];
+    float y[8];
+    float z[8];
+
+    Float3 Get(int lane) const              { return Float3(x[lane], y[lane], z[lane]); }
+    void Set(int lane, const Float3& v)     { x[lane] = v.x; y[lane] = v.y; z[lane] = v.z; }
+};
+
+void SampleHemisphereCosine8(const float randomX[8], const float randomY[8], Float3Block8& direction);
+
+void FresnelDieletricConductorApprox8(const Float3& eta, const Float3& etak, const float cosTheta[8], Float3Block8& fresnel);
+
+void EvaluateMicrofacetBrdf8(const float NdotL[8], const Float3Block8& toLight, const float NdotV[8], const Float3Block8& toView, const Float3Block8& normal,
+                             const Float3& eta, const Float3& k, float roughnessSq, Float3Block8& brdf);
+
+void SampleGGXVisibleNormal8(const Float3Block8& toViewTS, float roughness, const float randomX[8], const float randomY[8], Float3Block8& microfacetNormalTS);
+
+void EvaluateAshikminShirleyBrdf8(const float NdotL[8], const Float3Block8& toLight, const float NdotV[8], const Float3Block8& toView, const Float3Block8& normal,
+                                  const Float3& k, float roughnessSq, const Float3Block8& diffuse, Float3Block8& brdf);
+
+void SampleAshikminShirleySubstrateBrdf8(const Float3Block8& toViewTS, const float randomX[8], const float randomY[8], const Float3& k, float roughnessSq,
+                                         const Float3Block8& diffuse, Float3Block8& nextRayDirTS, Float3Block8& throughput);
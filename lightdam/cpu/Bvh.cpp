@@ -0,0 +1,141 @@
+#include "Bvh.h"
+#include <algorithm>
+#include <utility>
+
+Bvh Bvh::BuildMedianSplit(const std::vector<Aabb>& primitiveBounds, uint32_t maxPrimitivesPerLeaf)
+{
+    Bvh bvh;
+    const uint32_t numPrimitives = static_cast<uint32_t>(primitiveBounds.size());
+    bvh.primitiveIndices.resize(numPrimitives);
+    for (uint32_t i = 0; i < numPrimitives; ++i)
+        bvh.primitiveIndices[i] = i;
+    if (numPrimitives == 0)
+        return bvh;
+
+    std::vector<Float3> centroids(numPrimitives);
+    for (uint32_t i = 0; i < numPrimitives; ++i)
+        centroids[i] = primitiveBounds[i].GetCenter();
+
+    // A binary tree with leaves of at least one primitive has at most 2n-1 nodes.
+    bvh.nodes.reserve(numPrimitives * 2);
+    bvh.nodes.push_back({ Float3(0.0f), 0, Float3(0.0f), numPrimitives });
+
+    // Nodes on the stack are already allocated, but their primitives are not partitioned yet.
+    std::vector<std::pair<uint32_t, uint32_t>> stack; // node, depth
+    stack.push_back({ 0, 1 });
+    while (!stack.empty())
+    {
+        const uint32_t nodeIndex = stack.back().first;
+        const uint32_t depth = stack.back().second;
+        stack.pop_back();
+
+        const uint32_t first = bvh.nodes[nodeIndex].childOrFirstPrimitive;
+        const uint32_t count = bvh.nodes[nodeIndex].numPrimitives;
+        Aabb bounds, centroidBounds;
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            bounds.Extend(primitiveBounds[bvh.primitiveIndices[i]]);
+            centroidBounds.Extend(centroids[bvh.primitiveIndices[i]]);
+        }
+        bvh.nodes[nodeIndex].boundsMin = bounds.min;
+        bvh.nodes[nodeIndex].boundsMax = bounds.max;
+
+        const int axis = centroidBounds.GetLargestAxis();
+        // All centroids in one spot can't be split by position.
+        if (count <= maxPrimitivesPerLeaf || centroidBounds.GetExtent()[axis] <= 0.0f || depth >= MaxDepth)
+            continue;
+
+        auto begin = bvh.primitiveIndices.begin() + first;
+        const uint32_t numLeft = count / 2;
+        std::nth_element(begin, begin + numLeft, begin + count,
+            [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+
+        const uint32_t leftIndex = static_cast<uint32_t>(bvh.nodes.size());
+        bvh.nodes.push_back({ Float3(0.0f), first, Float3(0.0f), numLeft });
+        bvh.nodes.push_back({ Float3(0.0f), first + numLeft, Float3(0.0f), count - numLeft });
+        bvh.nodes[nodeIndex].childOrFirstPrimitive = leftIndex;
+        bvh.nodes[nodeIndex].numPrimitives = 0;
+        stack.push_back({ leftIndex + 1, depth + 1 });
+        stack.push_back({ leftIndex, depth + 1 });
+    }
+
+    return bvh;
+}
+
+void Bvh::Refit(const std::vector<Aabb>& primitiveBounds)
+{
+    // Going backwards visits children before their parent.
+    for (size_t i = nodes.size(); i-- > 0;)
+    {
+        BvhNode& node = nodes[i];
+        Aabb bounds;
+        if (node.IsLeaf())
+        {
+            for (uint32_t j = node.childOrFirstPrimitive; j < node.childOrFirstPrimitive + node.numPrimitives; ++j)
+                bounds.Extend(primitiveBounds[primitiveIndices[j]]);
+        }
+        else
+        {
+            const BvhNode& left = nodes[node.childOrFirstPrimitive];
+            const BvhNode& right = nodes[node.childOrFirstPrimitive + 1];
+            bounds = Aabb(Min(left.boundsMin, right.boundsMin), Max(left.boundsMax, right.boundsMax));
+        }
+        node.boundsMin = bounds.min;
+        node.boundsMax = bounds.max;
+    }
+}
+
+uint32_t Bvh::ComputeDepth() const
+{
+    if (nodes.empty())
+        return 0;
+
+    uint32_t maxDepth = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> stack; // node, depth
+    stack.push_back({ 0, 1 });
+    while (!stack.empty())
+    {
+        const auto entry = stack.back();
+        stack.pop_back();
+        maxDepth = std::max(maxDepth, entry.second);
+        const BvhNode& node = nodes[entry.first];
+        if (!node.IsLeaf())
+        {
+            stack.push_back({ node.childOrFirstPrimitive, entry.second + 1 });
+            stack.push_back({ node.childOrFirstPrimitive + 1, entry.second + 1 });
+        }
+    }
+    return maxDepth;
+}
+
+float Bvh::ComputeSahCost(float traversalCost, float primitiveIntersectionCost) const
+{
+    if (nodes.empty())
+        return 0.0f;
+
+    double cost = 0.0;
+    for (const BvhNode& node : nodes)
+    {
+        const float area = Aabb(node.boundsMin, node.boundsMax).GetSurfaceArea();
+        cost += area * (node.IsLeaf() ? node.numPrimitives * primitiveIntersectionCost : traversalCost);
+    }
+    return static_cast<float>(cost / Aabb(nodes[0].boundsMin, nodes[0].boundsMax).GetSurfaceArea());
+}
+
+Bvh Bvh::Build(BvhBuilder builder, const std::vector<Aabb>& primitiveBounds, ThreadPool* threadPool)
+{
+    switch (builder)
+    {
+    case BvhBuilder::Linear:
+        return BuildLinear(primitiveBounds, BvhLinearSettings(), threadPool);
+    case BvhBuilder::Ploc:
+    {
+        BvhLinearSettings settings;
+        settings.plocSearchRadius = 4;
+        return BuildLinear(primitiveBounds, settings, threadPool);
+    }
+    default:
+        // Also BvhBuilder::SpatialSplits, which needs more than bounds.
+        return BuildBinnedSah(primitiveBounds, BvhSahSettings(), threadPool);
+    }
+}
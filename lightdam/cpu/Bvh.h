@@ -0,0 +1,120 @@
+#pragma once
+
+#include "CpuMath.h"
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// Node of a binary bounding volume hierarchy, 32 bytes.
+// Inner nodes have numPrimitives == 0 and their two children at childOrFirstPrimitive and childOrFirstPrimitive + 1.
+// Leaves reference numPrimitives consecutive entries of Bvh::primitiveIndices, starting at childOrFirstPrimitive.
+// All builders store children after their parent.
+struct BvhNode
+{
+    Float3 boundsMin;
+    uint32_t childOrFirstPrimitive;
+    Float3 boundsMax;
+    uint32_t numPrimitives;
+
+    bool IsLeaf() const { return numPrimitives > 0; }
+};
+static_assert(sizeof(BvhNode) == 32, "BvhNode is expected to be 32 bytes");
+
+// Slab test, returns the entry distance or INFINITY on a miss.
+inline float IntersectBox(const BvhNode& node, const Float3& origin, const Float3& invDirection, float tMin, float tMax)
+{
+    const Float3 t0 = (node.boundsMin - origin) * invDirection;
+    const Float3 t1 = (node.boundsMax - origin) * invDirection;
+    const Float3 tNear = Min(t0, t1);
+    const Float3 tFar = Max(t0, t1);
+    const float tEnter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, tMin));
+    const float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+    return tEnter <= tExit ? tEnter : INFINITY;
+}
+
+// Settings for Bvh::BuildBinnedSah.
+struct BvhSahSettings
+{
+    uint32_t numBins = 32;
+    // Leaves are intersected in blocks of leafBlockSize primitives with SIMD, so the leaf cost is per started block.
+    uint32_t leafBlockSize = 8;
+    uint32_t maxPrimitivesPerLeaf = 8;
+    float traversalCost = 1.0f;
+    float blockIntersectionCost = 1.0f;
+    // Nodes with more primitives are built in parallel, below this the task overhead outweighs the gain.
+    uint32_t parallelThreshold = 4096;
+};
+
+// Settings for Bvh::BuildLinear.
+struct BvhLinearSettings
+{
+    // 63 bit Morton codes separate small details in large scenes better, 30 bit codes need only half the sort passes.
+    bool use63BitMortonCodes = false;
+    uint32_t maxPrimitivesPerLeaf = 4;
+    // Search radius of the PLOC refinement, 0 keeps the plain LBVH.
+    uint32_t plocSearchRadius = 0;
+};
+
+// Settings for Bvh::BuildSpatialSplits.
+struct BvhSpatialSplitSettings
+{
+    // Object splits and leaf costs, as for the binned SAH builder.
+    BvhSahSettings sah;
+    uint32_t numSpatialBins = 32;
+    // Spatial splits are only tried where the children of the best object split overlap by more than this fraction
+    // of the root surface area (alpha in Stich et al. 2009). 0 tries them everywhere, 1 effectively never.
+    float overlapThreshold = 1e-5f;
+    // Memory budget: triangles are referenced at most this many times on average, which bounds the growth of the
+    // nodes and of the triangle data in the leaves. Nodes still split after the budget is used up, just not spatially.
+    float maxReferencesPerPrimitive = 1.5f;
+};
+
+// Builders to choose from, ordered from fastest build to fastest traversal.
+enum class BvhBuilder
+{
+    Linear,         // Plain LBVH
+    Ploc,           // LBVH leaves clustered by PLOC
+    BinnedSah,
+    SpatialSplits,  // SBVH, needs the triangles and not only their bounds
+};
+
+// Binary BVH over an arbitrary set of primitives given by their bounding boxes. Root is nodes[0], no nodes if there are no primitives.
+struct Bvh
+{
+    // Builders stop splitting at this depth, so traversal stacks of this size never overflow.
+    static const uint32_t MaxDepth = 64;
+
+    std::vector<BvhNode> nodes;
+    // Indices of the input primitives in leaf order.
+    std::vector<uint32_t> primitiveIndices;
+
+    // Splits at the object median along the largest axis of the centroid bounds.
+    static Bvh BuildMedianSplit(const std::vector<Aabb>& primitiveBounds, uint32_t maxPrimitivesPerLeaf = 4);
+
+    // Binned surface area heuristic on all three axes. Runs on the thread pool if one is given.
+    static Bvh BuildBinnedSah(const std::vector<Aabb>& primitiveBounds, const BvhSahSettings& settings = BvhSahSettings(), ThreadPool* threadPool = nullptr);
+
+    // Sorts primitives along a Morton curve and splits at the highest differing bit (LBVH, see Lauterbach et al. 2009).
+    // With a PLOC search radius, the LBVH leaves are instead merged bottom up by PLOC (Meister and Bittner 2018).
+    // Faster to build than BuildBinnedSah, but slower to trace, suited for scenes that change interactively.
+    static Bvh BuildLinear(const std::vector<Aabb>& primitiveBounds, const BvhLinearSettings& settings = BvhLinearSettings(), ThreadPool* threadPool = nullptr);
+
+    // Binned SAH that may also split triangles at a plane and reference them from both sides (SBVH, Stich et al. 2009).
+    // Much better trees for scenes with large or long thin triangles, whose bounds overlap many others.
+    // Takes three vertices per triangle. primitiveIndices can reference a triangle several times and is longer than the triangle count.
+    static Bvh BuildSpatialSplits(const std::vector<Float3>& triangleVertices, const BvhSpatialSplitSettings& settings = BvhSpatialSplitSettings(), ThreadPool* threadPool = nullptr);
+
+    // Builds with the default settings of the given builder.
+    // Only the bounds are known here, so BvhBuilder::SpatialSplits falls back to the binned SAH.
+    static Bvh Build(BvhBuilder builder, const std::vector<Aabb>& primitiveBounds, ThreadPool* threadPool = nullptr);
+
+    // Recomputes all node bounds for moved primitives, keeping the tree as it is.
+    // Much faster than building again, but the tree gets worse the further primitives move from where they were built.
+    void Refit(const std::vector<Aabb>& primitiveBounds);
+
+    // Maximum depth a traversal stack needs to accommodate.
+    uint32_t ComputeDepth() const;
+    // Expected cost of a random ray hitting the root, relative to the cost of traversing a node.
+    float ComputeSahCost(float traversalCost = 1.0f, float primitiveIntersectionCost = 1.0f) const;
+};
@@ -0,0 +1,329 @@
+#include "Bvh8.h"
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+Bvh8Node::Bvh8Node()
+{
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            bounds[0][axis][i] = INFINITY;
+            bounds[1][axis][i] = -INFINITY;
+        }
+    }
+    for (int i = 0; i < 8; ++i)
+        children[i] = EmptyChild;
+}
+
+static void SetChildBounds(Bvh8Node& node, uint32_t slot, const Float3& boundsMin, const Float3& boundsMax)
+{
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        node.bounds[0][axis][slot] = boundsMin[axis];
+        node.bounds[1][axis][slot] = boundsMax[axis];
+    }
+}
+
+// Returns the child reference of a leaf, leaves with too many primitives are spread over the slots of new nodes.
+// Those all get the bounds of the whole leaf, which is not tight but only happens for leaves the builder could not split.
+static uint32_t EmitLeaf(std::vector<Bvh8Node>& nodes, uint32_t firstPrimitive, uint32_t numPrimitives, const Float3& boundsMin, const Float3& boundsMax)
+{
+    assert(firstPrimitive + numPrimitives - 1 <= Bvh8Node::LeafFirstPrimitiveMask);
+    if (numPrimitives <= Bvh8Node::MaxPrimitivesPerLeaf)
+        return Bvh8Node::MakeLeaf(firstPrimitive, numPrimitives);
+
+    const uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+    const uint32_t numPrimitivesPerSlot = (numPrimitives + 7) / 8;
+    for (uint32_t slot = 0; slot * numPrimitivesPerSlot < numPrimitives; ++slot)
+    {
+        const uint32_t first = firstPrimitive + slot * numPrimitivesPerSlot;
+        const uint32_t count = std::min(numPrimitivesPerSlot, numPrimitives - slot * numPrimitivesPerSlot);
+        const uint32_t child = EmitLeaf(nodes, first, count, boundsMin, boundsMax);
+        SetChildBounds(nodes[nodeIndex], slot, boundsMin, boundsMax);
+        nodes[nodeIndex].children[slot] = child;
+    }
+    return nodeIndex;
+}
+
+Bvh8 Bvh8::Collapse(const Bvh& bvh)
+{
+    Bvh8 bvh8;
+    if (bvh.nodes.empty())
+        return bvh8;
+
+    // Every 8 wide node takes the place of at least one inner node of the binary BVH, which has half its nodes as inner
+    // ones at most. Nodes with fewer than 8 children are common, so the final count is somewhere in between.
+    bvh8.nodes.reserve(bvh.nodes.size() / 2 + 1);
+    bvh8.nodes.emplace_back();
+
+    // Nodes on the stack are already allocated, but their children are not filled in yet.
+    std::vector<std::pair<uint32_t, uint32_t>> stack; // binary node, 8 wide node
+    stack.push_back({ 0, 0 });
+    while (!stack.empty())
+    {
+        const uint32_t binaryNodeIndex = stack.back().first;
+        const uint32_t nodeIndex = stack.back().second;
+        stack.pop_back();
+
+        // A binary root that is a leaf becomes the only child of the root.
+        uint32_t children[8];
+        uint32_t numChildren = 0;
+        const BvhNode& binaryNode = bvh.nodes[binaryNodeIndex];
+        if (binaryNode.IsLeaf())
+        {
+            children[numChildren++] = binaryNodeIndex;
+        }
+        else
+        {
+            children[numChildren++] = binaryNode.childOrFirstPrimitive;
+            children[numChildren++] = binaryNode.childOrFirstPrimitive + 1;
+        }
+
+        while (numChildren < 8)
+        {
+            int largestChild = -1;
+            float largestArea = -1.0f;
+            for (uint32_t i = 0; i < numChildren; ++i)
+            {
+                const BvhNode& child = bvh.nodes[children[i]];
+                const float area = Aabb(child.boundsMin, child.boundsMax).GetSurfaceArea();
+                if (!child.IsLeaf() && area > largestArea)
+                {
+                    largestChild = static_cast<int>(i);
+                    largestArea = area;
+                }
+            }
+            if (largestChild < 0)
+                break;
+
+            // Left child takes the place of its parent to keep the order of the binary BVH.
+            const uint32_t left = bvh.nodes[children[largestChild]].childOrFirstPrimitive;
+            for (uint32_t i = numChildren; i > static_cast<uint32_t>(largestChild) + 1; --i)
+                children[i] = children[i - 1];
+            children[largestChild] = left;
+            children[largestChild + 1] = left + 1;
+            ++numChildren;
+        }
+
+        for (uint32_t slot = 0; slot < numChildren; ++slot)
+        {
+            const BvhNode& child = bvh.nodes[children[slot]];
+            uint32_t childReference;
+            if (child.IsLeaf())
+            {
+                childReference = EmitLeaf(bvh8.nodes, child.childOrFirstPrimitive, child.numPrimitives, child.boundsMin, child.boundsMax);
+            }
+            else
+            {
+                childReference = static_cast<uint32_t>(bvh8.nodes.size());
+                bvh8.nodes.emplace_back();
+                stack.push_back({ children[slot], childReference });
+            }
+            SetChildBounds(bvh8.nodes[nodeIndex], slot, child.boundsMin, child.boundsMax);
+            bvh8.nodes[nodeIndex].children[slot] = childReference;
+        }
+    }
+
+    bvh8.nodes.shrink_to_fit();
+    return bvh8;
+}
+
+uint32_t Bvh8::ComputeDepth() const
+{
+    if (nodes.empty())
+        return 0;
+
+    uint32_t maxDepth = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> stack; // node, depth
+    stack.push_back({ 0, 1 });
+    while (!stack.empty())
+    {
+        const auto entry = stack.back();
+        stack.pop_back();
+        maxDepth = std::max(maxDepth, entry.second);
+        for (uint32_t child : nodes[entry.first].children)
+        {
+            if (child != Bvh8Node::EmptyChild && !Bvh8Node::IsLeaf(child))
+                stack.push_back({ child, entry.second + 1 });
+        }
+    }
+    return maxDepth;
+}
+
+float QuantizedBvh8Node::GetScale(int axis) const
+{
+    const uint32_t bits = static_cast<uint32_t>(exponents[axis] + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return scale;
+}
+
+float QuantizedBvh8Node::Dequantize(int minOrMax, int axis, uint32_t slot) const
+{
+    return std::fma(static_cast<float>(bounds[minOrMax][axis][slot]), GetScale(axis), origin[axis]);
+}
+
+// Quantizes the child bounds of a node, children and leaves are filled in by the caller.
+static QuantizedBvh8Node QuantizeBounds(const Bvh8Node& node)
+{
+    QuantizedBvh8Node quantized;
+    memset(&quantized, 0, sizeof(quantized));
+    Aabb bounds;
+    for (uint32_t slot = 0; slot < 8; ++slot)
+    {
+        if (node.children[slot] == Bvh8Node::EmptyChild)
+            continue;
+        quantized.validMask |= 1 << slot;
+        bounds.Extend(Aabb(Float3(node.bounds[0][0][slot], node.bounds[0][1][slot], node.bounds[0][2][slot]),
+                           Float3(node.bounds[1][0][slot], node.bounds[1][1][slot], node.bounds[1][2][slot])));
+    }
+    quantized.origin = bounds.min;
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        // Smallest power of two with which 255 grid cells cover the whole node, exponents of normal floats only.
+        const double extent = static_cast<double>(bounds.max[axis]) - bounds.min[axis];
+        int exponent = -126;
+        if (extent > 0.0)
+        {
+            frexp(extent / 255.0, &exponent);
+            exponent = std::max(-126, std::min(127, exponent));
+        }
+        quantized.exponents[axis] = static_cast<int8_t>(exponent);
+        const double inverseScale = ldexp(1.0, -exponent);
+        const float scale = quantized.GetScale(axis);
+
+        // Axis aligned quads like floors, walls and lights have flat boxes, which rounded outwards would be a grid cell thick.
+        // Every ray starting on them or ending at them would then have to test their triangles. If the grid has a cell to
+        // spare, it is shifted so that the largest flat child lies exactly on it.
+        int flatSlot = -1;
+        float flatArea = 0.0f;
+        for (uint32_t slot = 0; slot < 8; ++slot)
+        {
+            const Aabb childBounds(Float3(node.bounds[0][0][slot], node.bounds[0][1][slot], node.bounds[0][2][slot]),
+                                   Float3(node.bounds[1][0][slot], node.bounds[1][1][slot], node.bounds[1][2][slot]));
+            if ((quantized.validMask & (1 << slot)) && childBounds.min[axis] == childBounds.max[axis] && childBounds.GetSurfaceArea() > flatArea)
+            {
+                flatSlot = static_cast<int>(slot);
+                flatArea = childBounds.GetSurfaceArea();
+            }
+        }
+        if (flatSlot >= 0)
+        {
+            const float flat = node.bounds[0][axis][flatSlot];
+            const double numCells = std::ceil((flat - static_cast<double>(bounds.min[axis])) * inverseScale);
+            const float origin = static_cast<float>(flat - numCells * scale);
+            if (static_cast<double>(origin) == flat - numCells * scale && origin + 255.0 * scale >= bounds.max[axis] &&
+                std::fma(static_cast<float>(numCells), scale, origin) == flat)
+            {
+                quantized.origin[axis] = origin;
+            }
+        }
+
+        for (uint32_t slot = 0; slot < 8; ++slot)
+        {
+            if ((quantized.validMask & (1 << slot)) == 0)
+            {
+                // Inverted, never hit even without looking at validMask.
+                quantized.bounds[0][axis][slot] = 255;
+                quantized.bounds[1][axis][slot] = 0;
+                continue;
+            }
+
+            // Rounded outwards, then corrected in case dequantizing rounds the wrong way.
+            const float childMin = node.bounds[0][axis][slot];
+            const float childMax = node.bounds[1][axis][slot];
+            double lower = std::floor((childMin - static_cast<double>(quantized.origin[axis])) * inverseScale);
+            double upper = std::ceil((childMax - static_cast<double>(quantized.origin[axis])) * inverseScale);
+            lower = std::max(0.0, std::min(255.0, lower));
+            upper = std::max(0.0, std::min(255.0, upper));
+            while (lower > 0.0 && std::fma(static_cast<float>(lower), scale, quantized.origin[axis]) > childMin)
+                lower -= 1.0;
+            while (upper < 255.0 && std::fma(static_cast<float>(upper), scale, quantized.origin[axis]) < childMax)
+                upper += 1.0;
+            quantized.bounds[0][axis][slot] = static_cast<uint8_t>(lower);
+            quantized.bounds[1][axis][slot] = static_cast<uint8_t>(upper);
+        }
+    }
+    return quantized;
+}
+
+QuantizedBvh8 QuantizedBvh8::Quantize(const Bvh8& bvh8, std::vector<uint32_t>& leafOrder)
+{
+    QuantizedBvh8 quantized;
+    leafOrder.clear();
+    if (bvh8.nodes.empty())
+        return quantized;
+
+    // Breadth first, the children of a node are allocated together when it is processed.
+    quantized.nodes.reserve(bvh8.nodes.size());
+    quantized.nodes.emplace_back();
+    std::vector<std::pair<uint32_t, uint32_t>> queue; // 8 wide node, quantized node
+    queue.push_back({ 0, 0 });
+    for (size_t i = 0; i < queue.size(); ++i)
+    {
+        const Bvh8Node& node = bvh8.nodes[queue[i].first];
+        QuantizedBvh8Node quantizedNode = QuantizeBounds(node);
+        quantizedNode.firstChild = static_cast<uint32_t>(quantized.nodes.size());
+        quantizedNode.firstLeaf = static_cast<uint32_t>(leafOrder.size());
+        uint32_t numChildren = 0;
+        uint32_t numLeaves = 0;
+        for (uint32_t slot = 0; slot < 8; ++slot)
+        {
+            const uint32_t child = node.children[slot];
+            if (child == Bvh8Node::EmptyChild)
+                continue;
+            if (Bvh8Node::IsLeaf(child))
+            {
+                quantizedNode.meta[slot] = static_cast<uint8_t>(QuantizedBvh8Node::LeafSlot | numLeaves++);
+                leafOrder.push_back(child);
+            }
+            else
+            {
+                quantizedNode.meta[slot] = static_cast<uint8_t>(numChildren++);
+                queue.push_back({ child, static_cast<uint32_t>(quantized.nodes.size()) });
+                quantized.nodes.emplace_back();
+            }
+        }
+        quantized.nodes[queue[i].second] = quantizedNode;
+    }
+    return quantized;
+}
+
+uint32_t QuantizedBvh8::CountNonConservativeBounds(const Bvh8& bvh8) const
+{
+    if (nodes.empty())
+        return 0;
+
+    uint32_t numNonConservative = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> stack; // 8 wide node, quantized node
+    stack.push_back({ 0, 0 });
+    while (!stack.empty())
+    {
+        const Bvh8Node& node = bvh8.nodes[stack.back().first];
+        const QuantizedBvh8Node& quantizedNode = nodes[stack.back().second];
+        stack.pop_back();
+        for (uint32_t slot = 0; slot < 8; ++slot)
+        {
+            const uint32_t child = node.children[slot];
+            if (child == Bvh8Node::EmptyChild)
+                continue;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                if (quantizedNode.Dequantize(0, axis, slot) > node.bounds[0][axis][slot] ||
+                    quantizedNode.Dequantize(1, axis, slot) < node.bounds[1][axis][slot])
+                {
+                    ++numNonConservative;
+                    break;
+                }
+            }
+            if (!Bvh8Node::IsLeaf(child))
+                stack.push_back({ child, quantizedNode.firstChild + (quantizedNode.meta[slot] & QuantizedBvh8Node::SlotOffsetMask) });
+        }
+    }
+    return numNonConservative;
+}
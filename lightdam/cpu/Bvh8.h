@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Bvh.h"
+
+// Node of an 8 wide BVH, 224 bytes.
+// Child bounds are stored as structure of arrays, so a ray is tested against all children at once with AVX2.
+// Unused slots have inverted bounds (+inf minimum, -inf maximum) that no ray can hit.
+struct Bvh8Node
+{
+    // Leaf slots reference (count >> LeafCountShift) + 1 primitives starting at (child & LeafFirstPrimitiveMask).
+    static const uint32_t LeafFlag = 0x80000000u;
+    static const uint32_t LeafCountShift = 28;
+    static const uint32_t LeafFirstPrimitiveMask = (1u << LeafCountShift) - 1;
+    static const uint32_t MaxPrimitivesPerLeaf = 8;
+    static const uint32_t EmptyChild = 0xFFFFFFFFu;
+
+    Bvh8Node();
+
+    static uint32_t MakeLeaf(uint32_t firstPrimitive, uint32_t numPrimitives) { return LeafFlag | ((numPrimitives - 1) << LeafCountShift) | firstPrimitive; }
+    static bool IsLeaf(uint32_t child)                      { return (child & LeafFlag) != 0; }
+    static uint32_t GetFirstPrimitive(uint32_t child)       { return child & LeafFirstPrimitiveMask; }
+    static uint32_t GetNumPrimitives(uint32_t child)        { return ((child & ~LeafFlag) >> LeafCountShift) + 1; }
+
+    float bounds[2][3][8];  // [minimum/maximum][axis][child]
+    uint32_t children[8];   // Node index, leaf or EmptyChild.
+};
+static_assert(sizeof(Bvh8Node) == 224, "Bvh8Node is expected to be 224 bytes");
+
+// 8 wide BVH collapsed from a binary one. Root is nodes[0], no nodes if the binary BVH has none.
+// Leaves keep the primitive order of the binary BVH, so its primitiveIndices stay valid.
+struct Bvh8
+{
+    // Collapsing never adds depth, but leaves of the binary BVH with more than MaxPrimitivesPerLeaf primitives
+    // become small subtrees. With at most 2^28 primitives that are no more than 9 additional levels.
+    static const uint32_t MaxDepth = Bvh::MaxDepth + 9;
+
+    std::vector<Bvh8Node> nodes;
+
+    // Greedily opens the child with the largest surface area until a node has 8 children (Wald et al. 2008).
+    static Bvh8 Collapse(const Bvh& bvh);
+
+    uint32_t ComputeDepth() const;
+};
+
+// Node of an 8 wide BVH with child bounds quantized to 8 bits, 80 bytes (Ylitie et al. 2017).
+// Child bounds lie on a grid starting at origin, with a power of two spacing per axis. They are rounded outwards,
+// so dequantized bounds always contain the exact ones. Dequantizing with a fused multiply add is exact up to a single rounding.
+struct QuantizedBvh8Node
+{
+    // meta of leaf slots, the lower bits hold the offset from firstLeaf or firstChild.
+    static const uint8_t LeafSlot = 0x80;
+    static const uint8_t SlotOffsetMask = 0x07;
+
+    // Spacing of the grid along an axis, 2^exponent.
+    float GetScale(int axis) const;
+    // Same as the traversal computes it, origin + quantized * scale with a single rounding.
+    float Dequantize(int minOrMax, int axis, uint32_t slot) const;
+
+    Float3 origin;
+    int8_t exponents[3];
+    uint8_t validMask;              // Bit per used slot.
+    uint32_t firstChild;            // Inner children are consecutive nodes.
+    uint32_t firstLeaf;             // Leaves are consecutive as well.
+    uint8_t meta[8];
+    uint8_t bounds[2][3][8];        // [minimum/maximum][axis][child]
+};
+static_assert(sizeof(QuantizedBvh8Node) == 80, "QuantizedBvh8Node is expected to be 80 bytes");
+
+// 8 wide BVH with quantized nodes, same tree and same order of children as the Bvh8 it is made from.
+struct QuantizedBvh8
+{
+    std::vector<QuantizedBvh8Node> nodes;
+
+    // Quantizes all nodes, placing the inner children of every node next to each other.
+    // Leaves are numbered the same way, leafOrder receives the Bvh8 leaf references (as in Bvh8Node::children) in that order.
+    static QuantizedBvh8 Quantize(const Bvh8& bvh8, std::vector<uint32_t>& leafOrder);
+
+    // Number of child bounds that do not contain their exact counterpart in bvh8, which should always be zero.
+    uint32_t CountNonConservativeBounds(const Bvh8& bvh8) const;
+};
@@ -0,0 +1,439 @@
+#include "Bvh.h"
+#include "../ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Inserts two zero bits between each of the lower 10 bits.
+static uint64_t ExpandBits10(uint64_t x)
+{
+    x = (x | (x << 16)) & 0x030000FF;
+    x = (x | (x << 8)) & 0x0300F00F;
+    x = (x | (x << 4)) & 0x030C30C3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+// Inserts two zero bits between each of the lower 21 bits.
+static uint64_t ExpandBits21(uint64_t x)
+{
+    x = (x | (x << 32)) & 0x001F00000000FFFFull;
+    x = (x | (x << 16)) & 0x001F0000FF0000FFull;
+    x = (x | (x << 8)) & 0x100F00F00F00F00Full;
+    x = (x | (x << 4)) & 0x10C30C30C30C30C3ull;
+    x = (x | (x << 2)) & 0x1249249249249249ull;
+    return x;
+}
+
+static int GetHighestSetBit(uint64_t x)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return static_cast<int>(index);
+#else
+    return 63 - __builtin_clzll(x);
+#endif
+}
+
+// Symmetric pseudo random key of an unordered pair, breaks ties in RefineWithPloc.
+static uint32_t HashPair(uint32_t a, uint32_t b)
+{
+    uint64_t x = a < b ? (static_cast<uint64_t>(a) << 32 | b) : (static_cast<uint64_t>(b) << 32 | a);
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return static_cast<uint32_t>((x ^ (x >> 31)) >> 32);
+}
+
+// LBVH builder with optional PLOC refinement.
+// All passes over the primitives are chunked and run on the thread pool if there is one.
+class LinearBvhBuilder
+{
+public:
+    LinearBvhBuilder(const std::vector<Aabb>& primitiveBounds, const BvhLinearSettings& settings, ThreadPool* threadPool, Bvh& bvh)
+        : m_primitiveBounds(primitiveBounds)
+        , m_settings(settings)
+        , m_threadPool(threadPool)
+        , m_bvh(bvh)
+        , m_numNodes(0)
+    {
+    }
+
+    void Build();
+
+private:
+    // Node that is allocated but not yet emitted.
+    struct PendingNode
+    {
+        uint32_t nodeIndex;
+        uint32_t first;
+        uint32_t count;
+        uint32_t depth;
+    };
+
+    // Number of elements processed by a single task.
+    static const uint32_t ChunkSize = 1 << 16;
+    // Subtrees with more primitives are emitted as separate tasks.
+    static const uint32_t ParallelEmitThreshold = 1 << 14;
+
+    void ForEachChunk(uint32_t count, const std::function<void(uint32_t chunk, uint32_t begin, uint32_t end)>& function);
+
+    void ComputeMortonCodes();
+    void SortMortonCodes();
+    void EmitSubtree(PendingNode root, ThreadPool::TaskGroup* taskGroup);
+    void ComputeNodeBounds();
+    void RefineWithPloc();
+
+    const std::vector<Aabb>& m_primitiveBounds;
+    const BvhLinearSettings m_settings;
+    ThreadPool* m_threadPool;
+    Bvh& m_bvh;
+
+    std::vector<uint64_t> m_mortonCodes;    // In the same order as m_bvh.primitiveIndices.
+    std::atomic<uint32_t> m_numNodes;
+};
+
+void LinearBvhBuilder::ForEachChunk(uint32_t count, const std::function<void(uint32_t chunk, uint32_t begin, uint32_t end)>& function)
+{
+    const uint32_t numChunks = (count + ChunkSize - 1) / ChunkSize;
+    auto processChunks = [&](uint32_t chunkBegin, uint32_t chunkEnd)
+    {
+        for (uint32_t chunk = chunkBegin; chunk < chunkEnd; ++chunk)
+            function(chunk, chunk * ChunkSize, std::min(count, (chunk + 1) * ChunkSize));
+    };
+    if (m_threadPool && numChunks > 1)
+        m_threadPool->ParallelFor(0, numChunks, 1, processChunks);
+    else
+        processChunks(0, numChunks);
+}
+
+void LinearBvhBuilder::Build()
+{
+    const uint32_t numPrimitives = static_cast<uint32_t>(m_primitiveBounds.size());
+    m_bvh.nodes.clear();
+    m_bvh.primitiveIndices.resize(numPrimitives);
+    if (numPrimitives == 0)
+        return;
+
+    ComputeMortonCodes();
+    SortMortonCodes();
+
+    // Leaves have at least one primitive, so there are at most 2n-1 nodes.
+    m_bvh.nodes.resize(numPrimitives * 2 - 1);
+    m_numNodes = 1;
+    if (m_threadPool)
+    {
+        ThreadPool::TaskGroup taskGroup(*m_threadPool);
+        EmitSubtree({ 0, 0, numPrimitives, 1 }, &taskGroup);
+        taskGroup.Wait();
+    }
+    else
+        EmitSubtree({ 0, 0, numPrimitives, 1 }, nullptr);
+    m_bvh.nodes.resize(m_numNodes);
+
+    ComputeNodeBounds();
+    if (m_settings.plocSearchRadius > 0)
+        RefineWithPloc();
+    m_bvh.nodes.shrink_to_fit();
+}
+
+void LinearBvhBuilder::ComputeMortonCodes()
+{
+    const uint32_t numPrimitives = static_cast<uint32_t>(m_primitiveBounds.size());
+    std::vector<Aabb> chunkCentroidBounds((numPrimitives + ChunkSize - 1) / ChunkSize);
+    ForEachChunk(numPrimitives, [&](uint32_t chunk, uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; ++i)
+            chunkCentroidBounds[chunk].Extend(m_primitiveBounds[i].GetCenter());
+    });
+    Aabb centroidBounds;
+    for (const Aabb& bounds : chunkCentroidBounds)
+        centroidBounds.Extend(bounds);
+
+    // Quantize centroids to the grid spanned by the centroid bounds.
+    const uint32_t bitsPerAxis = m_settings.use63BitMortonCodes ? 21 : 10;
+    const float maxCoordinate = static_cast<float>((1u << bitsPerAxis) - 1);
+    const Float3 extent = centroidBounds.GetExtent();
+    const Float3 scale(extent.x > 0.0f ? maxCoordinate / extent.x : 0.0f,
+                       extent.y > 0.0f ? maxCoordinate / extent.y : 0.0f,
+                       extent.z > 0.0f ? maxCoordinate / extent.z : 0.0f);
+    auto expandBits = m_settings.use63BitMortonCodes ? ExpandBits21 : ExpandBits10;
+
+    m_mortonCodes.resize(numPrimitives);
+    ForEachChunk(numPrimitives, [&](uint32_t, uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            const Float3 grid = (m_primitiveBounds[i].GetCenter() - centroidBounds.min) * scale;
+            uint64_t code = 0;
+            for (int axis = 0; axis < 3; ++axis)
+                code |= expandBits(static_cast<uint64_t>(std::min(std::max(grid[axis], 0.0f), maxCoordinate))) << (2 - axis);
+            m_mortonCodes[i] = code;
+            m_bvh.primitiveIndices[i] = i;
+        }
+    });
+}
+
+// Parallel LSD radix sort with 8 bit digits, every chunk scatters to its own precomputed offsets so the sort is stable.
+void LinearBvhBuilder::SortMortonCodes()
+{
+    const uint32_t numPrimitives = static_cast<uint32_t>(m_mortonCodes.size());
+    const uint32_t numChunks = (numPrimitives + ChunkSize - 1) / ChunkSize;
+    const uint32_t numPasses = m_settings.use63BitMortonCodes ? 8 : 4;
+
+    std::vector<uint64_t> codesTemp(numPrimitives);
+    std::vector<uint32_t> indicesTemp(numPrimitives);
+    std::vector<uint32_t> chunkOffsets(numChunks * 256);
+    for (uint32_t pass = 0; pass < numPasses; ++pass)
+    {
+        const uint32_t shift = pass * 8;
+        std::fill(chunkOffsets.begin(), chunkOffsets.end(), 0);
+        ForEachChunk(numPrimitives, [&](uint32_t chunk, uint32_t begin, uint32_t end)
+        {
+            uint32_t* histogram = &chunkOffsets[chunk * 256];
+            for (uint32_t i = begin; i < end; ++i)
+                ++histogram[(m_mortonCodes[i] >> shift) & 255];
+        });
+
+        // Turn the histograms into offsets, digit major so that lower chunks go first.
+        uint32_t offset = 0;
+        bool allInOneBucket = false;
+        for (uint32_t digit = 0; digit < 256; ++digit)
+        {
+            uint32_t digitCount = 0;
+            for (uint32_t chunk = 0; chunk < numChunks; ++chunk)
+            {
+                const uint32_t count = chunkOffsets[chunk * 256 + digit];
+                chunkOffsets[chunk * 256 + digit] = offset;
+                offset += count;
+                digitCount += count;
+            }
+            allInOneBucket |= digitCount == numPrimitives;
+        }
+        // Nothing to reorder if all codes share this digit.
+        if (allInOneBucket)
+            continue;
+
+        ForEachChunk(numPrimitives, [&](uint32_t chunk, uint32_t begin, uint32_t end)
+        {
+            uint32_t* offsets = &chunkOffsets[chunk * 256];
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                const uint32_t target = offsets[(m_mortonCodes[i] >> shift) & 255]++;
+                codesTemp[target] = m_mortonCodes[i];
+                indicesTemp[target] = m_bvh.primitiveIndices[i];
+            }
+        });
+        m_mortonCodes.swap(codesTemp);
+        m_bvh.primitiveIndices.swap(indicesTemp);
+    }
+}
+
+void LinearBvhBuilder::EmitSubtree(PendingNode root, ThreadPool::TaskGroup* taskGroup)
+{
+    std::vector<PendingNode> stack;
+    stack.push_back(root);
+    while (!stack.empty())
+    {
+        const PendingNode pending = stack.back();
+        stack.pop_back();
+
+        BvhNode& node = m_bvh.nodes[pending.nodeIndex];
+        node.childOrFirstPrimitive = pending.first;
+        node.numPrimitives = pending.count;
+        if (pending.count <= m_settings.maxPrimitivesPerLeaf || pending.depth >= Bvh::MaxDepth)
+            continue;
+
+        // All codes of the range share the bits above the highest differing bit of the first and last code.
+        // Splitting there puts all codes with that bit set on the right.
+        const uint64_t* codes = m_mortonCodes.data() + pending.first;
+        const uint64_t difference = codes[0] ^ codes[pending.count - 1];
+        uint32_t numLeft;
+        if (difference == 0)
+            numLeft = pending.count / 2;
+        else
+        {
+            const uint64_t splitBit = 1ull << GetHighestSetBit(difference);
+            numLeft = static_cast<uint32_t>(std::partition_point(codes, codes + pending.count, [splitBit](uint64_t code) { return (code & splitBit) == 0; }) - codes);
+        }
+
+        const uint32_t leftIndex = m_numNodes.fetch_add(2);
+        node.childOrFirstPrimitive = leftIndex;
+        node.numPrimitives = 0;
+
+        const PendingNode leftChild = { leftIndex, pending.first, numLeft, pending.depth + 1 };
+        const PendingNode rightChild = { leftIndex + 1, pending.first + numLeft, pending.count - numLeft, pending.depth + 1 };
+        if (taskGroup && rightChild.count >= ParallelEmitThreshold)
+            taskGroup->Run([this, rightChild, taskGroup] { EmitSubtree(rightChild, taskGroup); });
+        else
+            stack.push_back(rightChild);
+        stack.push_back(leftChild);
+    }
+}
+
+void LinearBvhBuilder::ComputeNodeBounds()
+{
+    // Leaves are independent of each other.
+    const uint32_t numNodes = static_cast<uint32_t>(m_bvh.nodes.size());
+    ForEachChunk(numNodes, [&](uint32_t, uint32_t begin, uint32_t end)
+    {
+        for (uint32_t nodeIndex = begin; nodeIndex < end; ++nodeIndex)
+        {
+            BvhNode& node = m_bvh.nodes[nodeIndex];
+            if (!node.IsLeaf())
+                continue;
+            Aabb bounds;
+            for (uint32_t i = node.childOrFirstPrimitive; i < node.childOrFirstPrimitive + node.numPrimitives; ++i)
+                bounds.Extend(m_primitiveBounds[m_bvh.primitiveIndices[i]]);
+            node.boundsMin = bounds.min;
+            node.boundsMax = bounds.max;
+        }
+    });
+
+    // Children are always allocated after their parent, so a backwards sweep sees children first.
+    for (uint32_t nodeIndex = numNodes; nodeIndex-- > 0;)
+    {
+        BvhNode& node = m_bvh.nodes[nodeIndex];
+        if (node.IsLeaf())
+            continue;
+        const BvhNode& left = m_bvh.nodes[node.childOrFirstPrimitive];
+        const BvhNode& right = m_bvh.nodes[node.childOrFirstPrimitive + 1];
+        node.boundsMin = Min(left.boundsMin, right.boundsMin);
+        node.boundsMax = Max(left.boundsMax, right.boundsMax);
+    }
+}
+
+// Replaces the inner nodes of the LBVH by merging its leaves bottom up.
+// In each iteration, every cluster looks for the cluster within the search radius (in Morton order) that gives the smallest
+// merged bounding box. Mutual nearest neighbors are merged, which is done serially so the node order is deterministic.
+void LinearBvhBuilder::RefineWithPloc()
+{
+    // Leaves in Morton order, a left-to-right depth first traversal visits them in that order.
+    std::vector<BvhNode> clusters;
+    std::vector<uint32_t> stack(1, 0);
+    while (!stack.empty())
+    {
+        const BvhNode& node = m_bvh.nodes[stack.back()];
+        stack.pop_back();
+        if (node.IsLeaf())
+            clusters.push_back(node);
+        else
+        {
+            stack.push_back(node.childOrFirstPrimitive + 1);
+            stack.push_back(node.childOrFirstPrimitive);
+        }
+    }
+    if (clusters.size() == 1)
+        return;
+
+    std::vector<BvhNode> nodes(clusters.size() * 2 - 1);
+    uint32_t numNodes = 1; // nodes[0] is reserved for the root.
+
+    auto getMergedArea = [](const BvhNode& a, const BvhNode& b)
+    {
+        return Aabb(Min(a.boundsMin, b.boundsMin), Max(a.boundsMax, b.boundsMax)).GetSurfaceArea();
+    };
+
+    // Pairs are ordered by merged area, then by a random but symmetric key, then by their indices.
+    // This is a strict order on pairs, so its minimum is a mutual pair and every iteration makes progress.
+    // The random key lets runs of identical clusters merge in many pairs at once instead of chaining up.
+    struct Neighbor
+    {
+        float area;
+        uint32_t key;
+        uint32_t index;
+
+        void Update(float candidateArea, uint32_t candidateKey, uint32_t candidateIndex)
+        {
+            if (candidateArea < area || (candidateArea == area && (candidateKey < key || (candidateKey == key && candidateIndex < index))))
+            {
+                area = candidateArea;
+                key = candidateKey;
+                index = candidateIndex;
+            }
+        }
+    };
+
+    const int radius = static_cast<int>(m_settings.plocSearchRadius);
+    std::vector<Neighbor> nearestNeighbors;
+    std::vector<BvhNode> mergedClusters;
+    while (clusters.size() > 1)
+    {
+        const int numClusters = static_cast<int>(clusters.size());
+        nearestNeighbors.assign(numClusters, { INFINITY, UINT32_MAX, UINT32_MAX });
+        // Every pair within the radius is evaluated once and updates both of its clusters.
+        // Pairs crossing a chunk border are evaluated by both chunks, each chunk only updates its own clusters.
+        ForEachChunk(numClusters, [&](uint32_t, uint32_t begin, uint32_t end)
+        {
+            for (int i = std::max(0, static_cast<int>(begin) - radius); i < static_cast<int>(end); ++i)
+            {
+                for (int j = std::max(i + 1, static_cast<int>(begin)); j <= std::min(numClusters - 1, i + radius); ++j)
+                {
+                    const float area = getMergedArea(clusters[i], clusters[j]);
+                    const uint32_t key = HashPair(i, j);
+                    if (i >= static_cast<int>(begin))
+                        nearestNeighbors[i].Update(area, key, j);
+                    if (j < static_cast<int>(end))
+                        nearestNeighbors[j].Update(area, key, i);
+                }
+            }
+        });
+
+        mergedClusters.clear();
+        for (int i = 0; i < numClusters; ++i)
+        {
+            const uint32_t neighbor = nearestNeighbors[i].index;
+            if (nearestNeighbors[neighbor].index != static_cast<uint32_t>(i))
+                mergedClusters.push_back(clusters[i]);
+            else if (static_cast<uint32_t>(i) < neighbor)
+            {
+                nodes[numNodes] = clusters[i];
+                nodes[numNodes + 1] = clusters[neighbor];
+                mergedClusters.push_back({ Min(clusters[i].boundsMin, clusters[neighbor].boundsMin), numNodes,
+                                           Max(clusters[i].boundsMax, clusters[neighbor].boundsMax), 0 });
+                numNodes += 2;
+            }
+            // The higher index of a pair is already part of the merged cluster.
+        }
+        clusters.swap(mergedClusters);
+    }
+    nodes[0] = clusters[0];
+
+    // Merging allocates the top of the tree last. Reorder depth first, so that traversal walks through memory mostly forward.
+    std::vector<BvhNode> orderedNodes(nodes.size());
+    orderedNodes[0] = nodes[0];
+    uint32_t numOrderedNodes = 1;
+    uint32_t maxDepth = 1;
+    std::vector<std::pair<uint32_t, uint32_t>> orderStack; // ordered node index, depth
+    orderStack.push_back({ 0, 1 });
+    while (!orderStack.empty())
+    {
+        const auto entry = orderStack.back();
+        orderStack.pop_back();
+        maxDepth = std::max(maxDepth, entry.second);
+        BvhNode& node = orderedNodes[entry.first];
+        if (node.IsLeaf())
+            continue;
+        orderedNodes[numOrderedNodes] = nodes[node.childOrFirstPrimitive];
+        orderedNodes[numOrderedNodes + 1] = nodes[node.childOrFirstPrimitive + 1];
+        node.childOrFirstPrimitive = numOrderedNodes;
+        orderStack.push_back({ numOrderedNodes + 1, entry.second + 1 });
+        orderStack.push_back({ numOrderedNodes, entry.second + 1 });
+        numOrderedNodes += 2;
+    }
+
+    // Agglomerative clustering gives no depth guarantee, keep the LBVH in the rare case it would overflow traversal stacks.
+    if (maxDepth <= Bvh::MaxDepth)
+        m_bvh.nodes.swap(orderedNodes);
+}
+
+Bvh Bvh::BuildLinear(const std::vector<Aabb>& primitiveBounds, const BvhLinearSettings& settings, ThreadPool* threadPool)
+{
+    Bvh bvh;
+    LinearBvhBuilder(primitiveBounds, settings, threadPool, bvh).Build();
+    return bvh;
+}
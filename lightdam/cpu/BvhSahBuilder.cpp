@@ -0,0 +1,376 @@
+#include "Bvh.h"
+#include "../ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <emmintrin.h>
+
+// Top down binned SAH builder, see Wald 2007, "On fast Construction of SAH-based Bounding Volume Hierarchies".
+// Subtrees above the parallel threshold become tasks, binning of very large nodes is split up as well.
+class BinnedSahBuilder
+{
+public:
+    BinnedSahBuilder(const std::vector<Aabb>& primitiveBounds, const BvhSahSettings& settings, ThreadPool* threadPool, Bvh& bvh)
+        : m_primitiveBounds(primitiveBounds)
+        , m_settings(settings)
+        , m_inverseLeafBlockSize(1.0f / settings.leafBlockSize)
+        , m_threadPool(threadPool)
+        , m_bvh(bvh)
+        , m_numNodes(0)
+    {
+    }
+
+    void Build();
+
+private:
+    // Copy of the primitive bounds that is partitioned in place, so the builder only ever streams through memory.
+    struct PrimitiveReference
+    {
+        Float3 boundsMin;
+        uint32_t primitiveIndex;
+        Float3 boundsMax;
+        uint32_t padding;
+
+        // Doubled centroid, the factor of two cancels out in all uses.
+        Float3 GetCentroid2() const { return boundsMin + boundsMax; }
+
+        // The fourth component holds primitiveIndex/padding and has to be ignored.
+        __m128 LoadMin() const { return _mm_loadu_ps(&boundsMin.x); }
+        __m128 LoadMax() const { return _mm_loadu_ps(&boundsMax.x); }
+    };
+
+    // Binning is the hot loop of the builder, bins are kept in SSE registers layout for that reason.
+    struct Bin
+    {
+        Bin() : boundsMin(_mm_set1_ps(INFINITY)), boundsMax(_mm_set1_ps(-INFINITY)), count(0) {}
+
+        __m128 boundsMin;
+        __m128 boundsMax;
+        uint32_t count;
+    };
+
+    // Node that is allocated but not yet built.
+    struct PendingNode
+    {
+        uint32_t nodeIndex;
+        uint32_t first;
+        uint32_t count;
+        Aabb bounds;
+        Aabb centroidBounds;    // Of the doubled centroids.
+        uint32_t depth;
+    };
+
+    // Number of primitives binned by a single task.
+    static const uint32_t BinningGrainSize = 1 << 16;
+
+    void BuildSubtree(PendingNode root, ThreadPool::TaskGroup* taskGroup);
+    void BinPrimitives(uint32_t first, uint32_t count, uint32_t numBins, const Float3& binOffset, const Float3& binScale, std::vector<Bin>& bins);
+
+    static float GetSurfaceArea(__m128 boundsMin, __m128 boundsMax)
+    {
+        float extent[4];
+        _mm_storeu_ps(extent, _mm_sub_ps(boundsMax, boundsMin));
+        return extent[0] < 0.0f ? 0.0f : 2.0f * (extent[0] * extent[1] + extent[1] * extent[2] + extent[2] * extent[0]);
+    }
+
+    static Aabb ToAabb(__m128 boundsMin, __m128 boundsMax)
+    {
+        float minValues[4], maxValues[4];
+        _mm_storeu_ps(minValues, boundsMin);
+        _mm_storeu_ps(maxValues, boundsMax);
+        return Aabb(Float3(minValues[0], minValues[1], minValues[2]), Float3(maxValues[0], maxValues[1], maxValues[2]));
+    }
+
+    // Scalar version of the bin computation in BinPrimitives, has to match it exactly.
+    static uint32_t GetBinIndex(float centroid2, float binOffset, float binScale, float maxBin)
+    {
+        float bin = (centroid2 - binOffset) * binScale;
+        bin = bin > 0.0f ? bin : 0.0f;
+        bin = bin < maxBin ? bin : maxBin;
+        return static_cast<uint32_t>(bin);
+    }
+
+    float GetLeafCost(uint32_t count) const
+    {
+        return ceilf(count * m_inverseLeafBlockSize) * m_settings.blockIntersectionCost;
+    }
+
+    const std::vector<Aabb>& m_primitiveBounds;
+    const BvhSahSettings m_settings;
+    const float m_inverseLeafBlockSize;
+    ThreadPool* m_threadPool;
+    Bvh& m_bvh;
+
+    std::vector<PrimitiveReference> m_references;
+    std::atomic<uint32_t> m_numNodes;
+};
+
+void BinnedSahBuilder::Build()
+{
+    const uint32_t numPrimitives = static_cast<uint32_t>(m_primitiveBounds.size());
+    m_bvh.nodes.clear();
+    m_bvh.primitiveIndices.resize(numPrimitives);
+    if (numPrimitives == 0)
+        return;
+
+    m_references.resize(numPrimitives);
+    // A binary tree with leaves of at least one primitive has at most 2n-1 nodes.
+    // Allocated up front, so tasks can hand out nodes with an atomic counter.
+    m_bvh.nodes.resize(numPrimitives * 2 - 1);
+    m_numNodes = 1;
+
+    // Chunked, so the root bounds can be computed in parallel.
+    const uint32_t numChunks = (numPrimitives + BinningGrainSize - 1) / BinningGrainSize;
+    std::vector<Aabb> chunkBounds(numChunks);
+    std::vector<Aabb> chunkCentroidBounds(numChunks);
+    auto prepareChunks = [&](uint32_t chunkBegin, uint32_t chunkEnd)
+    {
+        for (uint32_t chunk = chunkBegin; chunk < chunkEnd; ++chunk)
+        {
+            const uint32_t end = std::min(numPrimitives, (chunk + 1) * BinningGrainSize);
+            for (uint32_t i = chunk * BinningGrainSize; i < end; ++i)
+            {
+                const Aabb& bounds = m_primitiveBounds[i];
+                m_references[i] = { bounds.min, i, bounds.max, 0 };
+                chunkBounds[chunk].Extend(bounds);
+                chunkCentroidBounds[chunk].Extend(m_references[i].GetCentroid2());
+            }
+        }
+    };
+    if (m_threadPool)
+        m_threadPool->ParallelFor(0, numChunks, 1, prepareChunks);
+    else
+        prepareChunks(0, numChunks);
+
+    Aabb bounds, centroidBounds;
+    for (uint32_t chunk = 0; chunk < numChunks; ++chunk)
+    {
+        bounds.Extend(chunkBounds[chunk]);
+        centroidBounds.Extend(chunkCentroidBounds[chunk]);
+    }
+
+    if (m_threadPool)
+    {
+        ThreadPool::TaskGroup taskGroup(*m_threadPool);
+        BuildSubtree({ 0, 0, numPrimitives, bounds, centroidBounds, 1 }, &taskGroup);
+        taskGroup.Wait();
+    }
+    else
+        BuildSubtree({ 0, 0, numPrimitives, bounds, centroidBounds, 1 }, nullptr);
+
+    m_bvh.nodes.resize(m_numNodes);
+    m_bvh.nodes.shrink_to_fit();
+    for (uint32_t i = 0; i < numPrimitives; ++i)
+        m_bvh.primitiveIndices[i] = m_references[i].primitiveIndex;
+}
+
+void BinnedSahBuilder::BinPrimitives(uint32_t first, uint32_t count, uint32_t numBins, const Float3& binOffset, const Float3& binScale, std::vector<Bin>& bins)
+{
+    // Bin indices of all three axes at once, clamped in float so that the conversion never overflows.
+    const __m128 offset = _mm_setr_ps(binOffset.x, binOffset.y, binOffset.z, 0.0f);
+    const __m128 scale = _mm_setr_ps(binScale.x, binScale.y, binScale.z, 0.0f);
+    const __m128 maxBin = _mm_set1_ps(static_cast<float>(numBins - 1));
+    auto binRange = [&](uint32_t begin, uint32_t end, Bin* rangeBins)
+    {
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            const PrimitiveReference& reference = m_references[i];
+            const __m128 boundsMin = reference.LoadMin();
+            const __m128 boundsMax = reference.LoadMax();
+            const __m128 binFloat = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(boundsMin, boundsMax), offset), scale);
+            alignas(16) int32_t binIndices[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(binIndices), _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(binFloat, _mm_setzero_ps()), maxBin)));
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                Bin& bin = rangeBins[axis * numBins + binIndices[axis]];
+                bin.boundsMin = _mm_min_ps(bin.boundsMin, boundsMin);
+                bin.boundsMax = _mm_max_ps(bin.boundsMax, boundsMax);
+                ++bin.count;
+            }
+        }
+    };
+
+    const uint32_t numBinsTotal = 3 * numBins;
+    bins.assign(numBinsTotal, Bin());
+    if (!m_threadPool || count < BinningGrainSize * 2)
+    {
+        binRange(first, first + count, bins.data());
+        return;
+    }
+
+    // Every chunk fills its own set of bins, which are merged afterwards.
+    const uint32_t numChunks = (count + BinningGrainSize - 1) / BinningGrainSize;
+    std::vector<Bin> chunkBins(numChunks * numBinsTotal);
+    m_threadPool->ParallelFor(0, numChunks, 1, [&](uint32_t chunkBegin, uint32_t chunkEnd)
+    {
+        for (uint32_t chunk = chunkBegin; chunk < chunkEnd; ++chunk)
+            binRange(first + chunk * BinningGrainSize, first + std::min(count, (chunk + 1) * BinningGrainSize), &chunkBins[chunk * numBinsTotal]);
+    });
+    for (uint32_t chunk = 0; chunk < numChunks; ++chunk)
+    {
+        for (uint32_t i = 0; i < numBinsTotal; ++i)
+        {
+            const Bin& chunkBin = chunkBins[chunk * numBinsTotal + i];
+            bins[i].boundsMin = _mm_min_ps(bins[i].boundsMin, chunkBin.boundsMin);
+            bins[i].boundsMax = _mm_max_ps(bins[i].boundsMax, chunkBin.boundsMax);
+            bins[i].count += chunkBin.count;
+        }
+    }
+}
+
+void BinnedSahBuilder::BuildSubtree(PendingNode root, ThreadPool::TaskGroup* taskGroup)
+{
+    std::vector<Bin> bins;
+    std::vector<float> rightCosts(m_settings.numBins);
+
+    // Large right children become tasks of their own, everything else is processed depth first right here.
+    std::vector<PendingNode> stack;
+    stack.push_back(root);
+    while (!stack.empty())
+    {
+        const PendingNode pending = stack.back();
+        stack.pop_back();
+        const uint32_t first = pending.first;
+        const uint32_t count = pending.count;
+        const Aabb& bounds = pending.bounds;
+        const Aabb& centroidBounds = pending.centroidBounds;
+
+        BvhNode& node = m_bvh.nodes[pending.nodeIndex];
+        node.boundsMin = bounds.min;
+        node.boundsMax = bounds.max;
+        node.childOrFirstPrimitive = first;
+        node.numPrimitives = count;
+
+        if (count == 1 || pending.depth >= Bvh::MaxDepth)
+            continue;
+
+        const Float3 centroidExtent = centroidBounds.GetExtent();
+        const Float3 binOffset = centroidBounds.min;
+        // Small nodes use fewer bins, most of them would stay empty anyway and the sweep would dominate.
+        const uint32_t numBins = std::min(m_settings.numBins, count);
+        const float binScaleFactor = numBins * (1.0f - 1e-6f);
+        // Degenerate extents would produce infinite scales, such axes are not considered for splitting.
+        const Float3 binScale(centroidExtent.x > 1e-20f ? binScaleFactor / centroidExtent.x : 0.0f,
+                              centroidExtent.y > 1e-20f ? binScaleFactor / centroidExtent.y : 0.0f,
+                              centroidExtent.z > 1e-20f ? binScaleFactor / centroidExtent.z : 0.0f);
+
+        // Sweep from the right to get the cost of every right side, then from the left to evaluate all splits.
+        float bestCost = INFINITY;
+        int bestAxis = -1;
+        uint32_t bestSplit = 0;
+        if (binScale.x > 0.0f || binScale.y > 0.0f || binScale.z > 0.0f)
+        {
+            BinPrimitives(first, count, numBins, binOffset, binScale, bins);
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                if (binScale[axis] <= 0.0f)
+                    continue;
+                const Bin* axisBins = &bins[axis * numBins];
+
+                Bin accumulated;
+                for (uint32_t split = numBins - 1; split > 0; --split)
+                {
+                    accumulated.boundsMin = _mm_min_ps(accumulated.boundsMin, axisBins[split].boundsMin);
+                    accumulated.boundsMax = _mm_max_ps(accumulated.boundsMax, axisBins[split].boundsMax);
+                    accumulated.count += axisBins[split].count;
+                    rightCosts[split] = accumulated.count ? GetSurfaceArea(accumulated.boundsMin, accumulated.boundsMax) * GetLeafCost(accumulated.count) : 0.0f;
+                }
+                accumulated = Bin();
+                for (uint32_t split = 1; split < numBins; ++split)
+                {
+                    accumulated.boundsMin = _mm_min_ps(accumulated.boundsMin, axisBins[split - 1].boundsMin);
+                    accumulated.boundsMax = _mm_max_ps(accumulated.boundsMax, axisBins[split - 1].boundsMax);
+                    accumulated.count += axisBins[split - 1].count;
+                    if (accumulated.count == 0 || accumulated.count == count)
+                        continue;
+                    const float cost = GetSurfaceArea(accumulated.boundsMin, accumulated.boundsMax) * GetLeafCost(accumulated.count) + rightCosts[split];
+                    if (cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestSplit = split;
+                    }
+                }
+            }
+        }
+
+        uint32_t numLeft;
+        Aabb leftBounds, leftCentroidBounds, rightBounds, rightCentroidBounds;
+        if (bestAxis < 0)
+        {
+            // All centroids in one spot, there is nothing to gain from splitting other than keeping the leaf size in check.
+            if (count <= m_settings.maxPrimitivesPerLeaf)
+                continue;
+            numLeft = count / 2;
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                Aabb& childBounds = i < first + numLeft ? leftBounds : rightBounds;
+                childBounds.min = Min(childBounds.min, m_references[i].boundsMin);
+                childBounds.max = Max(childBounds.max, m_references[i].boundsMax);
+            }
+            leftCentroidBounds = centroidBounds;
+            rightCentroidBounds = centroidBounds;
+        }
+        else
+        {
+            bestCost = m_settings.traversalCost + bestCost / bounds.GetSurfaceArea();
+            if (count <= m_settings.maxPrimitivesPerLeaf && GetLeafCost(count) <= bestCost)
+                continue;
+
+            const Bin* axisBins = &bins[bestAxis * numBins];
+            Bin leftBin, rightBin;
+            for (uint32_t bin = 0; bin < numBins; ++bin)
+            {
+                Bin& side = bin < bestSplit ? leftBin : rightBin;
+                side.boundsMin = _mm_min_ps(side.boundsMin, axisBins[bin].boundsMin);
+                side.boundsMax = _mm_max_ps(side.boundsMax, axisBins[bin].boundsMax);
+            }
+            leftBounds = ToAabb(leftBin.boundsMin, leftBin.boundsMax);
+            rightBounds = ToAabb(rightBin.boundsMin, rightBin.boundsMax);
+
+            // Hoare partition that collects the centroid bounds of both sides on the way.
+            const float axisOffset = binOffset[bestAxis];
+            const float axisScale = binScale[bestAxis];
+            const float maxBin = static_cast<float>(numBins - 1);
+            auto isLeft = [&](const PrimitiveReference& reference)
+            {
+                return GetBinIndex(reference.boundsMin[bestAxis] + reference.boundsMax[bestAxis], axisOffset, axisScale, maxBin) < bestSplit;
+            };
+            PrimitiveReference* left = m_references.data() + first;
+            PrimitiveReference* right = left + count;
+            while (true)
+            {
+                while (left < right && isLeft(*left))
+                    leftCentroidBounds.Extend((left++)->GetCentroid2());
+                while (left < right && !isLeft(*(right - 1)))
+                    rightCentroidBounds.Extend((--right)->GetCentroid2());
+                if (left >= right)
+                    break;
+                --right;
+                std::swap(*left, *right);
+                leftCentroidBounds.Extend((left++)->GetCentroid2());
+                rightCentroidBounds.Extend(right->GetCentroid2());
+            }
+            numLeft = static_cast<uint32_t>(left - (m_references.data() + first));
+        }
+
+        const uint32_t leftIndex = m_numNodes.fetch_add(2);
+        node.childOrFirstPrimitive = leftIndex;
+        node.numPrimitives = 0;
+
+        const PendingNode leftChild = { leftIndex, first, numLeft, leftBounds, leftCentroidBounds, pending.depth + 1 };
+        const PendingNode rightChild = { leftIndex + 1, first + numLeft, count - numLeft, rightBounds, rightCentroidBounds, pending.depth + 1 };
+        if (taskGroup && rightChild.count >= m_settings.parallelThreshold)
+            taskGroup->Run([this, rightChild, taskGroup] { BuildSubtree(rightChild, taskGroup); });
+        else
+            stack.push_back(rightChild);
+        stack.push_back(leftChild);
+    }
+}
+
+Bvh Bvh::BuildBinnedSah(const std::vector<Aabb>& primitiveBounds, const BvhSahSettings& settings, ThreadPool* threadPool)
+{
+    Bvh bvh;
+    BinnedSahBuilder(primitiveBounds, settings, threadPool, bvh).Build();
+    return bvh;
+}
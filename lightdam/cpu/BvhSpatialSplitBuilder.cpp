@@ -0,0 +1,567 @@
+#include "Bvh.h"
+#include "../ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+
+// Spatial split BVH, see Stich et al. 2009, "Spatial Splits in Bounding Volume Hierarchies".
+// Every node tries binned object splits like BinnedSahBuilder. Where their children overlap a lot, it also tries binned
+// spatial splits, which clip the triangles crossing the split plane and reference them from both children.
+// Nodes work on their own lists of references, since splitting a node can produce more references than it had.
+// The memory budget is handed down the tree in proportion to the references of each child, like Embree does. Used up
+// first come first served, the first subtrees to be built would get all of it.
+class SpatialSplitBuilder
+{
+public:
+    SpatialSplitBuilder(const std::vector<Float3>& triangleVertices, const BvhSpatialSplitSettings& settings, ThreadPool* threadPool, Bvh& bvh)
+        : m_triangleVertices(triangleVertices)
+        , m_settings(settings)
+        , m_inverseLeafBlockSize(1.0f / settings.sah.leafBlockSize)
+        , m_threadPool(threadPool)
+        , m_bvh(bvh)
+        , m_numNodes(0)
+        , m_numPrimitiveIndices(0)
+        , m_minOverlapArea(0.0f)
+    {
+    }
+
+    void Build();
+
+private:
+    // Part of a triangle, the bounds get smaller with every spatial split it goes through.
+    struct Reference
+    {
+        Aabb bounds;
+        uint32_t primitiveIndex;
+
+        // Doubled centroid, as in BinnedSahBuilder.
+        Float3 GetCentroid2() const { return bounds.min + bounds.max; }
+    };
+
+    struct ObjectBin
+    {
+        Aabb bounds;
+        uint32_t count = 0;
+    };
+
+    // References are counted in the bin they start in and in the one they end in, their clipped parts extend all bins in between.
+    struct SpatialBin
+    {
+        Aabb bounds;
+        uint32_t numEntries = 0;
+        uint32_t numExits = 0;
+    };
+
+    // Node that is allocated but not yet built.
+    struct PendingNode
+    {
+        uint32_t nodeIndex;
+        std::vector<Reference> references;
+        Aabb bounds;
+        uint32_t depth;
+        uint32_t budget;    // References the subtree may add by spatial splits.
+    };
+
+    // Cost is the surface area weighted leaf cost of both children, not yet divided by the node surface area.
+    struct Split
+    {
+        float cost = INFINITY;
+        int axis = -1;
+        uint32_t bin = 0;       // First bin of the right child.
+        Aabb leftBounds;
+        Aabb rightBounds;
+        uint32_t numLeft = 0;
+        uint32_t numRight = 0;
+    };
+
+    void BuildSubtree(PendingNode root, ThreadPool::TaskGroup* taskGroup);
+    Split FindObjectSplit(const PendingNode& node, const Aabb& centroidBounds, std::vector<ObjectBin>& bins) const;
+    Split FindSpatialSplit(const PendingNode& node, std::vector<SpatialBin>& bins) const;
+    void PartitionObjects(const PendingNode& node, const Aabb& centroidBounds, const Split& split, PendingNode& left, PendingNode& right) const;
+    void PartitionSpatial(const PendingNode& node, const Split& split, PendingNode& left, PendingNode& right) const;
+    void SplitReference(const Reference& reference, int axis, float position, Aabb& left, Aabb& right) const;
+    void EmitLeaf(BvhNode& node, const std::vector<Reference>& references);
+
+    // Scalar bin computation of BinnedSahBuilder.
+    static uint32_t GetBinIndex(float value, float binOffset, float binScale, float maxBin)
+    {
+        float bin = (value - binOffset) * binScale;
+        bin = bin > 0.0f ? bin : 0.0f;
+        bin = bin < maxBin ? bin : maxBin;
+        return static_cast<uint32_t>(bin);
+    }
+
+    // Remaining budget of a node goes to its children in proportion to their number of references.
+    static void DistributeBudget(uint32_t budget, PendingNode& left, PendingNode& right)
+    {
+        const uint64_t numLeft = left.references.size();
+        const uint64_t numRight = right.references.size();
+        left.budget = static_cast<uint32_t>(budget * numLeft / (numLeft + numRight));
+        right.budget = budget - left.budget;
+    }
+
+    static float GetSpatialPlane(const Aabb& bounds, int axis, uint32_t numBins, uint32_t bin)
+    {
+        return bounds.min[axis] + (bounds.max[axis] - bounds.min[axis]) * (static_cast<float>(bin) / numBins);
+    }
+
+    static bool IsValid(const Aabb& bounds)
+    {
+        return bounds.min.x <= bounds.max.x && bounds.min.y <= bounds.max.y && bounds.min.z <= bounds.max.z;
+    }
+
+    static Aabb Intersect(const Aabb& a, const Aabb& b)
+    {
+        return Aabb(Max(a.min, b.min), Min(a.max, b.max));
+    }
+
+    static Aabb Union(Aabb a, const Aabb& b)
+    {
+        a.Extend(b);
+        return a;
+    }
+
+    float GetLeafCost(uint32_t count) const
+    {
+        return ceilf(count * m_inverseLeafBlockSize) * m_settings.sah.blockIntersectionCost;
+    }
+
+    const std::vector<Float3>& m_triangleVertices;
+    const BvhSpatialSplitSettings m_settings;
+    const float m_inverseLeafBlockSize;
+    ThreadPool* m_threadPool;
+    Bvh& m_bvh;
+
+    std::atomic<uint32_t> m_numNodes;
+    std::atomic<uint32_t> m_numPrimitiveIndices;
+    float m_minOverlapArea;
+};
+
+void SpatialSplitBuilder::Build()
+{
+    const uint32_t numPrimitives = static_cast<uint32_t>(m_triangleVertices.size() / 3);
+    m_bvh.nodes.clear();
+    m_bvh.primitiveIndices.clear();
+    if (numPrimitives == 0)
+        return;
+
+    PendingNode root;
+    root.nodeIndex = 0;
+    root.depth = 1;
+    root.references.resize(numPrimitives);
+    for (uint32_t i = 0; i < numPrimitives; ++i)
+    {
+        Reference& reference = root.references[i];
+        reference.primitiveIndex = i;
+        for (int vertex = 0; vertex < 3; ++vertex)
+            reference.bounds.Extend(m_triangleVertices[i * 3 + vertex]);
+        root.bounds.Extend(reference.bounds);
+    }
+
+    // All sizes are bounded by the budget, so nodes and leaf ranges can be handed out with atomic counters.
+    const double maxReferences = static_cast<double>(numPrimitives) * std::max(1.0f, m_settings.maxReferencesPerPrimitive);
+    // Node count of 2n-1 has to fit into 32 bits.
+    const uint32_t numMaxReferences = std::max(numPrimitives, static_cast<uint32_t>(std::min(maxReferences, static_cast<double>(0x7FFFFFFFu))));
+    root.budget = numMaxReferences - numPrimitives;
+    m_bvh.nodes.resize(numMaxReferences * 2 - 1);
+    m_bvh.primitiveIndices.resize(numMaxReferences);
+    m_numNodes = 1;
+    m_numPrimitiveIndices = 0;
+    m_minOverlapArea = root.bounds.GetSurfaceArea() * m_settings.overlapThreshold;
+
+    if (m_threadPool)
+    {
+        ThreadPool::TaskGroup taskGroup(*m_threadPool);
+        BuildSubtree(std::move(root), &taskGroup);
+        taskGroup.Wait();
+    }
+    else
+        BuildSubtree(std::move(root), nullptr);
+
+    m_bvh.nodes.resize(m_numNodes);
+    m_bvh.nodes.shrink_to_fit();
+    m_bvh.primitiveIndices.resize(m_numPrimitiveIndices);
+    m_bvh.primitiveIndices.shrink_to_fit();
+}
+
+void SpatialSplitBuilder::EmitLeaf(BvhNode& node, const std::vector<Reference>& references)
+{
+    const uint32_t count = static_cast<uint32_t>(references.size());
+    const uint32_t first = m_numPrimitiveIndices.fetch_add(count);
+    for (uint32_t i = 0; i < count; ++i)
+        m_bvh.primitiveIndices[first + i] = references[i].primitiveIndex;
+    node.childOrFirstPrimitive = first;
+    node.numPrimitives = count;
+}
+
+SpatialSplitBuilder::Split SpatialSplitBuilder::FindObjectSplit(const PendingNode& node, const Aabb& centroidBounds, std::vector<ObjectBin>& bins) const
+{
+    const uint32_t count = static_cast<uint32_t>(node.references.size());
+    const Float3 centroidExtent = centroidBounds.GetExtent();
+    const uint32_t numBins = std::min(m_settings.sah.numBins, count);
+    const float binScaleFactor = numBins * (1.0f - 1e-6f);
+    const float maxBin = static_cast<float>(numBins - 1);
+
+    Split best;
+    std::vector<float> rightCosts(numBins);
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (centroidExtent[axis] <= 1e-20f)
+            continue;
+        const float binScale = binScaleFactor / centroidExtent[axis];
+        bins.assign(numBins, ObjectBin());
+        for (const Reference& reference : node.references)
+        {
+            ObjectBin& bin = bins[GetBinIndex(reference.GetCentroid2()[axis], centroidBounds.min[axis], binScale, maxBin)];
+            bin.bounds.Extend(reference.bounds);
+            ++bin.count;
+        }
+
+        ObjectBin accumulated;
+        for (uint32_t split = numBins - 1; split > 0; --split)
+        {
+            accumulated.bounds.Extend(bins[split].bounds);
+            accumulated.count += bins[split].count;
+            rightCosts[split] = accumulated.count ? accumulated.bounds.GetSurfaceArea() * GetLeafCost(accumulated.count) : 0.0f;
+        }
+        accumulated = ObjectBin();
+        for (uint32_t split = 1; split < numBins; ++split)
+        {
+            accumulated.bounds.Extend(bins[split - 1].bounds);
+            accumulated.count += bins[split - 1].count;
+            if (accumulated.count == 0 || accumulated.count == count)
+                continue;
+            const float cost = accumulated.bounds.GetSurfaceArea() * GetLeafCost(accumulated.count) + rightCosts[split];
+            if (cost < best.cost)
+            {
+                best.cost = cost;
+                best.axis = axis;
+                best.bin = split;
+                best.leftBounds = accumulated.bounds;
+                best.numLeft = accumulated.count;
+            }
+        }
+    }
+
+    // Right bounds are needed for the overlap test only, so they are gathered for the best split alone.
+    if (best.axis >= 0)
+    {
+        const float binScale = binScaleFactor / centroidExtent[best.axis];
+        for (const Reference& reference : node.references)
+        {
+            if (GetBinIndex(reference.GetCentroid2()[best.axis], centroidBounds.min[best.axis], binScale, maxBin) >= best.bin)
+                best.rightBounds.Extend(reference.bounds);
+        }
+        best.numRight = count - best.numLeft;
+    }
+    return best;
+}
+
+SpatialSplitBuilder::Split SpatialSplitBuilder::FindSpatialSplit(const PendingNode& node, std::vector<SpatialBin>& bins) const
+{
+    const uint32_t numBins = m_settings.numSpatialBins;
+    const float maxBin = static_cast<float>(numBins - 1);
+
+    Split best;
+    std::vector<float> rightCosts(numBins);
+    std::vector<Aabb> rightBounds(numBins);
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const float extent = node.bounds.max[axis] - node.bounds.min[axis];
+        if (extent <= 1e-20f)
+            continue;
+        const float binScale = numBins * (1.0f - 1e-6f) / extent;
+
+        // Each reference is clipped at the planes between the bins it covers, piece by piece from the left.
+        bins.assign(numBins, SpatialBin());
+        for (const Reference& reference : node.references)
+        {
+            const uint32_t entryBin = GetBinIndex(reference.bounds.min[axis], node.bounds.min[axis], binScale, maxBin);
+            const uint32_t exitBin = GetBinIndex(reference.bounds.max[axis], node.bounds.min[axis], binScale, maxBin);
+            Reference remainder = reference;
+            for (uint32_t bin = entryBin; bin < exitBin; ++bin)
+            {
+                Aabb left, right;
+                SplitReference(remainder, axis, GetSpatialPlane(node.bounds, axis, numBins, bin + 1), left, right);
+                if (IsValid(left))
+                    bins[bin].bounds.Extend(left);
+                remainder.bounds = right;
+            }
+            if (IsValid(remainder.bounds))
+                bins[exitBin].bounds.Extend(remainder.bounds);
+            ++bins[entryBin].numEntries;
+            ++bins[exitBin].numExits;
+        }
+
+        Aabb accumulatedBounds;
+        uint32_t accumulatedCount = 0;
+        for (uint32_t split = numBins - 1; split > 0; --split)
+        {
+            accumulatedBounds.Extend(bins[split].bounds);
+            accumulatedCount += bins[split].numExits;
+            rightBounds[split] = accumulatedBounds;
+            rightCosts[split] = accumulatedCount ? accumulatedBounds.GetSurfaceArea() * GetLeafCost(accumulatedCount) : 0.0f;
+        }
+        accumulatedBounds = Aabb();
+        accumulatedCount = 0;
+        uint32_t numRight = static_cast<uint32_t>(node.references.size());
+        for (uint32_t split = 1; split < numBins; ++split)
+        {
+            accumulatedBounds.Extend(bins[split - 1].bounds);
+            accumulatedCount += bins[split - 1].numEntries;
+            numRight -= bins[split - 1].numExits;
+            if (accumulatedCount == 0 || numRight == 0)
+                continue;
+            const float cost = accumulatedBounds.GetSurfaceArea() * GetLeafCost(accumulatedCount) + rightCosts[split];
+            if (cost < best.cost)
+            {
+                best.cost = cost;
+                best.axis = axis;
+                best.bin = split;
+                best.leftBounds = accumulatedBounds;
+                best.rightBounds = rightBounds[split];
+                best.numLeft = accumulatedCount;
+                best.numRight = numRight;
+            }
+        }
+    }
+    return best;
+}
+
+void SpatialSplitBuilder::SplitReference(const Reference& reference, int axis, float position, Aabb& left, Aabb& right) const
+{
+    left = Aabb();
+    right = Aabb();
+    const Float3* vertices = &m_triangleVertices[reference.primitiveIndex * 3];
+    for (int i = 0; i < 3; ++i)
+    {
+        const Float3& v0 = vertices[i];
+        const Float3& v1 = vertices[(i + 1) % 3];
+        if (v0[axis] <= position)
+            left.Extend(v0);
+        if (v0[axis] >= position)
+            right.Extend(v0);
+        if ((v0[axis] < position && v1[axis] > position) || (v0[axis] > position && v1[axis] < position))
+        {
+            // The rounded intersection point may lie slightly inside the triangle. A margin of a few ulps
+            // keeps the clipped bounds conservative, otherwise rays could slip through between the children.
+            const float t = (position - v0[axis]) / (v1[axis] - v0[axis]);
+            const Float3 point = v0 + (v1 - v0) * t;
+            const Float3 margin = (Max(v0, -v0) + Max(v1, -v1)) * 1e-6f;
+            Aabb pointBounds(point - margin, point + margin);
+            pointBounds.min[axis] = position;
+            pointBounds.max[axis] = position;
+            left.Extend(pointBounds);
+            right.Extend(pointBounds);
+        }
+    }
+
+    // The reference may already be a clipped part of the triangle.
+    left.max[axis] = std::min(left.max[axis], position);
+    right.min[axis] = std::max(right.min[axis], position);
+    left = Intersect(left, reference.bounds);
+    right = Intersect(right, reference.bounds);
+}
+
+void SpatialSplitBuilder::PartitionObjects(const PendingNode& node, const Aabb& centroidBounds, const Split& split, PendingNode& left, PendingNode& right) const
+{
+    const uint32_t count = static_cast<uint32_t>(node.references.size());
+    if (split.axis < 0)
+    {
+        // All centroids in one spot, only the leaf size is kept in check.
+        left.references.assign(node.references.begin(), node.references.begin() + count / 2);
+        right.references.assign(node.references.begin() + count / 2, node.references.end());
+    }
+    else
+    {
+        const uint32_t numBins = std::min(m_settings.sah.numBins, count);
+        const float binScale = numBins * (1.0f - 1e-6f) / centroidBounds.GetExtent()[split.axis];
+        const float maxBin = static_cast<float>(numBins - 1);
+        left.references.reserve(split.numLeft);
+        right.references.reserve(split.numRight);
+        for (const Reference& reference : node.references)
+        {
+            const bool isLeft = GetBinIndex(reference.GetCentroid2()[split.axis], centroidBounds.min[split.axis], binScale, maxBin) < split.bin;
+            (isLeft ? left : right).references.push_back(reference);
+        }
+    }
+
+    for (const Reference& reference : left.references)
+        left.bounds.Extend(reference.bounds);
+    for (const Reference& reference : right.references)
+        right.bounds.Extend(reference.bounds);
+    DistributeBudget(node.budget, left, right);
+}
+
+void SpatialSplitBuilder::PartitionSpatial(const PendingNode& node, const Split& split, PendingNode& left, PendingNode& right) const
+{
+    const uint32_t numBins = m_settings.numSpatialBins;
+    const int axis = split.axis;
+    const float extent = node.bounds.max[axis] - node.bounds.min[axis];
+    const float binScale = numBins * (1.0f - 1e-6f) / extent;
+    const float maxBin = static_cast<float>(numBins - 1);
+    const float position = GetSpatialPlane(node.bounds, axis, numBins, split.bin);
+
+    // Costs of the unsplitting decisions use the child bounds and counts of the binned evaluation (Stich et al. 2009, section 4.3).
+    Aabb leftBounds = split.leftBounds;
+    Aabb rightBounds = split.rightBounds;
+    uint32_t numLeft = split.numLeft;
+    uint32_t numRight = split.numRight;
+    uint32_t budget = node.budget;
+    left.references.reserve(numLeft);
+    right.references.reserve(numRight);
+    for (const Reference& reference : node.references)
+    {
+        const uint32_t entryBin = GetBinIndex(reference.bounds.min[axis], node.bounds.min[axis], binScale, maxBin);
+        const uint32_t exitBin = GetBinIndex(reference.bounds.max[axis], node.bounds.min[axis], binScale, maxBin);
+        if (exitBin < split.bin)
+        {
+            left.references.push_back(reference);
+            continue;
+        }
+        if (entryBin >= split.bin)
+        {
+            right.references.push_back(reference);
+            continue;
+        }
+
+        Reference leftPart = reference;
+        Reference rightPart = reference;
+        SplitReference(reference, axis, position, leftPart.bounds, rightPart.bounds);
+        // Rounding of the bin indices can make one part empty.
+        if (!IsValid(rightPart.bounds))
+        {
+            left.references.push_back(reference);
+            continue;
+        }
+        if (!IsValid(leftPart.bounds))
+        {
+            right.references.push_back(reference);
+            continue;
+        }
+
+        // Moving the whole reference to one side can be cheaper than duplicating it, which also saves budget.
+        const float splitCost = leftBounds.GetSurfaceArea() * numLeft + rightBounds.GetSurfaceArea() * numRight;
+        const Aabb leftUnsplitBounds = Union(leftBounds, reference.bounds);
+        const Aabb rightUnsplitBounds = Union(rightBounds, reference.bounds);
+        const float leftUnsplitCost = leftUnsplitBounds.GetSurfaceArea() * numLeft + rightBounds.GetSurfaceArea() * (numRight - 1);
+        const float rightUnsplitCost = leftBounds.GetSurfaceArea() * (numLeft - 1) + rightUnsplitBounds.GetSurfaceArea() * numRight;
+        if (splitCost < std::min(leftUnsplitCost, rightUnsplitCost) && budget > 0)
+        {
+            --budget;
+            left.references.push_back(leftPart);
+            right.references.push_back(rightPart);
+        }
+        else if (leftUnsplitCost <= rightUnsplitCost)
+        {
+            left.references.push_back(reference);
+            leftBounds = leftUnsplitBounds;
+            --numRight;
+        }
+        else
+        {
+            right.references.push_back(reference);
+            rightBounds = rightUnsplitBounds;
+            --numLeft;
+        }
+    }
+
+    for (const Reference& reference : left.references)
+        left.bounds.Extend(reference.bounds);
+    for (const Reference& reference : right.references)
+        right.bounds.Extend(reference.bounds);
+    DistributeBudget(budget, left, right);
+}
+
+void SpatialSplitBuilder::BuildSubtree(PendingNode root, ThreadPool::TaskGroup* taskGroup)
+{
+    std::vector<ObjectBin> objectBins;
+    std::vector<SpatialBin> spatialBins;
+
+    // Large right children become tasks of their own, everything else is processed depth first right here.
+    std::vector<PendingNode> stack;
+    stack.push_back(std::move(root));
+    while (!stack.empty())
+    {
+        PendingNode pending = std::move(stack.back());
+        stack.pop_back();
+        const uint32_t count = static_cast<uint32_t>(pending.references.size());
+
+        BvhNode& node = m_bvh.nodes[pending.nodeIndex];
+        node.boundsMin = pending.bounds.min;
+        node.boundsMax = pending.bounds.max;
+        if (count == 1 || pending.depth >= Bvh::MaxDepth)
+        {
+            EmitLeaf(node, pending.references);
+            continue;
+        }
+
+        Aabb centroidBounds;
+        for (const Reference& reference : pending.references)
+            centroidBounds.Extend(reference.GetCentroid2());
+        const Split objectSplit = FindObjectSplit(pending, centroidBounds, objectBins);
+
+        // Spatial splits only pay off where the object split children overlap, and only while there is budget left.
+        Split spatialSplit;
+        const Aabb overlap = Intersect(objectSplit.leftBounds, objectSplit.rightBounds);
+        const float overlapArea = objectSplit.axis < 0 ? INFINITY : (IsValid(overlap) ? overlap.GetSurfaceArea() : 0.0f);
+        if (overlapArea > m_minOverlapArea && pending.budget > 0 && m_settings.numSpatialBins > 1)
+            spatialSplit = FindSpatialSplit(pending, spatialBins);
+
+        const float bestCost = m_settings.sah.traversalCost + std::min(objectSplit.cost, spatialSplit.cost) / pending.bounds.GetSurfaceArea();
+        if (count <= m_settings.sah.maxPrimitivesPerLeaf && GetLeafCost(count) <= bestCost)
+        {
+            EmitLeaf(node, pending.references);
+            continue;
+        }
+
+        PendingNode leftChild, rightChild;
+        if (spatialSplit.cost < objectSplit.cost)
+        {
+            PartitionSpatial(pending, spatialSplit, leftChild, rightChild);
+            // Unsplitting may have moved everything to one side.
+            if (leftChild.references.empty() || rightChild.references.empty())
+            {
+                leftChild = PendingNode();
+                rightChild = PendingNode();
+            }
+        }
+        if (leftChild.references.empty() && rightChild.references.empty())
+        {
+            if (objectSplit.axis < 0 && count <= m_settings.sah.maxPrimitivesPerLeaf)
+            {
+                EmitLeaf(node, pending.references);
+                continue;
+            }
+            PartitionObjects(pending, centroidBounds, objectSplit, leftChild, rightChild);
+        }
+        pending.references.clear();
+        pending.references.shrink_to_fit();
+
+        const uint32_t leftIndex = m_numNodes.fetch_add(2);
+        node.childOrFirstPrimitive = leftIndex;
+        node.numPrimitives = 0;
+        leftChild.nodeIndex = leftIndex;
+        leftChild.depth = pending.depth + 1;
+        rightChild.nodeIndex = leftIndex + 1;
+        rightChild.depth = pending.depth + 1;
+
+        if (taskGroup && rightChild.references.size() >= m_settings.sah.parallelThreshold)
+        {
+            // Tasks have to be copyable, the references are moved only once.
+            std::shared_ptr<PendingNode> task = std::make_shared<PendingNode>(std::move(rightChild));
+            taskGroup->Run([this, task, taskGroup] { BuildSubtree(std::move(*task), taskGroup); });
+        }
+        else
+            stack.push_back(std::move(rightChild));
+        stack.push_back(std::move(leftChild));
+    }
+}
+
+Bvh Bvh::BuildSpatialSplits(const std::vector<Float3>& triangleVertices, const BvhSpatialSplitSettings& settings, ThreadPool* threadPool)
+{
+    Bvh bvh;
+    SpatialSplitBuilder(triangleVertices, settings, threadPool, bvh).Build();
+    return bvh;
+}
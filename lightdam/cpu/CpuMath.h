@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+// Minimal vector math for the CPU side, with no dependency on DirectXMath/SimpleMath (which require Windows headers).
+// Function names follow their HLSL counterparts so CPU code can mirror the shaders line by line.
+
+struct Float2
+{
+    Float2() = default;
+    constexpr Float2(float x, float y) : x(x), y(y) {}
+
+    float x, y;
+};
+
+struct Float3
+{
+    Float3() = default;
+    constexpr Float3(float x, float y, float z) : x(x), y(y), z(z) {}
+    explicit constexpr Float3(float v) : x(v), y(v), z(v) {}
+
+    float& operator[](int i)       { return (&x)[i]; }
+    float operator[](int i) const  { return (&x)[i]; }
+
+    Float3& operator+=(const Float3& b) { x += b.x; y += b.y; z += b.z; return *this; }
+    Float3& operator-=(const Float3& b) { x -= b.x; y -= b.y; z -= b.z; return *this; }
+    Float3& operator*=(const Float3& b) { x *= b.x; y *= b.y; z *= b.z; return *this; }
+    Float3& operator*=(float s)         { x *= s; y *= s; z *= s; return *this; }
+    Float3& operator/=(float s)         { return *this *= 1.0f / s; }
+
+    float x, y, z;
+};
+
+inline Float2 operator+(const Float2& a, const Float2& b) { return Float2(a.x + b.x, a.y + b.y); }
+inline Float2 operator*(const Float2& a, float s)         { return Float2(a.x * s, a.y * s); }
+
+inline Float3 operator-(const Float3& a)                  { return Float3(-a.x, -a.y, -a.z); }
+inline Float3 operator+(const Float3& a, const Float3& b) { return Float3(a.x + b.x, a.y + b.y, a.z + b.z); }
+inline Float3 operator-(const Float3& a, const Float3& b) { return Float3(a.x - b.x, a.y - b.y, a.z - b.z); }
+inline Float3 operator*(const Float3& a, const Float3& b) { return Float3(a.x * b.x, a.y * b.y, a.z * b.z); }
+inline Float3 operator/(const Float3& a, const Float3& b) { return Float3(a.x / b.x, a.y / b.y, a.z / b.z); }
+inline Float3 operator*(const Float3& a, float s)         { return Float3(a.x * s, a.y * s, a.z * s); }
+inline Float3 operator*(float s, const Float3& a)         { return a * s; }
+inline Float3 operator/(const Float3& a, float s)         { return a * (1.0f / s); }
+
+inline float Dot(const Float3& a, const Float3& b)        { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Float3 Cross(const Float3& a, const Float3& b)     { return Float3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x); }
+inline float Length(const Float3& a)                      { return sqrtf(Dot(a, a)); }
+inline Float3 Normalize(const Float3& a)                  { return a / Length(a); }
+inline Float3 Min(const Float3& a, const Float3& b)       { return Float3(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)); }
+inline Float3 Max(const Float3& a, const Float3& b)       { return Float3(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)); }
+inline Float3 Sqrt(const Float3& a)                       { return Float3(sqrtf(a.x), sqrtf(a.y), sqrtf(a.z)); }
+inline float Saturate(float v)                            { return std::min(std::max(v, 0.0f), 1.0f); }
+
+// Same as HLSL reflect: i - 2 * dot(n, i) * n
+inline Float3 Reflect(const Float3& i, const Float3& n)   { return i - 2.0f * Dot(n, i) * n; }
+
+// Same as SimpleMath's Vector3::Barycentric: v0 + f * (v1 - v0) + g * (v2 - v0)
+inline Float3 Barycentric(const Float3& v0, const Float3& v1, const Float3& v2, float f, float g) { return v0 + f * (v1 - v0) + g * (v2 - v0); }
+
+// Barycentrics given as in Attributes.bary, i.e. weights of the second and third vertex.
+inline Float3 BarycentricLerp(const Float3& v0, const Float3& v1, const Float3& v2, Float2 bary) { return v0 * (1.0f - bary.x - bary.y) + v1 * bary.x + v2 * bary.y; }
+inline Float2 BarycentricLerp(const Float2& v0, const Float2& v1, const Float2& v2, Float2 bary) { return v0 * (1.0f - bary.x - bary.y) + v1 * bary.x + v2 * bary.y; }
+
+inline float GetLuminance(const Float3& rgb)              { return Dot(rgb, Float3(0.212671f, 0.715160f, 0.072169f)); }
+
+// Tangent frame around a normalized vector, same as CreateONB in Math.hlsl. Rows are tangent, bitangent, normal.
+struct Float3x3
+{
+    Float3 rows[3];
+
+    Float3 TransformToLocal(const Float3& v) const  { return Float3(Dot(v, rows[0]), Dot(v, rows[1]), Dot(v, rows[2])); }
+    Float3 TransformToWorld(const Float3& v) const  { return rows[0] * v.x + rows[1] * v.y + rows[2] * v.z; }
+};
+
+inline Float3x3 CreateONB(const Float3& n)
+{
+    Float3x3 m;
+    if (fabsf(n.y) > fabsf(n.x))
+        m.rows[0] = Float3(0.0f, n.z, -n.y);
+    else
+        m.rows[0] = Float3(-n.z, 0.0f, n.x);
+    m.rows[0] = Normalize(m.rows[0]);
+    m.rows[1] = Cross(n, m.rows[0]);
+    m.rows[2] = n;
+    return m;
+}
+
+// Affine transformation as the upper three rows of a 4x4 matrix, the layout of D3D12_RAYTRACING_INSTANCE_DESC::Transform.
+struct Float3x4
+{
+    static Float3x4 Identity()                      { return { { { 1.0f, 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 0.0f } } }; }
+
+    Float3 TransformPoint(const Float3& p) const    { return TransformVector(p) + Float3(m[0][3], m[1][3], m[2][3]); }
+    Float3 TransformVector(const Float3& v) const
+    {
+        return Float3(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+                      m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                      m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+    }
+
+    float m[3][4];
+};
+
+// Inverse of an invertible affine transformation, via the adjugate of its linear part.
+inline Float3x4 Inverse(const Float3x4& a)
+{
+    const Float3 row0(a.m[0][0], a.m[0][1], a.m[0][2]);
+    const Float3 row1(a.m[1][0], a.m[1][1], a.m[1][2]);
+    const Float3 row2(a.m[2][0], a.m[2][1], a.m[2][2]);
+    // Columns of the inverse of the linear part are the cross products of its rows, divided by the determinant.
+    const Float3 column0 = Cross(row1, row2);
+    const Float3 column1 = Cross(row2, row0);
+    const Float3 column2 = Cross(row0, row1);
+    const float invDeterminant = 1.0f / Dot(row0, column0);
+
+    Float3x4 inverse;
+    for (int row = 0; row < 3; ++row)
+    {
+        inverse.m[row][0] = column0[row] * invDeterminant;
+        inverse.m[row][1] = column1[row] * invDeterminant;
+        inverse.m[row][2] = column2[row] * invDeterminant;
+    }
+    const Float3 translation = inverse.TransformVector(Float3(a.m[0][3], a.m[1][3], a.m[2][3]));
+    for (int row = 0; row < 3; ++row)
+        inverse.m[row][3] = -translation[row];
+    return inverse;
+}
+
+// Axis aligned bounding box, empty if min > max.
+struct Aabb
+{
+    Aabb() : min(INFINITY), max(-INFINITY) {}
+    Aabb(const Float3& min, const Float3& max) : min(min), max(max) {}
+
+    void Extend(const Float3& point)    { min = Min(min, point); max = Max(max, point); }
+    void Extend(const Aabb& box)        { min = Min(min, box.min); max = Max(max, box.max); }
+
+    Float3 GetCenter() const            { return (min + max) * 0.5f; }
+    Float3 GetExtent() const            { return max - min; }
+    int GetLargestAxis() const
+    {
+        const Float3 extent = GetExtent();
+        return extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    }
+    float GetSurfaceArea() const
+    {
+        const Float3 extent = GetExtent();
+        return extent.x < 0.0f ? 0.0f : 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+    }
+
+    Float3 min;
+    Float3 max;
+};
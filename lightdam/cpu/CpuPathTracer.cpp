@@ -0,0 +1,441 @@
+#include "CpuPathTracer.h"
+#include "Brdf.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <thread>
+
+static float SrgbToLinear(float srgb)
+{
+    return srgb <= 0.04045f ? srgb / 12.92f : powf((srgb + 0.055f) / 1.055f, 2.4f);
+}
+
+Float3 CpuPathTracer::LinearTexture::Sample(Float2 texcoord) const
+{
+    // Texel centers are at half integers, same as the hardware sampler.
+    const float x = (texcoord.x - floorf(texcoord.x)) * width - 0.5f;
+    const float y = (texcoord.y - floorf(texcoord.y)) * height - 0.5f;
+    const float x0 = floorf(x);
+    const float y0 = floorf(y);
+    const float fx = x - x0;
+    const float fy = y - y0;
+
+    // Coordinates are in [-1, size], NaN texcoords end up anywhere but must not read out of bounds.
+    auto wrap = [](float v, uint32_t size) { return (static_cast<uint32_t>(static_cast<int32_t>(v) + static_cast<int32_t>(size))) % size; };
+    const uint32_t ix0 = wrap(x0, width);
+    const uint32_t ix1 = wrap(x0 + 1.0f, width);
+    const uint32_t iy0 = wrap(y0, height);
+    const uint32_t iy1 = wrap(y0 + 1.0f, height);
+
+    const Float3 top = texels[iy0 * width + ix0] * (1.0f - fx) + texels[iy0 * width + ix1] * fx;
+    const Float3 bottom = texels[iy1 * width + ix0] * (1.0f - fx) + texels[iy1 * width + ix1] * fx;
+    return top * (1.0f - fy) + bottom * fy;
+}
+
+CpuPathTracer::CpuPathTracer(const CpuScene& scene, const Settings& settings)
+    : m_scene(scene)
+    , m_settings(settings)
+    , m_numaTopology(settings.emulatedNumaNodes ? NumaTopology::Emulate(settings.emulatedNumaNodes) : NumaTopology::Detect())
+    , m_numThreads(settings.numThreads ? settings.numThreads : std::max(1u, std::thread::hardware_concurrency()))
+    , m_threadPool(m_numThreads, [this](uint32_t workerIndex)
+    {
+        // The calling thread (worker 0) is not ours to pin, it renders on the first node wherever it runs.
+        if (m_settings.numaAware && m_numaTopology.GetNumNodes() > 1)
+            m_numaTopology.PinCurrentThread(GetNodeOfWorker(workerIndex));
+    })
+    , m_lightSampler(scene.areaLights)
+    , m_outputWidth(0)
+    , m_outputHeight(0)
+    , m_iterationNumber(0)
+    , m_numRaysTraced(0)
+{
+    assert(settings.numBounces <= MaxNumBounces);
+    assert(settings.numLightSamplesPerHit <= settings.numLightSamplesAvailable);
+
+    std::unique_ptr<SceneReplica> replica(new SceneReplica());
+    if (settings.lazyBvh)
+        m_lazyIntersector.reset(new LazySceneIntersector(scene, &m_threadPool, settings.bvhLayout));
+    else if (settings.bvhCache)
+    {
+        const std::string cacheFilePath = SceneIntersector::GetCacheFilePath(scene, settings.bvhBuilder, settings.bvhLayout);
+        replica->intersector = SceneIntersector::LoadOrBuild(scene, cacheFilePath, &m_threadPool, settings.bvhBuilder, settings.bvhLayout);
+    }
+    else
+        replica->intersector.reset(new SceneIntersector(scene, &m_threadPool, settings.bvhBuilder, settings.bvhLayout));
+
+    // Decode all textures once. Filtering happens on linear values, just like the GPU does for sRGB formats.
+    float srgbToLinear[256];
+    for (int i = 0; i < 256; ++i)
+        srgbToLinear[i] = SrgbToLinear(i / 255.0f);
+
+    replica->textures.reserve(scene.textures.size());
+    for (const CpuScene::Texture& texture : scene.textures)
+    {
+        LinearTexture linearTexture;
+        if (texture.srgbTexels.empty())
+        {
+            linearTexture.width = 1;
+            linearTexture.height = 1;
+            linearTexture.texels.push_back(texture.color);
+        }
+        else
+        {
+            linearTexture.width = texture.width;
+            linearTexture.height = texture.height;
+            linearTexture.texels.resize(texture.width * texture.height);
+            for (size_t i = 0; i < linearTexture.texels.size(); ++i)
+            {
+                const uint8_t* texel = &texture.srgbTexels[i * 4];
+                linearTexture.texels[i] = Float3(srgbToLinear[texel[0]], srgbToLinear[texel[1]], srgbToLinear[texel[2]]);
+            }
+        }
+        replica->textures.push_back(std::move(linearTexture));
+    }
+    CreateMaterials(*replica);
+
+    // The BVH was built by threads on all nodes, so every node gets a copy of its own, the first one included.
+    if (m_settings.numaAware && m_numaTopology.GetNumNodes() > 1)
+    {
+        for (uint32_t node = 0; node < m_numaTopology.GetNumNodes(); ++node)
+            m_replicas.push_back(CreateReplica(*replica, node));
+    }
+    else
+        m_replicas.push_back(std::move(replica));
+
+    std::vector<uint32_t> meshOrder(scene.meshes.size());
+    for (uint32_t i = 0; i < meshOrder.size(); ++i)
+        meshOrder[i] = i;
+    std::stable_sort(meshOrder.begin(), meshOrder.end(), [&](uint32_t a, uint32_t b) { return scene.meshes[a].materialIndex < scene.meshes[b].materialIndex; });
+    m_meshShadingRank.resize(scene.meshes.size());
+    for (uint32_t i = 0; i < meshOrder.size(); ++i)
+        m_meshShadingRank[meshOrder[i]] = i;
+
+    if (!scene.cameras.empty())
+        SetCamera(scene.cameras[0]);
+    else
+        SetCamera({ Float3(0.0f), Float3(0.0f, 0.0f, 1.0f), Float3(0.0f, 1.0f, 0.0f), 1.0f });
+
+    ResizeOutput(scene.screenWidth ? scene.screenWidth : 1024, scene.screenHeight ? scene.screenHeight : 768);
+}
+
+std::unique_ptr<CpuPathTracer::SceneReplica> CpuPathTracer::CreateReplica(const SceneReplica& source, uint32_t node) const
+{
+    std::unique_ptr<SceneReplica> replica;
+    std::thread thread([&]()
+    {
+        m_numaTopology.PinCurrentThread(node);
+        replica.reset(new SceneReplica());
+        if (source.intersector)
+            replica->intersector = source.intersector->CreateReplica();
+        replica->textures = source.textures;
+        CreateMaterials(*replica);
+    });
+    thread.join();
+    return replica;
+}
+
+void CpuPathTracer::CreateMaterials(SceneReplica& replica) const
+{
+    replica.materials.clear();
+    for (const CpuScene::Material& material : m_scene.materials)
+    {
+        const LinearTexture& diffuseTexture = replica.textures[material.diffuseTextureIndex];
+        const bool textured = diffuseTexture.texels.size() > 1;
+        replica.materials.push_back({ material.type, &diffuseTexture, textured, diffuseTexture.texels[0], material.eta, material.ks, material.roughness, material.roughness * material.roughness });
+    }
+}
+
+uint32_t CpuPathTracer::GetNodeOfWorker(uint32_t workerIndex) const
+{
+    return m_settings.numaAware ? m_numaTopology.GetNodeOfThread(workerIndex, m_numThreads) : 0;
+}
+
+void CpuPathTracer::ResizeOutput(uint32_t outputWidth, uint32_t outputHeight)
+{
+    m_outputWidth = outputWidth;
+    m_outputHeight = outputHeight;
+    m_output.resize(outputWidth * outputHeight * 4);
+    SetCamera(m_camera);
+}
+
+void CpuPathTracer::SetCamera(const CpuScene::CameraDefinition& camera)
+{
+    m_camera = camera;
+    m_cameraPosition = camera.position;
+    camera.ComputeCameraParams(m_outputHeight == 0 ? 1.0f : static_cast<float>(m_outputWidth) / m_outputHeight, m_cameraU, m_cameraV, m_cameraW);
+    RestartSampling();
+}
+
+void CpuPathTracer::RestartSampling()
+{
+    std::fill(m_output.begin(), m_output.end(), 0.0f);
+    m_iterationNumber = 0;
+    m_numRaysTraced = 0;
+    m_schedulingStats = SchedulingStats();
+}
+
+void CpuPathTracer::DrawIterations(uint32_t numIterations)
+{
+    // Light samples of every iteration, same as the ones the GPU path tracer uploads for each frame.
+    std::vector<LightSampler::LightSample> lightSamples(numIterations * m_settings.numLightSamplesAvailable);
+    for (uint32_t i = 0; i < numIterations; ++i)
+        m_lightSampler.GenerateRandomSamples(m_iterationNumber + i, &lightSamples[i * m_settings.numLightSamplesAvailable], m_settings.numLightSamplesAvailable);
+
+    // Threads grab tiles and render all iterations for them at once, so there is no synchronization on the output.
+    const uint32_t numTilesX = (m_outputWidth + TileSize - 1) / TileSize;
+    const uint32_t numTilesY = (m_outputHeight + TileSize - 1) / TileSize;
+    // Every thread of the pool has a deque of tiles, consecutive threads are on the same node and so get neighboring parts of the image.
+    std::vector<uint32_t> workerNodes(m_numThreads);
+    for (uint32_t workerIndex = 0; workerIndex < m_numThreads; ++workerIndex)
+        workerNodes[workerIndex] = GetNodeOfWorker(workerIndex);
+    const uint32_t numWorkers = std::min(m_numThreads, numTilesX * numTilesY);
+    TileScheduler scheduler(m_outputWidth, m_outputHeight, TileSize, PacketSize, m_numThreads, m_settings.workStealing, workerNodes);
+    std::atomic<uint64_t> numRays(0);
+    std::atomic<uint64_t> busyNanoseconds(0);
+    auto start = std::chrono::high_resolution_clock::now();
+    m_threadPool.ParallelFor(0, numWorkers, 1, [&](uint32_t, uint32_t)
+    {
+        // Tasks take the tiles and the scene replica of the thread they happen to run on.
+        const uint32_t workerIndex = m_threadPool.GetCurrentWorkerIndex();
+        const SceneReplica& replica = *m_replicas[workerNodes[workerIndex]];
+        uint64_t numRaysThread = 0;
+        if (m_settings.wavefront)
+            DrawWavefront(replica, scheduler, workerIndex, m_iterationNumber, numIterations, lightSamples.data(), numRaysThread);
+        else
+        {
+            TileScheduler::Tile tile;
+            while (scheduler.GetNextTile(workerIndex, tile))
+                DrawTile(replica, tile, m_iterationNumber, numIterations, lightSamples.data(), numRaysThread);
+        }
+        numRays += numRaysThread;
+        busyNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count();
+    });
+    const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    m_iterationNumber += numIterations;
+    m_numRaysTraced += numRays;
+
+    const TileScheduler::Stats tileStats = scheduler.GetStats();
+    m_schedulingStats.numWorkers = numWorkers;
+    m_schedulingStats.numNodes = static_cast<uint32_t>(m_replicas.size());
+    m_schedulingStats.seconds += seconds;
+    m_schedulingStats.busySeconds += busyNanoseconds * 1e-9;
+    m_schedulingStats.tiles.numTiles += tileStats.numTiles;
+    m_schedulingStats.tiles.numSteals += tileStats.numSteals;
+    m_schedulingStats.tiles.numRemoteSteals += tileStats.numRemoteSteals;
+    m_schedulingStats.tiles.numSplits += tileStats.numSplits;
+}
+
+void CpuPathTracer::DrawTile(const SceneReplica& replica, const TileScheduler::Tile& tile, uint32_t firstIteration, uint32_t numIterations, const LightSampler::LightSample* lightSamples, uint64_t& numRays)
+{
+    static_assert(PacketSize * PacketSize <= RayPacket::MaxNumRays, "Packets of camera rays need to fit into a RayPacket");
+
+    const uint32_t tileMinX = tile.minX;
+    const uint32_t tileMinY = tile.minY;
+    const uint32_t tileMaxX = tile.maxX;
+    const uint32_t tileMaxY = tile.maxY;
+
+    for (uint32_t i = 0; i < numIterations; ++i)
+    {
+        const uint32_t iteration = firstIteration + i;
+        const float jitterX = m_haltonSampler.Sample(iteration, 0);
+        const float jitterY = m_haltonSampler.Sample(iteration, 1);
+        const LightSampler::LightSample* iterationLightSamples = lightSamples + i * m_settings.numLightSamplesAvailable;
+
+        // Bounces are incoherent and always traced one by one.
+        const bool usePackets = m_settings.primaryRayPackets && replica.intersector;
+        for (uint32_t packetMinY = tileMinY; packetMinY < tileMaxY; packetMinY += PacketSize)
+        {
+            for (uint32_t packetMinX = tileMinX; packetMinX < tileMaxX; packetMinX += PacketSize)
+            {
+                const uint32_t packetMaxX = std::min(packetMinX + PacketSize, tileMaxX);
+                const uint32_t packetMaxY = std::min(packetMinY + PacketSize, tileMaxY);
+                RayPacket packet;
+                packet.origin = m_cameraPosition;
+                packet.tMin = DefaultRayTMin;
+                packet.tMax = DefaultRayTMax;
+                packet.numRays = 0;
+                for (uint32_t y = packetMinY; y < packetMaxY; ++y)
+                {
+                    for (uint32_t x = packetMinX; x < packetMaxX; ++x)
+                    {
+                        const float screenCoordX = ((x + jitterX) / m_outputWidth) * 2.0f - 1.0f;
+                        const float screenCoordY = ((y + jitterY) / m_outputHeight) * 2.0f - 1.0f;
+                        packet.directions[packet.numRays++] = Normalize(screenCoordX * m_cameraU + screenCoordY * m_cameraV + m_cameraW);
+                    }
+                }
+                RayHit hits[RayPacket::MaxNumRays];
+                const uint64_t hitMask = usePackets ? replica.intersector->IntersectPacket(packet, hits) : 0;
+
+                uint32_t rayIndex = 0;
+                for (uint32_t y = packetMinY; y < packetMaxY; ++y)
+                {
+                    for (uint32_t x = packetMinX; x < packetMaxX; ++x, ++rayIndex)
+                    {
+                        const uint32_t pixelIndex = y * m_outputWidth + x;
+                        PhiloxStream random(m_settings.seed, pixelIndex, static_cast<uint64_t>(iteration) * RandomNumbersPerPath);
+                        const Ray ray = { packet.origin, packet.tMin, packet.directions[rayIndex], packet.tMax };
+
+                        Float3 radiance(0.0f);
+                        if (!usePackets)
+                            radiance = TracePath(replica, ray, nullptr, random, iterationLightSamples, numRays);
+                        else if (hitMask & (1ull << rayIndex))
+                            radiance = TracePath(replica, ray, &hits[rayIndex], random, iterationLightSamples, numRays);
+                        else
+                            ++numRays;
+
+                        float* output = &m_output[pixelIndex * 4];
+                        output[0] += radiance.x;
+                        output[1] += radiance.y;
+                        output[2] += radiance.z;
+                        output[3] += 1.0f;
+                    }
+                }
+            }
+        }
+    }
+}
+
+Float3 CpuPathTracer::TracePath(const SceneReplica& replica, Ray ray, const RayHit* primaryHit, PhiloxStream& random, const LightSampler::LightSample* lightSamples, uint64_t& numRays) const
+{
+    Float3 radiance(0.0f);
+    Float3 pathThroughput(1.0f);
+    float pathLength = 0.0f;
+
+    for (uint32_t remainingBounces = m_settings.numBounces; remainingBounces > 0;)
+    {
+        RayHit hit;
+        ++numRays;
+        if (primaryHit)
+        {
+            hit = *primaryHit;
+            primaryHit = nullptr;
+        }
+        else if (!Intersect(replica, ray, hit))
+            break;
+        remainingBounces -= 1;
+
+        pathLength += hit.t;
+        if (m_settings.enablePathLengthFilter && pathLength > m_settings.pathLengthFilterMax)
+            break;
+
+        // GetSurfaceHit
+        const CpuScene::Mesh& mesh = m_scene.meshes[hit.meshIndex];
+        const uint32_t vertexIdx0 = mesh.indices[hit.primitiveIndex * 3 + 0];
+        const uint32_t vertexIdx1 = mesh.indices[hit.primitiveIndex * 3 + 1];
+        const uint32_t vertexIdx2 = mesh.indices[hit.primitiveIndex * 3 + 2];
+        Float3 normal = Normalize(BarycentricLerp(mesh.vertices[vertexIdx0].normal, mesh.vertices[vertexIdx1].normal, mesh.vertices[vertexIdx2].normal, hit.bary));
+        if (!hit.frontFace)
+            normal = -normal;
+        const Float2 texcoord = BarycentricLerp(mesh.vertices[vertexIdx0].texcoord, mesh.vertices[vertexIdx1].texcoord, mesh.vertices[vertexIdx2].texcoord, hit.bary);
+
+        if (mesh.isEmitter)
+        {
+            if (remainingBounces == m_settings.numBounces - 1) // an eye ray
+                radiance += mesh.areaLightRadiance;
+            break;
+        }
+
+        const Material& material = replica.materials[mesh.materialIndex];
+        const Float3 worldPosition = ray.origin + hit.t * ray.direction;
+        const Float3x3 tangentToWorld = CreateONB(normal);
+        const Float3 toView = -ray.direction;
+        const Float3 toViewTS = tangentToWorld.TransformToLocal(toView);
+        const float NdotV = toViewTS.z;
+        // Single color textures are not sampled, bilinear filtering would change the color in the last bits.
+        const Float3 diffuse = material.textured ? material.diffuseTexture->Sample(texcoord) : material.diffuseColor;
+
+        // Sample area lights.
+        const float lightSampleOffsetSample = random.NextFloat();
+        const uint32_t randomSampleOffset = static_cast<uint32_t>(lightSampleOffsetSample * (m_settings.numLightSamplesAvailable - m_settings.numLightSamplesPerHit) + 0.5f);
+        Float3 lightRadiance(0.0f);
+        for (uint32_t i = 0; i < m_settings.numLightSamplesPerHit && !m_scene.areaLights.empty(); ++i)
+        {
+            // SampleAreaLight
+            const LightSampler::LightSample& areaLightSample = lightSamples[randomSampleOffset + i];
+            Float3 toLight = areaLightSample.position - worldPosition;
+            const float lightDistanceSq = Dot(toLight, toLight);
+            const float lightDistance = sqrtf(lightDistanceSq);
+            toLight /= lightDistance;
+
+            const float NdotL = Dot(toLight, normal);
+            const float lightSampleCos = Dot(-toLight, areaLightSample.normal);
+            // Unlike on the GPU, checking before tracing the shadow ray saves work.
+            if (NdotL <= 0.0f || lightSampleCos <= 0.0f)
+                continue;
+            if (m_settings.enablePathLengthFilter && pathLength + lightDistance > m_settings.pathLengthFilterMax)
+                continue;
+
+            ++numRays;
+            if (IsOccluded(replica, { worldPosition, DefaultRayTMin, toLight, lightDistance }))
+                continue;
+
+            Float3 brdfLightSample;
+            switch (material.type)
+            {
+            case CpuScene::MATERIAL_SUBSTRATE:
+                brdfLightSample = EvaluateAshikminShirleyBrdf(NdotL, toLight, NdotV, toView, normal, material.ks, material.roughnessSq, diffuse);
+                break;
+            case CpuScene::MATERIAL_METAL:
+                brdfLightSample = EvaluateMicrofacetBrdf(NdotL, toLight, NdotV, toView, normal, material.eta, material.ks, material.roughnessSq);
+                break;
+            default:
+                brdfLightSample = EvaluateLambertBrdf(diffuse);
+                break;
+            }
+
+            const float irradianceLightSample = NdotL / lightDistanceSq;
+            lightRadiance += (irradianceLightSample * lightSampleCos) * brdfLightSample * areaLightSample.intensity;
+        }
+        radiance += pathThroughput * lightRadiance / static_cast<float>(m_settings.numLightSamplesPerHit);
+
+        // Compute next ray.
+        if (remainingBounces == 0)
+            break;
+
+        const Float2 randomSample(random.NextFloat(), random.NextFloat());
+        Float3 nextRayDirTS;
+        Float3 throughput;
+        switch (material.type)
+        {
+        case CpuScene::MATERIAL_SUBSTRATE:
+            nextRayDirTS = SampleAshikminShirleySubstrateBrdf(toViewTS, randomSample, material.ks, material.roughnessSq, diffuse, throughput);
+            break;
+        case CpuScene::MATERIAL_METAL:
+        {
+            const Float3 microfacetNormalTS = SampleGGXVisibleNormal(toViewTS, material.roughness, randomSample);
+            nextRayDirTS = Reflect(-toViewTS, microfacetNormalTS);
+            const float NdotL = nextRayDirTS.z;
+            const Float3 F = FresnelDieletricConductorApprox(material.eta, material.ks, NdotL);
+            const float G2_div_G1 = (2.0f * NdotL) / (NdotL + sqrtf(material.roughnessSq + (1.0f - material.roughnessSq) * NdotL * NdotL));
+            throughput = F * G2_div_G1;
+            break;
+        }
+        default:
+            throughput = diffuse;
+            nextRayDirTS = SampleHemisphereCosine(randomSample);
+            break;
+        }
+
+        if (nextRayDirTS.z <= 0.0f)
+            break;
+
+        if (m_settings.russianRoulette)
+        {
+            const float continuationProbability = Saturate(GetLuminance(throughput));
+            if (random.NextFloat() >= continuationProbability)
+                break;
+            throughput /= continuationProbability;
+        }
+
+        pathThroughput *= throughput;
+        ray.origin = worldPosition;
+        ray.direction = tangentToWorld.TransformToWorld(nextRayDirTS);
+        ray.tMin = DefaultRayTMin;
+        ray.tMax = DefaultRayTMax;
+    }
+
+    return radiance;
+}
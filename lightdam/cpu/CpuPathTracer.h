@@ -0,0 +1,197 @@
+#pragma once
+
+#include "CpuScene.h"
+#include "LazySceneIntersector.h"
+#include "SceneIntersector.h"
+#include "TileScheduler.h"
+#include "../LightSampler.h"
+#include "../HaltonSampler.h"
+#include "../NumaTopology.h"
+#include "../RandomNumberGenerator.h"
+#include "../ThreadPool.h"
+
+#include <atomic>
+
+// Multithreaded CPU reference implementation of the light transport in RayGen.hlsl/Hit.hlsl/Brdf.hlsl.
+// Has no graphics API dependency, so it runs headless and can be used to validate GPU images.
+//
+// Differences to the GPU path tracer:
+// * Random numbers are Philox streams per pixel instead of blue noise seeded Weyl/Sobol sequences.
+// * Path state is kept in full precision instead of being packed into half floats / octahedral directions.
+class CpuPathTracer
+{
+public:
+    // Defaults mirror shaders/Config.hlsl.
+    struct Settings
+    {
+        uint32_t numBounces = 8;                    // NUM_BOUNCES, 1 bounce is direct lighting only. At most MaxNumBounces.
+        uint32_t numLightSamplesAvailable = 32;     // NUM_LIGHT_SAMPLES_AVAILABLE
+        uint32_t numLightSamplesPerHit = 1;         // NUM_LIGHT_SAMPLES_PERHIT
+        bool russianRoulette = false;               // RUSSIAN_ROULETTE
+
+        bool enablePathLengthFilter = false;        // ENABLE_PATHLENGTH_FILTER
+        float pathLengthFilterMax = 100.0f;
+
+        uint32_t numThreads = 0;                    // Used for rendering and BVH construction, 0 uses all hardware threads.
+        BvhBuilder bvhBuilder = BvhBuilder::BinnedSah;
+        BvhLayout bvhLayout = BvhLayout::Wide;      // WideQuantized only to save memory, see BvhLayout.
+        bool lazyBvh = false;                       // Builds parts of the BVH only once rays reach them, always with BvhBuilder::BinnedSah.
+        bool bvhCache = false;                      // Maps the BVH from a file next to the scene, written on the first load. Not with lazyBvh.
+        bool primaryRayPackets = true;              // Traces camera rays in packets of 8x8 pixels, faster with the wide layouts. Not with lazyBvh.
+        bool wavefront = false;                     // Moves waves of paths through one stage after another instead of one path at a time.
+        bool workStealing = true;                   // Threads take tiles along a Hilbert curve and steal from each other, instead of taking them in rows.
+        bool specializedShading = true;             // Wavefront only: shades runs of hits with the same material with a kernel compiled for
+                                                    // its type and features, instead of picking the kernel for every hit.
+        bool wideShading = true;                    // Wavefront with specialized shading only: evaluates and samples the BRDFs of 8 hits at
+                                                    // once. The images differ from one path at a time by rounding.
+        bool numaAware = true;                      // Pins the threads to NUMA nodes and gives every node its own copy of the BVH and textures.
+                                                    // The lazy BVH is shared by all nodes.
+        uint32_t emulatedNumaNodes = 0;             // Splits the processors into this many nodes instead of detecting them, 0 detects.
+        uint64_t seed = 0;
+    };
+
+    // Every path may consume at most this many random numbers per iteration (4 per bounce).
+    static const uint32_t RandomNumbersPerPath = 256;
+    static const uint32_t MaxNumBounces = RandomNumbersPerPath / 4;
+
+    CpuPathTracer(const CpuScene& scene, const Settings& settings);
+
+    void ResizeOutput(uint32_t outputWidth, uint32_t outputHeight);
+    void SetCamera(const CpuScene::CameraDefinition& camera);
+    void RestartSampling();
+
+    // Renders numIterations samples per pixel for the whole image and adds them to the output.
+    // Results are independent of the number of threads.
+    void DrawIterations(uint32_t numIterations);
+
+    // Same layout as the GPU output texture: float4 per pixel with (sum of radiance, number of samples), rows top to bottom.
+    const std::vector<float>& GetOutput() const { return m_output; }
+    uint32_t GetOutputWidth() const             { return m_outputWidth; }
+    uint32_t GetOutputHeight() const            { return m_outputHeight; }
+
+    // Number of samples per pixel since the last restart.
+    uint32_t GetIterationNumber() const         { return m_iterationNumber; }
+    // Number of radiance and shadow rays traced since the last restart.
+    uint64_t GetNumRaysTraced() const           { return m_numRaysTraced; }
+
+    // How well the threads were kept busy, summed over the DrawIterations calls since the last restart.
+    struct SchedulingStats
+    {
+        uint32_t numWorkers = 0;
+        uint32_t numNodes = 0;          // NUMA nodes with their own copy of the scene.
+        double seconds = 0.0;           // Wall clock time.
+        double busySeconds = 0.0;       // Summed over all workers, until each of them found no more tiles.
+        TileScheduler::Stats tiles;
+
+        double GetUtilization() const   { return seconds > 0.0 ? busySeconds / (seconds * numWorkers) : 0.0; }
+    };
+    const SchedulingStats& GetSchedulingStats() const { return m_schedulingStats; }
+
+    const Settings& GetSettings() const         { return m_settings; }
+    const NumaTopology& GetNumaTopology() const { return m_numaTopology; }
+    // Only one of them exists, depending on Settings::lazyBvh. The intersector is the copy of the first NUMA node.
+    const SceneIntersector* GetIntersector() const { return m_replicas[0]->intersector.get(); }
+    const LazySceneIntersector* GetLazyIntersector() const { return m_lazyIntersector.get(); }
+
+private:
+    // Pixels of a tile are rendered by one thread, for all iterations of a DrawIterations call.
+    // Tiles stolen at the end of a call are split down to PacketSize.
+    static const uint32_t TileSize = 32;
+    // Camera rays are traced in packets of PacketSize x PacketSize pixels.
+    static const uint32_t PacketSize = 8;
+
+    // Texture converted to linear colors, sampled bilinear with wrapping like SamplerLinearWrap.
+    struct LinearTexture
+    {
+        uint32_t width;
+        uint32_t height;
+        std::vector<Float3> texels;
+
+        Float3 Sample(Float2 texcoord) const;
+    };
+
+    struct Material
+    {
+        CpuScene::MaterialType type;
+        const LinearTexture* diffuseTexture;
+        bool textured;                              // False for single color textures, diffuseColor is used instead of sampling them.
+        Float3 diffuseColor;
+        Float3 eta;
+        Float3 ks;
+        float roughness;
+        float roughnessSq;
+    };
+
+    // Everything rays touch that does not change while rendering, copied into the memory of every NUMA node.
+    struct SceneReplica
+    {
+        std::unique_ptr<SceneIntersector> intersector;  // Null with Settings::lazyBvh.
+        std::vector<LinearTexture> textures;
+        std::vector<Material> materials;                // Point to the textures of the same replica.
+    };
+    // Copies a replica on a thread pinned to the node, so that the copy is placed in its memory.
+    std::unique_ptr<SceneReplica> CreateReplica(const SceneReplica& source, uint32_t node) const;
+    void CreateMaterials(SceneReplica& replica) const;
+    // NUMA node a worker of the thread pool runs on, always 0 if the renderer is not NUMA aware.
+    uint32_t GetNodeOfWorker(uint32_t workerIndex) const;
+
+    void DrawTile(const SceneReplica& replica, const TileScheduler::Tile& tile, uint32_t firstIteration, uint32_t numIterations, const LightSampler::LightSample* lightSamples, uint64_t& numRays);
+    // primaryHit is the hit of the camera ray if it was already traced in a packet, null to trace it here.
+    Float3 TracePath(const SceneReplica& replica, Ray ray, const RayHit* primaryHit, PhiloxStream& random, const LightSampler::LightSample* lightSamples, uint64_t& numRays) const;
+
+    // Wavefront rendering, see CpuPathTracerWavefront.cpp.
+    struct Wavefront;
+    void DrawWavefront(const SceneReplica& replica, TileScheduler& scheduler, uint32_t workerIndex, uint32_t firstIteration, uint32_t numIterations,
+                       const LightSampler::LightSample* lightSamples, uint64_t& numRays);
+    void ExtendWavefront(const SceneReplica& replica, Wavefront& wave, bool cameraRays, uint64_t& numRays) const;
+    // Features a shading kernel is compiled for, in addition to the material type.
+    enum ShadeFeatures
+    {
+        SHADE_TEXTURED = 1,
+        SHADE_PATH_LENGTH_FILTER = 2,
+        SHADE_RUSSIAN_ROULETTE = 4,
+        SHADE_WIDE = 8,
+        SHADE_ALL_FEATURES = 15,
+    };
+    template<CpuScene::MaterialType Type, uint32_t Features>
+    void ShadeWavefront(Wavefront& wave, const uint64_t* shadingKeys, uint32_t numPaths, const Material& material, const LightSampler::LightSample* lightSamples) const;
+    typedef void (CpuPathTracer::*ShadeKernel)(Wavefront& wave, const uint64_t* shadingKeys, uint32_t numPaths, const Material& material, const LightSampler::LightSample* lightSamples) const;
+    ShadeKernel GetShadeKernel(const Material& material) const;
+
+    bool Intersect(const SceneReplica& replica, const Ray& ray, RayHit& hit) const
+    {
+        return replica.intersector ? replica.intersector->Intersect(ray, hit) : m_lazyIntersector->Intersect(ray, hit);
+    }
+    bool IsOccluded(const SceneReplica& replica, const Ray& ray) const
+    {
+        return replica.intersector ? replica.intersector->IsOccluded(ray) : m_lazyIntersector->IsOccluded(ray);
+    }
+
+    const CpuScene& m_scene;
+    const Settings m_settings;
+    const NumaTopology m_numaTopology;
+    const uint32_t m_numThreads;
+    ThreadPool m_threadPool;
+    // One per NUMA node, or a single one if the renderer is not NUMA aware.
+    std::vector<std::unique_ptr<SceneReplica>> m_replicas;
+    std::unique_ptr<LazySceneIntersector> m_lazyIntersector;
+    // Position of every mesh when sorted by material, wavefront rendering shades hits in this order.
+    std::vector<uint32_t> m_meshShadingRank;
+
+    LightSampler m_lightSampler;
+    HaltonSampler m_haltonSampler;
+
+    Float3 m_cameraPosition;
+    Float3 m_cameraU;
+    Float3 m_cameraV;
+    Float3 m_cameraW;
+    CpuScene::CameraDefinition m_camera;
+
+    uint32_t m_outputWidth;
+    uint32_t m_outputHeight;
+    std::vector<float> m_output;
+
+    uint32_t m_iterationNumber;
+    uint64_t m_numRaysTraced;
+    SchedulingStats m_schedulingStats;
+};
@@ -0,0 +1,564 @@
+#include "CpuPathTracer.h"
+#include "Brdf8.h"
+
+#include <algorithm>
+
+// Wavefront rendering: instead of following one path to its end before starting the next, every thread keeps a wave
+// of paths in flight and runs one stage for all of them before moving on to the next:
+// 1. Generate camera rays for the pixels of one or more tiles.
+// 2. Extend all paths by tracing their next ray.
+// 3. Sort the hits by material and mesh.
+// 4. Shade each run of hits with the same material with a kernel compiled for its type and features, which takes
+//    the light samples and samples the next ray. The kernels have no branches on the material or on settings.
+//    With Settings::wideShading, they evaluate and sample the BRDFs of 8 hits at once.
+// 5. Trace all shadow rays and add the light of those that are unoccluded.
+// Every path consumes the same random numbers and adds up its radiance in the same order as TracePath does,
+// so the images are identical to those of DrawTile. Wide shading only matches it up to rounding, see Brdf8.h.
+
+// A path takes about 230 bytes of state with one light sample per hit. A wave takes half of a 256 KB L2 cache, which leaves
+// room for BVH nodes and triangles. Larger waves were not faster.
+static const uint32_t WaveSize = 512;
+
+struct CpuPathTracer::Wavefront
+{
+    Wavefront()
+        : pixelIndex(WaveSize), iteration(WaveSize), random(WaveSize), origin(WaveSize), direction(WaveSize), throughput(WaveSize)
+        , radiance(WaveSize), pathLength(WaveSize), remainingBounces(WaveSize), hits(WaveSize)
+        , lightThroughput(WaveSize), firstShadowRay(WaveSize), numShadowRays(WaveSize), continues(WaveSize)
+        , numPaths(0)
+    {
+    }
+
+    // Path state by slot, every field in its own array so that each stage only touches what it needs.
+    std::vector<uint32_t> pixelIndex;
+    std::vector<uint32_t> iteration;        // Counted from the first iteration of the DrawIterations call.
+    std::vector<PhiloxStream> random;
+    std::vector<Float3> origin;
+    std::vector<Float3> direction;
+    std::vector<Float3> throughput;
+    std::vector<Float3> radiance;
+    std::vector<float> pathLength;
+    std::vector<uint32_t> remainingBounces;
+    std::vector<RayHit> hits;
+
+    // Written when shading a hit: throughput its light samples are weighted with, its range of shadow rays
+    // and whether the path goes on.
+    std::vector<Float3> lightThroughput;
+    std::vector<uint32_t> firstShadowRay;
+    std::vector<uint32_t> numShadowRays;
+    std::vector<uint8_t> continues;
+
+    uint32_t numPaths;
+    // First slot of each 8x8 pixel block of camera rays, followed by numPaths.
+    std::vector<uint32_t> cameraPackets;
+    // Slots of the paths that still have a ray to trace.
+    std::vector<uint32_t> activePaths;
+    // Hits to shade, with the mesh's shading rank in the upper (only with specialized shading) and the slot in the lower 32 bits.
+    std::vector<uint64_t> shadingKeys;
+    std::vector<uint64_t> sortedShadingKeys;
+
+    // Shadow rays of all hits of the current bounce and the radiance each of them adds if the light is not occluded.
+    std::vector<Ray> shadowRays;
+    std::vector<Float3> shadowRadiance;
+    std::vector<uint8_t> shadowOccluded;
+};
+
+// Stable radix sort by shading rank, with as many passes of 8 bits as the number of meshes needs.
+// Paths are independent of each other, so the slots of a mesh can stay in any order.
+static void SortShadingKeys(std::vector<uint64_t>& keys, std::vector<uint64_t>& scratch, uint32_t numMeshes)
+{
+    scratch.resize(keys.size());
+    for (uint32_t shift = 32; shift < 64 && (numMeshes - 1) >> (shift - 32) != 0; shift += 8)
+    {
+        uint32_t offsets[256] = {};
+        for (uint64_t key : keys)
+            ++offsets[(key >> shift) & 255];
+        uint32_t sum = 0;
+        for (uint32_t& offset : offsets)
+        {
+            const uint32_t count = offset;
+            offset = sum;
+            sum += count;
+        }
+        for (uint64_t key : keys)
+            scratch[offsets[(key >> shift) & 255]++] = key;
+        keys.swap(scratch);
+    }
+}
+
+void CpuPathTracer::DrawWavefront(const SceneReplica& replica, TileScheduler& scheduler, uint32_t workerIndex, uint32_t firstIteration, uint32_t numIterations,
+                                  const LightSampler::LightSample* lightSamples, uint64_t& numRays)
+{
+    static_assert(WaveSize % (PacketSize * PacketSize) == 0, "Waves are filled with whole blocks of camera rays");
+
+    Wavefront wave;
+    std::vector<ShadeKernel> shadeKernels(replica.materials.size());
+    for (size_t i = 0; i < replica.materials.size(); ++i)
+        shadeKernels[i] = GetShadeKernel(replica.materials[i]);
+
+    // Next block of camera rays to generate. Like DrawTile, a thread renders all iterations of a tile in order.
+    TileScheduler::Tile tile;
+    bool hasTile = scheduler.GetNextTile(workerIndex, tile);
+    uint32_t iteration = 0;
+    uint32_t block = 0;
+
+    while (hasTile)
+    {
+        // Generate: camera rays for blocks of pixels until the wave is full, tiles can span several waves.
+        wave.numPaths = 0;
+        wave.cameraPackets.clear();
+        wave.activePaths.clear();
+        while (hasTile && wave.numPaths + PacketSize * PacketSize <= WaveSize)
+        {
+            const uint32_t numBlocksX = (tile.maxX - tile.minX + PacketSize - 1) / PacketSize;
+            const uint32_t numBlocksY = (tile.maxY - tile.minY + PacketSize - 1) / PacketSize;
+            const uint32_t blockMinX = tile.minX + (block % numBlocksX) * PacketSize;
+            const uint32_t blockMinY = tile.minY + (block / numBlocksX) * PacketSize;
+            const uint32_t blockMaxX = std::min<uint32_t>(blockMinX + PacketSize, tile.maxX);
+            const uint32_t blockMaxY = std::min<uint32_t>(blockMinY + PacketSize, tile.maxY);
+            const float jitterX = m_haltonSampler.Sample(firstIteration + iteration, 0);
+            const float jitterY = m_haltonSampler.Sample(firstIteration + iteration, 1);
+
+            wave.cameraPackets.push_back(wave.numPaths);
+            for (uint32_t y = blockMinY; y < blockMaxY; ++y)
+            {
+                for (uint32_t x = blockMinX; x < blockMaxX; ++x)
+                {
+                    const uint32_t slot = wave.numPaths++;
+                    const float screenCoordX = ((x + jitterX) / m_outputWidth) * 2.0f - 1.0f;
+                    const float screenCoordY = ((y + jitterY) / m_outputHeight) * 2.0f - 1.0f;
+                    wave.pixelIndex[slot] = y * m_outputWidth + x;
+                    wave.iteration[slot] = iteration;
+                    wave.random[slot] = PhiloxStream(m_settings.seed, wave.pixelIndex[slot], static_cast<uint64_t>(firstIteration + iteration) * RandomNumbersPerPath);
+                    wave.origin[slot] = m_cameraPosition;
+                    wave.direction[slot] = Normalize(screenCoordX * m_cameraU + screenCoordY * m_cameraV + m_cameraW);
+                    wave.throughput[slot] = Float3(1.0f);
+                    wave.radiance[slot] = Float3(0.0f);
+                    wave.pathLength[slot] = 0.0f;
+                    wave.remainingBounces[slot] = m_settings.numBounces;
+                    if (m_settings.numBounces > 0)
+                        wave.activePaths.push_back(slot);
+                }
+            }
+
+            if (++block == numBlocksX * numBlocksY)
+            {
+                block = 0;
+                if (++iteration == numIterations)
+                {
+                    iteration = 0;
+                    hasTile = scheduler.GetNextTile(workerIndex, tile);
+                }
+            }
+        }
+        wave.cameraPackets.push_back(wave.numPaths);
+
+        for (bool cameraRays = true; !wave.activePaths.empty(); cameraRays = false)
+        {
+            // Extend, paths that miss everything end here.
+            ExtendWavefront(replica, wave, cameraRays, numRays);
+
+            // Sort: emitters and paths that got too long end here, all others are shaded grouped by material and mesh.
+            // Without specialized shading, hits are shaded in the order they were traced in.
+            wave.shadingKeys.clear();
+            for (uint32_t slot : wave.activePaths)
+            {
+                const RayHit& hit = wave.hits[slot];
+                wave.remainingBounces[slot] -= 1;
+                wave.pathLength[slot] += hit.t;
+                if (m_settings.enablePathLengthFilter && wave.pathLength[slot] > m_settings.pathLengthFilterMax)
+                    continue;
+
+                const CpuScene::Mesh& mesh = m_scene.meshes[hit.meshIndex];
+                if (mesh.isEmitter)
+                {
+                    if (wave.remainingBounces[slot] == m_settings.numBounces - 1) // an eye ray
+                        wave.radiance[slot] += mesh.areaLightRadiance;
+                    continue;
+                }
+                if (m_settings.specializedShading)
+                    wave.shadingKeys.push_back(static_cast<uint64_t>(m_meshShadingRank[hit.meshIndex]) << 32 | slot);
+                else
+                    wave.shadingKeys.push_back(slot);
+            }
+            if (m_settings.specializedShading)
+                SortShadingKeys(wave.shadingKeys, wave.sortedShadingKeys, static_cast<uint32_t>(m_scene.meshes.size()));
+
+            // Shade: one kernel call per run of hits with the same material.
+            wave.shadowRays.clear();
+            wave.shadowRadiance.clear();
+            for (size_t first = 0; first < wave.shadingKeys.size();)
+            {
+                const uint32_t materialIndex = m_scene.meshes[wave.hits[static_cast<uint32_t>(wave.shadingKeys[first])].meshIndex].materialIndex;
+                size_t end = first + 1;
+                while (m_settings.specializedShading && end < wave.shadingKeys.size() &&
+                       m_scene.meshes[wave.hits[static_cast<uint32_t>(wave.shadingKeys[end])].meshIndex].materialIndex == materialIndex)
+                    ++end;
+
+                (this->*shadeKernels[materialIndex])(wave, &wave.shadingKeys[first], static_cast<uint32_t>(end - first), replica.materials[materialIndex], lightSamples);
+                first = end;
+            }
+
+            // Shadow rays of all hits at once.
+            numRays += wave.shadowRays.size();
+            wave.shadowOccluded.resize(wave.shadowRays.size());
+            for (size_t i = 0; i < wave.shadowRays.size(); ++i)
+                wave.shadowOccluded[i] = IsOccluded(replica, wave.shadowRays[i]) ? 1 : 0;
+
+            // Light that reached the hits, summed in the same order as in TracePath. Paths that go on are traced next.
+            wave.activePaths.clear();
+            for (uint64_t key : wave.shadingKeys)
+            {
+                const uint32_t slot = static_cast<uint32_t>(key);
+                Float3 lightRadiance(0.0f);
+                for (uint32_t i = wave.firstShadowRay[slot]; i < wave.firstShadowRay[slot] + wave.numShadowRays[slot]; ++i)
+                {
+                    if (!wave.shadowOccluded[i])
+                        lightRadiance += wave.shadowRadiance[i];
+                }
+                wave.radiance[slot] += wave.lightThroughput[slot] * lightRadiance / static_cast<float>(m_settings.numLightSamplesPerHit);
+                if (wave.continues[slot])
+                    wave.activePaths.push_back(slot);
+            }
+        }
+
+        // Paths of a pixel were generated in the order of their iterations, so they are summed up in the same order as in DrawTile.
+        for (uint32_t slot = 0; slot < wave.numPaths; ++slot)
+        {
+            float* output = &m_output[wave.pixelIndex[slot] * 4];
+            output[0] += wave.radiance[slot].x;
+            output[1] += wave.radiance[slot].y;
+            output[2] += wave.radiance[slot].z;
+            output[3] += 1.0f;
+        }
+    }
+}
+
+void CpuPathTracer::ExtendWavefront(const SceneReplica& replica, Wavefront& wave, bool cameraRays, uint64_t& numRays) const
+{
+    numRays += wave.activePaths.size();
+
+    // Camera rays are still in the order they were generated in, each block of them is traced as a packet.
+    if (cameraRays && m_settings.primaryRayPackets && replica.intersector)
+    {
+        wave.activePaths.clear();
+        for (size_t packetIndex = 0; packetIndex + 1 < wave.cameraPackets.size(); ++packetIndex)
+        {
+            const uint32_t firstSlot = wave.cameraPackets[packetIndex];
+            RayPacket packet;
+            packet.origin = m_cameraPosition;
+            packet.tMin = DefaultRayTMin;
+            packet.tMax = DefaultRayTMax;
+            packet.numRays = wave.cameraPackets[packetIndex + 1] - firstSlot;
+            std::copy(&wave.direction[firstSlot], &wave.direction[firstSlot] + packet.numRays, packet.directions);
+            const uint64_t hitMask = replica.intersector->IntersectPacket(packet, &wave.hits[firstSlot]);
+            for (uint32_t rayIndex = 0; rayIndex < packet.numRays; ++rayIndex)
+            {
+                if (hitMask & (1ull << rayIndex))
+                    wave.activePaths.push_back(firstSlot + rayIndex);
+            }
+        }
+        return;
+    }
+
+    size_t numHits = 0;
+    for (uint32_t slot : wave.activePaths)
+    {
+        if (Intersect(replica, { wave.origin[slot], DefaultRayTMin, wave.direction[slot], DefaultRayTMax }, wave.hits[slot]))
+            wave.activePaths[numHits++] = slot;
+    }
+    wave.activePaths.resize(numHits);
+}
+
+CpuPathTracer::ShadeKernel CpuPathTracer::GetShadeKernel(const Material& material) const
+{
+    #define SHADE_KERNELS(Type) { \
+        &CpuPathTracer::ShadeWavefront<Type, 0>, &CpuPathTracer::ShadeWavefront<Type, 1>, &CpuPathTracer::ShadeWavefront<Type, 2>, &CpuPathTracer::ShadeWavefront<Type, 3>, \
+        &CpuPathTracer::ShadeWavefront<Type, 4>, &CpuPathTracer::ShadeWavefront<Type, 5>, &CpuPathTracer::ShadeWavefront<Type, 6>, &CpuPathTracer::ShadeWavefront<Type, 7>, \
+        &CpuPathTracer::ShadeWavefront<Type, 8>, &CpuPathTracer::ShadeWavefront<Type, 9>, &CpuPathTracer::ShadeWavefront<Type, 10>, &CpuPathTracer::ShadeWavefront<Type, 11>, \
+        &CpuPathTracer::ShadeWavefront<Type, 12>, &CpuPathTracer::ShadeWavefront<Type, 13>, &CpuPathTracer::ShadeWavefront<Type, 14>, &CpuPathTracer::ShadeWavefront<Type, 15> }
+    static const ShadeKernel kernels[][SHADE_ALL_FEATURES + 1] =
+    {
+        SHADE_KERNELS(CpuScene::MATERIAL_MATTE),
+        SHADE_KERNELS(CpuScene::MATERIAL_METAL),
+        SHADE_KERNELS(CpuScene::MATERIAL_SUBSTRATE),
+    };
+    #undef SHADE_KERNELS
+
+    uint32_t features = 0;
+    if (material.textured)
+        features |= SHADE_TEXTURED;
+    if (m_settings.enablePathLengthFilter)
+        features |= SHADE_PATH_LENGTH_FILTER;
+    if (m_settings.russianRoulette)
+        features |= SHADE_RUSSIAN_ROULETTE;
+    // Runs are single hits without specialized shading.
+    if (m_settings.wideShading && m_settings.specializedShading)
+        features |= SHADE_WIDE;
+    return kernels[material.type][features];
+}
+
+// Light samples of up to 8 hits whose BRDF is evaluated at once. Until then, shadowRadiance only holds the light's intensity.
+struct LightSampleBatch
+{
+    uint32_t numLanes = 0;
+    uint32_t shadowRay[8];
+    float irradiance[8];        // Times the cosine at the light.
+    float NdotL[8];
+    float NdotV[8];
+    Float3Block8 toLight;
+    Float3Block8 toView;
+    Float3Block8 normal;
+    Float3Block8 diffuse;
+};
+
+// Up to 8 hits whose next ray direction is sampled at once.
+struct BrdfSampleBatch
+{
+    uint32_t numLanes = 0;
+    uint32_t slot[8];
+    Float3 worldPosition[8];
+    Float3x3 tangentToWorld[8];
+    float randomX[8];
+    float randomY[8];
+    Float3Block8 toViewTS;
+    Float3Block8 diffuse;
+};
+
+// Same as the loop body of TracePath after the hit, with all branches on the material type and on settings resolved at compile time.
+// With SHADE_WIDE, light samples and next rays are gathered over the run and their BRDFs evaluated and sampled 8 at a time.
+template<CpuScene::MaterialType Type, uint32_t Features>
+void CpuPathTracer::ShadeWavefront(Wavefront& wave, const uint64_t* shadingKeys, uint32_t numPaths, const Material& material, const LightSampler::LightSample* lightSamples) const
+{
+    LightSampleBatch lightBatch;
+    BrdfSampleBatch sampleBatch;
+
+    // The last batch of a run is filled up with copies of its first lane. Every hit then gets the result of the 8 wide
+    // functions, no matter which run it lands in, and images stay independent of how tiles are spread over the threads.
+    auto evaluateLightBatch = [&]()
+    {
+        LightSampleBatch& batch = lightBatch;
+        if (batch.numLanes == 0)
+            return;
+        for (uint32_t lane = batch.numLanes; lane < 8; ++lane)
+        {
+            batch.NdotL[lane] = batch.NdotL[0];
+            batch.NdotV[lane] = batch.NdotV[0];
+            batch.toLight.Set(lane, batch.toLight.Get(0));
+            batch.toView.Set(lane, batch.toView.Get(0));
+            batch.normal.Set(lane, batch.normal.Get(0));
+            batch.diffuse.Set(lane, batch.diffuse.Get(0));
+        }
+
+        Float3Block8 brdf;
+        if (Type == CpuScene::MATERIAL_SUBSTRATE)
+            EvaluateAshikminShirleyBrdf8(batch.NdotL, batch.toLight, batch.NdotV, batch.toView, batch.normal, material.ks, material.roughnessSq, batch.diffuse, brdf);
+        else
+            EvaluateMicrofacetBrdf8(batch.NdotL, batch.toLight, batch.NdotV, batch.toView, batch.normal, material.eta, material.ks, material.roughnessSq, brdf);
+        for (uint32_t lane = 0; lane < batch.numLanes; ++lane)
+        {
+            Float3& radiance = wave.shadowRadiance[batch.shadowRay[lane]];
+            radiance = batch.irradiance[lane] * brdf.Get(lane) * radiance;
+        }
+        batch.numLanes = 0;
+    };
+
+    // Rest of TracePath's loop body once the next ray direction is known.
+    auto continuePath = [&](uint32_t slot, const Float3& worldPosition, const Float3x3& tangentToWorld, const Float3& nextRayDirTS, Float3 throughput)
+    {
+        if (nextRayDirTS.z <= 0.0f)
+            return;
+
+        if (Features & SHADE_RUSSIAN_ROULETTE)
+        {
+            const float continuationProbability = Saturate(GetLuminance(throughput));
+            if (wave.random[slot].NextFloat() >= continuationProbability)
+                return;
+            throughput /= continuationProbability;
+        }
+
+        wave.throughput[slot] *= throughput;
+        wave.origin[slot] = worldPosition;
+        wave.direction[slot] = tangentToWorld.TransformToWorld(nextRayDirTS);
+        wave.continues[slot] = 1;
+    };
+
+    auto sampleBrdf = [&](const Float3& toViewTS, const Float2& randomSample, const Float3& diffuse, Float3& throughput)
+    {
+        Float3 nextRayDirTS;
+        if (Type == CpuScene::MATERIAL_SUBSTRATE)
+            nextRayDirTS = SampleAshikminShirleySubstrateBrdf(toViewTS, randomSample, material.ks, material.roughnessSq, diffuse, throughput);
+        else if (Type == CpuScene::MATERIAL_METAL)
+        {
+            const Float3 microfacetNormalTS = SampleGGXVisibleNormal(toViewTS, material.roughness, randomSample);
+            nextRayDirTS = Reflect(-toViewTS, microfacetNormalTS);
+            const float NdotL = nextRayDirTS.z;
+            const Float3 F = FresnelDieletricConductorApprox(material.eta, material.ks, NdotL);
+            const float G2_div_G1 = (2.0f * NdotL) / (NdotL + sqrtf(material.roughnessSq + (1.0f - material.roughnessSq) * NdotL * NdotL));
+            throughput = F * G2_div_G1;
+        }
+        else
+        {
+            throughput = diffuse;
+            nextRayDirTS = SampleHemisphereCosine(randomSample);
+        }
+        return nextRayDirTS;
+    };
+
+    auto sampleBrdfBatch = [&]()
+    {
+        BrdfSampleBatch& batch = sampleBatch;
+        if (batch.numLanes == 0)
+            return;
+        for (uint32_t lane = batch.numLanes; lane < 8; ++lane)
+        {
+            batch.randomX[lane] = batch.randomX[0];
+            batch.randomY[lane] = batch.randomY[0];
+            batch.toViewTS.Set(lane, batch.toViewTS.Get(0));
+            batch.diffuse.Set(lane, batch.diffuse.Get(0));
+        }
+
+        Float3Block8 nextRayDirTS;
+        Float3Block8 throughput;
+        if (Type == CpuScene::MATERIAL_SUBSTRATE)
+            SampleAshikminShirleySubstrateBrdf8(batch.toViewTS, batch.randomX, batch.randomY, material.ks, material.roughnessSq, batch.diffuse, nextRayDirTS, throughput);
+        else if (Type == CpuScene::MATERIAL_METAL)
+        {
+            Float3Block8 microfacetNormalTS;
+            SampleGGXVisibleNormal8(batch.toViewTS, material.roughness, batch.randomX, batch.randomY, microfacetNormalTS);
+            float NdotL[8];
+            for (uint32_t lane = 0; lane < 8; ++lane)
+            {
+                nextRayDirTS.Set(lane, Reflect(-batch.toViewTS.Get(lane), microfacetNormalTS.Get(lane)));
+                NdotL[lane] = nextRayDirTS.z[lane];
+            }
+            Float3Block8 F;
+            FresnelDieletricConductorApprox8(material.eta, material.ks, NdotL, F);
+            for (uint32_t lane = 0; lane < 8; ++lane)
+            {
+                const float G2_div_G1 = (2.0f * NdotL[lane]) / (NdotL[lane] + sqrtf(material.roughnessSq + (1.0f - material.roughnessSq) * NdotL[lane] * NdotL[lane]));
+                throughput.Set(lane, F.Get(lane) * G2_div_G1);
+            }
+        }
+        else
+        {
+            throughput = batch.diffuse;
+            SampleHemisphereCosine8(batch.randomX, batch.randomY, nextRayDirTS);
+        }
+        for (uint32_t lane = 0; lane < batch.numLanes; ++lane)
+            continuePath(batch.slot[lane], batch.worldPosition[lane], batch.tangentToWorld[lane], nextRayDirTS.Get(lane), throughput.Get(lane));
+        batch.numLanes = 0;
+    };
+
+    for (uint32_t pathIndex = 0; pathIndex < numPaths; ++pathIndex)
+    {
+        const uint32_t slot = static_cast<uint32_t>(shadingKeys[pathIndex]);
+        const RayHit& hit = wave.hits[slot];
+        PhiloxStream& random = wave.random[slot];
+
+        // GetSurfaceHit
+        const CpuScene::Mesh& mesh = m_scene.meshes[hit.meshIndex];
+        const uint32_t vertexIdx0 = mesh.indices[hit.primitiveIndex * 3 + 0];
+        const uint32_t vertexIdx1 = mesh.indices[hit.primitiveIndex * 3 + 1];
+        const uint32_t vertexIdx2 = mesh.indices[hit.primitiveIndex * 3 + 2];
+        Float3 normal = Normalize(BarycentricLerp(mesh.vertices[vertexIdx0].normal, mesh.vertices[vertexIdx1].normal, mesh.vertices[vertexIdx2].normal, hit.bary));
+        if (!hit.frontFace)
+            normal = -normal;
+
+        const Float3 worldPosition = wave.origin[slot] + hit.t * wave.direction[slot];
+        const Float3x3 tangentToWorld = CreateONB(normal);
+        const Float3 toView = -wave.direction[slot];
+        const Float3 toViewTS = tangentToWorld.TransformToLocal(toView);
+        const float NdotV = toViewTS.z;
+        Float3 diffuse = material.diffuseColor;
+        if (Features & SHADE_TEXTURED)
+        {
+            const Float2 texcoord = BarycentricLerp(mesh.vertices[vertexIdx0].texcoord, mesh.vertices[vertexIdx1].texcoord, mesh.vertices[vertexIdx2].texcoord, hit.bary);
+            diffuse = material.diffuseTexture->Sample(texcoord);
+        }
+
+        // Sample area lights, the shadow rays are traced later for the whole wave.
+        const LightSampler::LightSample* iterationLightSamples = lightSamples + wave.iteration[slot] * m_settings.numLightSamplesAvailable;
+        const float lightSampleOffsetSample = random.NextFloat();
+        const uint32_t randomSampleOffset = static_cast<uint32_t>(lightSampleOffsetSample * (m_settings.numLightSamplesAvailable - m_settings.numLightSamplesPerHit) + 0.5f);
+        wave.firstShadowRay[slot] = static_cast<uint32_t>(wave.shadowRays.size());
+        for (uint32_t i = 0; i < m_settings.numLightSamplesPerHit && !m_scene.areaLights.empty(); ++i)
+        {
+            // SampleAreaLight
+            const LightSampler::LightSample& areaLightSample = iterationLightSamples[randomSampleOffset + i];
+            Float3 toLight = areaLightSample.position - worldPosition;
+            const float lightDistanceSq = Dot(toLight, toLight);
+            const float lightDistance = sqrtf(lightDistanceSq);
+            toLight /= lightDistance;
+
+            const float NdotL = Dot(toLight, normal);
+            const float lightSampleCos = Dot(-toLight, areaLightSample.normal);
+            if (NdotL <= 0.0f || lightSampleCos <= 0.0f)
+                continue;
+            if ((Features & SHADE_PATH_LENGTH_FILTER) && wave.pathLength[slot] + lightDistance > m_settings.pathLengthFilterMax)
+                continue;
+
+            const float irradianceLightSample = NdotL / lightDistanceSq;
+            wave.shadowRays.push_back({ worldPosition, DefaultRayTMin, toLight, lightDistance });
+            if ((Features & SHADE_WIDE) && Type != CpuScene::MATERIAL_MATTE)
+            {
+                const uint32_t lane = lightBatch.numLanes++;
+                lightBatch.shadowRay[lane] = static_cast<uint32_t>(wave.shadowRadiance.size());
+                lightBatch.irradiance[lane] = irradianceLightSample * lightSampleCos;
+                lightBatch.NdotL[lane] = NdotL;
+                lightBatch.NdotV[lane] = NdotV;
+                lightBatch.toLight.Set(lane, toLight);
+                lightBatch.toView.Set(lane, toView);
+                lightBatch.normal.Set(lane, normal);
+                lightBatch.diffuse.Set(lane, diffuse);
+                wave.shadowRadiance.push_back(areaLightSample.intensity);
+                if (lightBatch.numLanes == 8)
+                    evaluateLightBatch();
+                continue;
+            }
+
+            Float3 brdfLightSample;
+            if (Type == CpuScene::MATERIAL_SUBSTRATE)
+                brdfLightSample = EvaluateAshikminShirleyBrdf(NdotL, toLight, NdotV, toView, normal, material.ks, material.roughnessSq, diffuse);
+            else if (Type == CpuScene::MATERIAL_METAL)
+                brdfLightSample = EvaluateMicrofacetBrdf(NdotL, toLight, NdotV, toView, normal, material.eta, material.ks, material.roughnessSq);
+            else
+                brdfLightSample = EvaluateLambertBrdf(diffuse);
+            wave.shadowRadiance.push_back((irradianceLightSample * lightSampleCos) * brdfLightSample * areaLightSample.intensity);
+        }
+        wave.numShadowRays[slot] = static_cast<uint32_t>(wave.shadowRays.size()) - wave.firstShadowRay[slot];
+        wave.lightThroughput[slot] = wave.throughput[slot];
+        wave.continues[slot] = 0;
+
+        // Compute next ray.
+        if (wave.remainingBounces[slot] == 0)
+            continue;
+
+        const Float2 randomSample(random.NextFloat(), random.NextFloat());
+        if (Features & SHADE_WIDE)
+        {
+            const uint32_t lane = sampleBatch.numLanes++;
+            sampleBatch.slot[lane] = slot;
+            sampleBatch.worldPosition[lane] = worldPosition;
+            sampleBatch.tangentToWorld[lane] = tangentToWorld;
+            sampleBatch.randomX[lane] = randomSample.x;
+            sampleBatch.randomY[lane] = randomSample.y;
+            sampleBatch.toViewTS.Set(lane, toViewTS);
+            sampleBatch.diffuse.Set(lane, diffuse);
+            if (sampleBatch.numLanes == 8)
+                sampleBrdfBatch();
+            continue;
+        }
+
+        Float3 throughput;
+        const Float3 nextRayDirTS = sampleBrdf(toViewTS, randomSample, diffuse, throughput);
+        continuePath(slot, worldPosition, tangentToWorld, nextRayDirTS, throughput);
+    }
+
+    // Rest of the run.
+    if (Features & SHADE_WIDE)
+    {
+        evaluateLightBatch();
+        sampleBrdfBatch();
+    }
+}
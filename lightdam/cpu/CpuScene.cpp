@@ -0,0 +1,610 @@
+#include "CpuScene.h"
+#include "PbrtTextParser.h"
+#include "../ErrorHandling.h"
+#include "../MathUtils.h"
+#include "../ThreadPool.h"
+
+#include "../../external/stb/stb_image.h"
+#include "pbrtParser/Scene.h"
+
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+
+static Float3 PbrtVecToFloat3(pbrt::vec3f v)
+{
+    return Float3(v.x, v.y, v.z);
+}
+
+static std::string GetDirectory(const std::string& path)
+{
+    size_t lastSlash = path.find_last_of('/');
+    size_t lastBackSlash = path.find_last_of('\\');
+    size_t lastDelimiter = std::string::npos;
+
+    if (lastSlash != std::string::npos)
+    {
+        if (lastBackSlash == std::string::npos)
+            lastDelimiter = lastSlash;
+        else
+            lastDelimiter = std::max(lastSlash, lastBackSlash);
+    }
+    else if (lastBackSlash != std::string::npos)
+        lastDelimiter = lastBackSlash;
+    else
+        return "";
+
+    return path.substr(0, lastDelimiter);
+}
+
+// Makes camera easier to control. (same as Camera::SnapUpToAxis)
+static Float3 SnapToAxis(Float3 up)
+{
+    if (fabsf(up.x) > fabsf(up.y) && fabsf(up.x) > fabsf(up.z))
+        return Float3(up.x > 0.0f ? 1.0f : -1.0f, 0.0f, 0.0f);
+    else if (fabsf(up.y) > fabsf(up.x) && fabsf(up.y) > fabsf(up.z))
+        return Float3(0.0f, up.y > 0.0f ? 1.0f : -1.0f, 0.0f);
+    else if (fabsf(up.z) > fabsf(up.y) && fabsf(up.z) > fabsf(up.y))
+        return Float3(0.0f, 0.0f, up.z > 0.0f ? 1.0f : -1.0f);
+    return up;
+}
+
+static void GenerateNormalsIfMissing(const pbrt::TriangleMesh::SP& triangleShape)
+{
+    if (!triangleShape->normal.empty())
+        return;
+
+    triangleShape->normal.resize(triangleShape->vertex.size());
+    memset(triangleShape->normal.data(), 0, sizeof(pbrt::vec3f) * triangleShape->normal.size());
+
+    for (auto triangle : triangleShape->index)
+    {
+        auto v1 = triangleShape->vertex[triangle.x];
+        auto v2 = triangleShape->vertex[triangle.y];
+        auto v3 = triangleShape->vertex[triangle.z];
+        auto triangleNormal = pbrt::math::cross(v2 - v1, v3 - v1);
+        triangleShape->normal[triangle.x] = triangleShape->normal[triangle.x] + triangleNormal;
+        triangleShape->normal[triangle.y] = triangleShape->normal[triangle.y] + triangleNormal;
+        triangleShape->normal[triangle.z] = triangleShape->normal[triangle.z] + triangleNormal;
+    }
+    for (auto& normal : triangleShape->normal)
+        normal = pbrt::math::normalize(normal);
+}
+
+// Runs function(i) for all i < count, on the thread pool if there is one.
+static void ParallelForEach(ThreadPool* threadPool, uint32_t count, const char* name, const std::function<void(uint32_t)>& function)
+{
+    auto range = [&function](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; ++i)
+            function(i);
+    };
+    if (threadPool)
+        threadPool->ParallelFor(0, count, 1, range, name);
+    else
+        range(0, count);
+}
+
+static uint32_t LoadPbrtTexture(const std::string& sceneDirectory, const pbrt::Texture::SP& texture, CpuScene& scene)
+{
+    const auto& imageTexture = texture->as<pbrt::ImageTexture>();
+    if (!imageTexture)
+    {
+        LogPrint(LogLevel::Warning, "Texture type '%s' not supported", texture->toString().c_str());
+        return scene.GetTextureIndexForColor(Float3(0.5f, 0.5f, 0.5f));
+    }
+
+    return scene.GetTextureIndexForFile(sceneDirectory + "/" + imageTexture->fileName);
+}
+
+static CpuScene::Material LoadPbrtMaterial(const std::string& sceneDirectory, const pbrt::Material::SP& material, CpuScene& scene)
+{
+    CpuScene::Material output = {};
+
+    if (const auto matteMaterial = material->as<pbrt::MatteMaterial>())
+    {
+        output.type = CpuScene::MATERIAL_MATTE;
+        if (matteMaterial->map_kd)
+            output.diffuseTextureIndex = LoadPbrtTexture(sceneDirectory, matteMaterial->map_kd, scene);
+        else
+            output.diffuseTextureIndex = scene.GetTextureIndexForColor(PbrtVecToFloat3(matteMaterial->kd));
+
+        if (matteMaterial->sigma != 0.0f || matteMaterial->map_sigma)
+            LogPrint(LogLevel::Warning, "Sigma parameter in matte material '%s' not supported", matteMaterial->name.c_str());
+    }
+    else if (const auto substrateMaterial = material->as<pbrt::SubstrateMaterial>())
+    {
+        if (substrateMaterial->map_kd)
+            output.diffuseTextureIndex = LoadPbrtTexture(sceneDirectory, substrateMaterial->map_kd, scene);
+        else
+            output.diffuseTextureIndex = scene.GetTextureIndexForColor(PbrtVecToFloat3(substrateMaterial->kd));
+
+        output.type = CpuScene::MATERIAL_SUBSTRATE;
+        output.eta = Float3(0, 0, 0); // Dielectric!
+        output.ks = PbrtVecToFloat3(substrateMaterial->ks);
+        output.roughness = substrateMaterial->uRoughness;
+
+        if (substrateMaterial->map_ks)
+            LogPrint(LogLevel::Warning, "Map KS parameter in substrate material '%s' not supported", substrateMaterial->name.c_str());
+        if (substrateMaterial->map_bump)
+            LogPrint(LogLevel::Warning, "Bump parameter in substrate material '%s' not supported", substrateMaterial->name.c_str());
+        if (substrateMaterial->uRoughness != substrateMaterial->vRoughness)
+            LogPrint(LogLevel::Warning, "Non uniform roughness in substrate material '%s' not supported", substrateMaterial->name.c_str());
+    }
+    else if (const auto metalMaterial = material->as<pbrt::MetalMaterial>())
+    {
+        output.type = CpuScene::MATERIAL_METAL;
+        output.eta = PbrtVecToFloat3(metalMaterial->eta);
+        output.ks = PbrtVecToFloat3(metalMaterial->k);
+        output.roughness = metalMaterial->roughness;
+
+        if (metalMaterial->map_roughness)
+            LogPrint(LogLevel::Warning, "Map roughness parameter in metal material '%s' not supported", metalMaterial->name.c_str());
+        if (metalMaterial->map_uRoughness)
+            LogPrint(LogLevel::Warning, "Map uroughness parameter in metal material '%s' not supported", metalMaterial->name.c_str());
+        if (metalMaterial->map_vRoughness)
+            LogPrint(LogLevel::Warning, "Map vroughness parameter in metal material '%s' not supported", metalMaterial->name.c_str());
+        if (metalMaterial->uRoughness != metalMaterial->vRoughness)
+            LogPrint(LogLevel::Warning, "Non uniform roughness in metal material '%s' not supported", metalMaterial->name.c_str());
+        if (metalMaterial->remapRoughness)
+            LogPrint(LogLevel::Warning, "remapRoughness in metal material '%s' not supported", metalMaterial->name.c_str());
+        if (metalMaterial->map_bump)
+            LogPrint(LogLevel::Warning, "map_bump in metal material '%s' not supported", metalMaterial->name.c_str());
+        if (!metalMaterial->spectrum_eta.spd.empty() || !metalMaterial->spectrum_k.spd.empty())
+            LogPrint(LogLevel::Warning, "Spectrum for eta/k in metal material '%s' not supported", metalMaterial->name.c_str());
+    }
+
+    else
+    {
+        output.type = CpuScene::MATERIAL_MATTE;
+        output.diffuseTextureIndex = scene.GetTextureIndexForColor(Float3(0.5f, 0.5f, 0.5f));
+        LogPrint(LogLevel::Warning, "Material type of material '%s' not supported", material->name.c_str());
+    }
+
+    return output;
+}
+
+static pbrt::DiffuseAreaLightRGB::SP GetAreaLight(const pbrt::TriangleMesh::SP& triangleShape)
+{
+    return triangleShape->areaLight ? triangleShape->areaLight->as<pbrt::DiffuseAreaLightRGB>() : nullptr;
+}
+
+// Converts a shape to world space and writes it into the arrays of a mesh, starting at firstVertex and firstIndex.
+// Normals need to exist on the shape already.
+static void WritePbrtMesh(const pbrt::TriangleMesh::SP& triangleShape, const pbrt::Instance::SP& instance, CpuScene::Mesh& mesh, size_t firstVertex, size_t firstIndex)
+{
+    // Positions
+    for (size_t vertexIdx = 0; vertexIdx < triangleShape->vertex.size(); ++vertexIdx)
+        mesh.positions[firstVertex + vertexIdx] = PbrtVecToFloat3(instance->xfm * triangleShape->vertex[vertexIdx]);
+
+    // Vertices.
+    auto normalTransformation = pbrt::math::inverse_transpose(instance->xfm.l);
+    const bool hasTexcoords = triangleShape->texcoord.size() == triangleShape->vertex.size();
+    for (size_t vertexIdx = 0; vertexIdx < triangleShape->vertex.size(); ++vertexIdx)
+    {
+        auto normal = triangleShape->normal[vertexIdx];
+        if (triangleShape->reverseOrientation)
+            normal = -normal;
+        CpuScene::Vertex& vertex = mesh.vertices[firstVertex + vertexIdx];
+        vertex.normal = PbrtVecToFloat3(normalTransformation * normal);
+        vertex.texcoord = hasTexcoords ? Float2(triangleShape->texcoord[vertexIdx].x, -triangleShape->texcoord[vertexIdx].y) : Float2(0, 0);
+    }
+
+    // Indices
+    const uint32_t* indices = reinterpret_cast<const uint32_t*>(triangleShape->index.data());
+    const uint32_t baseVertex = static_cast<uint32_t>(firstVertex);
+    for (size_t i = 0; i < triangleShape->index.size() * 3; ++i)
+        mesh.indices[firstIndex + i] = indices[i] + baseVertex;
+}
+
+// What decides whether meshes can be merged.
+struct MeshMergeInfo
+{
+    uint32_t numVertices;
+    uint32_t numTriangles;
+    uint32_t materialIndex;
+    bool isEmitter;
+    Float3 areaLightRadiance;
+};
+
+// Splits meshes into groups that become one mesh each. Meshes with at least smallMeshTriangles triangles stay on their own,
+// all others are grouped by material and light. Groups are in the order of their first mesh, meshes within them in their original order.
+static std::vector<std::vector<uint32_t>> GroupMeshesForMerging(const std::vector<MeshMergeInfo>& meshes, uint32_t smallMeshTriangles)
+{
+    // Keeps merged meshes at a size where vertex indices and buffer sizes are no concern.
+    const uint32_t maxMergedVertices = 1u << 24;
+
+    std::vector<std::vector<uint32_t>> groups;
+    std::vector<uint32_t> groupNumVertices;
+    std::map<std::tuple<uint32_t, bool, float, float, float>, uint32_t> openGroups;
+    for (uint32_t meshIdx = 0; meshIdx < (uint32_t)meshes.size(); ++meshIdx)
+    {
+        const MeshMergeInfo& mesh = meshes[meshIdx];
+        if (mesh.numTriangles >= smallMeshTriangles)
+        {
+            groups.push_back({ meshIdx });
+            groupNumVertices.push_back(mesh.numVertices);
+            continue;
+        }
+
+        const auto key = std::make_tuple(mesh.materialIndex, mesh.isEmitter, mesh.areaLightRadiance.x, mesh.areaLightRadiance.y, mesh.areaLightRadiance.z);
+        auto openGroupIt = openGroups.find(key);
+        if (openGroupIt == openGroups.end() || groupNumVertices[openGroupIt->second] + mesh.numVertices > maxMergedVertices)
+        {
+            groups.emplace_back();
+            groupNumVertices.push_back(0);
+            openGroupIt = openGroups.insert(std::make_pair(key, (uint32_t)groups.size() - 1)).first;
+        }
+        groups[openGroupIt->second].push_back(meshIdx);
+        groupNumVertices[openGroupIt->second] += mesh.numVertices;
+    }
+    return groups;
+}
+
+std::unique_ptr<CpuScene> CpuScene::LoadPbrtScene(const std::string& pbrtFilePath, ThreadPool* threadPool, const ImportSettings& settings)
+{
+    pbrt::Scene::SP pbrtScene;
+
+    std::string pbfFilePath = pbrtFilePath.substr(0, pbrtFilePath.find_last_of('.')) + ".pbf";
+    bool pbfFileExists = std::ifstream(pbfFilePath.c_str()).good();
+
+    if (pbfFileExists)
+    {
+        try
+        {
+            pbrtScene = pbrt::Scene::loadFrom(pbfFilePath);
+        }
+        catch (std::exception& exception)
+        {
+            LogPrint(LogLevel::Failure, "Failed to load scene from pbf: %s", exception.what());
+        }
+        LogPrint(LogLevel::Success, "Successfully imported pbrt scene from pbf (%s)", pbrtFilePath.c_str());
+    }
+    else
+    {
+        try
+        {
+            if (settings.fastTextParser)
+                pbrtScene = ParsePbrtTextScene(pbrtFilePath, threadPool);
+            if (!pbrtScene)
+                pbrtScene = pbrt::importPBRT(pbrtFilePath);
+        }
+        catch (std::exception& exception)
+        {
+            LogPrint(LogLevel::Failure, "Failed to load scene from pbrt: %s", exception.what());
+        }
+        LogPrint(LogLevel::Success, "Successfully imported pbrt scene from pbrt (%s)", pbrtFilePath.c_str());
+    }
+
+    if (!pbrtScene)
+        return nullptr;
+    LogPrint(LogLevel::Info, "Flattening scene...");
+    pbrtScene->makeSingleLevel();
+
+    auto scene = std::unique_ptr<CpuScene>(new CpuScene());
+    scene->arena.reset(new MemoryArena(settings.hugePages));
+
+    LogPrint(LogLevel::Info, "Importing...");
+
+    scene->originFilePath = pbrtFilePath;
+    if (pbrtScene->film)
+    {
+        scene->screenHeight = (uint32_t)pbrtScene->film->resolution.y;
+        scene->screenWidth = (uint32_t)pbrtScene->film->resolution.x;
+    }
+
+    for (const auto& pbrtCamera : pbrtScene->cameras)
+    {
+        CameraDefinition camera;
+        camera.position = PbrtVecToFloat3(pbrtCamera->frame.p);
+        camera.up = SnapToAxis(Normalize(PbrtVecToFloat3(pbrtCamera->frame.l.vy)));
+        camera.direction = Normalize(PbrtVecToFloat3(pbrtCamera->frame.l.vz));
+        camera.fovRad = pbrtCamera->fov * (PI / 180.0f);
+        scene->cameras.push_back(camera);
+    }
+
+    std::string sceneDirectory = GetDirectory(pbrtFilePath);
+
+    std::unordered_map<pbrt::Material*, uint32_t> loadedMaterials;
+
+    // Materials and texture names are gathered first, meshes are converted afterwards all at once.
+    struct ShapeInstance
+    {
+        pbrt::TriangleMesh::SP shape;
+        pbrt::Instance::SP instance;
+        uint32_t materialIndex;
+    };
+    std::vector<ShapeInstance> shapeInstances;
+    for (const pbrt::Instance::SP& instance : pbrtScene->world->instances)
+    {
+        for (const pbrt::Shape::SP& shape : instance->object->shapes)
+        {
+            const auto triangleShape = shape->as<pbrt::TriangleMesh>();
+            if (!triangleShape)
+            {
+                LogPrint(LogLevel::Warning, "Unsupported shape type %s", shape->toString().c_str());
+                continue;
+            }
+
+            auto preloadedMaterialIt = loadedMaterials.find(shape->material.get());
+            if (preloadedMaterialIt == loadedMaterials.end())
+            {
+                scene->materials.push_back(LoadPbrtMaterial(sceneDirectory, shape->material, *scene));
+                preloadedMaterialIt = loadedMaterials.insert(std::make_pair(shape->material.get(), (uint32_t)scene->materials.size() - 1)).first;
+            }
+            shapeInstances.push_back({ triangleShape, instance, preloadedMaterialIt->second });
+        }
+        for (const pbrt::LightSource::SP& lightSource : instance->object->lightSources)
+        {
+            // todo.
+        }
+    }
+
+    // Textures are decoded while meshes are converted.
+    std::unique_ptr<ThreadPool::TaskGroup> textureTasks(threadPool ? new ThreadPool::TaskGroup(*threadPool) : nullptr);
+    if (textureTasks)
+        textureTasks->Run([&scene, threadPool]() { scene->DecodeTextures(threadPool); }, "DecodeTextures");
+    else
+        scene->DecodeTextures();
+
+    // Generate normals on the shapes, so we can use the binary format of the pbrt library next time.
+    // Shapes may be used by several instances, but need to be changed only once.
+    std::vector<pbrt::TriangleMesh::SP> uniqueShapes;
+    std::unordered_set<pbrt::TriangleMesh*> visitedShapes;
+    for (const ShapeInstance& shapeInstance : shapeInstances)
+    {
+        if (visitedShapes.insert(shapeInstance.shape.get()).second)
+            uniqueShapes.push_back(shapeInstance.shape);
+    }
+    ParallelForEach(threadPool, (uint32_t)uniqueShapes.size(), "GenerateNormals", [&](uint32_t shapeIdx) { GenerateNormalsIfMissing(uniqueShapes[shapeIdx]); });
+
+    // Small shapes are written right into the mesh they are merged into.
+    std::vector<MeshMergeInfo> mergeInfos;
+    mergeInfos.reserve(shapeInstances.size());
+    for (const ShapeInstance& shapeInstance : shapeInstances)
+    {
+        pbrt::DiffuseAreaLightRGB::SP areaLight = GetAreaLight(shapeInstance.shape);
+        mergeInfos.push_back({ (uint32_t)shapeInstance.shape->vertex.size(), (uint32_t)shapeInstance.shape->index.size(), shapeInstance.materialIndex,
+                               areaLight != nullptr, areaLight ? PbrtVecToFloat3(areaLight->L) : Float3(0.0f) });
+    }
+    const std::vector<std::vector<uint32_t>> meshGroups = GroupMeshesForMerging(mergeInfos, settings.smallMeshTriangles);
+    if (meshGroups.size() < shapeInstances.size())
+    {
+        uint32_t numMergedShapes = 0, numMergedMeshes = 0;
+        for (const std::vector<uint32_t>& group : meshGroups)
+        {
+            if (group.size() > 1)
+            {
+                numMergedShapes += (uint32_t)group.size();
+                ++numMergedMeshes;
+            }
+        }
+        LogPrint(LogLevel::Info, "Merged %u small shapes into %u meshes, %u meshes in total", numMergedShapes, numMergedMeshes, (unsigned int)meshGroups.size());
+    }
+
+    // Shapes that are not saved to a pbf file anymore are freed once the last of their instances is converted,
+    // so that the pbrt scene and ours are never both in memory as a whole.
+    std::unordered_map<pbrt::TriangleMesh*, std::atomic<uint32_t>> numUnconvertedInstances;
+    for (const ShapeInstance& shapeInstance : shapeInstances)
+        ++numUnconvertedInstances[shapeInstance.shape.get()];
+
+    scene->meshes.resize(meshGroups.size());
+    ParallelForEach(threadPool, (uint32_t)meshGroups.size(), "LoadMesh", [&](uint32_t meshIdx)
+    {
+        const std::vector<uint32_t>& group = meshGroups[meshIdx];
+        size_t numVertices = 0;
+        size_t numIndices = 0;
+        for (uint32_t shapeInstanceIdx : group)
+        {
+            numVertices += mergeInfos[shapeInstanceIdx].numVertices;
+            numIndices += mergeInfos[shapeInstanceIdx].numTriangles * 3;
+        }
+
+        // Arrays are allocated from the arena and written only once.
+        const MeshMergeInfo& mergeInfo = mergeInfos[group[0]];
+        Mesh mesh(scene->arena.get());
+        mesh.name = shapeInstances[group[0]].instance->object->name;
+        if (group.size() > 1)
+            mesh.name += " (" + std::to_string(group.size()) + " merged)";
+        mesh.positions.resize(numVertices);
+        mesh.vertices.resize(numVertices);
+        mesh.indices.resize(numIndices);
+        mesh.materialIndex = mergeInfo.materialIndex;
+        mesh.isEmitter = mergeInfo.isEmitter;
+        mesh.areaLightRadiance = mergeInfo.areaLightRadiance;
+
+        size_t firstVertex = 0;
+        size_t firstIndex = 0;
+        for (uint32_t shapeInstanceIdx : group)
+        {
+            const pbrt::TriangleMesh::SP& shape = shapeInstances[shapeInstanceIdx].shape;
+            WritePbrtMesh(shape, shapeInstances[shapeInstanceIdx].instance, mesh, firstVertex, firstIndex);
+            firstVertex += mergeInfos[shapeInstanceIdx].numVertices;
+            firstIndex += mergeInfos[shapeInstanceIdx].numTriangles * 3;
+            if (pbfFileExists && --numUnconvertedInstances.find(shape.get())->second == 0)
+            {
+                std::vector<pbrt::vec3f>().swap(shape->vertex);
+                std::vector<pbrt::vec3f>().swap(shape->normal);
+                std::vector<pbrt::vec2f>().swap(shape->texcoord);
+                std::vector<pbrt::vec3i>().swap(shape->index);
+            }
+        }
+        scene->meshes[meshIdx] = std::move(mesh);
+    });
+    for (const Mesh& mesh : scene->meshes)
+    {
+        if (mesh.isEmitter)
+            scene->AddAreaLights(mesh);
+    }
+    textureTasks.reset();
+
+    if (!pbfFileExists)
+    {
+        LogPrint(LogLevel::Info, "Saving pbf file...");
+        pbrtScene->saveTo(pbfFilePath);
+    }
+
+    return scene;
+}
+
+std::unique_ptr<CpuScene> CpuScene::LoadPbrtScene(const std::string& pbrtFilePath, ThreadPool* threadPool)
+{
+    return LoadPbrtScene(pbrtFilePath, threadPool, ImportSettings());
+}
+
+void CpuScene::CameraDefinition::ComputeCameraParams(float aspectRatio, Float3& cameraU, Float3& cameraV, Float3& cameraW) const
+{
+    cameraW = direction;
+    cameraU = Normalize(Cross(cameraW, up));
+    cameraV = Normalize(Cross(cameraW, cameraU));
+
+    float f = tanf(fovRad * 0.5f);
+    cameraU *= f;
+    cameraV *= f;
+
+    if (aspectRatio > 1.0f)
+        cameraU *= aspectRatio;
+    else
+        cameraV /= aspectRatio;
+}
+
+uint32_t CpuScene::GetTextureIndexForColor(Float3 color)
+{
+    std::string textureIdentifier = std::to_string(color.x) + std::to_string(color.y) + std::to_string(color.z);
+    auto identifierIt = m_textureIdentifierToTextureIndex.find(textureIdentifier);
+    if (identifierIt != m_textureIdentifierToTextureIndex.end())
+        return identifierIt->second;
+
+    Texture texture;
+    texture.identifier = textureIdentifier;
+    texture.color = color;
+
+    m_textureIdentifierToTextureIndex.insert(std::make_pair(textureIdentifier, (uint32_t)textures.size()));
+    textures.push_back(std::move(texture));
+    return (uint32_t)textures.size() - 1;
+}
+
+uint32_t CpuScene::GetTextureIndexForFile(const std::string& filename)
+{
+    auto identifierIt = m_textureIdentifierToTextureIndex.find(filename);
+    if (identifierIt != m_textureIdentifierToTextureIndex.end())
+        return identifierIt->second;
+
+    Texture texture;
+    texture.identifier = filename;
+    m_texturesToDecode.push_back((uint32_t)textures.size());
+    m_textureIdentifierToTextureIndex.insert(std::make_pair(filename, (uint32_t)textures.size()));
+    textures.push_back(std::move(texture));
+    return (uint32_t)textures.size() - 1;
+}
+
+void CpuScene::DecodeTextures(ThreadPool* threadPool)
+{
+    // todo: Use stbi_is_hdr to detect hdr formats.
+    // todo: Support single channel. (a bit tricky because then we no longer force to 4 channels meaning we need to expand whenever we encounter 3)
+    std::vector<const char*> failureReasons(m_texturesToDecode.size(), nullptr);
+    ParallelForEach(threadPool, (uint32_t)m_texturesToDecode.size(), "DecodeTexture", [&](uint32_t i)
+    {
+        Texture& texture = textures[m_texturesToDecode[i]];
+        int textureWidth, textureHeight, numComp;
+        stbi_uc* loadedImage = stbi_load(texture.identifier.c_str(), &textureWidth, &textureHeight, &numComp, 4);
+        if (loadedImage)
+        {
+            texture.width = (uint32_t)textureWidth;
+            texture.height = (uint32_t)textureHeight;
+            texture.srgbTexels = Array<uint8_t>(arena.get());
+            texture.srgbTexels.assign(loadedImage, loadedImage + (size_t)4 * textureWidth * textureHeight);
+            stbi_image_free(loadedImage);
+        }
+        else
+        {
+            failureReasons[i] = stbi_failure_reason();
+            texture.color = Float3(1.0f, 0.0f, 1.0f);
+        }
+    });
+
+    for (size_t i = 0; i < m_texturesToDecode.size(); ++i)
+    {
+        if (failureReasons[i])
+            LogPrint(LogLevel::Failure, "Failed to load image from \"%s\": %s", textures[m_texturesToDecode[i]].identifier.c_str(), failureReasons[i]);
+    }
+    m_texturesToDecode.clear();
+}
+
+void CpuScene::MergeSmallMeshes(uint32_t smallMeshTriangles)
+{
+    std::vector<MeshMergeInfo> mergeInfos;
+    mergeInfos.reserve(meshes.size());
+    for (const Mesh& mesh : meshes)
+        mergeInfos.push_back({ (uint32_t)mesh.positions.size(), (uint32_t)(mesh.indices.size() / 3), mesh.materialIndex, mesh.isEmitter, mesh.areaLightRadiance });
+    const std::vector<std::vector<uint32_t>> meshGroups = GroupMeshesForMerging(mergeInfos, smallMeshTriangles);
+
+    std::vector<Mesh> mergedMeshes;
+    mergedMeshes.reserve(meshGroups.size());
+    for (const std::vector<uint32_t>& group : meshGroups)
+    {
+        if (group.size() == 1)
+        {
+            mergedMeshes.push_back(std::move(meshes[group[0]]));
+            continue;
+        }
+
+        size_t numVertices = 0;
+        size_t numIndices = 0;
+        for (uint32_t meshIdx : group)
+        {
+            numVertices += meshes[meshIdx].positions.size();
+            numIndices += meshes[meshIdx].indices.size();
+        }
+
+        const Mesh& firstMesh = meshes[group[0]];
+        Mesh mergedMesh(arena.get());
+        mergedMesh.name = firstMesh.name + " (" + std::to_string(group.size()) + " merged)";
+        mergedMesh.positions.reserve(numVertices);
+        mergedMesh.vertices.reserve(numVertices);
+        mergedMesh.indices.reserve(numIndices);
+        mergedMesh.materialIndex = firstMesh.materialIndex;
+        mergedMesh.isEmitter = firstMesh.isEmitter;
+        mergedMesh.areaLightRadiance = firstMesh.areaLightRadiance;
+        for (uint32_t meshIdx : group)
+        {
+            const Mesh& mesh = meshes[meshIdx];
+            const uint32_t baseVertex = (uint32_t)mergedMesh.positions.size();
+            mergedMesh.positions.insert(mergedMesh.positions.end(), mesh.positions.begin(), mesh.positions.end());
+            mergedMesh.vertices.insert(mergedMesh.vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+            for (uint32_t index : mesh.indices)
+                mergedMesh.indices.push_back(index + baseVertex);
+        }
+        mergedMeshes.push_back(std::move(mergedMesh));
+    }
+    meshes = std::move(mergedMeshes);
+
+    areaLights.clear();
+    for (const Mesh& mesh : meshes)
+    {
+        if (mesh.isEmitter)
+            AddAreaLights(mesh);
+    }
+}
+
+void CpuScene::AddAreaLights(const Mesh& mesh)
+{
+    const size_t numTriangles = mesh.indices.size() / 3;
+    for (size_t triangleIdx = 0; triangleIdx < numTriangles; ++triangleIdx)
+    {
+        AreaLightTriangle areaLightTriangle;
+        for (int i = 0; i < 3; ++i)
+        {
+            areaLightTriangle.positions[i] = mesh.positions[mesh.indices[triangleIdx * 3 + i]];
+            areaLightTriangle.normals[i] = mesh.vertices[mesh.indices[triangleIdx * 3 + i]].normal;
+        }
+        areaLightTriangle.area = Length(Cross(areaLightTriangle.positions[1] - areaLightTriangle.positions[0], areaLightTriangle.positions[2] - areaLightTriangle.positions[0])) * 0.5f;
+        areaLightTriangle.emittedRadiance = mesh.areaLightRadiance;
+        areaLights.push_back(areaLightTriangle);
+    }
+}
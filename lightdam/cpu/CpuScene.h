@@ -0,0 +1,141 @@
+#pragma once
+
+#include "CpuMath.h"
+#include "../MemoryArena.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class ThreadPool;
+
+// Scene data in plain CPU memory without any graphics API dependency.
+// Scene uploads it to the GPU, the CPU path tracer renders it directly.
+class CpuScene
+{
+public:
+    struct ImportSettings
+    {
+        // Backing of the arena all mesh and texture arrays are allocated from.
+        MemoryArena::HugePages hugePages = MemoryArena::HugePages::Transparent;
+        // Meshes with fewer triangles are merged with other small meshes of the same material and light, 0 keeps all meshes.
+        // Every mesh costs buffers, descriptors and shader binding table records on the GPU,
+        // about 1024 helps scenes made of many small meshes.
+        uint32_t smallMeshTriangles = 0;
+        // Text files are read with ParsePbrtTextScene, pbrt-parser is only used for what it does not support.
+        bool fastTextParser = true;
+    };
+
+    // Loads from a PBRT file.
+    // Converts to binary format on successful load which will be used automatically if already existing.
+    // Meshes are converted and textures decoded on the thread pool if there is one.
+    static std::unique_ptr<CpuScene> LoadPbrtScene(const std::string& pbrtFilePath, ThreadPool* threadPool, const ImportSettings& settings);
+    static std::unique_ptr<CpuScene> LoadPbrtScene(const std::string& pbrtFilePath, ThreadPool* threadPool = nullptr);
+
+    // Array in the scene's arena, or on the heap for scenes without one.
+    template<typename T>
+    using Array = std::vector<T, ArenaAllocator<T>>;
+
+    enum MaterialType
+    {
+        MATERIAL_MATTE = 0,
+        MATERIAL_METAL = 1,
+        MATERIAL_SUBSTRATE = 2,
+    };
+
+    struct Material
+    {
+        MaterialType type;
+        uint32_t diffuseTextureIndex;
+        Float3 eta;
+        Float3 ks;
+        float roughness;
+    };
+
+    // Vertex format used by all meshes. (GPU layout)
+    struct Vertex
+    {
+        // Positions are stored separately since the accelleration datastructure only needs those.
+        Float3 normal;
+        Float2 texcoord;
+    };
+
+    // Triangle mesh in world space.
+    struct Mesh
+    {
+        explicit Mesh(MemoryArena* arena = nullptr) : positions(arena), vertices(arena), indices(arena) {}
+
+        std::string name;
+        Array<Float3> positions;
+        Array<Vertex> vertices;
+        Array<uint32_t> indices;
+
+        uint32_t materialIndex;
+        bool isEmitter;
+        Float3 areaLightRadiance;
+    };
+
+    // Either an image loaded from file or a single color.
+    struct Texture
+    {
+        std::string identifier;
+        uint32_t width = 1;
+        uint32_t height = 1;
+        Array<uint8_t> srgbTexels;        // RGBA8, empty for single color textures.
+        Float3 color = Float3(0.0f);      // Linear color if srgbTexels is empty.
+    };
+
+    // Info struct on an area light.
+    struct AreaLightTriangle
+    {
+        Float3 positions[3];
+        Float3 normals[3];
+        Float3 emittedRadiance; // The amount of emitted radiance at each point and emitted direction.
+        float area;
+    };
+
+    struct CameraDefinition
+    {
+        Float3 position;
+        Float3 direction;   // Normalized
+        Float3 up;          // Normalized, snapped to the closest axis.
+        float fovRad;       // Spread angle of the viewing frustum along the narrower of the image's width and height.
+
+        // Same as Camera::ComputeCameraParams.
+        void ComputeCameraParams(float aspectRatio, Float3& cameraU, Float3& cameraV, Float3& cameraW) const;
+    };
+
+    // Backs the arrays of meshes and textures loaded from file, null for scenes that were put together in code.
+    // Comes first, so that it outlives them. Copies of the scene share it, but have their arrays on the heap.
+    std::shared_ptr<MemoryArena> arena;
+
+    std::vector<Mesh> meshes;
+    std::vector<Material> materials;
+    std::vector<Texture> textures;
+    std::vector<AreaLightTriangle> areaLights;
+    std::vector<CameraDefinition> cameras;
+    // Resolution setting defined by the scene. 0 if no resolution was defined.
+    uint32_t screenWidth = 0;
+    uint32_t screenHeight = 0;
+
+    // Where the scene originated from.
+    std::string originFilePath;
+
+    // Textures are shared by identifier (file path or color).
+    uint32_t GetTextureIndexForColor(Float3 color);
+    // Images are only decoded by DecodeTextures.
+    uint32_t GetTextureIndexForFile(const std::string& filename);
+    void DecodeTextures(ThreadPool* threadPool = nullptr);
+
+    // Adds area light triangles for every triangle of an emitting mesh.
+    void AddAreaLights(const Mesh& mesh);
+
+    // Same merging as ImportSettings::smallMeshTriangles for scenes that are already in memory, rebuilds the area lights.
+    // The arrays of merged meshes stay in the arena until it is freed, the importer merges while converting instead.
+    void MergeSmallMeshes(uint32_t smallMeshTriangles);
+
+private:
+    std::unordered_map<std::string, uint32_t> m_textureIdentifierToTextureIndex;
+    std::vector<uint32_t> m_texturesToDecode;
+};
@@ -0,0 +1,172 @@
+#include "InstancedSceneIntersector.h"
+#include "../ThreadPool.h"
+#include <cassert>
+
+// World space bounds of an object space box. Padded a little, because rays are transformed into object space with
+// rounding errors of their own and must not find triangles outside of the box they entered.
+static Aabb TransformBounds(const Float3x4& transform, const Aabb& bounds)
+{
+    // Instances of empty objects are a point, so that the builders don't have to deal with empty boxes.
+    if (bounds.min.x > bounds.max.x)
+    {
+        const Float3 translation(transform.m[0][3], transform.m[1][3], transform.m[2][3]);
+        return Aabb(translation, translation);
+    }
+
+    // Extent of the rotated box along each world axis (Arvo 1990).
+    const Float3 center = transform.TransformPoint(bounds.GetCenter());
+    const Float3 halfExtent = bounds.GetExtent() * 0.5f;
+    Float3 worldHalfExtent;
+    for (int row = 0; row < 3; ++row)
+        worldHalfExtent[row] = fabsf(transform.m[row][0]) * halfExtent.x + fabsf(transform.m[row][1]) * halfExtent.y + fabsf(transform.m[row][2]) * halfExtent.z;
+    const Float3 padding = (Float3(fabsf(center.x), fabsf(center.y), fabsf(center.z)) + worldHalfExtent) * 1e-6f;
+    return Aabb(center - worldHalfExtent - padding, center + worldHalfExtent + padding);
+}
+
+InstancedSceneIntersector::InstancedSceneIntersector(std::vector<SceneIntersectorInstance> instances, ThreadPool* threadPool, BvhBuilder builder)
+    : m_instances(std::move(instances))
+    , m_worldToObject(m_instances.size())
+    , m_instanceBounds(m_instances.size())
+    , m_threadPool(threadPool)
+    , m_builder(builder)
+{
+    UpdateInstanceData();
+    BuildTopLevel();
+}
+
+void InstancedSceneIntersector::Update(const std::vector<Float3x4>& transforms, bool refit)
+{
+    assert(transforms.size() == m_instances.size());
+    for (size_t i = 0; i < m_instances.size(); ++i)
+        m_instances[i].transform = transforms[i];
+    UpdateInstanceData();
+    if (refit)
+        m_bvh.Refit(m_instanceBounds);
+    else
+        BuildTopLevel();
+}
+
+void InstancedSceneIntersector::UpdateInstanceData()
+{
+    auto update = [this](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            m_worldToObject[i] = Inverse(m_instances[i].transform);
+            m_instanceBounds[i] = TransformBounds(m_instances[i].transform, m_instances[i].object->GetBounds());
+        }
+    };
+    const uint32_t numInstances = static_cast<uint32_t>(m_instances.size());
+    if (m_threadPool)
+        m_threadPool->ParallelFor(0, numInstances, 4096, update);
+    else
+        update(0, numInstances);
+}
+
+void InstancedSceneIntersector::BuildTopLevel()
+{
+    if (m_builder != BvhBuilder::BinnedSah && m_builder != BvhBuilder::SpatialSplits)
+    {
+        m_bvh = Bvh::Build(m_builder, m_instanceBounds, m_threadPool);
+        return;
+    }
+
+    // Each instance in a leaf is a traversal of its own, not a lane of a triangle block.
+    BvhSahSettings settings;
+    settings.leafBlockSize = 1;
+    settings.maxPrimitivesPerLeaf = 4;
+    m_bvh = Bvh::BuildBinnedSah(m_instanceBounds, settings, m_threadPool);
+}
+
+template<bool AnyHit>
+bool InstancedSceneIntersector::Traverse(const Ray& ray, RayHit& hit, uint32_t& instanceIndex) const
+{
+    if (m_bvh.nodes.empty())
+        return false;
+
+    const Float3 invDirection(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+    float tMax = ray.tMax;
+    bool anyHit = false;
+
+    // Like SceneIntersector::Traverse, with objects instead of triangles in the leaves. Instances are expensive to
+    // test and often hidden behind each other, so pushed nodes remember where the ray enters them and are skipped
+    // once there is a closer hit.
+    struct StackEntry
+    {
+        uint32_t nodeIndex;
+        float tEnter;
+    };
+    StackEntry stack[Bvh::MaxDepth];
+    uint32_t stackSize = 0;
+    uint32_t nodeIndex = 0;
+    if (IntersectBox(m_bvh.nodes[0], ray.origin, invDirection, ray.tMin, tMax) == INFINITY)
+        return false;
+
+    while (true)
+    {
+        const BvhNode& node = m_bvh.nodes[nodeIndex];
+        if (node.IsLeaf())
+        {
+            for (uint32_t i = node.childOrFirstPrimitive; i < node.childOrFirstPrimitive + node.numPrimitives; ++i)
+            {
+                // The direction is not normalized again, so distances along the ray are the same in both spaces.
+                const uint32_t instance = m_bvh.primitiveIndices[i];
+                const Float3x4& worldToObject = m_worldToObject[instance];
+                const Ray objectRay = { worldToObject.TransformPoint(ray.origin), ray.tMin, worldToObject.TransformVector(ray.direction), tMax };
+                if (AnyHit)
+                {
+                    if (m_instances[instance].object->IsOccluded(objectRay))
+                        return true;
+                }
+                else if (m_instances[instance].object->Intersect(objectRay, hit))
+                {
+                    tMax = hit.t;
+                    instanceIndex = instance;
+                    anyHit = true;
+                }
+            }
+        }
+        else
+        {
+            const uint32_t left = node.childOrFirstPrimitive;
+            const float tLeft = IntersectBox(m_bvh.nodes[left], ray.origin, invDirection, ray.tMin, tMax);
+            const float tRight = IntersectBox(m_bvh.nodes[left + 1], ray.origin, invDirection, ray.tMin, tMax);
+            if (tLeft != INFINITY && tRight != INFINITY)
+            {
+                nodeIndex = tLeft <= tRight ? left : left + 1;
+                stack[stackSize++] = tLeft <= tRight ? StackEntry{ left + 1, tRight } : StackEntry{ left, tLeft };
+                continue;
+            }
+            if (tLeft != INFINITY)
+            {
+                nodeIndex = left;
+                continue;
+            }
+            if (tRight != INFINITY)
+            {
+                nodeIndex = left + 1;
+                continue;
+            }
+        }
+
+        while (stackSize > 0 && stack[stackSize - 1].tEnter > tMax)
+            --stackSize;
+        if (stackSize == 0)
+            break;
+        nodeIndex = stack[--stackSize].nodeIndex;
+    }
+
+    return anyHit;
+}
+
+bool InstancedSceneIntersector::Intersect(const Ray& ray, RayHit& hit, uint32_t& instanceIndex) const
+{
+    return Traverse<false>(ray, hit, instanceIndex);
+}
+
+bool InstancedSceneIntersector::IsOccluded(const Ray& ray) const
+{
+    RayHit hit;
+    uint32_t instanceIndex;
+    return Traverse<true>(ray, hit, instanceIndex);
+}
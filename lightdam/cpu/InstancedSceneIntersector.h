@@ -0,0 +1,48 @@
+#pragma once
+
+#include "SceneIntersector.h"
+
+// Object placed in the world, the CPU equivalent of BottomLevelASInstance.
+struct SceneIntersectorInstance
+{
+    const SceneIntersector* object;     // Triangles in object space, may be shared by any number of instances.
+    Float3x4 transform;                 // Object to world.
+};
+
+// Two level acceleration structure, mirroring the BLAS/TLAS split of the DXR path.
+// SceneIntersectors of objects are the bottom level and are never touched again, the top level is a binary BVH over
+// the world space bounds of the instances. Moving instances only needs new transforms and an update of the top level.
+class InstancedSceneIntersector
+{
+public:
+    // Builds the top level on the given thread pool if there is one. The objects have to outlive the intersector.
+    InstancedSceneIntersector(std::vector<SceneIntersectorInstance> instances, ThreadPool* threadPool = nullptr, BvhBuilder builder = BvhBuilder::BinnedSah);
+
+    // Sets new transforms for all instances, in the order they were given to the constructor.
+    // With refit the top level keeps its tree and only its bounds are updated, which is a lot cheaper than building it
+    // again but gets slower to trace the further instances move from where they were at the last build.
+    void Update(const std::vector<Float3x4>& transforms, bool refit);
+
+    // Same as the SceneIntersector queries, instanceIndex tells which instance was hit. The hit's meshIndex and
+    // primitiveIndex refer to the object of that instance.
+    bool Intersect(const Ray& ray, RayHit& hit, uint32_t& instanceIndex) const;
+    bool IsOccluded(const Ray& ray) const;
+
+    const Bvh& GetBvh() const { return m_bvh; }
+    uint32_t GetNumInstances() const { return static_cast<uint32_t>(m_instances.size()); }
+    const SceneIntersectorInstance& GetInstance(uint32_t instanceIndex) const { return m_instances[instanceIndex]; }
+
+private:
+    // Inverse transforms and world space bounds of all instances.
+    void UpdateInstanceData();
+    void BuildTopLevel();
+    template<bool AnyHit>
+    bool Traverse(const Ray& ray, RayHit& hit, uint32_t& instanceIndex) const;
+
+    std::vector<SceneIntersectorInstance> m_instances;
+    std::vector<Float3x4> m_worldToObject;
+    std::vector<Aabb> m_instanceBounds;
+    Bvh m_bvh;
+    ThreadPool* m_threadPool;
+    BvhBuilder m_builder;
+};
@@ -0,0 +1,196 @@
+#include "LazySceneIntersector.h"
+#include "../ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+// Smaller subtrees cost more per ray than they save in building, larger ones get built as soon as any ray gets close.
+static const uint32_t MinAutomaticSubtreeTriangles = 4096;
+static const uint32_t MaxAutomaticSubtreeTriangles = 65536;
+
+LazySceneIntersector::LazySceneIntersector(const CpuScene& scene, ThreadPool* threadPool, BvhLayout layout, uint32_t maxSubtreeTriangles)
+    : m_scene(scene)
+    , m_layout(layout)
+    , m_numSubtrees(0)
+    , m_numBuiltSubtrees(0)
+    , m_numBuiltTriangles(0)
+    , m_subtreeBuildNanoseconds(0)
+{
+    std::vector<Aabb> triangleBounds;
+    for (uint32_t meshIndex = 0; meshIndex < scene.meshes.size(); ++meshIndex)
+    {
+        const CpuScene::Mesh& mesh = scene.meshes[meshIndex];
+        for (uint32_t primitiveIndex = 0; primitiveIndex < mesh.indices.size() / 3; ++primitiveIndex)
+        {
+            Aabb bounds;
+            for (int vertex = 0; vertex < 3; ++vertex)
+                bounds.Extend(mesh.positions[mesh.indices[primitiveIndex * 3 + vertex]]);
+            triangleBounds.push_back(bounds);
+            m_triangles.push_back({ meshIndex, primitiveIndex });
+        }
+    }
+
+    if (maxSubtreeTriangles == 0)
+        maxSubtreeTriangles = std::min(MaxAutomaticSubtreeTriangles, std::max(MinAutomaticSubtreeTriangles, static_cast<uint32_t>(m_triangles.size()) / 64));
+
+    // Binned SAH with subtrees as leaf blocks. Building a subtree costs the same as a split below, so every node
+    // with at most maxSubtreeTriangles triangles becomes a subtree and larger ones are split where the children
+    // would need the fewest subtree visits.
+    BvhSahSettings settings;
+    settings.leafBlockSize = maxSubtreeTriangles;
+    settings.maxPrimitivesPerLeaf = maxSubtreeTriangles;
+    m_bvh = Bvh::BuildBinnedSah(triangleBounds, settings, threadPool);
+
+    for (const BvhNode& node : m_bvh.nodes)
+        m_numSubtrees += node.IsLeaf() ? 1 : 0;
+    m_subtrees.reset(new Subtree[m_numSubtrees]);
+    uint32_t subtreeIndex = 0;
+    for (BvhNode& node : m_bvh.nodes)
+    {
+        if (!node.IsLeaf())
+            continue;
+        Subtree& subtree = m_subtrees[subtreeIndex];
+        subtree.firstPrimitive = node.childOrFirstPrimitive;
+        subtree.numPrimitives = node.numPrimitives;
+        subtree.claimed = false;
+        subtree.intersector = nullptr;
+        node.childOrFirstPrimitive = subtreeIndex++;
+    }
+}
+
+LazySceneIntersector::~LazySceneIntersector()
+{
+    for (uint32_t i = 0; i < m_numSubtrees; ++i)
+        delete m_subtrees[i].intersector.load();
+}
+
+const SceneIntersector& LazySceneIntersector::GetSubtree(uint32_t subtreeIndex) const
+{
+    // Acquire pairs with the release when publishing, so the nodes of a subtree are visible once its pointer is.
+    Subtree& subtree = m_subtrees[subtreeIndex];
+    const SceneIntersector* intersector = subtree.intersector.load(std::memory_order_acquire);
+    if (intersector)
+        return *intersector;
+
+    if (!subtree.claimed.exchange(true, std::memory_order_relaxed))
+    {
+        // Built without the thread pool: this may run inside a pool task, which would help out with other tasks while
+        // waiting for the build and could end up waiting for this very subtree.
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<MeshTriangle> triangles(subtree.numPrimitives);
+        for (uint32_t i = 0; i < subtree.numPrimitives; ++i)
+            triangles[i] = m_triangles[m_bvh.primitiveIndices[subtree.firstPrimitive + i]];
+        intersector = new SceneIntersector(m_scene, triangles, nullptr, BvhBuilder::BinnedSah, m_layout);
+        subtree.intersector.store(intersector, std::memory_order_release);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        m_numBuiltSubtrees += 1;
+        m_numBuiltTriangles += subtree.numPrimitives;
+        m_subtreeBuildNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        return *intersector;
+    }
+
+    // Someone else is building it, which takes a few milliseconds at most.
+    while ((intersector = subtree.intersector.load(std::memory_order_acquire)) == nullptr)
+        std::this_thread::yield();
+    return *intersector;
+}
+
+void LazySceneIntersector::BuildAll(ThreadPool* threadPool)
+{
+    if (!threadPool)
+    {
+        for (uint32_t i = 0; i < m_numSubtrees; ++i)
+            GetSubtree(i);
+        return;
+    }
+    threadPool->ParallelFor(0, m_numSubtrees, 1, [this](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; ++i)
+            GetSubtree(i);
+    });
+}
+
+template<bool AnyHit>
+bool LazySceneIntersector::Traverse(const Ray& ray, RayHit& hit) const
+{
+    if (m_bvh.nodes.empty())
+        return false;
+
+    const Float3 invDirection(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+    float tMax = ray.tMax;
+    bool anyHit = false;
+
+    // Same as the top level of InstancedSceneIntersector, subtrees are expensive enough to skip those behind a hit.
+    struct StackEntry
+    {
+        uint32_t nodeIndex;
+        float tEnter;
+    };
+    StackEntry stack[Bvh::MaxDepth];
+    uint32_t stackSize = 0;
+    uint32_t nodeIndex = 0;
+    if (IntersectBox(m_bvh.nodes[0], ray.origin, invDirection, ray.tMin, tMax) == INFINITY)
+        return false;
+
+    while (true)
+    {
+        const BvhNode& node = m_bvh.nodes[nodeIndex];
+        if (node.IsLeaf())
+        {
+            const SceneIntersector& subtree = GetSubtree(node.childOrFirstPrimitive);
+            const Ray subtreeRay = { ray.origin, ray.tMin, ray.direction, tMax };
+            if (AnyHit)
+            {
+                if (subtree.IsOccluded(subtreeRay))
+                    return true;
+            }
+            else if (subtree.Intersect(subtreeRay, hit))
+            {
+                tMax = hit.t;
+                anyHit = true;
+            }
+        }
+        else
+        {
+            const uint32_t left = node.childOrFirstPrimitive;
+            const float tLeft = IntersectBox(m_bvh.nodes[left], ray.origin, invDirection, ray.tMin, tMax);
+            const float tRight = IntersectBox(m_bvh.nodes[left + 1], ray.origin, invDirection, ray.tMin, tMax);
+            if (tLeft != INFINITY && tRight != INFINITY)
+            {
+                nodeIndex = tLeft <= tRight ? left : left + 1;
+                stack[stackSize++] = tLeft <= tRight ? StackEntry{ left + 1, tRight } : StackEntry{ left, tLeft };
+                continue;
+            }
+            if (tLeft != INFINITY)
+            {
+                nodeIndex = left;
+                continue;
+            }
+            if (tRight != INFINITY)
+            {
+                nodeIndex = left + 1;
+                continue;
+            }
+        }
+
+        while (stackSize > 0 && stack[stackSize - 1].tEnter > tMax)
+            --stackSize;
+        if (stackSize == 0)
+            break;
+        nodeIndex = stack[--stackSize].nodeIndex;
+    }
+
+    return anyHit;
+}
+
+bool LazySceneIntersector::Intersect(const Ray& ray, RayHit& hit) const
+{
+    return Traverse<false>(ray, hit);
+}
+
+bool LazySceneIntersector::IsOccluded(const Ray& ray) const
+{
+    RayHit hit;
+    return Traverse<true>(ray, hit);
+}
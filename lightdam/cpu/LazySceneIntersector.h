@@ -0,0 +1,61 @@
+#pragma once
+
+#include "SceneIntersector.h"
+#include <atomic>
+#include <memory>
+
+// Ray queries against a CpuScene whose BVH is built on demand.
+// Only the top of the tree is built up front, with a coarse binned SAH. Its leaves are subtrees of up to
+// maxSubtreeTriangles triangles, each one a SceneIntersector that is built the first time a ray enters it.
+// Views that see only a part of a huge scene start tracing much earlier and never pay for the rest.
+// By default subtrees hold about 1/64 of the scene, so a region that no ray enters stays unbuilt no matter how large
+// the scene is, while small scenes are not cut into subtrees too small to be worth the extra traversal level.
+class LazySceneIntersector
+{
+public:
+    // The scene has to outlive the intersector, subtrees read its triangles when they are built.
+    // A maxSubtreeTriangles of 0 picks the subtree size from the number of triangles.
+    LazySceneIntersector(const CpuScene& scene, ThreadPool* threadPool = nullptr, BvhLayout layout = BvhLayout::Wide, uint32_t maxSubtreeTriangles = 0);
+    ~LazySceneIntersector();
+
+    // Same as in SceneIntersector. Safe to call from any number of threads, the first one to enter a subtree builds
+    // it and others that need it meanwhile wait for it.
+    bool Intersect(const Ray& ray, RayHit& hit) const;
+    bool IsOccluded(const Ray& ray) const;
+
+    // Builds all subtrees that have not been built yet.
+    void BuildAll(ThreadPool* threadPool = nullptr);
+
+    const Bvh& GetTopLevelBvh() const           { return m_bvh; }
+    uint32_t GetNumTriangles() const            { return static_cast<uint32_t>(m_triangles.size()); }
+    uint32_t GetNumSubtrees() const             { return m_numSubtrees; }
+    uint32_t GetNumBuiltSubtrees() const        { return m_numBuiltSubtrees; }
+    uint32_t GetNumBuiltTriangles() const       { return m_numBuiltTriangles; }
+    // Summed over all threads.
+    double GetSubtreeBuildSeconds() const       { return m_subtreeBuildNanoseconds * 1e-9; }
+
+private:
+    struct Subtree
+    {
+        uint32_t firstPrimitive;                        // Range of m_bvh.primitiveIndices.
+        uint32_t numPrimitives;
+        std::atomic<bool> claimed;                      // Set by the thread that builds it.
+        std::atomic<const SceneIntersector*> intersector; // Published once it is built, null until then.
+    };
+
+    const SceneIntersector& GetSubtree(uint32_t subtreeIndex) const;
+    template<bool AnyHit>
+    bool Traverse(const Ray& ray, RayHit& hit) const;
+
+    const CpuScene& m_scene;
+    const BvhLayout m_layout;
+    std::vector<MeshTriangle> m_triangles;
+    // Leaves have the index of their subtree in childOrFirstPrimitive.
+    Bvh m_bvh;
+    std::unique_ptr<Subtree[]> m_subtrees;
+    uint32_t m_numSubtrees;
+
+    mutable std::atomic<uint32_t> m_numBuiltSubtrees;
+    mutable std::atomic<uint32_t> m_numBuiltTriangles;
+    mutable std::atomic<uint64_t> m_subtreeBuildNanoseconds;
+};
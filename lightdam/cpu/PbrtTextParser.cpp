@@ -0,0 +1,1330 @@
+#include "PbrtTextParser.h"
+#include "CpuMath.h"
+#include "PlyMeshReader.h"
+#include "../ErrorHandling.h"
+#include "../MappedFile.h"
+#include "../ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <emmintrin.h>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static uint32_t CountTrailingZeros(uint32_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// All powers of ten that are exactly representable as double.
+static const double ExactPowersOfTen[] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// Whether 8 bytes are all ASCII digits.
+static bool AreEightDigits(uint64_t bytes)
+{
+    return (((bytes + 0x4646464646464646ull) | (bytes - 0x3030303030303030ull)) & 0x8080808080808080ull) == 0;
+}
+
+// Value of 8 ASCII digits loaded from memory, the first digit is the lowest byte.
+static uint32_t ParseEightDigits(uint64_t bytes)
+{
+    bytes = (bytes & 0x0F0F0F0F0F0F0F0Full) * 2561 >> 8;
+    bytes = (bytes & 0x00FF00FF00FF00FFull) * 6553601 >> 16;
+    return static_cast<uint32_t>((bytes & 0x0000FFFF0000FFFFull) * 42949672960001ull >> 32);
+}
+
+const char* ParsePbrtNumber(const char* begin, const char* end, double& value)
+{
+    const char* cur = begin;
+    bool negative = false;
+    if (cur != end && (*cur == '-' || *cur == '+'))
+    {
+        negative = *cur == '-';
+        ++cur;
+    }
+
+    // Digits go into the mantissa up to 19 of them (counting from the first that is not zero), the exponent makes up for the decimal point.
+    // Exporters write long runs of digits, which are converted 8 at a time.
+    uint64_t mantissa = 0;
+    int numMantissaDigits = 0;
+    int exponent = 0;
+    bool hasDigits = false;
+    bool inFraction = false;
+    bool truncated = false;
+    for (;;)
+    {
+        uint64_t bytes;
+        if (end - cur >= 8 && numMantissaDigits <= 11 && (memcpy(&bytes, cur, 8), AreEightDigits(bytes)))
+        {
+            mantissa = mantissa * 100000000 + ParseEightDigits(bytes);
+            if (mantissa != 0)
+                numMantissaDigits += 8;
+            if (inFraction)
+                exponent -= 8;
+            hasDigits = true;
+            cur += 8;
+            continue;
+        }
+        if (cur == end)
+            break;
+        const char c = *cur;
+        if (c >= '0' && c <= '9')
+        {
+            if (numMantissaDigits < 19)
+            {
+                mantissa = mantissa * 10 + static_cast<uint64_t>(c - '0');
+                if (mantissa != 0)
+                    ++numMantissaDigits;
+                if (inFraction)
+                    --exponent;
+            }
+            else
+                truncated = true;
+            hasDigits = true;
+            ++cur;
+        }
+        else if (c == '.' && !inFraction)
+        {
+            inFraction = true;
+            ++cur;
+        }
+        else
+            break;
+    }
+    if (!hasDigits)
+        return nullptr;
+
+    // Like strtod, an 'e' without digits after it is not part of the number.
+    if (cur != end && (*cur == 'e' || *cur == 'E'))
+    {
+        const char* exponentCur = cur + 1;
+        bool negativeExponent = false;
+        if (exponentCur != end && (*exponentCur == '-' || *exponentCur == '+'))
+        {
+            negativeExponent = *exponentCur == '-';
+            ++exponentCur;
+        }
+        if (exponentCur != end && *exponentCur >= '0' && *exponentCur <= '9')
+        {
+            int explicitExponent = 0;
+            for (; exponentCur != end && *exponentCur >= '0' && *exponentCur <= '9'; ++exponentCur)
+                explicitExponent = std::min(explicitExponent * 10 + (*exponentCur - '0'), 100000);
+            exponent += negativeExponent ? -explicitExponent : explicitExponent;
+            cur = exponentCur;
+        }
+    }
+
+    if (mantissa == 0 && !truncated)
+    {
+        value = negative ? -0.0 : 0.0;
+        return cur;
+    }
+    // Both operands are exact, so the correctly rounded result of the operation is the correctly rounded number.
+    if (!truncated && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22)
+    {
+        const double absoluteValue = exponent < 0 ? static_cast<double>(mantissa) / ExactPowersOfTen[-exponent] : static_cast<double>(mantissa) * ExactPowersOfTen[exponent];
+        value = negative ? -absoluteValue : absoluteValue;
+        return cur;
+    }
+
+    // The mapped file is not null terminated.
+    const std::string text(begin, cur);
+    value = strtod(text.c_str(), nullptr);
+    return cur;
+}
+
+static const char* ParseInt(const char* cur, const char* end, int32_t& value)
+{
+    bool negative = false;
+    if (cur != end && (*cur == '-' || *cur == '+'))
+    {
+        negative = *cur == '-';
+        ++cur;
+    }
+    const char* digitsBegin = cur;
+    int64_t absoluteValue = 0;
+    for (; cur != end && *cur >= '0' && *cur <= '9' && cur - digitsBegin < 11; ++cur)
+        absoluteValue = absoluteValue * 10 + (*cur - '0');
+    if (cur == digitsBegin || absoluteValue > (negative ? 2147483648ll : 2147483647ll))
+        return nullptr;
+    value = static_cast<int32_t>(negative ? -absoluteValue : absoluteValue);
+    return cur;
+}
+
+static bool IsDelimiter(char c)
+{
+    return static_cast<unsigned char>(c) <= ' ' || c == '[' || c == ']' || c == '"' || c == '#';
+}
+
+// Skips whitespace 16 bytes at a time, all bytes up to ' ' count as whitespace.
+static const char* SkipSpaces(const char* cur, const char* end)
+{
+    if (cur != end && static_cast<unsigned char>(*cur) > ' ')
+        return cur;
+    const __m128i spaces = _mm_set1_epi8(' ');
+    while (end - cur >= 16)
+    {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur));
+        const uint32_t nonSpaceMask = ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(bytes, spaces), spaces))) & 0xFFFF;
+        if (nonSpaceMask)
+            return cur + CountTrailingZeros(nonSpaceMask);
+        cur += 16;
+    }
+    while (cur != end && static_cast<unsigned char>(*cur) <= ' ')
+        ++cur;
+    return cur;
+}
+
+static const char* SkipWhitespaceAndComments(const char* cur, const char* end)
+{
+    for (;;)
+    {
+        cur = SkipSpaces(cur, end);
+        if (cur == end || *cur != '#')
+            return cur;
+        const char* lineEnd = static_cast<const char*>(memchr(cur, '\n', end - cur));
+        cur = lineEnd ? lineEnd + 1 : end;
+    }
+}
+
+enum class TokenType : uint8_t
+{
+    Identifier,     // Directives, and the rare unquoted true/false.
+    String,         // Without the quotes.
+    Number,
+    FloatArray,
+    IntArray,       // Arrays of "integer" parameters.
+    StringArray,
+};
+
+struct Token
+{
+    TokenType type;
+    uint32_t arrayIndex;    // Into the file's arrays of the token's type.
+    const char* text;       // Start of the token in the file, after the quote for strings.
+    uint32_t length;        // Of identifiers and strings.
+    double number;
+
+    bool Equals(const char* string) const { return strlen(string) == length && memcmp(text, string, length) == 0; }
+    std::string ToString() const { return std::string(text, length); }
+};
+
+// Tokens and arrays of a file. Tokens point into the file, which stays mapped as long as they are used.
+struct TokenizedFile
+{
+    std::string path;
+    uint32_t includeDepth = 0;
+    MappedFile file;
+    std::vector<Token> tokens;
+    std::vector<std::vector<float>> floatArrays;
+    std::vector<std::vector<int32_t>> intArrays;
+    std::vector<std::vector<std::string>> stringArrays;
+    // Token index of the file name of each Include or Import, and the index of the file among all tokenized ones.
+    std::vector<std::pair<uint32_t, std::string>> includes;
+    std::vector<uint32_t> includedFiles;
+    size_t numNumbers = 0;
+    std::string error;
+
+    const char* GetData() const { return reinterpret_cast<const char*>(file.GetData()); }
+
+    [[noreturn]] void ThrowError(const char* position, const std::string& message) const
+    {
+        const uint32_t line = 1 + static_cast<uint32_t>(std::count(GetData(), position, '\n'));
+        throw std::runtime_error(path + "(" + std::to_string(line) + "): " + message);
+    }
+};
+
+static const char* ParseArrayElement(const char* cur, const char* end, float& value)
+{
+    double number;
+    cur = ParsePbrtNumber(cur, end, number);
+    value = static_cast<float>(number);
+    return cur;
+}
+
+static const char* ParseArrayElement(const char* cur, const char* end, int32_t& value)
+{
+    return ParseInt(cur, end, value);
+}
+
+// Parses numbers up to the closing bracket.
+template<typename T>
+static const char* TokenizeNumberArray(const TokenizedFile& file, const char* cur, const char* end, std::vector<T>& values)
+{
+    for (;;)
+    {
+        cur = SkipWhitespaceAndComments(cur, end);
+        if (cur == end)
+            file.ThrowError(cur, "Array without closing bracket");
+        if (*cur == ']')
+            return cur + 1;
+        T value;
+        const char* numberEnd = ParseArrayElement(cur, end, value);
+        if (!numberEnd || (numberEnd != end && !IsDelimiter(*numberEnd)))
+            file.ThrowError(cur, std::is_same<T, int32_t>::value ? "Expected an integer" : "Expected a number");
+        values.push_back(value);
+        cur = numberEnd;
+    }
+}
+
+static const char* FindClosingQuote(const TokenizedFile& file, const char* cur, const char* end)
+{
+    const char* quote = static_cast<const char*>(memchr(cur, '"', end - cur));
+    if (!quote)
+        file.ThrowError(cur - 1, "String without closing quote");
+    return quote;
+}
+
+static void Tokenize(TokenizedFile& file)
+{
+    const char* cur = file.GetData();
+    const char* const end = cur + file.file.GetSize();
+    for (;;)
+    {
+        cur = SkipWhitespaceAndComments(cur, end);
+        if (cur == end)
+            break;
+
+        Token token = {};
+        token.text = cur;
+        const char c = *cur;
+        if (c == '"')
+        {
+            const char* quote = FindClosingQuote(file, cur + 1, end);
+            token.type = TokenType::String;
+            token.text = cur + 1;
+            token.length = static_cast<uint32_t>(quote - token.text);
+            cur = quote + 1;
+
+            if (!file.tokens.empty() && file.tokens.back().type == TokenType::Identifier &&
+                (file.tokens.back().Equals("Include") || file.tokens.back().Equals("Import")))
+            {
+                file.includes.push_back(std::make_pair(static_cast<uint32_t>(file.tokens.size()), token.ToString()));
+            }
+        }
+        else if (c == '[')
+        {
+            // Parameter arrays are parsed into the type of the parameter declared by the string in front of them.
+            const Token* declaration = file.tokens.empty() || file.tokens.back().type != TokenType::String ? nullptr : &file.tokens.back();
+            cur = SkipWhitespaceAndComments(cur + 1, end);
+            if (cur != end && *cur == '"')
+            {
+                token.type = TokenType::StringArray;
+                token.arrayIndex = static_cast<uint32_t>(file.stringArrays.size());
+                file.stringArrays.emplace_back();
+                for (;;)
+                {
+                    cur = SkipWhitespaceAndComments(cur, end);
+                    if (cur == end)
+                        file.ThrowError(token.text, "Array without closing bracket");
+                    if (*cur == ']')
+                        break;
+                    if (*cur != '"')
+                        file.ThrowError(cur, "Expected a string");
+                    const char* quote = FindClosingQuote(file, cur + 1, end);
+                    file.stringArrays.back().emplace_back(cur + 1, quote);
+                    cur = quote + 1;
+                }
+                ++cur;
+            }
+            else if (declaration && declaration->length > 8 && memcmp(declaration->text, "integer ", 8) == 0)
+            {
+                token.type = TokenType::IntArray;
+                token.arrayIndex = static_cast<uint32_t>(file.intArrays.size());
+                file.intArrays.emplace_back();
+                cur = TokenizeNumberArray(file, cur, end, file.intArrays.back());
+                file.numNumbers += file.intArrays.back().size();
+            }
+            else
+            {
+                token.type = TokenType::FloatArray;
+                token.arrayIndex = static_cast<uint32_t>(file.floatArrays.size());
+                file.floatArrays.emplace_back();
+                cur = TokenizeNumberArray(file, cur, end, file.floatArrays.back());
+                file.numNumbers += file.floatArrays.back().size();
+            }
+        }
+        else if (c == ']')
+            file.ThrowError(cur, "Closing bracket without array");
+        else if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.')
+        {
+            token.type = TokenType::Number;
+            cur = ParsePbrtNumber(cur, end, token.number);
+            if (!cur || (cur != end && !IsDelimiter(*cur)))
+                file.ThrowError(token.text, "Expected a number");
+        }
+        else
+        {
+            token.type = TokenType::Identifier;
+            while (cur != end && !IsDelimiter(*cur))
+                ++cur;
+            token.length = static_cast<uint32_t>(cur - token.text);
+        }
+        file.tokens.push_back(token);
+    }
+}
+
+// Row major 3x4 matrix, pbrt's current transformation without the projective part that only cameras use.
+struct Transform
+{
+    float m[3][4];
+
+    static Transform Identity()
+    {
+        return Transform{ { { 1.0f, 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 0.0f } } };
+    }
+
+    static Transform FromColumns(const Float3& x, const Float3& y, const Float3& z, const Float3& translation)
+    {
+        return Transform{ { { x.x, y.x, z.x, translation.x }, { x.y, y.y, z.y, translation.y }, { x.z, y.z, z.z, translation.z } } };
+    }
+
+    Transform operator * (const Transform& other) const
+    {
+        Transform result;
+        for (int row = 0; row < 3; ++row)
+        {
+            for (int column = 0; column < 4; ++column)
+            {
+                result.m[row][column] = m[row][0] * other.m[0][column] + m[row][1] * other.m[1][column] + m[row][2] * other.m[2][column];
+                if (column == 3)
+                    result.m[row][column] += m[row][3];
+            }
+        }
+        return result;
+    }
+
+    Transform Inverse() const
+    {
+        const float determinant = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+                                  m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        const float invDeterminant = 1.0f / determinant;
+        Transform result;
+        for (int row = 0; row < 3; ++row)
+        {
+            for (int column = 0; column < 3; ++column)
+            {
+                // Cofactor of the transposed element.
+                const int r0 = (column + 1) % 3, r1 = (column + 2) % 3, c0 = (row + 1) % 3, c1 = (row + 2) % 3;
+                result.m[row][column] = (m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0]) * invDeterminant;
+            }
+        }
+        for (int row = 0; row < 3; ++row)
+            result.m[row][3] = -(result.m[row][0] * m[0][3] + result.m[row][1] * m[1][3] + result.m[row][2] * m[2][3]);
+        return result;
+    }
+
+    bool IsIdentity() const
+    {
+        const Transform identity = Identity();
+        return memcmp(m, identity.m, sizeof(m)) == 0;
+    }
+
+    pbrt::affine3f ToAffine() const
+    {
+        pbrt::affine3f affine;
+        affine.l.vx.x = m[0][0]; affine.l.vx.y = m[1][0]; affine.l.vx.z = m[2][0];
+        affine.l.vy.x = m[0][1]; affine.l.vy.y = m[1][1]; affine.l.vy.z = m[2][1];
+        affine.l.vz.x = m[0][2]; affine.l.vz.y = m[1][2]; affine.l.vz.z = m[2][2];
+        affine.p.x = m[0][3]; affine.p.y = m[1][3]; affine.p.z = m[2][3];
+        return affine;
+    }
+};
+
+// Runs the statements of the tokenized files and creates the scene objects the way the semantic layer of pbrt-parser does:
+// Shapes are transformed into the space of the object they are defined in (the world for all outside of ObjectBegin/End),
+// instances keep the transformation they were created with.
+static bool IsAbsolutePath(const std::string& path)
+{
+    return !path.empty() && (path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'));
+}
+
+class PbrtSceneBuilder
+{
+public:
+    PbrtSceneBuilder(std::vector<std::unique_ptr<TokenizedFile>>& files, const std::string& sceneDirectory, ThreadPool* threadPool, PbrtTextParserStats& stats)
+        : m_files(files)
+        , m_sceneDirectory(sceneDirectory)
+        , m_threadPool(threadPool)
+        , m_stats(stats)
+        , m_scene(std::make_shared<pbrt::Scene>())
+        , m_transform(Transform::Identity())
+        , m_transformStart(true)
+        , m_needsPbrtParser(false)
+    {
+        m_scene->world = std::make_shared<pbrt::Object>();
+        // pbrt's default material.
+        m_state.material = std::make_shared<pbrt::MatteMaterial>();
+    }
+
+    // Null if the scene needs pbrt-parser.
+    pbrt::Scene::SP Build()
+    {
+        ParseFile(*m_files[0]);
+        if (!m_needsPbrtParser)
+            LoadPlyMeshes();
+        return m_needsPbrtParser ? nullptr : m_scene;
+    }
+
+private:
+    // A directive with the tokens up to the next one.
+    struct Statement
+    {
+        TokenizedFile* file;
+        const Token* name;
+        const Token* arguments;
+        const Token* argumentsEnd;
+        uint32_t numPositionalArguments;
+    };
+
+    struct GraphicsState
+    {
+        pbrt::Material::SP material;
+        pbrt::AreaLight::SP areaLight;
+        bool reverseOrientation = false;
+    };
+
+    struct PushedAttributes
+    {
+        GraphicsState state;
+        Transform transform;
+        bool transformStart;
+    };
+
+    // Mesh of a plymesh shape, filled by LoadPlyMeshes.
+    struct PlyMesh
+    {
+        pbrt::TriangleMesh::SP mesh;
+        std::string filePath;
+        Transform transform;
+        size_t fileSize;
+        std::string error;
+    };
+
+    void ParseFile(TokenizedFile& file)
+    {
+        const Token* token = file.tokens.data();
+        const Token* end = token + file.tokens.size();
+        while (token != end && !m_needsPbrtParser)
+        {
+            if (token->type != TokenType::Identifier)
+                file.ThrowError(token->text, "Expected a directive");
+            Statement statement = { &file, token, token + 1, token + 1, 0 };
+            // The only directive with an unquoted argument.
+            if (token->Equals("ActiveTransform") && statement.argumentsEnd != end)
+                ++statement.argumentsEnd;
+            while (statement.argumentsEnd != end && (statement.argumentsEnd->type != TokenType::Identifier ||
+                   statement.argumentsEnd->Equals("true") || statement.argumentsEnd->Equals("false")))
+            {
+                ++statement.argumentsEnd;
+            }
+            Execute(statement);
+            token = statement.argumentsEnd;
+        }
+    }
+
+    void Execute(Statement& statement)
+    {
+        const Token& name = *statement.name;
+        if (name.Equals("Shape"))
+            CreateShape(statement);
+        else if (name.Equals("AttributeBegin"))
+            m_pushedAttributes.push_back({ m_state, m_transform, m_transformStart });
+        else if (name.Equals("AttributeEnd"))
+            PopAttributes(statement);
+        else if (name.Equals("TransformBegin"))
+            m_pushedTransforms.push_back(m_transform);
+        else if (name.Equals("TransformEnd"))
+        {
+            if (m_pushedTransforms.empty())
+                statement.file->ThrowError(name.text, "Unmatched TransformEnd");
+            m_transform = m_pushedTransforms.back();
+            m_pushedTransforms.pop_back();
+        }
+        else if (name.Equals("Translate"))
+            ApplyTransform(Transform::FromColumns(Float3(1.0f, 0.0f, 0.0f), Float3(0.0f, 1.0f, 0.0f), Float3(0.0f, 0.0f, 1.0f), GetFloat3Argument(statement, 0)));
+        else if (name.Equals("Scale"))
+        {
+            const Float3 scale = GetFloat3Argument(statement, 0);
+            ApplyTransform(Transform::FromColumns(Float3(scale.x, 0.0f, 0.0f), Float3(0.0f, scale.y, 0.0f), Float3(0.0f, 0.0f, scale.z), Float3(0.0f)));
+        }
+        else if (name.Equals("Rotate"))
+            ApplyRotate(statement);
+        else if (name.Equals("LookAt"))
+            ApplyLookAt(statement);
+        else if (name.Equals("Transform") || name.Equals("ConcatTransform"))
+        {
+            const std::vector<float> matrix = GetMatrixArgument(statement);
+            Transform transform;
+            for (int row = 0; row < 3; ++row)
+            {
+                for (int column = 0; column < 4; ++column)
+                    transform.m[row][column] = matrix[column * 4 + row];
+            }
+            if (name.Equals("Transform"))
+                SetTransform(transform);
+            else
+                ApplyTransform(transform);
+        }
+        else if (name.Equals("Identity"))
+            SetTransform(Transform::Identity());
+        else if (name.Equals("CoordinateSystem"))
+            m_namedCoordinateSystems[GetStringArgument(statement, 0)] = m_transform;
+        else if (name.Equals("CoordSysTransform"))
+        {
+            auto coordinateSystemIt = m_namedCoordinateSystems.find(GetStringArgument(statement, 0));
+            if (coordinateSystemIt != m_namedCoordinateSystems.end())
+                m_transform = coordinateSystemIt->second;
+            else
+                LogPrint(LogLevel::Warning, "Unknown coordinate system '%s'", GetStringArgument(statement, 0).c_str());
+        }
+        else if (name.Equals("ActiveTransform"))
+        {
+            // pbrt-parser only keeps the transformations at the start time.
+            const Token* time = statement.arguments != statement.argumentsEnd ? statement.arguments : nullptr;
+            m_transformStart = !time || !time->Equals("EndTime");
+            statement.numPositionalArguments = 1;
+        }
+        else if (name.Equals("ReverseOrientation"))
+            m_state.reverseOrientation = !m_state.reverseOrientation;
+        else if (name.Equals("Material"))
+        {
+            statement.numPositionalArguments = 1;
+            m_state.material = CreateMaterial(statement, GetStringArgument(statement, 0), "");
+        }
+        else if (name.Equals("MakeNamedMaterial"))
+        {
+            statement.numPositionalArguments = 1;
+            const std::string materialName = GetStringArgument(statement, 0);
+            std::string type;
+            GetString(statement, "type", type);
+            m_namedMaterials[materialName] = CreateMaterial(statement, type, materialName);
+        }
+        else if (name.Equals("NamedMaterial"))
+        {
+            const std::string materialName = GetStringArgument(statement, 0);
+            auto materialIt = m_namedMaterials.find(materialName);
+            if (materialIt != m_namedMaterials.end())
+                m_state.material = materialIt->second;
+            else
+                LogPrint(LogLevel::Warning, "Unknown named material '%s'", materialName.c_str());
+        }
+        else if (name.Equals("Texture"))
+            CreateTexture(statement);
+        else if (name.Equals("AreaLightSource"))
+            CreateAreaLight(statement);
+        else if (name.Equals("ObjectBegin"))
+        {
+            // Same as pbrt, objects have attributes of their own.
+            m_pushedAttributes.push_back({ m_state, m_transform, m_transformStart });
+            const std::string objectName = GetStringArgument(statement, 0);
+            m_currentObject = std::make_shared<pbrt::Object>();
+            m_currentObject->name = objectName;
+            m_objects[objectName] = m_currentObject;
+        }
+        else if (name.Equals("ObjectEnd"))
+        {
+            m_currentObject = nullptr;
+            PopAttributes(statement);
+        }
+        else if (name.Equals("ObjectInstance"))
+        {
+            const std::string objectName = GetStringArgument(statement, 0);
+            auto objectIt = m_objects.find(objectName);
+            if (objectIt == m_objects.end())
+                statement.file->ThrowError(name.text, "Unknown object '" + objectName + "'");
+            auto instance = std::make_shared<pbrt::Instance>();
+            instance->object = objectIt->second;
+            instance->xfm = m_transform.ToAffine();
+            (m_currentObject ? m_currentObject : m_scene->world)->instances.push_back(instance);
+        }
+        else if (name.Equals("Camera"))
+            CreateCamera(statement);
+        else if (name.Equals("Film"))
+        {
+            statement.numPositionalArguments = 1;
+            pbrt::vec2i resolution;
+            resolution.x = static_cast<int>(GetFloat(statement, "integer", "xresolution", 1280.0f));
+            resolution.y = static_cast<int>(GetFloat(statement, "integer", "yresolution", 720.0f));
+            std::string fileName;
+            GetString(statement, "filename", fileName);
+            m_scene->film = std::make_shared<pbrt::Film>(resolution, fileName);
+        }
+        else if (name.Equals("WorldBegin"))
+        {
+            m_transform = Transform::Identity();
+            m_namedCoordinateSystems["world"] = m_transform;
+        }
+        else if (name.Equals("Include") || name.Equals("Import"))
+        {
+            const uint32_t tokenIndex = static_cast<uint32_t>(statement.arguments - statement.file->tokens.data());
+            for (size_t includeIdx = 0; includeIdx < statement.file->includes.size(); ++includeIdx)
+            {
+                if (statement.file->includes[includeIdx].first == tokenIndex)
+                    ParseFile(*m_files[statement.file->includedFiles[includeIdx]]);
+            }
+        }
+        else if (!name.Equals("WorldEnd") && !name.Equals("TransformTimes") && !name.Equals("Sampler") && !name.Equals("Integrator") &&
+                 !name.Equals("PixelFilter") && !name.Equals("Accelerator") && !name.Equals("LightSource") &&
+                 !name.Equals("MakeNamedMedium") && !name.Equals("MediumInterface"))
+        {
+            if (m_reportedDirectives.insert(name.ToString()).second)
+                LogPrint(LogLevel::Warning, "Unknown pbrt directive '%s' ignored", name.ToString().c_str());
+        }
+    }
+
+    void PopAttributes(const Statement& statement)
+    {
+        if (m_pushedAttributes.empty())
+            statement.file->ThrowError(statement.name->text, "Unmatched " + statement.name->ToString());
+        m_state = m_pushedAttributes.back().state;
+        m_transform = m_pushedAttributes.back().transform;
+        m_transformStart = m_pushedAttributes.back().transformStart;
+        m_pushedAttributes.pop_back();
+    }
+
+    void SetTransform(const Transform& transform)
+    {
+        if (m_transformStart)
+            m_transform = transform;
+    }
+
+    void ApplyTransform(const Transform& transform)
+    {
+        SetTransform(m_transform * transform);
+    }
+
+    void ApplyRotate(const Statement& statement)
+    {
+        const float angle = GetNumberArgument(statement, 0) * (3.14159265358979f / 180.0f);
+        const Float3 axis = Normalize(GetFloat3Argument(statement, 1));
+        const float sinTheta = sinf(angle);
+        const float cosTheta = cosf(angle);
+        // Same as pbrt's Rotate.
+        Transform rotation = Transform::Identity();
+        rotation.m[0][0] = axis.x * axis.x + (1.0f - axis.x * axis.x) * cosTheta;
+        rotation.m[0][1] = axis.x * axis.y * (1.0f - cosTheta) - axis.z * sinTheta;
+        rotation.m[0][2] = axis.x * axis.z * (1.0f - cosTheta) + axis.y * sinTheta;
+        rotation.m[1][0] = axis.x * axis.y * (1.0f - cosTheta) + axis.z * sinTheta;
+        rotation.m[1][1] = axis.y * axis.y + (1.0f - axis.y * axis.y) * cosTheta;
+        rotation.m[1][2] = axis.y * axis.z * (1.0f - cosTheta) - axis.x * sinTheta;
+        rotation.m[2][0] = axis.x * axis.z * (1.0f - cosTheta) - axis.y * sinTheta;
+        rotation.m[2][1] = axis.y * axis.z * (1.0f - cosTheta) + axis.x * sinTheta;
+        rotation.m[2][2] = axis.z * axis.z + (1.0f - axis.z * axis.z) * cosTheta;
+        ApplyTransform(rotation);
+    }
+
+    void ApplyLookAt(const Statement& statement)
+    {
+        const Float3 position = GetFloat3Argument(statement, 0);
+        const Float3 direction = Normalize(GetFloat3Argument(statement, 3) - position);
+        const Float3 right = Cross(Normalize(GetFloat3Argument(statement, 6)), direction);
+        if (Length(right) == 0.0f)
+        {
+            LogPrint(LogLevel::Warning, "LookAt with up vector parallel to the viewing direction ignored");
+            return;
+        }
+        const Float3 normalizedRight = Normalize(right);
+        const Float3 up = Cross(direction, normalizedRight);
+        ApplyTransform(Transform::FromColumns(normalizedRight, up, direction, position).Inverse());
+    }
+
+    void CreateCamera(Statement& statement)
+    {
+        statement.numPositionalArguments = 1;
+        auto camera = std::make_shared<pbrt::Camera>();
+        camera->fov = GetFloat(statement, "float", "fov", 90.0f);
+        const Transform cameraToWorld = m_transform.Inverse();
+        camera->frame = cameraToWorld.ToAffine();
+        m_namedCoordinateSystems["camera"] = cameraToWorld;
+        m_scene->cameras.push_back(camera);
+    }
+
+    void CreateTexture(Statement& statement)
+    {
+        statement.numPositionalArguments = 3;
+        const std::string textureName = GetStringArgument(statement, 0);
+        const std::string textureClass = GetStringArgument(statement, 2);
+        if (textureClass == "imagemap")
+        {
+            auto texture = std::make_shared<pbrt::ImageTexture>();
+            GetString(statement, "filename", texture->fileName);
+            m_textures[textureName] = texture;
+        }
+        else
+        {
+            // CpuScene doesn't support any of the procedural textures, it only needs to know that there is one.
+            m_textures[textureName] = std::make_shared<pbrt::Texture>();
+        }
+    }
+
+    void CreateAreaLight(Statement& statement)
+    {
+        statement.numPositionalArguments = 1;
+        m_state.areaLight = nullptr;
+        if (GetStringArgument(statement, 0) != "diffuse")
+        {
+            LogPrint(LogLevel::Warning, "Area light type '%s' not supported", GetStringArgument(statement, 0).c_str());
+            return;
+        }
+        // Blackbody emitters are no DiffuseAreaLightRGB for pbrt-parser either.
+        if (FindParameter(statement, "blackbody", "L"))
+            return;
+        auto areaLight = std::make_shared<pbrt::DiffuseAreaLightRGB>();
+        areaLight->L = MakeVec3f(1.0f, 1.0f, 1.0f);
+        GetColor(statement, "L", areaLight->L);
+        m_state.areaLight = areaLight;
+    }
+
+    pbrt::Material::SP CreateMaterial(const Statement& statement, const std::string& type, const std::string& name)
+    {
+        if (type == "matte")
+        {
+            auto material = std::make_shared<pbrt::MatteMaterial>();
+            GetColor(statement, "Kd", material->kd);
+            material->map_kd = GetTexture(statement, "Kd");
+            material->sigma = GetFloat(statement, "float", "sigma", material->sigma);
+            material->map_sigma = GetTexture(statement, "sigma");
+            material->name = name;
+            return material;
+        }
+        if (type == "substrate")
+        {
+            auto material = std::make_shared<pbrt::SubstrateMaterial>();
+            GetColor(statement, "Kd", material->kd);
+            material->map_kd = GetTexture(statement, "Kd");
+            GetColor(statement, "Ks", material->ks);
+            material->map_ks = GetTexture(statement, "Ks");
+            material->uRoughness = GetFloat(statement, "float", "uroughness", material->uRoughness);
+            material->vRoughness = GetFloat(statement, "float", "vroughness", material->vRoughness);
+            material->map_bump = GetTexture(statement, "bumpmap");
+            material->name = name;
+            return material;
+        }
+        if (type == "metal")
+        {
+            auto material = std::make_shared<pbrt::MetalMaterial>();
+            GetColor(statement, "eta", material->eta);
+            GetSpectrum(statement, "eta", material->spectrum_eta);
+            GetColor(statement, "k", material->k);
+            GetSpectrum(statement, "k", material->spectrum_k);
+            material->roughness = GetFloat(statement, "float", "roughness", material->roughness);
+            material->uRoughness = GetFloat(statement, "float", "uroughness", material->uRoughness);
+            material->vRoughness = GetFloat(statement, "float", "vroughness", material->vRoughness);
+            GetBool(statement, "remaproughness", material->remapRoughness);
+            material->map_roughness = GetTexture(statement, "roughness");
+            material->map_uRoughness = GetTexture(statement, "uroughness");
+            material->map_vRoughness = GetTexture(statement, "vroughness");
+            material->map_bump = GetTexture(statement, "bumpmap");
+            material->name = name;
+            return material;
+        }
+        // CpuScene renders all other materials the same way.
+        auto material = std::make_shared<pbrt::Material>();
+        material->name = name;
+        return material;
+    }
+
+    void CreateShape(Statement& statement)
+    {
+        statement.numPositionalArguments = 1;
+        const std::string type = GetStringArgument(statement, 0);
+        if (type == "plymesh")
+        {
+            std::string fileName;
+            GetString(statement, "filename", fileName);
+            if (fileName.empty())
+                statement.file->ThrowError(statement.name->text, "plymesh without \"string filename\"");
+            auto mesh = std::make_shared<pbrt::TriangleMesh>();
+            mesh->material = m_state.material;
+            mesh->areaLight = m_state.areaLight;
+            mesh->reverseOrientation = m_state.reverseOrientation;
+            m_plyMeshes.push_back({ mesh, IsAbsolutePath(fileName) ? fileName : m_sceneDirectory + "/" + fileName, m_transform, 0, std::string() });
+            (m_currentObject ? m_currentObject : m_scene->world)->shapes.push_back(mesh);
+            return;
+        }
+        if (type != "trianglemesh")
+        {
+            if (m_reportedShapeTypes.insert(type).second)
+                LogPrint(LogLevel::Warning, "Unsupported shape type %s", type.c_str());
+            return;
+        }
+
+        TokenizedFile& file = *statement.file;
+        std::vector<float>* positions = GetFloatArray(statement, "point", "P");
+        if (!positions)
+            positions = GetFloatArray(statement, "point3", "P");
+        if (!positions || positions->size() % 3 != 0)
+            file.ThrowError(statement.name->text, "trianglemesh without valid \"point P\"");
+        const size_t numVertices = positions->size() / 3;
+
+        auto mesh = std::make_shared<pbrt::TriangleMesh>();
+        mesh->material = m_state.material;
+        mesh->areaLight = m_state.areaLight;
+        mesh->reverseOrientation = m_state.reverseOrientation;
+
+        const Token* indicesToken = FindParameter(statement, "integer", "indices");
+        if (indicesToken && indicesToken->type == TokenType::IntArray)
+        {
+            std::vector<int32_t>& indices = file.intArrays[indicesToken->arrayIndex];
+            if (indices.size() % 3 != 0)
+                file.ThrowError(indicesToken->text, "Number of indices is not a multiple of 3");
+            for (int32_t index : indices)
+            {
+                if (index < 0 || static_cast<size_t>(index) >= numVertices)
+                    file.ThrowError(indicesToken->text, "Index out of range");
+            }
+            mesh->index.resize(indices.size() / 3);
+            memcpy(mesh->index.data(), indices.data(), indices.size() * sizeof(int32_t));
+            std::vector<int32_t>().swap(indices);
+        }
+        else if (numVertices == 3)
+        {
+            mesh->index.resize(1);
+            mesh->index[0].x = 0;
+            mesh->index[0].y = 1;
+            mesh->index[0].z = 2;
+        }
+        else
+            file.ThrowError(statement.name->text, "trianglemesh without \"integer indices\"");
+
+        const bool transformed = !m_transform.IsIdentity();
+        const pbrt::affine3f transform = m_transform.ToAffine();
+        mesh->vertex.resize(numVertices);
+        for (size_t vertexIdx = 0; vertexIdx < numVertices; ++vertexIdx)
+        {
+            const pbrt::vec3f vertex = MakeVec3f((*positions)[vertexIdx * 3 + 0], (*positions)[vertexIdx * 3 + 1], (*positions)[vertexIdx * 3 + 2]);
+            mesh->vertex[vertexIdx] = transformed ? transform * vertex : vertex;
+        }
+        std::vector<float>().swap(*positions);
+
+        std::vector<float>* normals = GetFloatArray(statement, "normal", "N");
+        if (!normals)
+            normals = GetFloatArray(statement, "normal3", "N");
+        if (normals && normals->size() == numVertices * 3)
+        {
+            const pbrt::linear3f normalTransform = pbrt::math::inverse_transpose(transform.l);
+            mesh->normal.resize(numVertices);
+            for (size_t vertexIdx = 0; vertexIdx < numVertices; ++vertexIdx)
+            {
+                const pbrt::vec3f normal = MakeVec3f((*normals)[vertexIdx * 3 + 0], (*normals)[vertexIdx * 3 + 1], (*normals)[vertexIdx * 3 + 2]);
+                mesh->normal[vertexIdx] = transformed ? normalTransform * normal : normal;
+            }
+            std::vector<float>().swap(*normals);
+        }
+
+        std::vector<float>* texcoords = GetFloatArray(statement, "float", "uv");
+        if (!texcoords)
+            texcoords = GetFloatArray(statement, "point2", "uv");
+        if (!texcoords)
+            texcoords = GetFloatArray(statement, "float", "st");
+        if (!texcoords)
+            texcoords = GetFloatArray(statement, "point2", "st");
+        if (texcoords && texcoords->size() == numVertices * 2)
+        {
+            mesh->texcoord.resize(numVertices);
+            for (size_t vertexIdx = 0; vertexIdx < numVertices; ++vertexIdx)
+            {
+                mesh->texcoord[vertexIdx].x = (*texcoords)[vertexIdx * 2 + 0];
+                mesh->texcoord[vertexIdx].y = (*texcoords)[vertexIdx * 2 + 1];
+            }
+            std::vector<float>().swap(*texcoords);
+        }
+
+        (m_currentObject ? m_currentObject : m_scene->world)->shapes.push_back(mesh);
+    }
+
+    // All plymesh shapes are loaded once the scene is complete, in parallel on the thread pool if there is one.
+    // Files that PlyMeshReader can't read leave the whole scene to pbrt-parser.
+    void LoadPlyMeshes()
+    {
+        const auto loadStart = std::chrono::high_resolution_clock::now();
+        auto loadMeshes = [this](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t meshIdx = begin; meshIdx < end; ++meshIdx)
+                LoadPlyMesh(m_plyMeshes[meshIdx]);
+        };
+        if (m_threadPool && m_plyMeshes.size() > 1)
+            m_threadPool->ParallelFor(0, static_cast<uint32_t>(m_plyMeshes.size()), 1, loadMeshes, "LoadPly");
+        else
+            loadMeshes(0, static_cast<uint32_t>(m_plyMeshes.size()));
+
+        for (const PlyMesh& plyMesh : m_plyMeshes)
+        {
+            if (!plyMesh.error.empty())
+            {
+                LogPrint(LogLevel::Info, "%s, leaving the scene to pbrt-parser", plyMesh.error.c_str());
+                m_needsPbrtParser = true;
+                return;
+            }
+            ++m_stats.numPlyFiles;
+            m_stats.numPlyBytes += plyMesh.fileSize;
+            m_stats.numPlyTriangles += plyMesh.mesh->index.size();
+        }
+        m_stats.plySeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - loadStart).count();
+    }
+
+    static void LoadPlyMesh(PlyMesh& plyMesh)
+    {
+        static_assert(sizeof(pbrt::vec3f) == 3 * sizeof(float) && sizeof(pbrt::vec2f) == 2 * sizeof(float) &&
+                      sizeof(pbrt::vec3i) == 3 * sizeof(int32_t), "PLY attributes are read straight into pbrt's vectors");
+        PlyMeshReader reader;
+        if (!reader.Open(plyMesh.filePath, plyMesh.error))
+            return;
+
+        pbrt::TriangleMesh& mesh = *plyMesh.mesh;
+        mesh.vertex.resize(reader.GetNumVertices());
+        reader.ReadPositions(reinterpret_cast<float*>(mesh.vertex.data()));
+        if (reader.HasNormals())
+        {
+            mesh.normal.resize(reader.GetNumVertices());
+            reader.ReadNormals(reinterpret_cast<float*>(mesh.normal.data()));
+        }
+        if (reader.HasTexcoords())
+        {
+            mesh.texcoord.resize(reader.GetNumVertices());
+            reader.ReadTexcoords(reinterpret_cast<float*>(mesh.texcoord.data()));
+        }
+        // Room for all faces is enough unless there are polygons with more than 3 corners.
+        mesh.index.resize(reader.GetNumFaces());
+        size_t numTriangles = reader.ReadTriangles(reinterpret_cast<int32_t*>(mesh.index.data()), mesh.index.size(), plyMesh.error);
+        if (numTriangles > mesh.index.size() && plyMesh.error.empty())
+        {
+            mesh.index.resize(numTriangles);
+            numTriangles = reader.ReadTriangles(reinterpret_cast<int32_t*>(mesh.index.data()), mesh.index.size(), plyMesh.error);
+        }
+        mesh.index.resize(numTriangles);
+        if (!plyMesh.error.empty())
+        {
+            plyMesh.error = plyMesh.filePath + ": " + plyMesh.error;
+            return;
+        }
+        plyMesh.fileSize = reader.GetFileSize();
+
+        if (!plyMesh.transform.IsIdentity())
+        {
+            const pbrt::affine3f transform = plyMesh.transform.ToAffine();
+            for (pbrt::vec3f& vertex : mesh.vertex)
+                vertex = transform * vertex;
+            const pbrt::linear3f normalTransform = pbrt::math::inverse_transpose(transform.l);
+            for (pbrt::vec3f& normal : mesh.normal)
+                normal = normalTransform * normal;
+        }
+    }
+
+    static pbrt::vec3f MakeVec3f(float x, float y, float z)
+    {
+        pbrt::vec3f vector;
+        vector.x = x;
+        vector.y = y;
+        vector.z = z;
+        return vector;
+    }
+
+    // Positional arguments.
+
+    const Token& GetArgument(const Statement& statement, uint32_t index, TokenType type) const
+    {
+        if (statement.arguments + index >= statement.argumentsEnd || statement.arguments[index].type != type)
+            statement.file->ThrowError(statement.name->text, "Missing or invalid arguments of " + statement.name->ToString());
+        return statement.arguments[index];
+    }
+
+    float GetNumberArgument(const Statement& statement, uint32_t index) const
+    {
+        return static_cast<float>(GetArgument(statement, index, TokenType::Number).number);
+    }
+
+    Float3 GetFloat3Argument(const Statement& statement, uint32_t index) const
+    {
+        return Float3(GetNumberArgument(statement, index), GetNumberArgument(statement, index + 1), GetNumberArgument(statement, index + 2));
+    }
+
+    std::string GetStringArgument(const Statement& statement, uint32_t index) const
+    {
+        return GetArgument(statement, index, TokenType::String).ToString();
+    }
+
+    std::vector<float> GetMatrixArgument(const Statement& statement) const
+    {
+        std::vector<float> matrix;
+        if (statement.arguments != statement.argumentsEnd && statement.arguments->type == TokenType::FloatArray)
+            matrix = statement.file->floatArrays[statement.arguments->arrayIndex];
+        else
+        {
+            for (const Token* token = statement.arguments; token != statement.argumentsEnd && token->type == TokenType::Number; ++token)
+                matrix.push_back(static_cast<float>(token->number));
+        }
+        if (matrix.size() != 16)
+            statement.file->ThrowError(statement.name->text, statement.name->ToString() + " needs 16 numbers");
+        return matrix;
+    }
+
+    // Parameters, declared by a string with type and name followed by the value.
+
+    const Token* FindParameter(const Statement& statement, const char* type, const char* name) const
+    {
+        const size_t typeLength = strlen(type);
+        const size_t nameLength = strlen(name);
+        for (const Token* token = statement.arguments + statement.numPositionalArguments; token + 1 < statement.argumentsEnd; token += 2)
+        {
+            if (token->type != TokenType::String)
+                statement.file->ThrowError(token->text, "Expected a parameter declaration");
+            // "type name" with any amount of whitespace around both.
+            const char* declaration = SkipSpaces(token->text, token->text + token->length);
+            const char* declarationEnd = token->text + token->length;
+            if (static_cast<size_t>(declarationEnd - declaration) <= typeLength || memcmp(declaration, type, typeLength) != 0 ||
+                static_cast<unsigned char>(declaration[typeLength]) > ' ')
+            {
+                continue;
+            }
+            const char* parameterName = SkipSpaces(declaration + typeLength, declarationEnd);
+            const char* parameterNameEnd = parameterName;
+            while (parameterNameEnd != declarationEnd && static_cast<unsigned char>(*parameterNameEnd) > ' ')
+                ++parameterNameEnd;
+            if (static_cast<size_t>(parameterNameEnd - parameterName) == nameLength && memcmp(parameterName, name, nameLength) == 0)
+                return token + 1;
+        }
+        return nullptr;
+    }
+
+    float GetFloat(const Statement& statement, const char* type, const char* name, float defaultValue) const
+    {
+        const Token* value = FindParameter(statement, type, name);
+        if (!value)
+            return defaultValue;
+        if (value->type == TokenType::Number)
+            return static_cast<float>(value->number);
+        if (value->type == TokenType::FloatArray && statement.file->floatArrays[value->arrayIndex].size() == 1)
+            return statement.file->floatArrays[value->arrayIndex][0];
+        if (value->type == TokenType::IntArray && statement.file->intArrays[value->arrayIndex].size() == 1)
+            return static_cast<float>(statement.file->intArrays[value->arrayIndex][0]);
+        statement.file->ThrowError(value->text, std::string("Invalid value of parameter '") + name + "'");
+    }
+
+    void GetColor(const Statement& statement, const char* name, pbrt::vec3f& color) const
+    {
+        const Token* value = FindParameter(statement, "rgb", name);
+        if (!value)
+            value = FindParameter(statement, "color", name);
+        if (!value)
+            return;
+        if (value->type != TokenType::FloatArray || statement.file->floatArrays[value->arrayIndex].size() != 3)
+            statement.file->ThrowError(value->text, std::string("Parameter '") + name + "' needs 3 numbers");
+        const std::vector<float>& values = statement.file->floatArrays[value->arrayIndex];
+        color = MakeVec3f(values[0], values[1], values[2]);
+    }
+
+    bool GetString(const Statement& statement, const char* name, std::string& string) const
+    {
+        const Token* value = FindParameter(statement, "string", name);
+        if (value && value->type == TokenType::String)
+            string = value->ToString();
+        else if (value && value->type == TokenType::StringArray && statement.file->stringArrays[value->arrayIndex].size() == 1)
+            string = statement.file->stringArrays[value->arrayIndex][0];
+        else
+            return false;
+        return true;
+    }
+
+    void GetBool(const Statement& statement, const char* name, bool& boolean) const
+    {
+        const Token* value = FindParameter(statement, "bool", name);
+        if (!value)
+            return;
+        std::string string;
+        if (value->type == TokenType::String || value->type == TokenType::Identifier)
+            string = value->ToString();
+        else if (value->type == TokenType::StringArray && statement.file->stringArrays[value->arrayIndex].size() == 1)
+            string = statement.file->stringArrays[value->arrayIndex][0];
+        if (string != "true" && string != "false")
+            statement.file->ThrowError(value->text, std::string("Parameter '") + name + "' needs to be true or false");
+        boolean = string == "true";
+    }
+
+    pbrt::Texture::SP GetTexture(const Statement& statement, const char* name) const
+    {
+        const Token* value = FindParameter(statement, "texture", name);
+        std::string textureName;
+        if (value && value->type == TokenType::String)
+            textureName = value->ToString();
+        else if (value && value->type == TokenType::StringArray && statement.file->stringArrays[value->arrayIndex].size() == 1)
+            textureName = statement.file->stringArrays[value->arrayIndex][0];
+        else
+            return nullptr;
+        auto textureIt = m_textures.find(textureName);
+        if (textureIt == m_textures.end())
+        {
+            LogPrint(LogLevel::Warning, "Unknown texture '%s'", textureName.c_str());
+            return nullptr;
+        }
+        return textureIt->second;
+    }
+
+    // Inline wavelength and value pairs, or an spd file with the same.
+    void GetSpectrum(const Statement& statement, const char* name, pbrt::Spectrum& spectrum) const
+    {
+        const Token* value = FindParameter(statement, "spectrum", name);
+        if (!value)
+            return;
+        std::vector<float> values;
+        if (value->type == TokenType::FloatArray)
+            values = statement.file->floatArrays[value->arrayIndex];
+        else
+        {
+            std::string fileName;
+            if (value->type == TokenType::String)
+                fileName = value->ToString();
+            else if (value->type == TokenType::StringArray && statement.file->stringArrays[value->arrayIndex].size() == 1)
+                fileName = statement.file->stringArrays[value->arrayIndex][0];
+            MappedFile file;
+            if (fileName.empty() || !file.Open(m_sceneDirectory + "/" + fileName))
+            {
+                LogPrint(LogLevel::Warning, "Failed to read spectrum of parameter '%s' from '%s'", name, fileName.c_str());
+                return;
+            }
+            const char* cur = reinterpret_cast<const char*>(file.GetData());
+            const char* end = cur + file.GetSize();
+            while ((cur = SkipWhitespaceAndComments(cur, end)) != end)
+            {
+                double number;
+                cur = ParsePbrtNumber(cur, end, number);
+                if (!cur)
+                {
+                    LogPrint(LogLevel::Warning, "Invalid spectrum file '%s'", fileName.c_str());
+                    return;
+                }
+                values.push_back(static_cast<float>(number));
+            }
+        }
+        spectrum.spd.clear();
+        for (size_t i = 0; i + 1 < values.size(); i += 2)
+            spectrum.spd.push_back(std::make_pair(values[i], values[i + 1]));
+    }
+
+    std::vector<float>* GetFloatArray(const Statement& statement, const char* type, const char* name) const
+    {
+        const Token* value = FindParameter(statement, type, name);
+        return value && value->type == TokenType::FloatArray ? &statement.file->floatArrays[value->arrayIndex] : nullptr;
+    }
+
+    std::vector<std::unique_ptr<TokenizedFile>>& m_files;
+    const std::string m_sceneDirectory;
+    ThreadPool* m_threadPool;
+    PbrtTextParserStats& m_stats;
+    pbrt::Scene::SP m_scene;
+
+    GraphicsState m_state;
+    Transform m_transform;
+    bool m_transformStart;
+    std::vector<PushedAttributes> m_pushedAttributes;
+    std::vector<Transform> m_pushedTransforms;
+    std::unordered_map<std::string, Transform> m_namedCoordinateSystems;
+
+    std::unordered_map<std::string, pbrt::Material::SP> m_namedMaterials;
+    std::unordered_map<std::string, pbrt::Texture::SP> m_textures;
+    std::unordered_map<std::string, pbrt::Object::SP> m_objects;
+    pbrt::Object::SP m_currentObject;
+    std::vector<PlyMesh> m_plyMeshes;
+
+    std::unordered_set<std::string> m_reportedDirectives;
+    std::unordered_set<std::string> m_reportedShapeTypes;
+    bool m_needsPbrtParser;
+};
+
+pbrt::Scene::SP ParsePbrtTextScene(const std::string& filePath, ThreadPool* threadPool, PbrtTextParserStats* stats)
+{
+    const auto tokenizeStart = std::chrono::high_resolution_clock::now();
+
+    // Same as pbrt, included files are relative to the directory of the scene file.
+    const size_t directoryEnd = filePath.find_last_of("/\\");
+    const std::string sceneDirectory = directoryEnd == std::string::npos ? "." : filePath.substr(0, directoryEnd);
+
+    // All files of an include level are tokenized in parallel, which finds the files of the next level.
+    std::vector<std::unique_ptr<TokenizedFile>> files;
+    files.emplace_back(new TokenizedFile());
+    files[0]->path = filePath;
+    size_t levelBegin = 0;
+    while (levelBegin < files.size())
+    {
+        const size_t levelEnd = files.size();
+        auto tokenizeFiles = [&files, levelBegin](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t fileIdx = begin; fileIdx < end; ++fileIdx)
+            {
+                TokenizedFile& file = *files[levelBegin + fileIdx];
+                try
+                {
+                    if (!file.file.Open(file.path))
+                        file.error = "Failed to open " + file.path;
+                    else
+                        Tokenize(file);
+                }
+                catch (std::exception& exception)
+                {
+                    file.error = exception.what();
+                }
+            }
+        };
+        if (threadPool && levelEnd - levelBegin > 1)
+            threadPool->ParallelFor(0, static_cast<uint32_t>(levelEnd - levelBegin), 1, tokenizeFiles, "TokenizePbrt");
+        else
+            tokenizeFiles(0, static_cast<uint32_t>(levelEnd - levelBegin));
+
+        for (size_t fileIdx = levelBegin; fileIdx < levelEnd; ++fileIdx)
+        {
+            TokenizedFile& file = *files[fileIdx];
+            if (!file.error.empty())
+                throw std::runtime_error(file.error);
+            for (const auto& include : file.includes)
+            {
+                if (file.includeDepth >= 32)
+                    file.ThrowError(file.tokens[include.first].text, "Files are included more than 32 levels deep");
+                file.includedFiles.push_back(static_cast<uint32_t>(files.size()));
+                files.emplace_back(new TokenizedFile());
+                files.back()->path = IsAbsolutePath(include.second) ? include.second : sceneDirectory + "/" + include.second;
+                files.back()->includeDepth = file.includeDepth + 1;
+            }
+        }
+        levelBegin = levelEnd;
+    }
+
+    const auto buildStart = std::chrono::high_resolution_clock::now();
+    PbrtTextParserStats buildStats;
+    pbrt::Scene::SP scene = PbrtSceneBuilder(files, sceneDirectory, threadPool, buildStats).Build();
+
+    if (stats)
+    {
+        *stats = buildStats;
+        stats->numFiles = files.size();
+        for (const auto& file : files)
+        {
+            stats->numBytes += file->file.GetSize();
+            stats->numNumbers += file->numNumbers;
+        }
+        stats->tokenizeSeconds = std::chrono::duration<double>(buildStart - tokenizeStart).count();
+        stats->buildSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - buildStart).count();
+    }
+    return scene;
+}
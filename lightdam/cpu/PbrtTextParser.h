@@ -0,0 +1,31 @@
+#pragma once
+
+#include "pbrtParser/Scene.h"
+#include <cstddef>
+#include <string>
+
+class ThreadPool;
+
+struct PbrtTextParserStats
+{
+    size_t numFiles = 0;        // The scene file and all files it includes.
+    size_t numBytes = 0;
+    size_t numNumbers = 0;      // Numbers in parameter arrays.
+    double tokenizeSeconds = 0.0;
+    double buildSeconds = 0.0;  // Creating the scene objects from the tokens, including the PLY files.
+    size_t numPlyFiles = 0;     // Meshes of plymesh shapes.
+    size_t numPlyBytes = 0;
+    size_t numPlyTriangles = 0;
+    double plySeconds = 0.0;
+};
+
+// Parser for pbrt v3 text files that creates the same scene objects as pbrt::importPBRT for everything CpuScene imports.
+// Exported scenes are mostly huge number arrays, which are parsed right from the memory mapped files into arrays of the
+// parameter's type. Included files are tokenized and binary PLY files are read in parallel on the thread pool if there is one.
+// Returns null if the scene uses something only pbrt-parser supports (ASCII PLY files), throws std::runtime_error on syntax errors.
+pbrt::Scene::SP ParsePbrtTextScene(const std::string& filePath, ThreadPool* threadPool = nullptr, PbrtTextParserStats* stats = nullptr);
+
+// Parses the number at the start of [begin, end) to the same double as strtod, returns the end of the number or null if there is none.
+// Numbers with up to 15 significant digits and decimal exponents of at most 22 are converted with a single exact multiplication
+// or division of two doubles, all others are left to strtod.
+const char* ParsePbrtNumber(const char* begin, const char* end, double& value);
@@ -0,0 +1,488 @@
+#include "PlyMeshReader.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <emmintrin.h>
+
+PlyMeshReader::PlyMeshReader()
+    : m_bigEndian(false)
+    , m_positionProperties{ -1, -1, -1 }
+    , m_normalProperties{ -1, -1, -1 }
+    , m_texcoordProperties{ -1, -1 }
+    , m_indexProperty(-1)
+{
+}
+
+uint32_t PlyMeshReader::GetSize(Type type)
+{
+    switch (type)
+    {
+    case Type::Int8:
+    case Type::Uint8:
+        return 1;
+    case Type::Int16:
+    case Type::Uint16:
+        return 2;
+    case Type::Int32:
+    case Type::Uint32:
+    case Type::Float32:
+        return 4;
+    default:
+        return 8;
+    }
+}
+
+bool PlyMeshReader::ParseType(const std::string& name, Type& type)
+{
+    static const struct { const char* name; Type type; } types[] =
+    {
+        { "char", Type::Int8 }, { "int8", Type::Int8 }, { "uchar", Type::Uint8 }, { "uint8", Type::Uint8 },
+        { "short", Type::Int16 }, { "int16", Type::Int16 }, { "ushort", Type::Uint16 }, { "uint16", Type::Uint16 },
+        { "int", Type::Int32 }, { "int32", Type::Int32 }, { "uint", Type::Uint32 }, { "uint32", Type::Uint32 },
+        { "float", Type::Float32 }, { "float32", Type::Float32 }, { "double", Type::Float64 }, { "float64", Type::Float64 },
+    };
+    for (const auto& entry : types)
+    {
+        if (name == entry.name)
+        {
+            type = entry.type;
+            return true;
+        }
+    }
+    return false;
+}
+
+int PlyMeshReader::FindProperty(const Element& element, std::initializer_list<const char*> names)
+{
+    for (const char* name : names)
+    {
+        for (size_t propertyIdx = 0; propertyIdx < element.properties.size(); ++propertyIdx)
+        {
+            if (element.properties[propertyIdx].name == name)
+                return static_cast<int>(propertyIdx);
+        }
+    }
+    return -1;
+}
+
+// Shifts that compilers turn into single byte swap instructions.
+static uint8_t SwapBytes(uint8_t value)     { return value; }
+static uint16_t SwapBytes(uint16_t value)   { return static_cast<uint16_t>((value >> 8) | (value << 8)); }
+static uint32_t SwapBytes(uint32_t value)   { return (value >> 24) | ((value >> 8) & 0xff00) | ((value << 8) & 0xff0000) | (value << 24); }
+static uint64_t SwapBytes(uint64_t value)   { return (static_cast<uint64_t>(SwapBytes(static_cast<uint32_t>(value))) << 32) | SwapBytes(static_cast<uint32_t>(value >> 32)); }
+
+template<size_t Size> struct UnsignedOfSize;
+template<> struct UnsignedOfSize<1> { using Type = uint8_t; };
+template<> struct UnsignedOfSize<2> { using Type = uint16_t; };
+template<> struct UnsignedOfSize<4> { using Type = uint32_t; };
+template<> struct UnsignedOfSize<8> { using Type = uint64_t; };
+
+// Values in the file's byte order, the hosts we build for are all little endian.
+template<typename S>
+static S LoadValue(const uint8_t* value, bool bigEndian)
+{
+    typename UnsignedOfSize<sizeof(S)>::Type bits;
+    memcpy(&bits, value, sizeof(S));
+    if (bigEndian)
+        bits = SwapBytes(bits);
+    S result;
+    memcpy(&result, &bits, sizeof(S));
+    return result;
+}
+
+template<typename T>
+T PlyMeshReader::Read(const uint8_t* value, Type type) const
+{
+    switch (type)
+    {
+    case Type::Int8:    return static_cast<T>(LoadValue<int8_t>(value, m_bigEndian));
+    case Type::Uint8:   return static_cast<T>(LoadValue<uint8_t>(value, m_bigEndian));
+    case Type::Int16:   return static_cast<T>(LoadValue<int16_t>(value, m_bigEndian));
+    case Type::Uint16:  return static_cast<T>(LoadValue<uint16_t>(value, m_bigEndian));
+    case Type::Int32:   return static_cast<T>(LoadValue<int32_t>(value, m_bigEndian));
+    case Type::Uint32:  return static_cast<T>(LoadValue<uint32_t>(value, m_bigEndian));
+    case Type::Float32: return static_cast<T>(LoadValue<float>(value, m_bigEndian));
+    default:            return static_cast<T>(LoadValue<double>(value, m_bigEndian));
+    }
+}
+
+const uint8_t* PlyMeshReader::Skip(const Property& property, const uint8_t* value) const
+{
+    const size_t remainingBytes = m_file.GetData() + m_file.GetSize() - value;
+    if (!property.isList)
+        return GetSize(property.type) <= remainingBytes ? value + GetSize(property.type) : nullptr;
+
+    const uint32_t countSize = GetSize(property.countType);
+    if (countSize > remainingBytes)
+        return nullptr;
+    const size_t listSize = Read<uint32_t>(value, property.countType) * static_cast<size_t>(GetSize(property.type));
+    return listSize <= remainingBytes - countSize ? value + countSize + listSize : nullptr;
+}
+
+bool PlyMeshReader::Open(const std::string& filePath, std::string& error)
+{
+    m_bigEndian = false;
+    m_vertices = Element();
+    m_faces = Element();
+    std::fill(m_positionProperties, m_positionProperties + 3, -1);
+    std::fill(m_normalProperties, m_normalProperties + 3, -1);
+    std::fill(m_texcoordProperties, m_texcoordProperties + 2, -1);
+    m_indexProperty = -1;
+    if (!m_file.Open(filePath))
+    {
+        error = "Failed to open " + filePath;
+        return false;
+    }
+
+    // The header is ASCII text, one keyword with its arguments per line.
+    const char* cur = reinterpret_cast<const char*>(m_file.GetData());
+    const char* end = cur + m_file.GetSize();
+    std::vector<Element> elements;
+    bool hasFormat = false;
+    bool isFirstLine = true;
+    for (;;)
+    {
+        if (cur == end)
+        {
+            error = filePath + " has no complete PLY header";
+            return false;
+        }
+        const char* lineEnd = std::find(cur, end, '\n');
+        std::vector<std::string> words;
+        for (const char* word = cur; word != lineEnd;)
+        {
+            if (*word == ' ' || *word == '\t' || *word == '\r')
+            {
+                ++word;
+                continue;
+            }
+            const char* wordEnd = word;
+            while (wordEnd != lineEnd && *wordEnd != ' ' && *wordEnd != '\t' && *wordEnd != '\r')
+                ++wordEnd;
+            words.emplace_back(word, wordEnd);
+            word = wordEnd;
+        }
+        cur = lineEnd == end ? end : lineEnd + 1;
+
+        if (isFirstLine)
+        {
+            if (words.size() != 1 || words[0] != "ply")
+            {
+                error = filePath + " is no PLY file";
+                return false;
+            }
+            isFirstLine = false;
+        }
+        else if (words.empty() || words[0] == "comment" || words[0] == "obj_info")
+            continue;
+        else if (words[0] == "format" && words.size() >= 2)
+        {
+            if (words[1] == "ascii")
+            {
+                error = filePath + " is an ASCII PLY file, only binary ones are supported";
+                return false;
+            }
+            if (words[1] != "binary_little_endian" && words[1] != "binary_big_endian")
+            {
+                error = filePath + " has the unknown PLY format " + words[1];
+                return false;
+            }
+            m_bigEndian = words[1] == "binary_big_endian";
+            hasFormat = true;
+        }
+        else if (words[0] == "element" && words.size() == 3)
+        {
+            elements.emplace_back();
+            elements.back().name = words[1];
+            elements.back().count = strtoull(words[2].c_str(), nullptr, 10);
+        }
+        else if (words[0] == "property" && !elements.empty() &&
+                 (words.size() == 3 || (words.size() == 5 && words[1] == "list")))
+        {
+            Property property;
+            property.isList = words.size() == 5;
+            property.name = words.back();
+            property.countType = Type::Uint8;
+            property.offset = 0;
+            if (!ParseType(words[words.size() - 2], property.type) || (property.isList && !ParseType(words[2], property.countType)))
+            {
+                error = filePath + " has a property of unknown type";
+                return false;
+            }
+            elements.back().properties.push_back(property);
+        }
+        else if (words[0] == "end_header")
+            break;
+        else
+        {
+            error = filePath + " has the invalid PLY header line '" + words[0] + "...'";
+            return false;
+        }
+    }
+    if (!hasFormat)
+    {
+        error = filePath + " has no PLY format line";
+        return false;
+    }
+
+    // Elements are stored one after another, all records of an element with lists need to be skipped one by one.
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(cur);
+    const uint8_t* dataEnd = m_file.GetData() + m_file.GetSize();
+    for (Element& element : elements)
+    {
+        element.recordSize = 0;
+        for (Property& property : element.properties)
+        {
+            if (property.isList)
+            {
+                element.recordSize = 0;
+                break;
+            }
+            property.offset = element.recordSize;
+            element.recordSize += GetSize(property.type);
+        }
+        element.data = data;
+
+        if (element.name == "vertex")
+            m_vertices = element;
+        else if (element.name == "face")
+            m_faces = element;
+        if (m_vertices.data && m_faces.data)
+            break;
+
+        if (element.recordSize > 0)
+        {
+            if (element.count > static_cast<size_t>(dataEnd - data) / element.recordSize)
+                data = nullptr;
+            else
+                data += element.count * element.recordSize;
+        }
+        else
+        {
+            for (size_t recordIdx = 0; recordIdx < element.count && data; ++recordIdx)
+            {
+                for (const Property& property : element.properties)
+                {
+                    data = Skip(property, data);
+                    if (!data)
+                        break;
+                }
+            }
+        }
+        if (!data)
+        {
+            error = filePath + " is shorter than its header says";
+            return false;
+        }
+    }
+
+    if (!m_vertices.data || !m_faces.data)
+    {
+        error = filePath + " has no vertex or face element";
+        return false;
+    }
+    if (m_vertices.recordSize == 0)
+    {
+        error = filePath + " has vertices with list properties";
+        return false;
+    }
+    if (m_vertices.count > static_cast<size_t>(dataEnd - m_vertices.data) / m_vertices.recordSize)
+    {
+        error = filePath + " is shorter than its header says";
+        return false;
+    }
+    if (!FindVertexAttribute({ { "x" }, { "y" }, { "z" } }, m_positionProperties))
+    {
+        error = filePath + " has no vertex positions";
+        return false;
+    }
+    FindVertexAttribute({ { "nx" }, { "ny" }, { "nz" } }, m_normalProperties);
+    FindVertexAttribute({ { "u", "s", "texture_u", "texture_s" }, { "v", "t", "texture_v", "texture_t" } }, m_texcoordProperties);
+    m_indexProperty = FindProperty(m_faces, { "vertex_indices", "vertex_index" });
+    if (m_indexProperty < 0 || !m_faces.properties[m_indexProperty].isList)
+    {
+        error = filePath + " has no vertex index lists";
+        return false;
+    }
+    return true;
+}
+
+bool PlyMeshReader::FindVertexAttribute(std::initializer_list<std::initializer_list<const char*>> componentNames, int* properties) const
+{
+    int componentIdx = 0;
+    for (const auto& names : componentNames)
+        properties[componentIdx++] = FindProperty(m_vertices, names);
+    if (std::find(properties, properties + componentIdx, -1) == properties + componentIdx)
+        return true;
+    std::fill(properties, properties + componentIdx, -1);
+    return false;
+}
+
+void PlyMeshReader::ReadVertexAttribute(const int* properties, uint32_t numComponents, float* output) const
+{
+    const size_t numVertices = m_vertices.count;
+    const size_t stride = m_vertices.recordSize;
+    const uint32_t offset = m_vertices.properties[properties[0]].offset;
+
+    bool isPackedFloat = !m_bigEndian;
+    for (uint32_t componentIdx = 0; componentIdx < numComponents; ++componentIdx)
+    {
+        const Property& property = m_vertices.properties[properties[componentIdx]];
+        isPackedFloat &= property.type == Type::Float32 && property.offset == offset + componentIdx * sizeof(float);
+    }
+    if (!isPackedFloat)
+    {
+        // One component after another, so that the type is only looked at once.
+        for (uint32_t componentIdx = 0; componentIdx < numComponents; ++componentIdx)
+        {
+            const Property& property = m_vertices.properties[properties[componentIdx]];
+            auto convert = [&](auto typeTag)
+            {
+                using S = decltype(typeTag);
+                for (size_t vertexIdx = 0; vertexIdx < numVertices; ++vertexIdx)
+                    output[vertexIdx * numComponents + componentIdx] = static_cast<float>(LoadValue<S>(m_vertices.data + vertexIdx * stride + property.offset, m_bigEndian));
+            };
+            switch (property.type)
+            {
+            case Type::Int8:    convert(int8_t()); break;
+            case Type::Uint8:   convert(uint8_t()); break;
+            case Type::Int16:   convert(int16_t()); break;
+            case Type::Uint16:  convert(uint16_t()); break;
+            case Type::Int32:   convert(int32_t()); break;
+            case Type::Uint32:  convert(uint32_t()); break;
+            case Type::Float32: convert(float()); break;
+            default:            convert(double()); break;
+            }
+        }
+        return;
+    }
+
+    const uint8_t* input = m_vertices.data + offset;
+    const size_t attributeSize = numComponents * sizeof(float);
+    if (stride == attributeSize)
+        memcpy(output, input, numVertices * attributeSize);
+    else if (numComponents == 3 && numVertices > 0)
+    {
+        // Moves 16 bytes, the 4th float is overwritten by the next vertex and the reads stay in the next record.
+        for (size_t vertexIdx = 0; vertexIdx + 1 < numVertices; ++vertexIdx)
+            _mm_storeu_ps(output + vertexIdx * 3, _mm_loadu_ps(reinterpret_cast<const float*>(input + vertexIdx * stride)));
+        memcpy(output + (numVertices - 1) * 3, input + (numVertices - 1) * stride, attributeSize);
+    }
+    else if (numComponents == 2)
+    {
+        for (size_t vertexIdx = 0; vertexIdx < numVertices; ++vertexIdx)
+            memcpy(output + vertexIdx * 2, input + vertexIdx * stride, 2 * sizeof(float));
+    }
+    else
+    {
+        for (size_t vertexIdx = 0; vertexIdx < numVertices; ++vertexIdx)
+            memcpy(output + vertexIdx * numComponents, input + vertexIdx * stride, attributeSize);
+    }
+}
+
+void PlyMeshReader::ReadPositions(float* positions) const
+{
+    ReadVertexAttribute(m_positionProperties, 3, positions);
+}
+
+void PlyMeshReader::ReadNormals(float* normals) const
+{
+    if (HasNormals())
+        ReadVertexAttribute(m_normalProperties, 3, normals);
+}
+
+void PlyMeshReader::ReadTexcoords(float* texcoords) const
+{
+    if (HasTexcoords())
+        ReadVertexAttribute(m_texcoordProperties, 2, texcoords);
+}
+
+const uint8_t* PlyMeshReader::ReadFace(const uint8_t* record, int32_t* indices, size_t maxTriangles, size_t& numTriangles, std::string& error) const
+{
+    for (size_t propertyIdx = 0; propertyIdx < m_faces.properties.size(); ++propertyIdx)
+    {
+        const Property& property = m_faces.properties[propertyIdx];
+        const uint8_t* next = Skip(property, record);
+        if (!next)
+        {
+            error = "Faces run past the end of the file";
+            return nullptr;
+        }
+        if (static_cast<int>(propertyIdx) == m_indexProperty)
+        {
+            const uint32_t numCorners = Read<uint32_t>(record, property.countType);
+            const uint8_t* corners = record + GetSize(property.countType);
+            const uint32_t indexSize = GetSize(property.type);
+            int32_t triangle[3] = {};
+            for (uint32_t cornerIdx = 0; cornerIdx < numCorners; ++cornerIdx)
+            {
+                const int64_t index = Read<int64_t>(corners + cornerIdx * indexSize, property.type);
+                if (index < 0 || index >= GetNumVertices())
+                {
+                    error = "Vertex index out of range";
+                    return nullptr;
+                }
+                // Fan around the first corner.
+                triangle[std::min(cornerIdx, 2u)] = static_cast<int32_t>(index);
+                if (cornerIdx >= 2)
+                {
+                    if (numTriangles < maxTriangles)
+                        memcpy(indices + numTriangles * 3, triangle, sizeof(triangle));
+                    ++numTriangles;
+                    triangle[1] = triangle[2];
+                }
+            }
+        }
+        record = next;
+    }
+    return record;
+}
+
+size_t PlyMeshReader::ReadTriangles(int32_t* indices, size_t maxTriangles, std::string& error) const
+{
+    const uint8_t* end = m_file.GetData() + m_file.GetSize();
+    const uint8_t* record = m_faces.data;
+    const Property& indexProperty = m_faces.properties[m_indexProperty];
+    size_t numTriangles = 0;
+
+    // Faces with nothing but a uchar count and 32 bit indices are 13 byte records, runs of triangles are copied as they are.
+    // Negative indices become large unsigned ones, so a single maximum finds all indices out of range.
+    const bool isTriangleRecord = !m_bigEndian && m_faces.properties.size() == 1 && indexProperty.countType == Type::Uint8 &&
+                                  (indexProperty.type == Type::Int32 || indexProperty.type == Type::Uint32);
+    const size_t triangleRecordSize = 1 + 3 * sizeof(uint32_t);
+    uint32_t maxIndex = 0;
+
+    size_t faceIdx = 0;
+    while (faceIdx < m_faces.count)
+    {
+        if (isTriangleRecord)
+        {
+            const size_t numRecords = std::min(std::min(m_faces.count - faceIdx, maxTriangles - std::min(numTriangles, maxTriangles)),
+                                               static_cast<size_t>(end - record) / triangleRecordSize);
+            const size_t runEnd = faceIdx + numRecords;
+            for (; faceIdx < runEnd && record[0] == 3; ++faceIdx, ++numTriangles, record += triangleRecordSize)
+            {
+                uint32_t triangle[3];
+                memcpy(triangle, record + 1, sizeof(triangle));
+                memcpy(indices + numTriangles * 3, triangle, sizeof(triangle));
+                maxIndex = std::max(maxIndex, std::max(triangle[0], std::max(triangle[1], triangle[2])));
+            }
+            if (faceIdx == m_faces.count)
+                break;
+        }
+
+        // Polygons, faces that don't fit into the indices and everything that is no triangle record.
+        record = ReadFace(record, indices, maxTriangles, numTriangles, error);
+        if (!record)
+            return 0;
+        ++faceIdx;
+    }
+
+    if (maxIndex >= GetNumVertices())
+    {
+        error = "Vertex index out of range";
+        return 0;
+    }
+    return numTriangles;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "../MappedFile.h"
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+// Reader for binary PLY triangle meshes, like the ones pbrt's plymesh shapes reference.
+// The file is memory mapped and every attribute is copied or converted right into the caller's arrays. The common layout of
+// float vertex attributes and triangles as uchar counted lists of int indices is copied without looking at single values,
+// all others go through a slower path that converts every value on its own. Polygons are split into triangle fans.
+class PlyMeshReader
+{
+public:
+    PlyMeshReader();
+
+    // Maps the file and reads its header. Fails for ASCII files and files without vertex positions or faces.
+    bool Open(const std::string& filePath, std::string& error);
+
+    size_t GetFileSize() const      { return m_file.GetSize(); }
+    uint32_t GetNumVertices() const { return static_cast<uint32_t>(m_vertices.count); }
+    // Same as the number of triangles if all faces are triangles.
+    uint32_t GetNumFaces() const    { return static_cast<uint32_t>(m_faces.count); }
+    bool HasNormals() const         { return m_normalProperties[0] >= 0; }
+    bool HasTexcoords() const       { return m_texcoordProperties[0] >= 0; }
+
+    // Arrays need room for 3 (positions, normals) or 2 (texcoords) floats per vertex.
+    void ReadPositions(float* positions) const;
+    void ReadNormals(float* normals) const;
+    void ReadTexcoords(float* texcoords) const;
+
+    // Writes the indices of at most maxTriangles triangles and returns how many triangles there are in total,
+    // call again with more room if that is more. Sets the error for out of range indices and faces past the end of the file.
+    size_t ReadTriangles(int32_t* indices, size_t maxTriangles, std::string& error) const;
+
+private:
+    enum class Type : uint8_t
+    {
+        Int8, Uint8, Int16, Uint16, Int32, Uint32, Float32, Float64,
+    };
+
+    struct Property
+    {
+        std::string name;
+        Type type;
+        bool isList;
+        Type countType;     // Of lists.
+        uint32_t offset;    // Within the record of elements without lists.
+    };
+
+    struct Element
+    {
+        std::string name;
+        size_t count = 0;
+        std::vector<Property> properties;
+        uint32_t recordSize = 0;        // 0 if the element has lists.
+        const uint8_t* data = nullptr;
+    };
+
+    static uint32_t GetSize(Type type);
+    static bool ParseType(const std::string& name, Type& type);
+    static int FindProperty(const Element& element, std::initializer_list<const char*> names);
+    // Null if the property runs past the end of the file.
+    const uint8_t* Skip(const Property& property, const uint8_t* value) const;
+    template<typename T> T Read(const uint8_t* value, Type type) const;
+    bool FindVertexAttribute(std::initializer_list<std::initializer_list<const char*>> componentNames, int* properties) const;
+    void ReadVertexAttribute(const int* properties, uint32_t numComponents, float* output) const;
+    // Returns the next record, null on errors.
+    const uint8_t* ReadFace(const uint8_t* record, int32_t* indices, size_t maxTriangles, size_t& numTriangles, std::string& error) const;
+
+    MappedFile m_file;
+    bool m_bigEndian;
+    Element m_vertices;
+    Element m_faces;
+    int m_positionProperties[3];
+    int m_normalProperties[3];
+    int m_texcoordProperties[2];
+    int m_indexProperty;
+};
@@ -0,0 +1,703 @@
+#include "SceneIntersector.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+static std::vector<MeshTriangle> GetAllTriangles(const CpuScene& scene)
+{
+    std::vector<MeshTriangle> triangles;
+    for (uint32_t meshIndex = 0; meshIndex < scene.meshes.size(); ++meshIndex)
+    {
+        for (uint32_t primitiveIndex = 0; primitiveIndex < scene.meshes[meshIndex].indices.size() / 3; ++primitiveIndex)
+            triangles.push_back({ meshIndex, primitiveIndex });
+    }
+    return triangles;
+}
+
+SceneIntersector::SceneIntersector(const CpuScene& scene, ThreadPool* threadPool, BvhBuilder builder, BvhLayout layout)
+    : SceneIntersector(scene, GetAllTriangles(scene), threadPool, builder, layout)
+{
+}
+
+SceneIntersector::SceneIntersector()
+    : m_layout(BvhLayout::Binary)
+    , m_numTriangles(0)
+    , m_numBinaryNodes(0)
+    , m_binaryDepth(0)
+    , m_nodes(nullptr)
+    , m_wideNodes(nullptr)
+    , m_quantizedNodes(nullptr)
+    , m_leafTriangles(nullptr)
+    , m_leafBlocks(nullptr)
+    , m_numNodes(0)
+    , m_numLeafEntries(0)
+{
+}
+
+SceneIntersector::SceneIntersector(const CpuScene& scene, const std::vector<MeshTriangle>& meshTriangles, ThreadPool* threadPool, BvhBuilder builder, BvhLayout layout)
+    : SceneIntersector()
+{
+    std::vector<Triangle> triangles;
+    std::vector<Aabb> triangleBounds;
+    triangles.reserve(meshTriangles.size());
+    triangleBounds.reserve(meshTriangles.size());
+    for (const MeshTriangle& meshTriangle : meshTriangles)
+    {
+        const CpuScene::Mesh& mesh = scene.meshes[meshTriangle.meshIndex];
+        const Float3& v0 = mesh.positions[mesh.indices[meshTriangle.primitiveIndex * 3 + 0]];
+        const Float3& v1 = mesh.positions[mesh.indices[meshTriangle.primitiveIndex * 3 + 1]];
+        const Float3& v2 = mesh.positions[mesh.indices[meshTriangle.primitiveIndex * 3 + 2]];
+        triangles.push_back({ v0, v1 - v0, v2 - v0, meshTriangle.meshIndex, meshTriangle.primitiveIndex });
+
+        Aabb bounds;
+        bounds.Extend(v0);
+        bounds.Extend(v1);
+        bounds.Extend(v2);
+        triangleBounds.push_back(bounds);
+    }
+
+    if (builder == BvhBuilder::SpatialSplits)
+    {
+        // Clipping needs the actual vertices.
+        std::vector<Float3> triangleVertices;
+        triangleVertices.reserve(triangles.size() * 3);
+        for (const Triangle& triangle : triangles)
+        {
+            const CpuScene::Mesh& mesh = scene.meshes[triangle.meshIndex];
+            for (int vertex = 0; vertex < 3; ++vertex)
+                triangleVertices.push_back(mesh.positions[mesh.indices[triangle.primitiveIndex * 3 + vertex]]);
+        }
+        m_bvh = Bvh::BuildSpatialSplits(triangleVertices, BvhSpatialSplitSettings(), threadPool);
+    }
+    else
+        m_bvh = Bvh::Build(builder, triangleBounds, threadPool);
+
+    // Store triangles in leaf order, so leaves reference a consecutive range and primitiveIndices is no longer needed.
+    // Triangles referenced by several leaves of a spatial split BVH are stored once per leaf.
+    m_triangles.reserve(m_bvh.primitiveIndices.size());
+    for (uint32_t triangleIndex : m_bvh.primitiveIndices)
+        m_triangles.push_back(triangles[triangleIndex]);
+
+    m_numTriangles = static_cast<uint32_t>(triangles.size());
+    m_numBinaryNodes = static_cast<uint32_t>(m_bvh.nodes.size());
+    m_binaryDepth = m_bvh.ComputeDepth();
+    if (!m_bvh.nodes.empty())
+        m_bounds = Aabb(m_bvh.nodes[0].boundsMin, m_bvh.nodes[0].boundsMax);
+    if (layout != BvhLayout::Binary && CpuSupportsAvx2() && !m_bvh.nodes.empty())
+        CollapseToWide(scene, layout);
+    UseBuiltData();
+}
+
+void SceneIntersector::CollapseToWide(const CpuScene& scene, BvhLayout layout)
+{
+    // Repack every leaf into a block, with the original positions so that shared vertices stay bit identical.
+    m_bvh8 = Bvh8::Collapse(m_bvh);
+    // Traversal of the wide layouts never reads the binary BVH.
+    m_bvh = Bvh();
+    uint32_t numLeaves = 0;
+    for (const Bvh8Node& node : m_bvh8.nodes)
+    {
+        for (uint32_t child : node.children)
+            numLeaves += child != Bvh8Node::EmptyChild && Bvh8Node::IsLeaf(child) ? 1 : 0;
+    }
+    m_triangleBlocks.reserve(numLeaves);
+    for (Bvh8Node& node : m_bvh8.nodes)
+    {
+        for (uint32_t& child : node.children)
+        {
+            if (child == Bvh8Node::EmptyChild || !Bvh8Node::IsLeaf(child))
+                continue;
+
+            TriangleBlock8 block = {};
+            const uint32_t firstTriangle = Bvh8Node::GetFirstPrimitive(child);
+            const uint32_t numTriangles = Bvh8Node::GetNumPrimitives(child);
+            for (uint32_t lane = 0; lane < numTriangles; ++lane)
+            {
+                const Triangle& triangle = m_triangles[firstTriangle + lane];
+                const CpuScene::Mesh& mesh = scene.meshes[triangle.meshIndex];
+                for (int vertex = 0; vertex < 3; ++vertex)
+                {
+                    const Float3& position = mesh.positions[mesh.indices[triangle.primitiveIndex * 3 + vertex]];
+                    for (int axis = 0; axis < 3; ++axis)
+                        block.vertices[vertex][axis][lane] = position[axis];
+                }
+                block.meshIndex[lane] = triangle.meshIndex;
+                block.primitiveIndex[lane] = triangle.primitiveIndex;
+            }
+            child = Bvh8Node::MakeLeaf(static_cast<uint32_t>(m_triangleBlocks.size()), numTriangles);
+            m_triangleBlocks.push_back(block);
+        }
+    }
+    m_triangles.clear();
+    m_triangles.shrink_to_fit();
+    m_layout = layout;
+    if (layout != BvhLayout::WideQuantized)
+        return;
+
+    // Blocks are reordered to be consecutive for each node, just like the quantized nodes.
+    std::vector<uint32_t> leafOrder;
+    m_quantizedBvh8 = QuantizedBvh8::Quantize(m_bvh8, leafOrder);
+    std::vector<TriangleBlock8> triangleBlocks;
+    triangleBlocks.reserve(leafOrder.size());
+    for (uint32_t leaf : leafOrder)
+        triangleBlocks.push_back(m_triangleBlocks[Bvh8Node::GetFirstPrimitive(leaf)]);
+    m_triangleBlocks.swap(triangleBlocks);
+    m_bvh8 = Bvh8();
+}
+
+void SceneIntersector::UseBuiltData()
+{
+    m_nodes = m_bvh.nodes.data();
+    m_wideNodes = m_bvh8.nodes.data();
+    m_quantizedNodes = m_quantizedBvh8.nodes.data();
+    m_leafTriangles = m_triangles.data();
+    m_leafBlocks = m_triangleBlocks.data();
+    switch (m_layout)
+    {
+    case BvhLayout::Wide:
+        m_numNodes = static_cast<uint32_t>(m_bvh8.nodes.size());
+        m_numLeafEntries = static_cast<uint32_t>(m_triangleBlocks.size());
+        break;
+    case BvhLayout::WideQuantized:
+        m_numNodes = static_cast<uint32_t>(m_quantizedBvh8.nodes.size());
+        m_numLeafEntries = static_cast<uint32_t>(m_triangleBlocks.size());
+        break;
+    default:
+        m_numNodes = static_cast<uint32_t>(m_bvh.nodes.size());
+        m_numLeafEntries = static_cast<uint32_t>(m_triangles.size());
+        break;
+    }
+}
+
+std::unique_ptr<SceneIntersector> SceneIntersector::CreateReplica() const
+{
+    std::unique_ptr<SceneIntersector> replica(new SceneIntersector());
+    replica->m_layout = m_layout;
+    replica->m_numTriangles = m_numTriangles;
+    replica->m_numBinaryNodes = m_numBinaryNodes;
+    replica->m_binaryDepth = m_binaryDepth;
+    replica->m_bounds = m_bounds;
+    // Read through the traversal pointers, which also covers intersectors mapped from a cache file.
+    switch (m_layout)
+    {
+    case BvhLayout::Wide:
+        replica->m_bvh8.nodes.assign(m_wideNodes, m_wideNodes + m_numNodes);
+        replica->m_triangleBlocks.assign(m_leafBlocks, m_leafBlocks + m_numLeafEntries);
+        break;
+    case BvhLayout::WideQuantized:
+        replica->m_quantizedBvh8.nodes.assign(m_quantizedNodes, m_quantizedNodes + m_numNodes);
+        replica->m_triangleBlocks.assign(m_leafBlocks, m_leafBlocks + m_numLeafEntries);
+        break;
+    default:
+        replica->m_bvh.nodes.assign(m_nodes, m_nodes + m_numNodes);
+        replica->m_triangles.assign(m_leafTriangles, m_leafTriangles + m_numLeafEntries);
+        break;
+    }
+    replica->UseBuiltData();
+    return replica;
+}
+
+size_t SceneIntersector::GetNodeMemorySize() const
+{
+    switch (m_layout)
+    {
+    case BvhLayout::Wide:
+        return m_numNodes * sizeof(Bvh8Node);
+    case BvhLayout::WideQuantized:
+        return m_numNodes * sizeof(QuantizedBvh8Node);
+    default:
+        return m_numNodes * sizeof(BvhNode);
+    }
+}
+
+size_t SceneIntersector::GetMemorySize() const
+{
+    return m_bvh.nodes.capacity() * sizeof(BvhNode) + m_bvh.primitiveIndices.capacity() * sizeof(uint32_t) +
+           m_triangles.capacity() * sizeof(Triangle) + m_bvh8.nodes.capacity() * sizeof(Bvh8Node) +
+           m_quantizedBvh8.nodes.capacity() * sizeof(QuantizedBvh8Node) + m_triangleBlocks.capacity() * sizeof(TriangleBlock8) +
+           m_cacheFile.GetSize();
+}
+
+template<bool AnyHit>
+bool SceneIntersector::IntersectLeaf(uint32_t firstTriangle, uint32_t numTriangles, const Ray& ray, float& tMax, RayHit& hit) const
+{
+    bool anyHit = false;
+    for (uint32_t i = firstTriangle; i < firstTriangle + numTriangles; ++i)
+    {
+        // Moller-Trumbore, without backface culling.
+        const Triangle& triangle = m_leafTriangles[i];
+        const Float3 pvec = Cross(ray.direction, triangle.edge2);
+        const float det = Dot(triangle.edge1, pvec);
+        if (det == 0.0f)
+            continue;
+        const float invDet = 1.0f / det;
+        const Float3 tvec = ray.origin - triangle.v0;
+        const float u = Dot(tvec, pvec) * invDet;
+        if (u < 0.0f || u > 1.0f)
+            continue;
+        const Float3 qvec = Cross(tvec, triangle.edge1);
+        const float v = Dot(ray.direction, qvec) * invDet;
+        if (v < 0.0f || u + v > 1.0f)
+            continue;
+        const float t = Dot(triangle.edge2, qvec) * invDet;
+        if (t <= ray.tMin || t >= tMax)
+            continue;
+
+        if (AnyHit)
+            return true;
+        tMax = t;
+        anyHit = true;
+        hit.t = t;
+        hit.meshIndex = triangle.meshIndex;
+        hit.primitiveIndex = triangle.primitiveIndex;
+        hit.bary = Float2(u, v);
+        // det > 0 <=> dot(cross(edge1, edge2), direction) < 0
+        hit.frontFace = det > 0.0f;
+    }
+    return anyHit;
+}
+
+template<bool AnyHit>
+bool SceneIntersector::Traverse(const Ray& ray, RayHit& hit) const
+{
+    if (m_numNodes == 0)
+        return false;
+
+    const Float3 invDirection(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+    float tMax = ray.tMax;
+    bool anyHit = false;
+
+    // Builders never exceed Bvh::MaxDepth.
+    uint32_t stack[Bvh::MaxDepth];
+    uint32_t stackSize = 0;
+    uint32_t nodeIndex = 0;
+    if (IntersectBox(m_nodes[0], ray.origin, invDirection, ray.tMin, tMax) == INFINITY)
+        return false;
+
+    while (true)
+    {
+        const BvhNode& node = m_nodes[nodeIndex];
+        if (node.IsLeaf())
+        {
+            if (IntersectLeaf<AnyHit>(node.childOrFirstPrimitive, node.numPrimitives, ray, tMax, hit))
+            {
+                if (AnyHit)
+                    return true;
+                anyHit = true;
+            }
+        }
+        else
+        {
+            // Visit the closer child first, push the other one.
+            const uint32_t left = node.childOrFirstPrimitive;
+            const float tLeft = IntersectBox(m_nodes[left], ray.origin, invDirection, ray.tMin, tMax);
+            const float tRight = IntersectBox(m_nodes[left + 1], ray.origin, invDirection, ray.tMin, tMax);
+            if (tLeft != INFINITY && tRight != INFINITY)
+            {
+                nodeIndex = tLeft <= tRight ? left : left + 1;
+                stack[stackSize++] = tLeft <= tRight ? left + 1 : left;
+                continue;
+            }
+            if (tLeft != INFINITY)
+            {
+                nodeIndex = left;
+                continue;
+            }
+            if (tRight != INFINITY)
+            {
+                nodeIndex = left + 1;
+                continue;
+            }
+        }
+
+        if (stackSize == 0)
+            break;
+        nodeIndex = stack[--stackSize];
+    }
+
+    return anyHit;
+}
+
+// Exit distances are scaled up by 1 + 2 * gamma(3) to cover the rounding errors of the slab test (Ize 2013).
+// Otherwise rays that hit a triangle right at the bounds of its box could miss the box, breaking the watertight test.
+static const float RobustExitScale = 1.0000003576f;
+
+// One bounds plane of all children of a quantized node, with the same single rounding as QuantizedBvh8Node::Dequantize.
+TARGET_AVX2 static inline __m256 DequantizePlanes(const uint8_t* quantized, __m256 scale, __m256 origin)
+{
+    const __m256i integers = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(quantized)));
+    return _mm256_fmadd_ps(_mm256_cvtepi32_ps(integers), scale, origin);
+}
+
+template<bool Quantized>
+uint32_t SceneIntersector::GetChild(uint32_t nodeIndex, uint32_t slot) const
+{
+    if (!Quantized)
+        return m_wideNodes[nodeIndex].children[slot];
+
+    // Leaves are always single blocks, their count is not needed.
+    const QuantizedBvh8Node& node = m_quantizedNodes[nodeIndex];
+    const uint32_t offset = node.meta[slot] & QuantizedBvh8Node::SlotOffsetMask;
+    return (node.meta[slot] & QuantizedBvh8Node::LeafSlot) ? Bvh8Node::MakeLeaf(node.firstLeaf + offset, 1) : node.firstChild + offset;
+}
+
+template<bool Quantized>
+TARGET_AVX2 inline void SceneIntersector::LoadChildPlanes(uint32_t nodeIndex, const int nearSide[3], __m256 planes[2][3]) const
+{
+    // Quantized planes are dequantized to exactly what QuantizedBvh8Node::Dequantize returns.
+    if (Quantized)
+    {
+        // Scales are built from the exponent bits, the fourth lane of origin holds exponents and validMask and is unused.
+        const QuantizedBvh8Node& node = m_quantizedNodes[nodeIndex];
+        const __m128 origin = _mm_loadu_ps(&node.origin.x);
+        int32_t exponentBits;
+        memcpy(&exponentBits, node.exponents, sizeof(exponentBits));
+        const __m128i exponents = _mm_cvtepi8_epi32(_mm_cvtsi32_si128(exponentBits));
+        const __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(exponents, _mm_set1_epi32(127)), 23));
+        const __m256 scaleX = _mm256_broadcastss_ps(scale);
+        const __m256 scaleY = _mm256_broadcastss_ps(_mm_permute_ps(scale, _MM_SHUFFLE(1, 1, 1, 1)));
+        const __m256 scaleZ = _mm256_broadcastss_ps(_mm_permute_ps(scale, _MM_SHUFFLE(2, 2, 2, 2)));
+        const __m256 boundsOriginX = _mm256_broadcastss_ps(origin);
+        const __m256 boundsOriginY = _mm256_broadcastss_ps(_mm_permute_ps(origin, _MM_SHUFFLE(1, 1, 1, 1)));
+        const __m256 boundsOriginZ = _mm256_broadcastss_ps(_mm_permute_ps(origin, _MM_SHUFFLE(2, 2, 2, 2)));
+        planes[0][0] = DequantizePlanes(node.bounds[nearSide[0]][0], scaleX, boundsOriginX);
+        planes[0][1] = DequantizePlanes(node.bounds[nearSide[1]][1], scaleY, boundsOriginY);
+        planes[0][2] = DequantizePlanes(node.bounds[nearSide[2]][2], scaleZ, boundsOriginZ);
+        planes[1][0] = DequantizePlanes(node.bounds[1 - nearSide[0]][0], scaleX, boundsOriginX);
+        planes[1][1] = DequantizePlanes(node.bounds[1 - nearSide[1]][1], scaleY, boundsOriginY);
+        planes[1][2] = DequantizePlanes(node.bounds[1 - nearSide[2]][2], scaleZ, boundsOriginZ);
+    }
+    else
+    {
+        const Bvh8Node& node = m_wideNodes[nodeIndex];
+        planes[0][0] = _mm256_loadu_ps(node.bounds[nearSide[0]][0]);
+        planes[0][1] = _mm256_loadu_ps(node.bounds[nearSide[1]][1]);
+        planes[0][2] = _mm256_loadu_ps(node.bounds[nearSide[2]][2]);
+        planes[1][0] = _mm256_loadu_ps(node.bounds[1 - nearSide[0]][0]);
+        planes[1][1] = _mm256_loadu_ps(node.bounds[1 - nearSide[1]][1]);
+        planes[1][2] = _mm256_loadu_ps(node.bounds[1 - nearSide[2]][2]);
+    }
+}
+
+template<bool AnyHit, bool Quantized>
+TARGET_AVX2 bool SceneIntersector::TraverseBvh8(const Ray& ray, RayHit& hit) const
+{
+    struct StackEntry
+    {
+        uint32_t child;
+        float tEnter;
+    };
+
+    const Float3 invDirection(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+    const WatertightRay watertightRay = PrepareWatertightRay(ray.origin, ray.direction, ray.tMin);
+    const __m256 originX = _mm256_set1_ps(ray.origin.x);
+    const __m256 originY = _mm256_set1_ps(ray.origin.y);
+    const __m256 originZ = _mm256_set1_ps(ray.origin.z);
+    const __m256 invDirectionX = _mm256_set1_ps(invDirection.x);
+    const __m256 invDirectionY = _mm256_set1_ps(invDirection.y);
+    const __m256 invDirectionZ = _mm256_set1_ps(invDirection.z);
+    const __m256 tMinVector = _mm256_set1_ps(ray.tMin);
+    const __m256 infinity = _mm256_set1_ps(INFINITY);
+    const __m256 robustExitScale = _mm256_set1_ps(RobustExitScale);
+    // Bounds planes the ray enters and exits through, so there is no min/max between them needed.
+    const int nearSide[3] = { invDirection.x < 0.0f ? 1 : 0, invDirection.y < 0.0f ? 1 : 0, invDirection.z < 0.0f ? 1 : 0 };
+    float tMax = ray.tMax;
+    bool anyHit = false;
+
+    // Every level leaves at most 7 children on the stack.
+    StackEntry stack[Bvh8::MaxDepth * 7];
+    uint32_t stackSize = 0;
+    uint32_t child = 0;
+
+    while (true)
+    {
+        if (Bvh8Node::IsLeaf(child))
+        {
+            const TriangleBlock8& block = m_leafBlocks[Bvh8Node::GetFirstPrimitive(child)];
+            uint32_t lane;
+            if (IntersectTriangleBlock8<AnyHit>(block, watertightRay, tMax, lane, hit.bary, hit.frontFace))
+            {
+                if (AnyHit)
+                    return true;
+                anyHit = true;
+                hit.t = tMax;
+                hit.meshIndex = block.meshIndex[lane];
+                hit.primitiveIndex = block.primitiveIndex[lane];
+            }
+        }
+        else
+        {
+            __m256 planes[2][3];
+            LoadChildPlanes<Quantized>(child, nearSide, planes);
+
+            // Slab test against all 8 children, like IntersectBox but conservative.
+            // max/min return the second operand if one is NaN (0 * inf for axis parallel rays), which drops that plane.
+            const __m256 tNearX = _mm256_mul_ps(_mm256_sub_ps(planes[0][0], originX), invDirectionX);
+            const __m256 tNearY = _mm256_mul_ps(_mm256_sub_ps(planes[0][1], originY), invDirectionY);
+            const __m256 tNearZ = _mm256_mul_ps(_mm256_sub_ps(planes[0][2], originZ), invDirectionZ);
+            const __m256 tFarX = _mm256_mul_ps(_mm256_sub_ps(planes[1][0], originX), invDirectionX);
+            const __m256 tFarY = _mm256_mul_ps(_mm256_sub_ps(planes[1][1], originY), invDirectionY);
+            const __m256 tFarZ = _mm256_mul_ps(_mm256_sub_ps(planes[1][2], originZ), invDirectionZ);
+            const __m256 tEnter = _mm256_max_ps(tNearX, _mm256_max_ps(tNearY, _mm256_max_ps(tNearZ, tMinVector)));
+            const __m256 tFar = _mm256_min_ps(tFarX, _mm256_min_ps(tFarY, _mm256_min_ps(tFarZ, infinity)));
+            const __m256 tExit = _mm256_min_ps(_mm256_mul_ps(tFar, robustExitScale), _mm256_set1_ps(tMax));
+            uint32_t hitMask = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(tEnter, tExit, _CMP_LE_OQ)));
+            if (Quantized)
+                hitMask &= m_quantizedNodes[child].validMask;
+
+            if (hitMask != 0)
+            {
+                // A single hit child is visited right away without going through the stack.
+                if ((hitMask & (hitMask - 1)) == 0)
+                {
+                    child = GetChild<Quantized>(child, _tzcnt_u32(hitMask));
+                    continue;
+                }
+
+                float tEnterChildren[8];
+                _mm256_storeu_ps(tEnterChildren, tEnter);
+                const uint32_t firstPushed = stackSize;
+                for (; hitMask != 0; hitMask &= hitMask - 1)
+                {
+                    const uint32_t slot = _tzcnt_u32(hitMask);
+                    const StackEntry entry = { GetChild<Quantized>(child, slot), tEnterChildren[slot] };
+                    // Any hit rays stop at the first hit wherever it is, closest hit rays visit the closer children first.
+                    uint32_t i = stackSize++;
+                    if (!AnyHit)
+                    {
+                        for (; i > firstPushed && stack[i - 1].tEnter < entry.tEnter; --i)
+                            stack[i] = stack[i - 1];
+                    }
+                    stack[i] = entry;
+                }
+                child = stack[--stackSize].child;
+                continue;
+            }
+        }
+
+        // Children further away than the closest hit so far are skipped.
+        while (stackSize > 0 && stack[stackSize - 1].tEnter > tMax)
+            --stackSize;
+        if (stackSize == 0)
+            break;
+        child = stack[--stackSize].child;
+    }
+
+    return anyHit;
+}
+
+template<bool Quantized>
+TARGET_AVX2 uint64_t SceneIntersector::TraverseBvh8Packet(const RayPacket& packet, RayHit* hits) const
+{
+    // Leaves keep the bounds planes from their parent, for the per ray test when they are visited.
+    struct StackEntry
+    {
+        uint32_t child;
+        float tEnter;
+        float planes[2][3];
+    };
+
+    // Rays in groups of 8 as structure of arrays. Lanes past the last ray have tMax = -inf and never hit anything.
+    const uint32_t numGroups = (packet.numRays + 7) / 8;
+    alignas(32) float invDirections[3][RayPacket::MaxNumRays];
+    alignas(32) float tMax[RayPacket::MaxNumRays];
+    WatertightRay watertightRays[RayPacket::MaxNumRays];
+    Float3 invDirectionMin(INFINITY);
+    Float3 invDirectionMax(-INFINITY);
+    for (uint32_t i = 0; i < numGroups * 8; ++i)
+    {
+        const Float3& direction = packet.directions[std::min(i, packet.numRays - 1)];
+        const Float3 invDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        for (int axis = 0; axis < 3; ++axis)
+            invDirections[axis][i] = invDirection[axis];
+        tMax[i] = i < packet.numRays ? packet.tMax : -INFINITY;
+        invDirectionMin = Min(invDirectionMin, invDirection);
+        invDirectionMax = Max(invDirectionMax, invDirection);
+    }
+    for (uint32_t i = 0; i < packet.numRays; ++i)
+        watertightRays[i] = PrepareWatertightRay(packet.origin, packet.directions[i], packet.tMin);
+
+    const __m256 origin[3] = { _mm256_set1_ps(packet.origin.x), _mm256_set1_ps(packet.origin.y), _mm256_set1_ps(packet.origin.z) };
+    const __m256 invDirectionLow[3] = { _mm256_set1_ps(invDirectionMin.x), _mm256_set1_ps(invDirectionMin.y), _mm256_set1_ps(invDirectionMin.z) };
+    const __m256 invDirectionHigh[3] = { _mm256_set1_ps(invDirectionMax.x), _mm256_set1_ps(invDirectionMax.y), _mm256_set1_ps(invDirectionMax.z) };
+    const __m256 tMinVector = _mm256_set1_ps(packet.tMin);
+    const __m256 infinity = _mm256_set1_ps(INFINITY);
+    const __m256 robustExitScale = _mm256_set1_ps(RobustExitScale);
+    // IntersectPacket made sure that all rays enter through the same planes.
+    const int nearSide[3] = { invDirectionMin.x < 0.0f ? 1 : 0, invDirectionMin.y < 0.0f ? 1 : 0, invDirectionMin.z < 0.0f ? 1 : 0 };
+    float packetTMax = packet.tMax;
+    uint64_t hitMask = 0;
+
+    StackEntry stack[Bvh8::MaxDepth * 7];
+    uint32_t stackSize = 0;
+    StackEntry current;
+    current.child = 0;
+
+    while (true)
+    {
+        if (Bvh8Node::IsLeaf(current.child))
+        {
+            // Same slab test as TraverseBvh8 for every ray, so each ray tests exactly the leaves it would test on its own.
+            uint64_t rayMask = 0;
+            for (uint32_t group = 0; group < numGroups; ++group)
+            {
+                __m256 tEnter = tMinVector;
+                __m256 tFar = infinity;
+                for (int axis = 2; axis >= 0; --axis)
+                {
+                    const __m256 invDirection = _mm256_load_ps(&invDirections[axis][group * 8]);
+                    tEnter = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(current.planes[0][axis]), origin[axis]), invDirection), tEnter);
+                    tFar = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(current.planes[1][axis]), origin[axis]), invDirection), tFar);
+                }
+                const __m256 tExit = _mm256_min_ps(_mm256_mul_ps(tFar, robustExitScale), _mm256_load_ps(&tMax[group * 8]));
+                rayMask |= static_cast<uint64_t>(_mm256_movemask_ps(_mm256_cmp_ps(tEnter, tExit, _CMP_LE_OQ))) << (group * 8);
+            }
+
+            const TriangleBlock8& block = m_leafBlocks[Bvh8Node::GetFirstPrimitive(current.child)];
+            bool anyHit = false;
+            for (; rayMask != 0; rayMask &= rayMask - 1)
+            {
+                const uint32_t ray = static_cast<uint32_t>(_tzcnt_u64(rayMask));
+                uint32_t lane;
+                if (IntersectTriangleBlock8<false>(block, watertightRays[ray], tMax[ray], lane, hits[ray].bary, hits[ray].frontFace))
+                {
+                    hits[ray].t = tMax[ray];
+                    hits[ray].meshIndex = block.meshIndex[lane];
+                    hits[ray].primitiveIndex = block.primitiveIndex[lane];
+                    hitMask |= 1ull << ray;
+                    anyHit = true;
+                }
+            }
+            if (anyHit)
+            {
+                __m256 maxTMax = _mm256_load_ps(tMax);
+                for (uint32_t group = 1; group < numGroups; ++group)
+                    maxTMax = _mm256_max_ps(maxTMax, _mm256_load_ps(&tMax[group * 8]));
+                alignas(32) float lanes[8];
+                _mm256_store_ps(lanes, maxTMax);
+                packetTMax = *std::max_element(lanes, lanes + 8);
+            }
+        }
+        else
+        {
+            __m256 planes[2][3];
+            LoadChildPlanes<Quantized>(current.child, nearSide, planes);
+
+            // Interval arithmetic over the inverse directions of all rays (Boulos et al. 2006): distances to each plane
+            // lie between those of the smallest and the largest inverse direction. Children that none of the rays can
+            // enter before tMax are culled for the whole packet.
+            __m256 tEnter = tMinVector;
+            __m256 tFar = infinity;
+            for (int axis = 2; axis >= 0; --axis)
+            {
+                const __m256 toNear = _mm256_sub_ps(planes[0][axis], origin[axis]);
+                const __m256 toFar = _mm256_sub_ps(planes[1][axis], origin[axis]);
+                const __m256 tNearLow = _mm256_min_ps(_mm256_mul_ps(toNear, invDirectionLow[axis]), _mm256_mul_ps(toNear, invDirectionHigh[axis]));
+                const __m256 tFarHigh = _mm256_max_ps(_mm256_mul_ps(toFar, invDirectionLow[axis]), _mm256_mul_ps(toFar, invDirectionHigh[axis]));
+                tEnter = _mm256_max_ps(tNearLow, tEnter);
+                tFar = _mm256_min_ps(tFarHigh, tFar);
+            }
+            const __m256 tExit = _mm256_min_ps(_mm256_mul_ps(tFar, robustExitScale), _mm256_set1_ps(packetTMax));
+            uint32_t childMask = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(tEnter, tExit, _CMP_LE_OQ)));
+            if (Quantized)
+                childMask &= m_quantizedNodes[current.child].validMask;
+
+            if (childMask != 0)
+            {
+                alignas(32) float tEnterChildren[8];
+                alignas(32) float childPlanes[2][3][8];
+                _mm256_store_ps(tEnterChildren, tEnter);
+                for (int side = 0; side < 2; ++side)
+                {
+                    for (int axis = 0; axis < 3; ++axis)
+                        _mm256_store_ps(childPlanes[side][axis], planes[side][axis]);
+                }
+
+                // Closer children are visited first, sorted by the earliest entry of any ray.
+                const uint32_t parent = current.child;
+                const uint32_t firstPushed = stackSize;
+                for (; childMask != 0; childMask &= childMask - 1)
+                {
+                    const uint32_t slot = _tzcnt_u32(childMask);
+                    StackEntry entry;
+                    entry.child = GetChild<Quantized>(parent, slot);
+                    entry.tEnter = tEnterChildren[slot];
+                    for (int side = 0; side < 2; ++side)
+                    {
+                        for (int axis = 0; axis < 3; ++axis)
+                            entry.planes[side][axis] = childPlanes[side][axis][slot];
+                    }
+                    uint32_t i = stackSize++;
+                    for (; i > firstPushed && stack[i - 1].tEnter < entry.tEnter; --i)
+                        stack[i] = stack[i - 1];
+                    stack[i] = entry;
+                }
+                current = stack[--stackSize];
+                continue;
+            }
+        }
+
+        // Children further away than the farthest closest hit of all rays are skipped.
+        while (stackSize > 0 && stack[stackSize - 1].tEnter > packetTMax)
+            --stackSize;
+        if (stackSize == 0)
+            break;
+        current = stack[--stackSize];
+    }
+
+    return hitMask;
+}
+
+bool SceneIntersector::Intersect(const Ray& ray, RayHit& hit) const
+{
+    switch (m_layout)
+    {
+    case BvhLayout::Wide:
+        return TraverseBvh8<false, false>(ray, hit);
+    case BvhLayout::WideQuantized:
+        return TraverseBvh8<false, true>(ray, hit);
+    default:
+        return Traverse<false>(ray, hit);
+    }
+}
+
+bool SceneIntersector::IsOccluded(const Ray& ray) const
+{
+    RayHit hit;
+    switch (m_layout)
+    {
+    case BvhLayout::Wide:
+        return TraverseBvh8<true, false>(ray, hit);
+    case BvhLayout::WideQuantized:
+        return TraverseBvh8<true, true>(ray, hit);
+    default:
+        return Traverse<true>(ray, hit);
+    }
+}
+
+uint64_t SceneIntersector::IntersectPacket(const RayPacket& packet, RayHit* hits) const
+{
+    assert(packet.numRays <= RayPacket::MaxNumRays);
+
+    // Interval arithmetic needs the same sign and a finite inverse for each direction component of all rays.
+    bool coherent = m_layout != BvhLayout::Binary && packet.numRays > 1;
+    for (int axis = 0; axis < 3 && coherent; ++axis)
+    {
+        const bool negative = packet.directions[0][axis] < 0.0f;
+        for (uint32_t i = 0; i < packet.numRays && coherent; ++i)
+            coherent = packet.directions[i][axis] != 0.0f && (packet.directions[i][axis] < 0.0f) == negative;
+    }
+
+    if (coherent && m_layout == BvhLayout::Wide)
+        return TraverseBvh8Packet<false>(packet, hits);
+    if (coherent && m_layout == BvhLayout::WideQuantized)
+        return TraverseBvh8Packet<true>(packet, hits);
+
+    uint64_t hitMask = 0;
+    for (uint32_t i = 0; i < packet.numRays; ++i)
+    {
+        if (Intersect({ packet.origin, packet.tMin, packet.directions[i], packet.tMax }, hits[i]))
+            hitMask |= 1ull << i;
+    }
+    return hitMask;
+}
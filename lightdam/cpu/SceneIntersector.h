@@ -0,0 +1,176 @@
+#pragma once
+
+#include "Bvh8.h"
+#include "CpuScene.h"
+#include "TriangleBlock.h"
+#include "../MappedFile.h"
+#include <memory>
+#include <string>
+
+// Same defaults as DefaultRayTMin/DefaultRayTMax in Common.hlsl.
+constexpr float DefaultRayTMin = 0.00001f;
+constexpr float DefaultRayTMax = 100000.0f;
+
+struct Ray
+{
+    Float3 origin;
+    float tMin;
+    Float3 direction;
+    float tMax;
+};
+
+struct RayHit
+{
+    float t;
+    uint32_t meshIndex;
+    uint32_t primitiveIndex;
+    Float2 bary;        // Weights of the second and third vertex, same as Attributes.bary.
+    bool frontFace;     // Same convention as HIT_KIND_TRIANGLE_FRONT_FACE.
+};
+
+// Rays sharing their origin, like the camera rays through a tile of pixels.
+struct RayPacket
+{
+    static const uint32_t MaxNumRays = 64;
+
+    Float3 origin;
+    float tMin;
+    float tMax;
+    uint32_t numRays;
+    Float3 directions[MaxNumRays];
+};
+
+// Triangle of a CpuScene mesh.
+struct MeshTriangle
+{
+    uint32_t meshIndex;
+    uint32_t primitiveIndex;
+};
+
+// Memory layout of the BVH that is traversed.
+enum class BvhLayout
+{
+    Binary,         // Binary BVH with Moller-Trumbore
+    Wide,           // 8 wide BVH with the watertight 8 wide triangle test, needs AVX2
+    // The same with quantized nodes, less than half the node memory and about 10% less memory in total (bvh-quantized, triangle
+    // blocks take the rest). Only worth it when memory is short: child boxes are rounded
+    // outwards by up to a grid cell, so rays starting on or ending at surfaces test more leaves. Any hit rays are about 30% slower,
+    // closest hit rays 5-10% (bvh-quantized). Never picked by default.
+    WideQuantized,
+};
+
+// Ray queries against all triangles of a CpuScene, the CPU equivalent of the DXR acceleration structure.
+// All triangles are double sided, just like the instances in the TLAS.
+class SceneIntersector
+{
+public:
+    // Builds the BVH on the given thread pool if there is one.
+    // The wide layouts are faster to trace, but fall back to the binary one if the cpu does not support AVX2.
+    // Their leaves are tested with a watertight 8 wide intersector, which hits shared edges from both sides.
+    SceneIntersector(const CpuScene& scene, ThreadPool* threadPool = nullptr, BvhBuilder builder = BvhBuilder::BinnedSah, BvhLayout layout = BvhLayout::Wide);
+    // Only the given triangles of the scene.
+    SceneIntersector(const CpuScene& scene, const std::vector<MeshTriangle>& triangles, ThreadPool* threadPool = nullptr,
+                     BvhBuilder builder = BvhBuilder::BinnedSah, BvhLayout layout = BvhLayout::Wide);
+
+    // Maps the BVH from a cache file if it was written for the same triangles, builder and layout, tracing then starts
+    // right away and reads the nodes straight from the file. Otherwise builds it and writes the cache file for next time.
+    static std::unique_ptr<SceneIntersector> LoadOrBuild(const CpuScene& scene, const std::string& cacheFilePath, ThreadPool* threadPool = nullptr,
+                                                         BvhBuilder builder = BvhBuilder::BinnedSah, BvhLayout layout = BvhLayout::Wide);
+    // Cache file next to the file the scene was loaded from, one per builder and layout. Empty if there is no such file.
+    static std::string GetCacheFilePath(const CpuScene& scene, BvhBuilder builder, BvhLayout layout);
+
+    // Copy of the nodes and triangles traversal reads, allocated and written by the calling thread, so that they lie in
+    // the memory of the NUMA node the thread runs on. Only the layout in use is copied, the binary BVH of a wide layout is not.
+    std::unique_ptr<SceneIntersector> CreateReplica() const;
+
+    // Closest hit in (ray.tMin, ray.tMax). Returns false on a miss.
+    bool Intersect(const Ray& ray, RayHit& hit) const;
+    // Any hit in (ray.tMin, ray.tMax), the equivalent of RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH.
+    bool IsOccluded(const Ray& ray) const;
+    // Closest hits of all rays of a packet, returns a bit per ray that hit something.
+    // Wide layouts traverse the packet as a whole as long as its directions have the same sign along each axis,
+    // otherwise every ray is traced on its own. Hits are the same as with Intersect, up to which of several hits
+    // at the exact same distance is found.
+    uint64_t IntersectPacket(const RayPacket& packet, RayHit* hits) const;
+
+    // Layout that is actually used.
+    BvhLayout GetLayout() const { return m_layout; }
+    // Whether the BVH is mapped from a cache file, which leaves GetBvh, GetBvh8 and GetQuantizedBvh8 empty.
+    bool IsLoadedFromCache() const { return m_cacheFile.GetData() != nullptr; }
+    // Only with the binary layout, the wide ones free it once they are collapsed from it.
+    const Bvh& GetBvh() const { return m_bvh; }
+    // Of the binary BVH that was built, also for the wide layouts. 0 if the BVH is mapped from a cache file.
+    uint32_t GetNumBinaryNodes() const { return m_numBinaryNodes; }
+    uint32_t GetBinaryDepth() const { return m_binaryDepth; }
+    // Only the one of the layout in use has nodes.
+    const Bvh8& GetBvh8() const { return m_bvh8; }
+    const QuantizedBvh8& GetQuantizedBvh8() const { return m_quantizedBvh8; }
+    // Memory used for the nodes of the layout in use.
+    size_t GetNodeMemorySize() const;
+    uint32_t GetNumTriangles() const { return m_numTriangles; }
+    // Bounds of all triangles, empty if there are none.
+    Aabb GetBounds() const { return m_bounds; }
+    // Memory used for triangle data, either the triangle blocks or the triangles of the binary BVH.
+    size_t GetTriangleMemorySize() const { return m_numLeafEntries * (m_layout == BvhLayout::Binary ? sizeof(Triangle) : sizeof(TriangleBlock8)); }
+    // All memory the intersector holds: its containers, whether traversal reads them or not, and a mapped cache file.
+    size_t GetMemorySize() const;
+
+private:
+    // Precomputed for Moller-Trumbore, in BVH leaf order.
+    struct Triangle
+    {
+        Float3 v0;
+        Float3 edge1;
+        Float3 edge2;
+        uint32_t meshIndex;
+        uint32_t primitiveIndex;
+    };
+
+    // Empty, for LoadOrBuild to fill.
+    SceneIntersector();
+
+    // Repacks the leaves into blocks for a wide layout.
+    void CollapseToWide(const CpuScene& scene, BvhLayout layout);
+    // Points traversal at the containers of the layout in use.
+    void UseBuiltData();
+    // Returns false if the file is missing, damaged or was written for another key.
+    bool MapCache(const std::string& cacheFilePath, uint64_t key);
+    bool SaveCache(const std::string& cacheFilePath, uint64_t key) const;
+
+    template<bool AnyHit>
+    bool IntersectLeaf(uint32_t firstTriangle, uint32_t numTriangles, const Ray& ray, float& tMax, RayHit& hit) const;
+    template<bool AnyHit>
+    bool Traverse(const Ray& ray, RayHit& hit) const;
+    // Child of a wide node in the encoding of Bvh8Node::children.
+    template<bool Quantized>
+    uint32_t GetChild(uint32_t nodeIndex, uint32_t slot) const;
+    // Near (planes[0]) and far (planes[1]) bounds planes of all 8 children of a wide node for rays with the given direction signs.
+    template<bool Quantized>
+    void LoadChildPlanes(uint32_t nodeIndex, const int nearSide[3], __m256 planes[2][3]) const;
+    template<bool AnyHit, bool Quantized>
+    bool TraverseBvh8(const Ray& ray, RayHit& hit) const;
+    template<bool Quantized>
+    uint64_t TraverseBvh8Packet(const RayPacket& packet, RayHit* hits) const;
+
+    Bvh m_bvh;
+    std::vector<Triangle> m_triangles;
+    // Only with the wide layouts, each of their leaves is one block instead of a range of m_triangles which stays empty.
+    Bvh8 m_bvh8;
+    QuantizedBvh8 m_quantizedBvh8;
+    std::vector<TriangleBlock8> m_triangleBlocks;
+    BvhLayout m_layout;
+    uint32_t m_numTriangles;
+    uint32_t m_numBinaryNodes;
+    uint32_t m_binaryDepth;
+    Aabb m_bounds;
+
+    // What traversal reads, either the containers above or a mapped cache file. Only those of the layout in use are read.
+    const BvhNode* m_nodes;
+    const Bvh8Node* m_wideNodes;
+    const QuantizedBvh8Node* m_quantizedNodes;
+    const Triangle* m_leafTriangles;
+    const TriangleBlock8* m_leafBlocks;
+    uint32_t m_numNodes;
+    uint32_t m_numLeafEntries;  // Triangles or blocks.
+    MappedFile m_cacheFile;
+};
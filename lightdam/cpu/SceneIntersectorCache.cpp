@@ -0,0 +1,243 @@
+#include "SceneIntersector.h"
+#include "../ErrorHandling.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+// Has to be increased whenever builders, collapsing or node and leaf formats change in a way the key doesn't cover.
+static const uint32_t CacheVersion = 1;
+static const char CacheMagic[8] = { 'L', 'D', 'B', 'V', 'H', 'C', 'A', 'C' };
+// Sections start at multiples of this, so the nodes are page aligned once the file is mapped.
+static const uint64_t CachePageSize = 4096;
+
+// First page of a cache file, followed by the nodes and then the triangles or triangle blocks of the leaves.
+// Integers are little endian, the file is only ever read back on the machine that wrote it.
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t layout;
+    uint64_t key;               // ComputeCacheKey of what the BVH was built from.
+    uint32_t numTriangles;
+    uint32_t numNodes;
+    uint32_t numLeafEntries;
+    uint32_t reserved;
+    Float3 boundsMin;
+    Float3 boundsMax;
+    uint64_t nodesOffset;
+    uint64_t leafEntriesOffset;
+    uint64_t fileSize;
+};
+static_assert(sizeof(CacheHeader) == 88, "CacheHeader is expected to be 88 bytes without any padding");
+
+static uint64_t HashValue(uint64_t hash, uint64_t value)
+{
+    hash = (hash ^ value) * 0x9E3779B97F4A7C15ull;
+    return hash ^ (hash >> 29);
+}
+
+static uint64_t HashFloat(uint64_t hash, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return HashValue(hash, bits);
+}
+
+// 8 bytes per step, fast enough to hash the whole scene on every load. Not cryptographic, but any change
+// of the geometry changes it with overwhelming probability.
+static uint64_t HashBytes(uint64_t hash, const void* data, size_t size)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    hash = HashValue(hash, size);
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), bytes += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        hash = HashValue(hash, word);
+    }
+    uint64_t lastWord = 0;
+    memcpy(&lastWord, bytes, size);
+    return HashValue(hash, lastWord);
+}
+
+// Everything the BVH depends on: the triangles in scene order, the builder with its default settings and the layout.
+static uint64_t ComputeCacheKey(const CpuScene& scene, BvhBuilder builder, BvhLayout layout)
+{
+    uint64_t hash = HashValue(0, CacheVersion);
+    hash = HashValue(hash, static_cast<uint64_t>(builder));
+    hash = HashValue(hash, static_cast<uint64_t>(layout));
+
+    // All builder defaults, a tweak to any of them invalidates every cache file which is rare enough to not matter.
+    const BvhSahSettings sah;
+    hash = HashValue(hash, sah.numBins);
+    hash = HashValue(hash, sah.leafBlockSize);
+    hash = HashValue(hash, sah.maxPrimitivesPerLeaf);
+    hash = HashFloat(hash, sah.traversalCost);
+    hash = HashFloat(hash, sah.blockIntersectionCost);
+    const BvhLinearSettings linear;
+    hash = HashValue(hash, linear.use63BitMortonCodes ? 1 : 0);
+    hash = HashValue(hash, linear.maxPrimitivesPerLeaf);
+    hash = HashValue(hash, linear.plocSearchRadius);
+    const BvhSpatialSplitSettings spatialSplits;
+    hash = HashValue(hash, spatialSplits.numSpatialBins);
+    hash = HashFloat(hash, spatialSplits.overlapThreshold);
+    hash = HashFloat(hash, spatialSplits.maxReferencesPerPrimitive);
+
+    hash = HashValue(hash, scene.meshes.size());
+    for (const CpuScene::Mesh& mesh : scene.meshes)
+    {
+        hash = HashBytes(hash, mesh.positions.data(), mesh.positions.size() * sizeof(Float3));
+        hash = HashBytes(hash, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+    }
+    return hash;
+}
+
+static uint64_t AlignToPage(uint64_t offset)
+{
+    return (offset + CachePageSize - 1) / CachePageSize * CachePageSize;
+}
+
+std::unique_ptr<SceneIntersector> SceneIntersector::LoadOrBuild(const CpuScene& scene, const std::string& cacheFilePath, ThreadPool* threadPool,
+                                                                BvhBuilder builder, BvhLayout layout)
+{
+    if (cacheFilePath.empty())
+        return std::unique_ptr<SceneIntersector>(new SceneIntersector(scene, threadPool, builder, layout));
+
+    // Wide layouts are built as binary ones without AVX2, their cache files are not interchangeable.
+    const uint64_t key = ComputeCacheKey(scene, builder, CpuSupportsAvx2() ? layout : BvhLayout::Binary);
+    std::unique_ptr<SceneIntersector> intersector(new SceneIntersector());
+    if (intersector->MapCache(cacheFilePath, key))
+        return intersector;
+
+    intersector.reset(new SceneIntersector(scene, threadPool, builder, layout));
+    if (!intersector->SaveCache(cacheFilePath, key))
+        LogPrint(LogLevel::Warning, "Failed to write BVH cache file %s", cacheFilePath.c_str());
+    return intersector;
+}
+
+std::string SceneIntersector::GetCacheFilePath(const CpuScene& scene, BvhBuilder builder, BvhLayout layout)
+{
+    if (scene.originFilePath.empty())
+        return "";
+
+    // Same place as the pbf file CpuScene::LoadPbrtScene writes.
+    const char* builderNames[] = { "linear", "ploc", "sah", "sbvh" };
+    const char* layoutNames[] = { "binary", "wide", "quantized" };
+    return scene.originFilePath.substr(0, scene.originFilePath.find_last_of('.')) + "." +
+        builderNames[static_cast<int>(builder)] + "-" + layoutNames[static_cast<int>(layout)] + ".bvh";
+}
+
+bool SceneIntersector::MapCache(const std::string& cacheFilePath, uint64_t key)
+{
+    if (!m_cacheFile.Open(cacheFilePath))
+        return false;
+
+    CacheHeader header;
+    const uint64_t fileSize = m_cacheFile.GetSize();
+    if (fileSize >= CachePageSize)
+        memcpy(&header, m_cacheFile.GetData(), sizeof(header));
+    if (fileSize < CachePageSize || memcmp(header.magic, CacheMagic, sizeof(CacheMagic)) != 0)
+    {
+        LogPrint(LogLevel::Warning, "%s is not a BVH cache file, rebuilding", cacheFilePath.c_str());
+        m_cacheFile.Close();
+        return false;
+    }
+    if (header.version != CacheVersion || header.key != key)
+    {
+        LogPrint(LogLevel::Info, "BVH cache file %s was written for different triangles or settings, rebuilding", cacheFilePath.c_str());
+        m_cacheFile.Close();
+        return false;
+    }
+
+    // Sections have to lie within the file, which catches files that were cut short.
+    const BvhLayout layout = static_cast<BvhLayout>(header.layout);
+    const uint64_t nodeSize = layout == BvhLayout::Wide ? sizeof(Bvh8Node) : layout == BvhLayout::WideQuantized ? sizeof(QuantizedBvh8Node) : sizeof(BvhNode);
+    const uint64_t leafEntrySize = layout == BvhLayout::Binary ? sizeof(Triangle) : sizeof(TriangleBlock8);
+    const bool validLayout = layout == BvhLayout::Binary || ((layout == BvhLayout::Wide || layout == BvhLayout::WideQuantized) && CpuSupportsAvx2());
+    if (!validLayout || header.fileSize != fileSize ||
+        header.nodesOffset % CachePageSize != 0 || header.leafEntriesOffset % CachePageSize != 0 ||
+        header.nodesOffset < CachePageSize || header.nodesOffset + header.numNodes * nodeSize > fileSize ||
+        header.leafEntriesOffset < CachePageSize || header.leafEntriesOffset + header.numLeafEntries * leafEntrySize > fileSize)
+    {
+        LogPrint(LogLevel::Warning, "BVH cache file %s is damaged, rebuilding", cacheFilePath.c_str());
+        m_cacheFile.Close();
+        return false;
+    }
+
+    m_layout = layout;
+    m_numTriangles = header.numTriangles;
+    m_bounds = header.numNodes > 0 ? Aabb(header.boundsMin, header.boundsMax) : Aabb();
+    m_numNodes = header.numNodes;
+    m_numLeafEntries = header.numLeafEntries;
+    const uint8_t* nodes = m_cacheFile.GetData() + header.nodesOffset;
+    const uint8_t* leafEntries = m_cacheFile.GetData() + header.leafEntriesOffset;
+    if (layout == BvhLayout::Binary)
+    {
+        m_nodes = reinterpret_cast<const BvhNode*>(nodes);
+        m_leafTriangles = reinterpret_cast<const Triangle*>(leafEntries);
+    }
+    else
+    {
+        if (layout == BvhLayout::Wide)
+            m_wideNodes = reinterpret_cast<const Bvh8Node*>(nodes);
+        else
+            m_quantizedNodes = reinterpret_cast<const QuantizedBvh8Node*>(nodes);
+        m_leafBlocks = reinterpret_cast<const TriangleBlock8*>(leafEntries);
+    }
+    return true;
+}
+
+bool SceneIntersector::SaveCache(const std::string& cacheFilePath, uint64_t key) const
+{
+    const void* nodes = m_layout == BvhLayout::Wide ? static_cast<const void*>(m_wideNodes) :
+                        m_layout == BvhLayout::WideQuantized ? static_cast<const void*>(m_quantizedNodes) : static_cast<const void*>(m_nodes);
+    const void* leafEntries = m_layout == BvhLayout::Binary ? static_cast<const void*>(m_leafTriangles) : static_cast<const void*>(m_leafBlocks);
+    const uint64_t nodesSize = GetNodeMemorySize();
+    const uint64_t leafEntriesSize = GetTriangleMemorySize();
+
+    CacheHeader header;
+    memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+    header.version = CacheVersion;
+    header.layout = static_cast<uint32_t>(m_layout);
+    header.key = key;
+    header.numTriangles = m_numTriangles;
+    header.numNodes = m_numNodes;
+    header.numLeafEntries = m_numLeafEntries;
+    header.reserved = 0;
+    header.boundsMin = m_numNodes > 0 ? m_bounds.min : Float3(0.0f);
+    header.boundsMax = m_numNodes > 0 ? m_bounds.max : Float3(0.0f);
+    header.nodesOffset = CachePageSize;
+    header.leafEntriesOffset = AlignToPage(header.nodesOffset + nodesSize);
+    header.fileSize = header.leafEntriesOffset + leafEntriesSize;
+
+    // Written next to the old file and swapped in at the end. Another process may still have the old one mapped,
+    // overwriting it in place would pull the pages from under it.
+    const std::string temporaryFilePath = cacheFilePath + ".tmp";
+    {
+        std::ofstream file(temporaryFilePath.c_str(), std::ios::binary);
+        if (!file)
+            return false;
+
+        const std::vector<char> padding(CachePageSize, 0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(padding.data(), header.nodesOffset - sizeof(header));
+        file.write(static_cast<const char*>(nodes), nodesSize);
+        file.write(padding.data(), header.leafEntriesOffset - header.nodesOffset - nodesSize);
+        file.write(static_cast<const char*>(leafEntries), leafEntriesSize);
+        if (!file)
+        {
+            file.close();
+            std::remove(temporaryFilePath.c_str());
+            return false;
+        }
+    }
+
+    std::remove(cacheFilePath.c_str());
+    if (std::rename(temporaryFilePath.c_str(), cacheFilePath.c_str()) != 0)
+    {
+        std::remove(temporaryFilePath.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,280 @@
+#include "TileScheduler.h"
+
+#include <algorithm>
+#include <cassert>
+
+// Chase-Lev deque with the memory orders of Le et al. 2013, "Correct and Efficient Work-Stealing for Weak Memory Models".
+// The owner pushes and pops at the bottom, other threads steal from the top. Does not grow: the owner only pushes the
+// initial tiles and the quadrants of a split tile, which it only does once its deque is empty.
+class TileScheduler::WorkStealingDeque
+{
+public:
+    enum class StealResult
+    {
+        Success,
+        Empty,
+        Abort,  // Lost a race with another thief or the owner, the deque may not be empty.
+    };
+
+    explicit WorkStealingDeque(uint32_t minCapacity)
+        : m_top(0)
+        , m_bottom(0)
+    {
+        uint32_t capacity = 1;
+        while (capacity < minCapacity)
+            capacity *= 2;
+        m_mask = capacity - 1;
+        m_items.reset(new std::atomic<uint64_t>[capacity]);
+    }
+
+    void Push(uint64_t item)
+    {
+        const int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        assert(bottom - m_top.load(std::memory_order_acquire) <= static_cast<int64_t>(m_mask));
+        m_items[bottom & m_mask].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    bool Pop(uint64_t& item)
+    {
+        const int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = m_top.load(std::memory_order_relaxed);
+        if (top > bottom)
+        {
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+        item = m_items[bottom & m_mask].load(std::memory_order_relaxed);
+        if (top < bottom)
+            return true;
+
+        // Last item, a thief may be taking it at the same time.
+        const bool won = m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        return won;
+    }
+
+    StealResult Steal(uint64_t& item)
+    {
+        int64_t top = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t bottom = m_bottom.load(std::memory_order_acquire);
+        if (top >= bottom)
+            return StealResult::Empty;
+        item = m_items[top & m_mask].load(std::memory_order_relaxed);
+        if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return StealResult::Abort;
+        return StealResult::Success;
+    }
+
+    // Only a snapshot while other threads work on the deque.
+    int64_t GetSize() const
+    {
+        return std::max<int64_t>(0, m_bottom.load(std::memory_order_relaxed) - m_top.load(std::memory_order_relaxed));
+    }
+
+private:
+    // Thieves write top and the owner writes bottom, they are kept on different cache lines.
+    std::atomic<int64_t> m_top;
+    char m_padding0[64];
+    std::atomic<int64_t> m_bottom;
+    uint32_t m_mask;
+    std::unique_ptr<std::atomic<uint64_t>[]> m_items;
+    char m_padding1[64];
+};
+
+// A stolen tile is split if its deque has no more than this many tiles left.
+static const int64_t SplitThreshold = 2;
+
+static uint64_t PackTile(const TileScheduler::Tile& tile)
+{
+    return static_cast<uint64_t>(tile.minX) | static_cast<uint64_t>(tile.minY) << 16 | static_cast<uint64_t>(tile.maxX) << 32 | static_cast<uint64_t>(tile.maxY) << 48;
+}
+
+static TileScheduler::Tile UnpackTile(uint64_t item)
+{
+    return { static_cast<uint16_t>(item), static_cast<uint16_t>(item >> 16), static_cast<uint16_t>(item >> 32), static_cast<uint16_t>(item >> 48) };
+}
+
+// Position of the d-th cell on a Hilbert curve through a grid of n x n cells, n a power of two.
+static void HilbertIndexToPosition(uint32_t n, uint32_t d, uint32_t& x, uint32_t& y)
+{
+    x = 0;
+    y = 0;
+    for (uint32_t s = 1; s < n; s *= 2)
+    {
+        const uint32_t rx = 1 & (d / 2);
+        const uint32_t ry = 1 & (d ^ rx);
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+        x += s * rx;
+        y += s * ry;
+        d /= 4;
+    }
+}
+
+TileScheduler::TileScheduler(uint32_t width, uint32_t height, uint32_t tileSize, uint32_t minTileSize, uint32_t numWorkers, bool workStealing,
+                             const std::vector<uint32_t>& workerNodes)
+    : m_minTileSize(minTileSize)
+    , m_workStealing(workStealing)
+    , m_workerNodes(workerNodes)
+    , m_nextTile(0)
+    , m_numTiles(0)
+    , m_numSteals(0)
+    , m_numRemoteSteals(0)
+    , m_numSplits(0)
+{
+    assert(width <= UINT16_MAX && height <= UINT16_MAX && numWorkers > 0);
+    assert(workerNodes.empty() || workerNodes.size() == numWorkers);
+    if (m_workerNodes.empty())
+        m_workerNodes.resize(numWorkers, 0);
+
+    const uint32_t numTilesX = (width + tileSize - 1) / tileSize;
+    const uint32_t numTilesY = (height + tileSize - 1) / tileSize;
+    auto makeTile = [&](uint32_t tileX, uint32_t tileY)
+    {
+        const Tile tile = { static_cast<uint16_t>(tileX * tileSize), static_cast<uint16_t>(tileY * tileSize),
+                            static_cast<uint16_t>(std::min((tileX + 1) * tileSize, width)), static_cast<uint16_t>(std::min((tileY + 1) * tileSize, height)) };
+        return tile;
+    };
+
+    if (!workStealing)
+    {
+        for (uint32_t tileY = 0; tileY < numTilesY; ++tileY)
+        {
+            for (uint32_t tileX = 0; tileX < numTilesX; ++tileX)
+                m_tiles.push_back(makeTile(tileX, tileY));
+        }
+        return;
+    }
+
+    // The curve goes through a square power of two grid, cells outside of the image are skipped.
+    uint32_t gridSize = 1;
+    while (gridSize < std::max(numTilesX, numTilesY))
+        gridSize *= 2;
+    std::vector<Tile> tiles;
+    tiles.reserve(numTilesX * numTilesY);
+    for (uint32_t d = 0; d < gridSize * gridSize; ++d)
+    {
+        uint32_t tileX, tileY;
+        HilbertIndexToPosition(gridSize, d, tileX, tileY);
+        if (tileX < numTilesX && tileY < numTilesY)
+            tiles.push_back(makeTile(tileX, tileY));
+    }
+
+    // Pushed back to front, so that the owner pops its part of the curve in order.
+    const uint32_t numTiles = static_cast<uint32_t>(tiles.size());
+    for (uint32_t worker = 0; worker < numWorkers; ++worker)
+    {
+        const uint32_t begin = static_cast<uint32_t>(static_cast<uint64_t>(numTiles) * worker / numWorkers);
+        const uint32_t end = static_cast<uint32_t>(static_cast<uint64_t>(numTiles) * (worker + 1) / numWorkers);
+        m_deques.emplace_back(new WorkStealingDeque(std::max(end - begin, 4u)));
+        for (uint32_t i = end; i-- > begin;)
+            m_deques.back()->Push(PackTile(tiles[i]));
+    }
+}
+
+TileScheduler::~TileScheduler()
+{
+}
+
+bool TileScheduler::GetNextTile(uint32_t workerIndex, Tile& tile)
+{
+    if (!m_workStealing)
+    {
+        const uint32_t tileIndex = m_nextTile++;
+        if (tileIndex >= m_tiles.size())
+            return false;
+        tile = m_tiles[tileIndex];
+        ++m_numTiles;
+        return true;
+    }
+
+    uint64_t item;
+    if (m_deques[workerIndex]->Pop(item))
+        tile = UnpackTile(item);
+    else if (!StealTile(workerIndex, tile))
+        return false;
+    ++m_numTiles;
+    return true;
+}
+
+bool TileScheduler::StealTile(uint32_t workerIndex, Tile& tile)
+{
+    const uint32_t numWorkers = static_cast<uint32_t>(m_deques.size());
+    const uint32_t node = m_workerNodes[workerIndex];
+    bool aborted = true;
+    while (aborted)
+    {
+        aborted = false;
+        // Victims on our own node first, remote ones only once all of those came up empty.
+        for (uint32_t i = 1; i < numWorkers * 2; ++i)
+        {
+            const uint32_t victimIndex = (workerIndex + i) % numWorkers;
+            const bool remote = m_workerNodes[victimIndex] != node;
+            if (remote != (i >= numWorkers) || victimIndex == workerIndex)
+                continue;
+            WorkStealingDeque& victim = *m_deques[victimIndex];
+            uint64_t item;
+            const WorkStealingDeque::StealResult result = victim.Steal(item);
+            if (result == WorkStealingDeque::StealResult::Abort)
+                aborted = true;
+            if (result != WorkStealingDeque::StealResult::Success)
+                continue;
+
+            ++m_numSteals;
+            if (remote)
+                ++m_numRemoteSteals;
+            tile = UnpackTile(item);
+            const uint32_t width = tile.maxX - tile.minX;
+            const uint32_t height = tile.maxY - tile.minY;
+            if (victim.GetSize() > SplitThreshold || std::max(width, height) <= m_minTileSize)
+                return true;
+
+            // Size of the tile before it was cut by the image border, quadrants are aligned to half of it.
+            uint32_t halfSize = m_minTileSize;
+            while (halfSize * 2 < std::max(width, height))
+                halfSize *= 2;
+            const uint16_t splitX = static_cast<uint16_t>(std::min<uint32_t>(tile.minX + halfSize, tile.maxX));
+            const uint16_t splitY = static_cast<uint16_t>(std::min<uint32_t>(tile.minY + halfSize, tile.maxY));
+            // Same order as a Hilbert curve through the quadrants.
+            const Tile quadrants[4] =
+            {
+                { tile.minX, tile.minY, splitX, splitY },
+                { tile.minX, splitY, splitX, tile.maxY },
+                { splitX, splitY, tile.maxX, tile.maxY },
+                { splitX, tile.minY, tile.maxX, splitY },
+            };
+            // Our own deque is empty, the other non-empty quadrants go there for the next call and for other thieves.
+            for (int quadrant = 3; quadrant > 0; --quadrant)
+            {
+                if (quadrants[quadrant].minX < quadrants[quadrant].maxX && quadrants[quadrant].minY < quadrants[quadrant].maxY)
+                    m_deques[workerIndex]->Push(PackTile(quadrants[quadrant]));
+            }
+            tile = quadrants[0];
+            ++m_numSplits;
+            return true;
+        }
+    }
+    return false;
+}
+
+TileScheduler::Stats TileScheduler::GetStats() const
+{
+    Stats stats;
+    stats.numTiles = m_numTiles;
+    stats.numSteals = m_numSteals;
+    stats.numRemoteSteals = m_numRemoteSteals;
+    stats.numSplits = m_numSplits;
+    return stats;
+}
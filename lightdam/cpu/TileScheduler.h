@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Hands out tiles of an image to a fixed number of workers.
+//
+// With work stealing, the tiles are ordered along a Hilbert curve, so that consecutive tiles are close to each other
+// in the image and share BVH nodes and triangles in the caches. Every worker gets a consecutive part of the curve in a
+// Chase-Lev deque and takes tiles from its bottom. Workers without tiles steal from the top of other deques, which is
+// the end of the victim's part of the curve that is furthest from where it works. A tile stolen from a deque that is
+// almost empty is split into quadrants, so that the last tiles of a frame are spread over the idle workers instead of
+// keeping one of them busy alone. Workers on a NUMA node first steal from other workers of the same node and only then
+// from remote ones, so tiles of a node's part of the curve stay with the threads that have its replica of the scene.
+//
+// Without work stealing, all workers take tiles in rows from a shared counter.
+class TileScheduler
+{
+public:
+    // Pixel rectangle [minX, maxX) x [minY, maxY).
+    struct Tile
+    {
+        uint16_t minX, minY, maxX, maxY;
+    };
+
+    struct Stats
+    {
+        uint32_t numTiles = 0;      // Handed out tiles, including those made by splitting.
+        uint32_t numSteals = 0;
+        uint32_t numRemoteSteals = 0;   // Steals from workers on a different NUMA node.
+        uint32_t numSplits = 0;
+    };
+
+    // Tiles have tileSize pixels on each side, or less at the image borders. Splits go down to minTileSize,
+    // tileSize needs to be minTileSize times a power of two.
+    // workerNodes has the NUMA node of every worker, empty if they are all on the same one.
+    TileScheduler(uint32_t width, uint32_t height, uint32_t tileSize, uint32_t minTileSize, uint32_t numWorkers, bool workStealing,
+                  const std::vector<uint32_t>& workerNodes = std::vector<uint32_t>());
+    ~TileScheduler();
+
+    // Next tile for a worker, workerIndex < numWorkers. Each worker must only be used by one thread at a time.
+    // Returns false once no tiles are left to take or steal. Tiles that are in the works by other workers at this point
+    // may still be split and stolen by workers that did not give up yet.
+    bool GetNextTile(uint32_t workerIndex, Tile& tile);
+
+    Stats GetStats() const;
+
+private:
+    class WorkStealingDeque;
+
+    bool StealTile(uint32_t workerIndex, Tile& tile);
+
+    const uint32_t m_minTileSize;
+    const bool m_workStealing;
+    std::vector<std::unique_ptr<WorkStealingDeque>> m_deques;
+    std::vector<uint32_t> m_workerNodes;
+
+    // Without work stealing.
+    std::vector<Tile> m_tiles;
+    std::atomic<uint32_t> m_nextTile;
+
+    std::atomic<uint32_t> m_numTiles;
+    std::atomic<uint32_t> m_numSteals;
+    std::atomic<uint32_t> m_numRemoteSteals;
+    std::atomic<uint32_t> m_numSplits;
+};
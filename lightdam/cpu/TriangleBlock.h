@@ -0,0 +1,121 @@
+#pragma once
+
+#include "CpuMath.h"
+#include "../CpuFeatures.h"
+#include <cstdint>
+#include <immintrin.h>
+
+// 8 triangles in structure of arrays layout for the AVX2 intersector, 352 bytes.
+// Vertices are stored as they are and not as edges, the watertight test relies on shared vertices being bit identical.
+// Unused lanes are degenerate triangles at the origin, which are never hit.
+struct TriangleBlock8
+{
+    float vertices[3][3][8];    // [vertex][axis][lane]
+    uint32_t meshIndex[8];
+    uint32_t primitiveIndex[8];
+};
+static_assert(sizeof(TriangleBlock8) == 352, "TriangleBlock8 is expected to be 352 bytes");
+
+// a * b - c * d with both products rounded, which is antisymmetric: EdgeFunction(c, d, a, b) == -EdgeFunction(a, b, c, d).
+// A fused multiply add breaks that. MSVC never contracts intrinsics, gcc does by default unless the products are hidden from it.
+TARGET_AVX2 inline __m256 EdgeFunction(__m256 a, __m256 b, __m256 c, __m256 d)
+{
+    __m256 ab = _mm256_mul_ps(a, b);
+    __m256 cd = _mm256_mul_ps(c, d);
+#if !defined(_MSC_VER) || defined(__clang__)
+    __asm__("" : "+x"(ab), "+x"(cd));
+#endif
+    return _mm256_sub_ps(ab, cd);
+}
+
+// Ray transformed for the watertight ray/triangle test (Woop et al. 2013).
+// Axes are permuted so that the ray goes along kz, then sheared so it becomes the positive z axis.
+struct WatertightRay
+{
+    int kx, ky, kz;
+    __m256 originX, originY, originZ;   // Origin along kx, ky, kz.
+    __m256 shearX, shearY, shearZ;
+    __m256 tMin;
+};
+
+TARGET_AVX2 inline WatertightRay PrepareWatertightRay(const Float3& origin, const Float3& direction, float tMin)
+{
+    WatertightRay ray;
+    const Float3 absDirection(fabsf(direction.x), fabsf(direction.y), fabsf(direction.z));
+    ray.kz = absDirection.x > absDirection.y ? (absDirection.x > absDirection.z ? 0 : 2) : (absDirection.y > absDirection.z ? 1 : 2);
+    ray.kx = (ray.kz + 1) % 3;
+    ray.ky = (ray.kx + 1) % 3;
+    // Keeps the winding, so the sign of the determinant tells front from back faces.
+    if (direction[ray.kz] < 0.0f)
+        std::swap(ray.kx, ray.ky);
+
+    ray.originX = _mm256_set1_ps(origin[ray.kx]);
+    ray.originY = _mm256_set1_ps(origin[ray.ky]);
+    ray.originZ = _mm256_set1_ps(origin[ray.kz]);
+    ray.shearX = _mm256_set1_ps(direction[ray.kx] / direction[ray.kz]);
+    ray.shearY = _mm256_set1_ps(direction[ray.ky] / direction[ray.kz]);
+    ray.shearZ = _mm256_set1_ps(1.0f / direction[ray.kz]);
+    ray.tMin = _mm256_set1_ps(tMin);
+    return ray;
+}
+
+// Closest or any hit in (tMin, tMax) of the given lanes of a block, without backface culling.
+// On a hit, tMax becomes the hit distance and the outputs are set. bary has the same convention as Attributes.bary.
+template<bool AnyHit>
+TARGET_AVX2 inline bool IntersectTriangleBlock8(const TriangleBlock8& block, const WatertightRay& ray, float& tMax,
+                                                uint32_t& lane, Float2& bary, bool& frontFace)
+{
+    // Vertices relative to the origin, sheared and scaled into ray space.
+    __m256 x[3], y[3], z[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        z[i] = _mm256_sub_ps(_mm256_loadu_ps(block.vertices[i][ray.kz]), ray.originZ);
+        x[i] = _mm256_fnmadd_ps(ray.shearX, z[i], _mm256_sub_ps(_mm256_loadu_ps(block.vertices[i][ray.kx]), ray.originX));
+        y[i] = _mm256_fnmadd_ps(ray.shearY, z[i], _mm256_sub_ps(_mm256_loadu_ps(block.vertices[i][ray.ky]), ray.originY));
+    }
+
+    // Scaled barycentrics as 2D edge functions. A triangle sharing an edge evaluates it with swapped operands
+    // and gets exactly the negated value, so a ray can't slip through between the two.
+    const __m256 u = EdgeFunction(x[2], y[1], y[2], x[1]);
+    const __m256 v = EdgeFunction(x[0], y[2], y[0], x[2]);
+    const __m256 w = EdgeFunction(x[1], y[0], y[1], x[0]);
+
+    // The ray is inside if all edge functions have the same sign, zeros count as inside for either sign.
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 anyNegative = _mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_LT_OQ), _mm256_or_ps(_mm256_cmp_ps(v, zero, _CMP_LT_OQ), _mm256_cmp_ps(w, zero, _CMP_LT_OQ)));
+    const __m256 anyPositive = _mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_GT_OQ), _mm256_or_ps(_mm256_cmp_ps(v, zero, _CMP_GT_OQ), _mm256_cmp_ps(w, zero, _CMP_GT_OQ)));
+    const __m256 det = _mm256_add_ps(u, _mm256_add_ps(v, w));
+    __m256 mask = _mm256_andnot_ps(_mm256_and_ps(anyNegative, anyPositive), _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ));
+    if (_mm256_movemask_ps(mask) == 0)
+        return false;
+
+    const __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+    const __m256 scaledT = _mm256_fmadd_ps(u, z[0], _mm256_fmadd_ps(v, z[1], _mm256_mul_ps(w, z[2])));
+    const __m256 t = _mm256_mul_ps(_mm256_mul_ps(scaledT, ray.shearZ), invDet);
+    mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(t, ray.tMin, _CMP_GT_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LT_OQ)));
+    uint32_t hitMask = static_cast<uint32_t>(_mm256_movemask_ps(mask));
+    if (hitMask == 0)
+        return false;
+
+    if (!AnyHit)
+    {
+        // Closest of all hit lanes.
+        __m256 closest = _mm256_blendv_ps(_mm256_set1_ps(INFINITY), t, mask);
+        closest = _mm256_min_ps(closest, _mm256_permute_ps(closest, _MM_SHUFFLE(2, 3, 0, 1)));
+        closest = _mm256_min_ps(closest, _mm256_permute_ps(closest, _MM_SHUFFLE(1, 0, 3, 2)));
+        closest = _mm256_min_ps(closest, _mm256_permute2f128_ps(closest, closest, 1));
+        hitMask &= static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(t, closest, _CMP_EQ_OQ)));
+    }
+    lane = _tzcnt_u32(hitMask);
+
+    float tLanes[8], vLanes[8], wLanes[8], invDetLanes[8];
+    _mm256_storeu_ps(tLanes, t);
+    _mm256_storeu_ps(vLanes, v);
+    _mm256_storeu_ps(wLanes, w);
+    _mm256_storeu_ps(invDetLanes, invDet);
+    tMax = tLanes[lane];
+    bary = Float2(vLanes[lane] * invDetLanes[lane], wLanes[lane] * invDetLanes[lane]);
+    // Same sign as the Moller-Trumbore determinant, positive <=> dot(cross(v1 - v0, v2 - v0), direction) < 0.
+    frontFace = invDetLanes[lane] > 0.0f;
+    return true;
+}
@@ -112,6 +112,12 @@ TextureResource TextureResource::CreateTexture2D(const wchar_t* name, DXGI_FORMA
     return TextureResource(name, D3D12_HEAP_TYPE_DEFAULT, initialState, desc, device);
 }
 
+TextureResource TextureResource::CreateTexture2DArray(const wchar_t* name, DXGI_FORMAT format, uint32_t width, uint32_t height, uint32_t arraySize, uint32_t mipLevels, D3D12_RESOURCE_FLAGS flags, D3D12_RESOURCE_STATES initialState, ID3D12Device* device)
+{
+    const D3D12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Tex2D(format, width, height, (UINT16)arraySize, mipLevels, 1, 0, flags);
+    return TextureResource(name, D3D12_HEAP_TYPE_DEFAULT, initialState, desc, device);
+}
+
 uint32_t GetBitsPerPixel(DXGI_FORMAT fmt)
 {
     switch (static_cast<int>(fmt))
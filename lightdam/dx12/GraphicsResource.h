@@ -61,6 +61,7 @@ public:
     void operator = (TextureResource&& temp)  { GraphicsResource::operator=(std::move(temp)); }
 
     static TextureResource CreateTexture2D(const wchar_t* name, DXGI_FORMAT format, uint32_t width, uint32_t height, uint32_t mipLevels, D3D12_RESOURCE_FLAGS flags, D3D12_RESOURCE_STATES initialState, ID3D12Device* device);
+    static TextureResource CreateTexture2DArray(const wchar_t* name, DXGI_FORMAT format, uint32_t width, uint32_t height, uint32_t arraySize, uint32_t mipLevels, D3D12_RESOURCE_FLAGS flags, D3D12_RESOURCE_STATES initialState, ID3D12Device* device);
 
     TextureResource CaptureTexture(ID3D12CommandList* commandList, UINT64 srcPitch, D3D12_RESOURCE_STATES beforeState, D3D12_RESOURCE_STATES afterState, ID3D12Device* device);
 
@@ -68,6 +69,7 @@ public:
     uint32_t    GetWidth() const       { return (uint32_t)m_desc.Width; }
     uint32_t    GetHeight() const      { return (uint32_t)m_desc.Height; }
     uint16_t    GetMipLevels() const   { return m_desc.MipLevels; }
+    uint16_t    GetArraySize() const   { return m_desc.DepthOrArraySize; }
 };
 
 
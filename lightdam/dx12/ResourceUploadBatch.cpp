@@ -52,7 +52,8 @@ D3D12_SUBRESOURCE_DATA ResourceUploadBatch::CreateAndMapUploadTexture2D(TextureR
         0, 0, 0,
         &CD3DX12_TEXTURE_COPY_LOCATION(tempResource.Get(), bufferFootprint),
         nullptr);
-    m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(targetResource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, targetResourceStateAfterCopy));
+    // Transition only the subresource we copied to, so other subresources can still be uploaded to.
+    m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(targetResource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, targetResourceStateAfterCopy, subresourceIndex));
 
     D3D12_SUBRESOURCE_DATA data;
     data.pData = tempResource.Map();
@@ -15,6 +15,7 @@ public:
     // Assumes that the target resource is in D3D12_RESOURCE_STATE_COPY_DEST state.
     void* CreateAndMapUploadBuffer(GraphicsResource& targetResource, D3D12_RESOURCE_STATES targetResourceStateAfterCopy = D3D12_RESOURCE_STATE_GENERIC_READ);
 
+    // Like CreateAndMapUploadBuffer, but for a single subresource (mip or array slice) of a 2D texture.
     D3D12_SUBRESOURCE_DATA CreateAndMapUploadTexture2D(TextureResource& targetResource, D3D12_RESOURCE_STATES targetResourceStateAfterCopy = D3D12_RESOURCE_STATE_GENERIC_READ, uint32_t subresourceIndex = 0);
 
     // Call this only if you know all copy actions are finished.
@@ -3,6 +3,7 @@
 #include "Config.hlsl"
 #include "Math.hlsl"
 #include "Random.hlsl"
+#include "Sobol.hlsl"
 
 // TODO: Packing
 struct RadianceRayHitInfo
@@ -47,7 +48,7 @@ SamplerState SamplerPointRepeat : register(s1);
 
 // Raytracing acceleration structure, accessed as a SRV
 RaytracingAccelerationStructure SceneBVH : register(t0, space0);
-Texture2D<uint> BlueNoiseTexture : register(t1, space0);
+Texture2DArray<uint> BlueNoiseTexture : register(t1, space0); // Spatiotemporal blue noise, one slice per frame.
 
 #define DefaultRayTMin 0.00001f
 #define DefaultRayTMax 100000.0f
@@ -11,3 +11,6 @@
 //#define DEBUG_VISUALIZE_DIFFUSETEXTURE
 
 //#define RUSSIAN_ROULETTE
+
+// Owen scrambled Sobol samples (padded per bounce) instead of the Weyl sequence for BRDF sampling.
+//#define USE_SOBOL_SAMPLER
@@ -142,9 +142,16 @@ float3 SampleAreaLight(AreaLightSample areaLightSample, Vertex hit, float pathLe
 
 // Computes next ray direction in tangent space
 // throughput = brdf / pdf
-bool ComputeNextRay(out float3 nextRayDirTS, out float3 throughput, inout uint sampleIndex, float3 toViewTS, float3 diffuse)
+// dimensionSet needs to be different for every bounce.
+bool ComputeNextRay(out float3 nextRayDirTS, out float3 throughput, inout uint sampleIndex, uint dimensionSet, float3 toViewTS, float3 diffuse)
 {
+#ifdef USE_SOBOL_SAMPLER
+    // Frame number walks the sequence, sampleIndex is a per pixel seed.
+    float4 sobolSample = SobolPadded4D(FrameNumber, dimensionSet, sampleIndex);
+    float2 randomSample = sobolSample.xy;
+#else
     float2 randomSample = WeylSequence2D(sampleIndex);
+#endif
 
     switch(MaterialType)
     {
@@ -187,7 +194,12 @@ bool ComputeNextRay(out float3 nextRayDirTS, out float3 throughput, inout uint s
 
 #ifdef RUSSIAN_ROULETTE
     float continuationProbability = saturate(GetLuminance(throughput));
-    if (WeylSequence(sampleIndex) >= continuationProbability) // if continuationProbability is zero, path should be stoped -> >=
+#ifdef USE_SOBOL_SAMPLER
+    float russianRouletteSample = sobolSample.z;
+#else
+    float russianRouletteSample = WeylSequence(sampleIndex);
+#endif
+    if (russianRouletteSample >= continuationProbability) // if continuationProbability is zero, path should be stoped -> >=
         return false;
     throughput /= continuationProbability; // Only change in spectrum, no energy loss.
 #endif
@@ -241,8 +253,13 @@ void SurfaceInteraction(inout RadianceRayHitInfo payload, Vertex hit)
 #endif
 
     // Sample area lights.
+#ifdef USE_SOBOL_SAMPLER
+    float lightSampleOffsetSample = SobolPadded2D(FrameNumber, NUM_BOUNCES + remainingBounces, payload.sampleIndex).x;
+#else
     uint xorshiftSeed = payload.sampleIndex;
-    uint randomSampleOffset = uint(XorShift(xorshiftSeed) * (NUM_LIGHT_SAMPLES_AVAILABLE - NUM_LIGHT_SAMPLES_PERHIT) + 0.5f);
+    float lightSampleOffsetSample = XorShift(xorshiftSeed);
+#endif
+    uint randomSampleOffset = uint(lightSampleOffsetSample * (NUM_LIGHT_SAMPLES_AVAILABLE - NUM_LIGHT_SAMPLES_PERHIT) + 0.5f);
     float3 radiance = float3(0.0f, 0.0f, 0.0f);
     for (uint i=0; i<NUM_LIGHT_SAMPLES_PERHIT; ++i)
         radiance += SampleAreaLight(AreaLightSamples[randomSampleOffset + i], hit, pathLength, worldPosition, toView, NdotV, diffuse);
@@ -253,7 +270,7 @@ void SurfaceInteraction(inout RadianceRayHitInfo payload, Vertex hit)
         return;
     float3 nextRayDirTS;
     float3 throughput;
-    if (!ComputeNextRay(nextRayDirTS, throughput, payload.sampleIndex, toViewTS, diffuse))
+    if (!ComputeNextRay(nextRayDirTS, throughput, payload.sampleIndex, remainingBounces, toViewTS, diffuse))
         return;
 
     // Pack data for next ray.
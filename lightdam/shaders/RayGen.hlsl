@@ -32,9 +32,14 @@ export void RayGen()
     // * temporarily: correlated/low discrepancy want to evently sample hemispheres over time
     // * from event to event: uncorrelated, one hit should not determine behavior of next
 
-    int3 noiseTextureSize;
-    BlueNoiseTexture.GetDimensions(0, noiseTextureSize.x, noiseTextureSize.y, noiseTextureSize.z);
-    uint blueNoise = BlueNoiseTexture.Load(int3((launchIndex) % noiseTextureSize.xy, 0));
+    uint4 noiseTextureSize; // width, height, slices, mips
+    BlueNoiseTexture.GetDimensions(0, noiseTextureSize.x, noiseTextureSize.y, noiseTextureSize.z, noiseTextureSize.w);
+#ifdef USE_SOBOL_SAMPLER
+    uint noiseSlice = 0; // Sobol scrambling seed needs to stay the same over time.
+#else
+    uint noiseSlice = FrameNumber % noiseTextureSize.z;
+#endif
+    uint blueNoise = BlueNoiseTexture.Load(int4((launchIndex) % noiseTextureSize.xy, noiseSlice, 0));
 
     RayDesc ray;
     ray.Origin = CameraPosition;
@@ -46,7 +51,11 @@ export void RayGen()
     payload.radiance = float3(0.0f, 0.0f, 0.0f);
     payload.distance = 0.0f;
     payload.pathThroughput_remainingBounces = FloatToHalf(float3(1.0f, 1.0f, 1.0f), NUM_BOUNCES);
+#ifdef USE_SOBOL_SAMPLER
+    payload.sampleIndex = blueNoise; // Seed for the scramble, needs to stay the same over time.
+#else
     payload.sampleIndex = blueNoise ^ FrameSeed;
+#endif
     float pathLength = 0.0f;
 
     TraceRadianceRay(ray, payload);